@@ -608,6 +608,36 @@ nffs_detect(const struct nffs_area_desc *area_descs)
     return rc;
 }
 
+/**
+ * Writes a checkpoint of the file system index to the scratch area, so that
+ * the next nffs_detect() only needs to read what was written since.  Call
+ * this before a clean shutdown, or periodically.  The checkpoint is discarded
+ * by the next garbage collection cycle.
+ *
+ * @return                  0 on success;
+ *                          FS_EFULL if the index does not fit in the scratch
+ *                              area;
+ *                          other nonzero on failure.
+ */
+int
+nffs_checkpoint(void)
+{
+    int rc;
+
+    nffs_lock();
+
+    if (!nffs_misc_ready()) {
+        rc = FS_EUNINIT;
+        goto done;
+    }
+
+    rc = nffs_ckpt_write();
+
+done:
+    nffs_unlock();
+    return rc;
+}
+
 /**
  * Initializes internal nffs memory and data structures.  This must be called
  * before any nffs operations are attempted.
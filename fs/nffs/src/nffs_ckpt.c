@@ -0,0 +1,655 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Index checkpoints.
+ *
+ * A checkpoint is a copy of the RAM representation of the file system: the ID
+ * and flash location of every inode and data block, plus the links between
+ * them.  It is written to the scratch area, which holds nothing else until the
+ * next garbage collection cycle.  When the file system is detected, a valid
+ * checkpoint is loaded in place of reading every object in every area; only
+ * the objects written after the checkpoint are read from flash.
+ *
+ * Layout in the scratch area, following the area header:
+ *     o struct nffs_disk_ckpt.
+ *     o One struct nffs_disk_ckpt_area per area.
+ *     o Inode and block records.
+ *
+ * The magic number is written first and the rest of the header last, so an
+ * interrupted checkpoint is never taken as valid, but still marks the scratch
+ * area as dirty.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include "hal/hal_flash.h"
+#include "nffs_priv.h"
+#include "nffs/nffs.h"
+
+#define NFFS_CKPT_OFFSET    (sizeof (struct nffs_disk_area))
+
+/** Number of detects that were served from a checkpoint. */
+unsigned int nffs_ckpt_restore_count;
+
+/**
+ * Sequential access to the checkpoint, through nffs_flash_buf.  Keeps a
+ * running CRC of everything that passes through.
+ */
+struct nffs_ckpt_stream {
+    uint32_t ncs_offset;        /* Area offset of the next flash access. */
+    uint32_t ncs_end;           /* Area offset past the last byte. */
+    uint16_t ncs_buf_off;
+    uint16_t ncs_buf_len;
+    uint16_t ncs_crc;
+    uint8_t ncs_area_idx;
+};
+
+static void
+nffs_ckpt_stream_init(struct nffs_ckpt_stream *stream, uint8_t area_idx,
+                      uint32_t offset, uint32_t end)
+{
+    stream->ncs_offset = offset;
+    stream->ncs_end = end;
+    stream->ncs_buf_off = 0;
+    stream->ncs_buf_len = 0;
+    stream->ncs_crc = 0;
+    stream->ncs_area_idx = area_idx;
+}
+
+static int
+nffs_ckpt_stream_flush(struct nffs_ckpt_stream *stream)
+{
+    int rc;
+
+    if (stream->ncs_buf_off == 0) {
+        return 0;
+    }
+
+    rc = nffs_flash_write(stream->ncs_area_idx, stream->ncs_offset,
+                          nffs_flash_buf, stream->ncs_buf_off);
+    if (rc != 0) {
+        return rc;
+    }
+    stream->ncs_crc = crc16_ccitt(stream->ncs_crc, nffs_flash_buf,
+                                  stream->ncs_buf_off);
+    stream->ncs_offset += stream->ncs_buf_off;
+    stream->ncs_buf_off = 0;
+
+    return 0;
+}
+
+static int
+nffs_ckpt_stream_write(struct nffs_ckpt_stream *stream, const void *data,
+                       int len)
+{
+    int rc;
+
+    if (stream->ncs_offset + stream->ncs_buf_off + len > stream->ncs_end) {
+        return FS_EFULL;
+    }
+
+    if (stream->ncs_buf_off + len > sizeof nffs_flash_buf) {
+        rc = nffs_ckpt_stream_flush(stream);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    memcpy(nffs_flash_buf + stream->ncs_buf_off, data, len);
+    stream->ncs_buf_off += len;
+
+    return 0;
+}
+
+/**
+ * Reads the next len bytes of the checkpoint.
+ *
+ * @return                      0 on success;
+ *                              FS_EEMPTY if the checkpoint has fewer bytes
+ *                                  left;
+ *                              other nonzero on error.
+ */
+static int
+nffs_ckpt_stream_read(struct nffs_ckpt_stream *stream, void *data, int len)
+{
+    uint32_t chunk_len;
+    int rc;
+
+    if (stream->ncs_buf_len - stream->ncs_buf_off < len) {
+        /* Move the remains of the buffer to the front and refill it. */
+        chunk_len = stream->ncs_buf_len - stream->ncs_buf_off;
+        memmove(nffs_flash_buf, nffs_flash_buf + stream->ncs_buf_off,
+                chunk_len);
+        stream->ncs_buf_len = chunk_len;
+        stream->ncs_buf_off = 0;
+
+        chunk_len = sizeof nffs_flash_buf - stream->ncs_buf_len;
+        if (chunk_len > stream->ncs_end - stream->ncs_offset) {
+            chunk_len = stream->ncs_end - stream->ncs_offset;
+        }
+        if (chunk_len > 0) {
+            rc = nffs_flash_read(stream->ncs_area_idx, stream->ncs_offset,
+                                 nffs_flash_buf + stream->ncs_buf_len,
+                                 chunk_len);
+            if (rc != 0) {
+                return rc;
+            }
+            stream->ncs_crc = crc16_ccitt(stream->ncs_crc,
+                                          nffs_flash_buf + stream->ncs_buf_len,
+                                          chunk_len);
+            stream->ncs_offset += chunk_len;
+            stream->ncs_buf_len += chunk_len;
+        }
+
+        if (stream->ncs_buf_len < len) {
+            return FS_EEMPTY;
+        }
+    }
+
+    memcpy(data, nffs_flash_buf + stream->ncs_buf_off, len);
+    stream->ncs_buf_off += len;
+
+    return 0;
+}
+
+/**
+ * Indicates whether the specified area contains anything past its header
+ * (e.g., a checkpoint), in which case it needs to be erased before it can be
+ * used as a garbage collection destination.
+ */
+int
+nffs_ckpt_present(uint8_t area_idx)
+{
+    uint32_t magic;
+    int rc;
+
+    rc = nffs_flash_read(area_idx, NFFS_CKPT_OFFSET, &magic, sizeof magic);
+    if (rc != 0) {
+        return 0;
+    }
+
+    return magic != 0xffffffff;
+}
+
+static int
+nffs_ckpt_write_blocks(struct nffs_ckpt_stream *stream,
+                       struct nffs_inode_entry *file)
+{
+    struct nffs_disk_ckpt_block disk_block;
+    struct nffs_hash_entry *cur;
+    struct nffs_block block;
+    int rc;
+
+    cur = file->nie_last_block_entry;
+    while (cur != NULL) {
+        disk_block.ndcb_id = cur->nhe_id;
+        disk_block.ndcb_flash_loc = cur->nhe_flash_loc;
+        rc = nffs_ckpt_stream_write(stream, &disk_block, sizeof disk_block);
+        if (rc != 0) {
+            return rc;
+        }
+
+        rc = nffs_block_from_hash_entry(&block, cur);
+        if (rc != 0) {
+            return rc;
+        }
+        cur = block.nb_prev;
+    }
+
+    return 0;
+}
+
+static int
+nffs_ckpt_write_inode(struct nffs_ckpt_stream *stream,
+                      struct nffs_inode_entry *inode_entry, uint32_t parent_id)
+{
+    struct nffs_disk_ckpt_inode disk_inode;
+    int rc;
+
+    disk_inode.ndci_id = inode_entry->nie_hash_entry.nhe_id;
+    disk_inode.ndci_flash_loc = inode_entry->nie_hash_entry.nhe_flash_loc;
+    disk_inode.ndci_parent_id = parent_id;
+    rc = nffs_ckpt_stream_write(stream, &disk_inode, sizeof disk_inode);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (nffs_hash_id_is_file(disk_inode.ndci_id)) {
+        rc = nffs_ckpt_write_blocks(stream, inode_entry);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Writes a checkpoint of the RAM representation to the scratch area.  Any
+ * previous checkpoint is erased first.  A clean scratch area is not: a reset
+ * during the erase leaves the file system without a scratch area header,
+ * which detection has to repair.
+ *
+ * @return                      0 on success;
+ *                              FS_EFULL if the checkpoint does not fit in the
+ *                                  scratch area;
+ *                              other nonzero on error.
+ */
+int
+nffs_ckpt_write(void)
+{
+    struct nffs_disk_ckpt_area disk_area;
+    struct nffs_inode_entry *inode_entry;
+    struct nffs_inode_entry *child;
+    struct nffs_hash_entry *entry;
+    struct nffs_hash_entry *next;
+    struct nffs_ckpt_stream stream;
+    struct nffs_disk_ckpt disk_ckpt;
+    struct nffs_area *area;
+    uint8_t area_idx;
+    int rc;
+    int i;
+
+    area_idx = nffs_scratch_area_idx;
+    area = nffs_areas + area_idx;
+
+    if (nffs_ckpt_present(area_idx)) {
+        rc = nffs_format_area(area_idx, 1);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    memset(&disk_ckpt, 0xff, sizeof disk_ckpt);
+    disk_ckpt.ndc_magic = NFFS_CKPT_MAGIC;
+    rc = nffs_flash_write(area_idx, NFFS_CKPT_OFFSET, &disk_ckpt.ndc_magic,
+                          sizeof disk_ckpt.ndc_magic);
+    if (rc != 0) {
+        return rc;
+    }
+
+    nffs_ckpt_stream_init(&stream, area_idx,
+                          NFFS_CKPT_OFFSET + sizeof disk_ckpt,
+                          area->na_length);
+
+    for (i = 0; i < nffs_num_areas; i++) {
+        memset(&disk_area, 0, sizeof disk_area);
+        disk_area.ndca_offset = nffs_areas[i].na_offset;
+        disk_area.ndca_cur = nffs_areas[i].na_cur;
+        disk_area.ndca_flash_id = nffs_areas[i].na_flash_id;
+        disk_area.ndca_id = nffs_areas[i].na_id;
+        disk_area.ndca_gc_seq = nffs_areas[i].na_gc_seq;
+        rc = nffs_ckpt_stream_write(&stream, &disk_area, sizeof disk_area);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    /* The root directory, followed by the contents of each directory.  Only
+     * inodes that are linked into the tree get recorded.
+     */
+    rc = nffs_ckpt_write_inode(&stream, nffs_root_dir, NFFS_ID_NONE);
+    if (rc != 0) {
+        return rc;
+    }
+    NFFS_HASH_TABLE_FOREACH(&nffs_hash_inodes, entry, i, next) {
+        if (nffs_hash_id_is_dir(entry->nhe_id)) {
+            inode_entry = (struct nffs_inode_entry *)entry;
+            SLIST_FOREACH(child, &inode_entry->nie_child_list,
+                          nie_sibling_next) {
+                rc = nffs_ckpt_write_inode(&stream, child, entry->nhe_id);
+                if (rc != 0) {
+                    return rc;
+                }
+            }
+        }
+    }
+
+    rc = nffs_ckpt_stream_flush(&stream);
+    if (rc != 0) {
+        return rc;
+    }
+
+    /* Commit the checkpoint by filling in the rest of the header. */
+    disk_ckpt.ndc_len = stream.ncs_offset -
+                        (NFFS_CKPT_OFFSET + sizeof disk_ckpt);
+    disk_ckpt.ndc_next_file_id = nffs_hash_next_file_id;
+    disk_ckpt.ndc_next_dir_id = nffs_hash_next_dir_id;
+    disk_ckpt.ndc_next_block_id = nffs_hash_next_block_id;
+    disk_ckpt.ndc_block_max_data_sz = nffs_block_max_data_sz;
+    disk_ckpt.ndc_num_areas = nffs_num_areas;
+    disk_ckpt.ndc_crc16 = crc16_ccitt(stream.ncs_crc, &disk_ckpt.ndc_len,
+                                      NFFS_DISK_CKPT_OFFSET_CRC -
+                                      sizeof disk_ckpt.ndc_magic);
+
+    /* This lies behind the area's write position, so bypass
+     * nffs_flash_write().
+     */
+    rc = hal_flash_write(area->na_flash_id,
+                         area->na_offset + NFFS_CKPT_OFFSET +
+                             sizeof disk_ckpt.ndc_magic,
+                         &disk_ckpt.ndc_len,
+                         sizeof disk_ckpt - sizeof disk_ckpt.ndc_magic);
+    if (rc != 0) {
+        return FS_EHW;
+    }
+
+    NFFS_LOG(DEBUG, "checkpoint written; len=%u\n",
+             (unsigned int)disk_ckpt.ndc_len);
+
+    return 0;
+}
+
+static int
+nffs_ckpt_check_loc(uint32_t flash_loc, const uint32_t *area_curs)
+{
+    uint32_t area_offset;
+    uint8_t area_idx;
+
+    nffs_flash_loc_expand(flash_loc, &area_idx, &area_offset);
+    if (area_idx >= nffs_num_areas || area_offset >= area_curs[area_idx]) {
+        return FS_ECORRUPT;
+    }
+
+    return 0;
+}
+
+/**
+ * Reads the next record from the checkpoint into either disk_inode or
+ * disk_block.
+ *
+ * @return                      NFFS_OBJECT_TYPE_INODE or
+ *                                  NFFS_OBJECT_TYPE_BLOCK on success;
+ *                              negative FS error code on failure.
+ */
+static int
+nffs_ckpt_read_record(struct nffs_ckpt_stream *stream,
+                      struct nffs_disk_ckpt_inode *disk_inode,
+                      struct nffs_disk_ckpt_block *disk_block)
+{
+    int rc;
+
+    rc = nffs_ckpt_stream_read(stream, disk_block, sizeof *disk_block);
+    if (rc != 0) {
+        return -rc;
+    }
+
+    if (nffs_hash_id_is_block(disk_block->ndcb_id)) {
+        return NFFS_OBJECT_TYPE_BLOCK;
+    }
+
+    if (!nffs_hash_id_is_inode(disk_block->ndcb_id)) {
+        return -FS_ECORRUPT;
+    }
+
+    disk_inode->ndci_id = disk_block->ndcb_id;
+    disk_inode->ndci_flash_loc = disk_block->ndcb_flash_loc;
+    rc = nffs_ckpt_stream_read(stream, &disk_inode->ndci_parent_id,
+                               sizeof disk_inode->ndci_parent_id);
+    if (rc != 0) {
+        return rc == FS_EEMPTY ? -FS_ECORRUPT : -rc;
+    }
+
+    return NFFS_OBJECT_TYPE_INODE;
+}
+
+/**
+ * Creates a hash entry for each record in the checkpoint.
+ */
+static int
+nffs_ckpt_restore_entries(struct nffs_ckpt_stream *stream,
+                          const uint32_t *area_curs)
+{
+    struct nffs_disk_ckpt_inode disk_inode;
+    struct nffs_disk_ckpt_block disk_block;
+    struct nffs_inode_entry *inode_entry;
+    struct nffs_inode_entry *file;
+    struct nffs_hash_entry *entry;
+    int type;
+    int rc;
+
+    file = NULL;
+    while (1) {
+        type = nffs_ckpt_read_record(stream, &disk_inode, &disk_block);
+        switch (type) {
+        case NFFS_OBJECT_TYPE_INODE:
+            rc = nffs_ckpt_check_loc(disk_inode.ndci_flash_loc, area_curs);
+            if (rc != 0) {
+                return rc;
+            }
+
+            inode_entry = nffs_inode_entry_alloc();
+            if (inode_entry == NULL) {
+                return FS_ENOMEM;
+            }
+            inode_entry->nie_hash_entry.nhe_id = disk_inode.ndci_id;
+            inode_entry->nie_hash_entry.nhe_flash_loc =
+                disk_inode.ndci_flash_loc;
+            inode_entry->nie_refcnt = 1;
+            nffs_hash_insert(&inode_entry->nie_hash_entry);
+
+            if (disk_inode.ndci_id == NFFS_ID_ROOT_DIR) {
+                nffs_root_dir = inode_entry;
+            }
+
+            /* The blocks that follow belong to this file. */
+            if (nffs_hash_id_is_file(disk_inode.ndci_id)) {
+                file = inode_entry;
+            } else {
+                file = NULL;
+            }
+            break;
+
+        case NFFS_OBJECT_TYPE_BLOCK:
+            if (file == NULL) {
+                return FS_ECORRUPT;
+            }
+            rc = nffs_ckpt_check_loc(disk_block.ndcb_flash_loc, area_curs);
+            if (rc != 0) {
+                return rc;
+            }
+
+            entry = nffs_block_entry_alloc();
+            if (entry == NULL) {
+                return FS_ENOMEM;
+            }
+            entry->nhe_id = disk_block.ndcb_id;
+            entry->nhe_flash_loc = disk_block.ndcb_flash_loc;
+            nffs_hash_insert(entry);
+
+            if (file->nie_last_block_entry == NULL) {
+                file->nie_last_block_entry = entry;
+            }
+            break;
+
+        case -FS_EEMPTY:
+            return 0;
+
+        default:
+            return -type;
+        }
+    }
+}
+
+/**
+ * Links each inode in the checkpoint into its parent directory.  The inodes
+ * of a directory are recorded together and in order, so each one is appended
+ * to the end of the directory's child list.
+ */
+static int
+nffs_ckpt_restore_links(struct nffs_ckpt_stream *stream)
+{
+    struct nffs_disk_ckpt_inode disk_inode;
+    struct nffs_disk_ckpt_block disk_block;
+    struct nffs_inode_entry *inode_entry;
+    struct nffs_inode_entry *parent;
+    struct nffs_inode_entry *prev;
+    struct nffs_inode_entry *cur;
+    int type;
+
+    parent = NULL;
+    prev = NULL;
+    while (1) {
+        type = nffs_ckpt_read_record(stream, &disk_inode, &disk_block);
+        switch (type) {
+        case NFFS_OBJECT_TYPE_INODE:
+            if (disk_inode.ndci_parent_id == NFFS_ID_NONE) {
+                break;
+            }
+            if (!nffs_hash_id_is_dir(disk_inode.ndci_parent_id)) {
+                return FS_ECORRUPT;
+            }
+
+            if (parent == NULL ||
+                parent->nie_hash_entry.nhe_id != disk_inode.ndci_parent_id) {
+
+                parent = nffs_hash_find_inode(disk_inode.ndci_parent_id);
+                if (parent == NULL) {
+                    return FS_ECORRUPT;
+                }
+                prev = NULL;
+                SLIST_FOREACH(cur, &parent->nie_child_list, nie_sibling_next) {
+                    prev = cur;
+                }
+            }
+
+            inode_entry = nffs_hash_find_inode(disk_inode.ndci_id);
+            assert(inode_entry != NULL);
+            if (prev == NULL) {
+                SLIST_INSERT_HEAD(&parent->nie_child_list, inode_entry,
+                                  nie_sibling_next);
+            } else {
+                SLIST_INSERT_AFTER(prev, inode_entry, nie_sibling_next);
+            }
+            prev = inode_entry;
+            break;
+
+        case NFFS_OBJECT_TYPE_BLOCK:
+            break;
+
+        case -FS_EEMPTY:
+            return 0;
+
+        default:
+            return -type;
+        }
+    }
+}
+
+/**
+ * Loads the checkpoint in the scratch area into the RAM representation.  The
+ * areas must already be detected, and the RAM representation must be empty.
+ * On failure, the RAM representation is left in an undefined state.
+ *
+ * @param out_area_curs         On success, for each area, the offset of the
+ *                                  first object that is not covered by the
+ *                                  checkpoint gets written here.
+ *
+ * @return                      0 on success;
+ *                              FS_ENOENT if there is no checkpoint;
+ *                              FS_ECORRUPT if the checkpoint is invalid or
+ *                                  does not match the detected areas;
+ *                              other nonzero on error.
+ */
+int
+nffs_ckpt_restore(uint32_t *out_area_curs)
+{
+    struct nffs_disk_ckpt_area disk_area;
+    struct nffs_ckpt_stream stream;
+    struct nffs_disk_ckpt disk_ckpt;
+    struct nffs_area *area;
+    uint32_t records_off;
+    uint32_t end;
+    uint16_t crc;
+    int rc;
+    int i;
+
+    if (nffs_scratch_area_idx == NFFS_AREA_ID_NONE) {
+        return FS_ENOENT;
+    }
+
+    rc = nffs_flash_read(nffs_scratch_area_idx, NFFS_CKPT_OFFSET, &disk_ckpt,
+                         sizeof disk_ckpt);
+    if (rc != 0) {
+        return rc;
+    }
+    if (disk_ckpt.ndc_magic != NFFS_CKPT_MAGIC) {
+        return FS_ENOENT;
+    }
+    if (disk_ckpt.ndc_num_areas != nffs_num_areas ||
+        disk_ckpt.ndc_len > nffs_areas[nffs_scratch_area_idx].na_length) {
+
+        return FS_ECORRUPT;
+    }
+
+    end = NFFS_CKPT_OFFSET + sizeof disk_ckpt + disk_ckpt.ndc_len;
+    nffs_ckpt_stream_init(&stream, nffs_scratch_area_idx,
+                          NFFS_CKPT_OFFSET + sizeof disk_ckpt, end);
+
+    /* The areas must be the ones the checkpoint was taken of. */
+    for (i = 0; i < nffs_num_areas; i++) {
+        rc = nffs_ckpt_stream_read(&stream, &disk_area, sizeof disk_area);
+        if (rc != 0) {
+            return rc == FS_EEMPTY ? FS_ECORRUPT : rc;
+        }
+
+        area = nffs_areas + i;
+        if (disk_area.ndca_offset != area->na_offset ||
+            disk_area.ndca_flash_id != area->na_flash_id ||
+            disk_area.ndca_id != (uint8_t)area->na_id ||
+            disk_area.ndca_gc_seq != area->na_gc_seq ||
+            disk_area.ndca_cur > area->na_length) {
+
+            return FS_ECORRUPT;
+        }
+        out_area_curs[i] = disk_area.ndca_cur;
+    }
+    records_off = stream.ncs_offset - stream.ncs_buf_len + stream.ncs_buf_off;
+
+    rc = nffs_ckpt_restore_entries(&stream, out_area_curs);
+    if (rc != 0) {
+        return rc;
+    }
+    if (stream.ncs_buf_off != stream.ncs_buf_len) {
+        /* Trailing partial record. */
+        return FS_ECORRUPT;
+    }
+
+    crc = crc16_ccitt(stream.ncs_crc, &disk_ckpt.ndc_len,
+                      NFFS_DISK_CKPT_OFFSET_CRC - sizeof disk_ckpt.ndc_magic);
+    if (crc != disk_ckpt.ndc_crc16) {
+        return FS_ECORRUPT;
+    }
+
+    nffs_ckpt_stream_init(&stream, nffs_scratch_area_idx, records_off, end);
+    rc = nffs_ckpt_restore_links(&stream);
+    if (rc != 0) {
+        return rc;
+    }
+
+    nffs_hash_next_file_id = disk_ckpt.ndc_next_file_id;
+    nffs_hash_next_dir_id = disk_ckpt.ndc_next_dir_id;
+    nffs_hash_next_block_id = disk_ckpt.ndc_next_block_id;
+    nffs_block_max_data_sz = disk_ckpt.ndc_block_max_data_sz;
+
+    nffs_ckpt_restore_count++;
+
+    return 0;
+}
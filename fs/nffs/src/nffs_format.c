@@ -25,8 +25,8 @@
 
 /**
  * Turns a scratch area into a non-scratch area.  If the specified area is not
- * actually a scratch area, this function falls back to a slower full format
- * operation.
+ * actually a scratch area, or it holds a checkpoint, this function falls back
+ * to a slower full format operation.
  */
 int
 nffs_format_from_scratch_area(uint8_t area_idx, uint8_t area_id)
@@ -41,7 +41,7 @@ nffs_format_from_scratch_area(uint8_t area_idx, uint8_t area_id)
     }
 
     nffs_areas[area_idx].na_id = area_id;
-    if (!nffs_area_is_scratch(&disk_area)) {
+    if (!nffs_area_is_scratch(&disk_area) || nffs_ckpt_present(area_idx)) {
         rc = nffs_format_area(area_idx, 0);
         if (rc != 0) {
             return rc;
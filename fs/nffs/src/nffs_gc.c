@@ -469,8 +469,8 @@ nffs_gc(uint8_t *out_area_idx)
         return rc;
     }
 
-    for (i = 0; i < NFFS_HASH_SIZE; i++) {
-        entry = SLIST_FIRST(nffs_hash + i);
+    for (i = 0; i < nffs_hash_inodes.nht_size; i++) {
+        entry = SLIST_FIRST(nffs_hash_inodes.nht_buckets + i);
         while (entry != NULL) {
             next = SLIST_NEXT(entry, nhe_next);
 
@@ -17,13 +17,34 @@
  * under the License.
  */
 
+/*
+ * The RAM index.  Inodes and data blocks are kept in separate hash tables,
+ * so that lookups of one kind do not have to wade through entries of the
+ * other, and code that is only interested in one kind can iterate over just
+ * that table.  Both tables live in the one nffs_hash allocation: the inode
+ * buckets, followed by the block buckets.
+ *
+ * Each table has a power-of-two number of buckets, chosen when the RAM
+ * representation is reset.  The number of entries a table can ever hold is
+ * bounded by the corresponding memory pool, so the table is sized to keep the
+ * average chain no longer than NFFS_HASH_LOAD_FACTOR with the pool full.
+ */
+
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include "nffs/nffs.h"
 #include "nffs_priv.h"
 
+/* Multiplier for Fibonacci hashing: 2^32 divided by the golden ratio. */
+#define NFFS_HASH_MULT  0x9e3779b1
+
 struct nffs_hash_list *nffs_hash;
+int nffs_hash_size;
+
+struct nffs_hash_table nffs_hash_inodes;
+struct nffs_hash_table nffs_hash_blocks;
 
 uint32_t nffs_hash_next_dir_id;
 uint32_t nffs_hash_next_file_id;
@@ -53,40 +74,51 @@ nffs_hash_id_is_block(uint32_t id)
     return id >= NFFS_ID_BLOCK_MIN && id < NFFS_ID_BLOCK_MAX;
 }
 
-static int
-nffs_hash_fn(uint32_t id)
+/**
+ * Maps an ID to its bucket in the specified table.  IDs are handed out
+ * sequentially, so the multiplication spreads both runs of consecutive IDs and
+ * IDs with a common stride evenly over the buckets.
+ */
+static struct nffs_hash_list *
+nffs_hash_bucket(const struct nffs_hash_table *table, uint32_t id)
 {
-    return id % NFFS_HASH_SIZE;
+    return table->nht_buckets + ((id * NFFS_HASH_MULT) >> table->nht_shift);
 }
 
-struct nffs_hash_entry *
-nffs_hash_find(uint32_t id)
+static struct nffs_hash_table *
+nffs_hash_table_for_id(uint32_t id)
 {
-    struct nffs_hash_entry *entry;
-    struct nffs_hash_entry *prev;
-    struct nffs_hash_list *list;
-    int idx;
+    if (nffs_hash_id_is_block(id)) {
+        return &nffs_hash_blocks;
+    } else {
+        return &nffs_hash_inodes;
+    }
+}
 
-    idx = nffs_hash_fn(id);
-    list = nffs_hash + idx;
+static struct nffs_hash_entry *
+nffs_hash_table_find(const struct nffs_hash_table *table, uint32_t id)
+{
+    struct nffs_hash_entry *entry;
 
-    prev = NULL;
-    SLIST_FOREACH(entry, list, nhe_next) {
+    SLIST_FOREACH(entry, nffs_hash_bucket(table, id), nhe_next) {
         if (entry->nhe_id == id) {
-            /* Put entry at the front of the list. */
-            if (prev != NULL) {
-                SLIST_NEXT(prev, nhe_next) = SLIST_NEXT(entry, nhe_next);
-                SLIST_INSERT_HEAD(list, entry, nhe_next);
-            }
             return entry;
         }
-
-        prev = entry;
     }
 
     return NULL;
 }
 
+struct nffs_hash_entry *
+nffs_hash_find(uint32_t id)
+{
+    if (!nffs_hash_id_is_inode(id) && !nffs_hash_id_is_block(id)) {
+        return NULL;
+    }
+
+    return nffs_hash_table_find(nffs_hash_table_for_id(id), id);
+}
+
 struct nffs_inode_entry *
 nffs_hash_find_inode(uint32_t id)
 {
@@ -94,7 +126,7 @@ nffs_hash_find_inode(uint32_t id)
 
     assert(nffs_hash_id_is_inode(id));
 
-    entry = nffs_hash_find(id);
+    entry = nffs_hash_table_find(&nffs_hash_inodes, id);
     return (struct nffs_inode_entry *)entry;
 }
 
@@ -105,50 +137,125 @@ nffs_hash_find_block(uint32_t id)
 
     assert(nffs_hash_id_is_block(id));
 
-    entry = nffs_hash_find(id);
+    entry = nffs_hash_table_find(&nffs_hash_blocks, id);
     return entry;
 }
 
 void
 nffs_hash_insert(struct nffs_hash_entry *entry)
 {
+    struct nffs_hash_table *table;
     struct nffs_hash_list *list;
-    int idx;
 
-    idx = nffs_hash_fn(entry->nhe_id);
-    list = nffs_hash + idx;
+    table = nffs_hash_table_for_id(entry->nhe_id);
+    list = nffs_hash_bucket(table, entry->nhe_id);
 
     SLIST_INSERT_HEAD(list, entry, nhe_next);
+    table->nht_num_entries++;
 }
 
 void
 nffs_hash_remove(struct nffs_hash_entry *entry)
 {
+    struct nffs_hash_table *table;
     struct nffs_hash_list *list;
-    int idx;
 
-    idx = nffs_hash_fn(entry->nhe_id);
-    list = nffs_hash + idx;
+    table = nffs_hash_table_for_id(entry->nhe_id);
+    list = nffs_hash_bucket(table, entry->nhe_id);
 
     SLIST_REMOVE(list, entry, nffs_hash_entry, nhe_next);
+    table->nht_num_entries--;
 }
 
+/**
+ * Calculates the log2 of the number of buckets for a table that holds up to
+ * the specified number of entries.
+ */
+static int
+nffs_hash_table_bits(uint32_t max_entries)
+{
+    int bits;
+
+    bits = NFFS_HASH_MIN_BITS;
+    while (bits < NFFS_HASH_MAX_BITS &&
+           (NFFS_HASH_LOAD_FACTOR << bits) < max_entries) {
+
+        bits++;
+    }
+
+    return bits;
+}
+
+static void
+nffs_hash_table_init(struct nffs_hash_table *table,
+                     struct nffs_hash_list *buckets, int bits)
+{
+    table->nht_buckets = buckets;
+    table->nht_size = 1 << bits;
+    table->nht_shift = 32 - bits;
+    table->nht_num_entries = 0;
+}
+
+/**
+ * Gathers chain length statistics for the specified hash table.
+ */
+void
+nffs_hash_table_stats(const struct nffs_hash_table *table,
+                      struct nffs_hash_stats *out_stats)
+{
+    struct nffs_hash_entry *entry;
+    uint32_t chain_len;
+    int i;
+
+    memset(out_stats, 0, sizeof *out_stats);
+    out_stats->nhs_num_buckets = table->nht_size;
+
+    for (i = 0; i < table->nht_size; i++) {
+        chain_len = 0;
+        SLIST_FOREACH(entry, table->nht_buckets + i, nhe_next) {
+            chain_len++;
+        }
+
+        if (chain_len == 0) {
+            out_stats->nhs_num_empty++;
+        }
+        if (chain_len > out_stats->nhs_max_chain) {
+            out_stats->nhs_max_chain = chain_len;
+        }
+        out_stats->nhs_num_entries += chain_len;
+    }
+}
+
+/**
+ * Allocates and clears the hash tables.  The number of buckets in each table
+ * depends on the sizes of the inode and block entry pools in nffs_config.
+ */
 int
 nffs_hash_init(void)
 {
+    int inode_bits;
+    int block_bits;
     int i;
 
     free(nffs_hash);
 
-    nffs_hash = malloc(NFFS_HASH_SIZE * sizeof *nffs_hash);
+    inode_bits = nffs_hash_table_bits(nffs_config.nc_num_inodes);
+    block_bits = nffs_hash_table_bits(nffs_config.nc_num_blocks);
+    nffs_hash_size = (1 << inode_bits) + (1 << block_bits);
+
+    nffs_hash = malloc(nffs_hash_size * sizeof *nffs_hash);
     if (nffs_hash == NULL) {
+        nffs_hash_size = 0;
         return FS_ENOMEM;
     }
 
-    for (i = 0; i < NFFS_HASH_SIZE; i++) {
+    for (i = 0; i < nffs_hash_size; i++) {
         SLIST_INIT(nffs_hash + i);
     }
 
+    nffs_hash_table_init(&nffs_hash_inodes, nffs_hash, inode_bits);
+    nffs_hash_table_init(&nffs_hash_blocks, nffs_hash + (1 << inode_bits),
+                         block_bits);
+
     return 0;
 }
-
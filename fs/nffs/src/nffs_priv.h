@@ -28,7 +28,12 @@
 #include "fs/fs.h"
 #include "util/crc16.h"
 
-#define NFFS_HASH_SIZE               256
+/* Bounds on the number of buckets in each hash table, as powers of two. */
+#define NFFS_HASH_MIN_BITS           4
+#define NFFS_HASH_MAX_BITS           16
+
+/* Average chain length a hash table is sized for, with its pool full. */
+#define NFFS_HASH_LOAD_FACTOR        4
 
 #define NFFS_ID_DIR_MIN              0
 #define NFFS_ID_DIR_MAX              0x10000000
@@ -46,6 +51,7 @@
 #define NFFS_AREA_MAGIC3             0xb185fc8e
 #define NFFS_BLOCK_MAGIC             0x53ba23b9
 #define NFFS_INODE_MAGIC             0x925f8bc0
+#define NFFS_CKPT_MAGIC              0x3d1c7a46
 
 #define NFFS_AREA_ID_NONE            0xff
 #define NFFS_AREA_VER                0
@@ -95,6 +101,56 @@ struct nffs_disk_block {
 
 #define NFFS_DISK_BLOCK_OFFSET_CRC  20
 
+/**
+ * On-disk representation of an index checkpoint.  A checkpoint is kept in the
+ * scratch area, right after the area header, and is erased by the next
+ * garbage collection cycle.
+ */
+struct nffs_disk_ckpt {
+    uint32_t ndc_magic;             /* NFFS_CKPT_MAGIC */
+    uint32_t ndc_len;               /* Length of area list and records. */
+    uint32_t ndc_next_file_id;
+    uint32_t ndc_next_dir_id;
+    uint32_t ndc_next_block_id;
+    uint16_t ndc_block_max_data_sz;
+    uint8_t ndc_num_areas;
+    uint8_t reserved8;
+    uint16_t reserved16;
+    uint16_t ndc_crc16;             /* Covers area list, records, and rest of
+                                       header. */
+    /* Followed by one nffs_disk_ckpt_area per area, then the records. */
+};
+
+#define NFFS_DISK_CKPT_OFFSET_CRC   26
+
+/** State of one area at the time a checkpoint was taken. */
+struct nffs_disk_ckpt_area {
+    uint32_t ndca_offset;           /* Flash offset of start of area. */
+    uint32_t ndca_cur;              /* Objects past this are not in the
+                                       checkpoint. */
+    uint8_t ndca_flash_id;
+    uint8_t ndca_id;
+    uint8_t ndca_gc_seq;
+    uint8_t reserved8;
+};
+
+/**
+ * Checkpoint record of an inode.  The inodes in a directory are recorded
+ * together, in directory order.  A file inode is followed by records of its
+ * data blocks, last block first.
+ */
+struct nffs_disk_ckpt_inode {
+    uint32_t ndci_id;
+    uint32_t ndci_flash_loc;
+    uint32_t ndci_parent_id;        /* NFFS_ID_NONE for the root directory. */
+};
+
+/** Checkpoint record of a data block. */
+struct nffs_disk_ckpt_block {
+    uint32_t ndcb_id;
+    uint32_t ndcb_flash_loc;
+};
+
 /**
  * What gets stored in the hash table.  Each entry represents a data block or
  * an inode.
@@ -109,6 +165,22 @@ struct nffs_hash_entry {
 SLIST_HEAD(nffs_hash_list, nffs_hash_entry);
 SLIST_HEAD(nffs_inode_list, nffs_inode_entry);
 
+/** A hash table of inode entries or of data block entries. */
+struct nffs_hash_table {
+    struct nffs_hash_list *nht_buckets;
+    int nht_size;                   /* Number of buckets; power of two. */
+    uint8_t nht_shift;              /* 32 - log2(nht_size). */
+    uint32_t nht_num_entries;
+};
+
+/** Chain length statistics of a hash table. */
+struct nffs_hash_stats {
+    uint32_t nhs_num_buckets;
+    uint32_t nhs_num_entries;
+    uint32_t nhs_num_empty;         /* Buckets without entries. */
+    uint32_t nhs_max_chain;
+};
+
 /** Each inode hash entry is actually one of these. */
 struct nffs_inode_entry {
     struct nffs_hash_entry nie_hash_entry;
@@ -233,11 +305,15 @@ extern uint8_t nffs_num_areas;
 extern uint8_t nffs_scratch_area_idx;
 extern uint16_t nffs_block_max_data_sz;
 extern unsigned int nffs_gc_count;
+extern unsigned int nffs_ckpt_restore_count;
 
 #define NFFS_FLASH_BUF_SZ        256
 extern uint8_t nffs_flash_buf[NFFS_FLASH_BUF_SZ];
 
 extern struct nffs_hash_list *nffs_hash;
+extern int nffs_hash_size;
+extern struct nffs_hash_table nffs_hash_inodes;
+extern struct nffs_hash_table nffs_hash_blocks;
 extern struct nffs_inode_entry *nffs_root_dir;
 extern struct nffs_inode_entry *nffs_lost_found_dir;
 
@@ -301,6 +377,11 @@ int nffs_crc_disk_inode_validate(const struct nffs_disk_inode *disk_inode,
 void nffs_crc_disk_inode_fill(struct nffs_disk_inode *disk_inode,
                               const char *filename);
 
+/* @ckpt */
+int nffs_ckpt_present(uint8_t area_idx);
+int nffs_ckpt_write(void);
+int nffs_ckpt_restore(uint32_t *out_area_curs);
+
 /* @config */
 void nffs_config_init(void);
 
@@ -352,6 +433,8 @@ struct nffs_inode_entry *nffs_hash_find_inode(uint32_t id);
 struct nffs_hash_entry *nffs_hash_find_block(uint32_t id);
 void nffs_hash_insert(struct nffs_hash_entry *entry);
 void nffs_hash_remove(struct nffs_hash_entry *entry);
+void nffs_hash_table_stats(const struct nffs_hash_table *table,
+                           struct nffs_hash_stats *out_stats);
 int nffs_hash_init(void);
 
 /* @inode */
@@ -436,11 +519,18 @@ int nffs_write_to_file(struct nffs_file *file, const void *data, int len);
 
 
 #define NFFS_HASH_FOREACH(entry, i, next)                               \
-    for ((i) = 0; (i) < NFFS_HASH_SIZE; (i)++)                          \
+    for ((i) = 0; (i) < nffs_hash_size; (i)++)                          \
         for ((entry) = SLIST_FIRST(nffs_hash + (i));                    \
              (entry) && (((next)) = SLIST_NEXT((entry), nhe_next), 1);  \
              (entry) = ((next)))
 
+/* Iterates through the entries in one hash table only. */
+#define NFFS_HASH_TABLE_FOREACH(table, entry, i, next)                  \
+    for ((i) = 0; (i) < (table)->nht_size; (i)++)                       \
+        for ((entry) = SLIST_FIRST((table)->nht_buckets + (i));         \
+             (entry) && (((next)) = SLIST_NEXT((entry), nhe_next), 1);  \
+             (entry) = ((next)))
+
 #define NFFS_FLASH_LOC_NONE  nffs_flash_loc(NFFS_AREA_ID_NONE, 0)
 
 #define NFFS_LOG(lvl, ...) \
@@ -33,6 +33,53 @@
  */
 static uint16_t nffs_restore_largest_block_data_len;
 
+/**
+ * While restoring from a checkpoint: for each area, the offset of the first
+ * object that was written after the checkpoint.  NULL otherwise.
+ */
+static uint32_t *nffs_restore_ckpt_curs;
+
+/**
+ * Indicates whether the object at the specified flash location was restored
+ * from a checkpoint rather than read from flash.
+ */
+static int
+nffs_restore_loc_in_ckpt(uint32_t flash_loc)
+{
+    uint32_t area_offset;
+    uint8_t area_idx;
+
+    if (nffs_restore_ckpt_curs == NULL) {
+        return 0;
+    }
+
+    nffs_flash_loc_expand(flash_loc, &area_idx, &area_offset);
+    return area_idx < nffs_num_areas &&
+           area_offset < nffs_restore_ckpt_curs[area_idx];
+}
+
+/**
+ * Indicates whether nothing written after the checkpoint affects the
+ * specified inode, so that it needs no further validation.
+ */
+static int
+nffs_restore_inode_in_ckpt(struct nffs_inode_entry *inode_entry)
+{
+    if (!nffs_restore_loc_in_ckpt(inode_entry->nie_hash_entry.nhe_flash_loc)) {
+        return 0;
+    }
+
+    if (nffs_hash_id_is_file(inode_entry->nie_hash_entry.nhe_id) &&
+        inode_entry->nie_last_block_entry != NULL &&
+        !nffs_restore_loc_in_ckpt(
+            inode_entry->nie_last_block_entry->nhe_flash_loc)) {
+
+        return 0;
+    }
+
+    return 1;
+}
+
 /**
  * Checks that each block a chain of data blocks was properly restored.
  *
@@ -279,8 +326,8 @@ nffs_restore_find_file_ends(void)
     int rc;
     int i;
 
-    NFFS_HASH_FOREACH(block_entry, i, next) {
-        if (!nffs_hash_id_is_inode(block_entry->nhe_id)) {
+    NFFS_HASH_TABLE_FOREACH(&nffs_hash_blocks, block_entry, i, next) {
+        if (!nffs_restore_loc_in_ckpt(block_entry->nhe_flash_loc)) {
             rc = nffs_restore_find_file_end_block(block_entry);
             assert(rc == 0);
         }
@@ -314,11 +361,11 @@ nffs_restore_sweep(void)
     int rc;
     int i;
 
-    /* Iterate through every object in the hash table, deleting all inodes that
+    /* Iterate through every inode in the hash table, deleting all inodes that
      * should be removed.
      */
-    for (i = 0; i < NFFS_HASH_SIZE; i++) {
-        list = nffs_hash + i;
+    for (i = 0; i < nffs_hash_inodes.nht_size; i++) {
+        list = nffs_hash_inodes.nht_buckets + i;
 
         entry = SLIST_FIRST(list);
         while (entry != NULL) {
@@ -335,6 +382,14 @@ nffs_restore_sweep(void)
                     return rc;
                 }
 
+                /* An inode taken from a checkpoint was valid when the
+                 * checkpoint was written.
+                 */
+                if (nffs_restore_inode_in_ckpt(inode_entry)) {
+                    entry = next;
+                    continue;
+                }
+
                 /* Determine if this inode needs to be deleted. */
                 rc = nffs_restore_should_sweep_inode_entry(inode_entry, &del);
                 if (rc != 0) {
@@ -830,11 +885,12 @@ nffs_restore_disk_object_size(const struct nffs_disk_object *disk_object)
  * representation.
  *
  * @param area_idx              The index of the area to read.
+ * @param area_offset           The offset to start reading from.
  *
  * @return                      0 on success; nonzero on failure.
  */
 static int
-nffs_restore_area_contents(int area_idx)
+nffs_restore_area_contents(int area_idx, uint32_t area_offset)
 {
     struct nffs_disk_object disk_object;
     struct nffs_area *area;
@@ -842,7 +898,7 @@ nffs_restore_area_contents(int area_idx)
 
     area = nffs_areas + area_idx;
 
-    area->na_cur = sizeof (struct nffs_disk_area);
+    area->na_cur = area_offset;
     while (1) {
         rc = nffs_restore_disk_object(area_idx, area->na_cur,  &disk_object);
         switch (rc) {
@@ -935,7 +991,7 @@ nffs_restore_corrupt_scratch(void)
     }
 
     /* Invalidate all objects resident in the bad area. */
-    for (i = 0; i < NFFS_HASH_SIZE; i++) {
+    for (i = 0; i < nffs_hash_size; i++) {
         entry = SLIST_FIRST(&nffs_hash[i]);
         while (entry != NULL) {
             next = SLIST_NEXT(entry, nhe_next);
@@ -961,7 +1017,7 @@ nffs_restore_corrupt_scratch(void)
     /* Now that the objects in the scratch area have been invalidated, reload
      * everything from the good area.
      */
-    rc = nffs_restore_area_contents(good_idx);
+    rc = nffs_restore_area_contents(good_idx, sizeof (struct nffs_disk_area));
     if (rc != 0) {
         return rc;
     }
@@ -1036,23 +1092,76 @@ nffs_log_contents(void)
     }
 }
 
+static void
+nffs_restore_log_hash_stats(const char *name,
+                            const struct nffs_hash_table *table)
+{
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+    struct nffs_hash_stats stats;
+
+    nffs_hash_table_stats(table, &stats);
+    NFFS_LOG(DEBUG, "%s hash; buckets=%u entries=%u empty=%u max_chain=%u\n",
+             name, (unsigned int)stats.nhs_num_buckets,
+             (unsigned int)stats.nhs_num_entries,
+             (unsigned int)stats.nhs_num_empty,
+             (unsigned int)stats.nhs_max_chain);
+#endif
+}
+
 /**
- * Searches for a valid nffs file system among the specified areas.  This
- * function succeeds if a file system is detected among any subset of the
- * supplied areas.  If the area set does not contain a valid file system,
- * a new one can be created via a call to nffs_format().
+ * Makes the area described by 'desc' the scratch area, at index 'area_idx'.
+ * The areas from that index on move up by one, so this can only be done
+ * before any objects have been read.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+nffs_restore_headerless_scratch(const struct nffs_area_desc *desc,
+                                int area_idx)
+{
+    int rc;
+
+    rc = nffs_misc_set_num_areas(nffs_num_areas + 1);
+    if (rc != 0) {
+        return rc;
+    }
+    memmove(nffs_areas + area_idx + 1, nffs_areas + area_idx,
+            (nffs_num_areas - 1 - area_idx) * sizeof *nffs_areas);
+
+    nffs_areas[area_idx].na_offset = desc->nad_offset;
+    nffs_areas[area_idx].na_length = desc->nad_length;
+    nffs_areas[area_idx].na_flash_id = desc->nad_flash_id;
+    nffs_areas[area_idx].na_gc_seq = 0;
+
+    rc = nffs_format_area(area_idx, 1);
+    if (rc != 0) {
+        return rc;
+    }
+    nffs_scratch_area_idx = area_idx;
+
+    NFFS_LOG(INFO, "area at 0x%lx has no header; now scratch\n",
+             (unsigned long)desc->nad_offset);
+
+    return 0;
+}
+
+/**
+ * Reads the header of each of the specified areas, and sets up the areas that
+ * belong to an nffs file system.  The contents of the areas are not read.
  *
  * @param area_descs        The area set to search.  This array must be
  *                              terminated with a 0-length area.
  *
- * @return                  0 on success;
- *                          FS_ECORRUPT if no valid file system was detected;
- *                          other nonzero on error.
+ * @return                  0 on success; nonzero on failure.
  */
-int
-nffs_restore_full(const struct nffs_area_desc *area_descs)
+static int
+nffs_restore_detect_areas(const struct nffs_area_desc *area_descs)
 {
     struct nffs_disk_area disk_area;
+    uint16_t good_idx;
+    uint16_t bad_idx;
+    int headerless_desc;
+    int headerless_pos;
     int cur_area_idx;
     int use_area;
     int rc;
@@ -1064,12 +1173,13 @@ nffs_restore_full(const struct nffs_area_desc *area_descs)
         return rc;
     }
     nffs_restore_largest_block_data_len = 0;
+    headerless_desc = -1;
+    headerless_pos = 0;
 
     /* Read each area from flash. */
     for (i = 0; area_descs[i].nad_length != 0; i++) {
         if (i > NFFS_MAX_AREAS) {
-            rc = FS_EINVAL;
-            goto err;
+            return FS_EINVAL;
         }
 
         rc = nffs_restore_detect_one_area(area_descs[i].nad_flash_id,
@@ -1082,10 +1192,16 @@ nffs_restore_full(const struct nffs_area_desc *area_descs)
 
         case FS_ECORRUPT:
             use_area = 0;
+            if (headerless_desc == -1) {
+                headerless_desc = i;
+                headerless_pos = nffs_num_areas;
+            } else {
+                headerless_desc = -2;
+            }
             break;
 
         default:
-            goto err;
+            return rc;
         }
 
         if (use_area) {
@@ -1098,12 +1214,11 @@ nffs_restore_full(const struct nffs_area_desc *area_descs)
         }
 
         if (use_area) {
-            /* Populate RAM with a representation of this area. */
             cur_area_idx = nffs_num_areas;
 
             rc = nffs_misc_set_num_areas(nffs_num_areas + 1);
             if (rc != 0) {
-                goto err;
+                return rc;
             }
 
             nffs_areas[cur_area_idx].na_offset = area_descs[i].nad_offset;
@@ -1118,7 +1233,117 @@ nffs_restore_full(const struct nffs_area_desc *area_descs)
             } else {
                 nffs_areas[cur_area_idx].na_cur =
                     sizeof (struct nffs_disk_area);
-                nffs_restore_area_contents(cur_area_idx);
+            }
+        }
+    }
+
+    /* A reset while the scratch area was being erased, by nffs_checkpoint()
+     * or at the end of a garbage collection cycle, leaves it without a
+     * header, and the file system without a scratch area.  If exactly one
+     * area has no header, and there is no sign of an interrupted garbage
+     * collection copy (two areas with the same ID), that area is the scratch
+     * area.
+     */
+    if (nffs_scratch_area_idx == NFFS_AREA_ID_NONE && headerless_desc >= 0 &&
+        nffs_num_areas > 0 &&
+        nffs_area_find_corrupt_scratch(&good_idx, &bad_idx) == FS_ENOENT) {
+
+        rc = nffs_restore_headerless_scratch(area_descs + headerless_desc,
+                                             headerless_pos);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Populates RAM from the checkpoint in the scratch area, if there is a valid
+ * one, and then reads the objects that were written after it.
+ * nffs_restore_ckpt_curs is left pointing to the extent of the checkpoint in
+ * each area; the caller frees it.
+ *
+ * @return                  0 on success;
+ *                          FS_ENOENT if there is no checkpoint;
+ *                          other nonzero if the checkpoint could not be used,
+ *                              in which case RAM needs to be reset.
+ */
+static int
+nffs_restore_from_ckpt(void)
+{
+    int rc;
+    int i;
+
+    nffs_restore_ckpt_curs = malloc(nffs_num_areas *
+                                    sizeof *nffs_restore_ckpt_curs);
+    if (nffs_restore_ckpt_curs == NULL) {
+        return FS_ENOMEM;
+    }
+
+    rc = nffs_ckpt_restore(nffs_restore_ckpt_curs);
+    if (rc != 0) {
+        return rc;
+    }
+    nffs_restore_largest_block_data_len = nffs_block_max_data_sz;
+
+    for (i = 0; i < nffs_num_areas; i++) {
+        if (i != nffs_scratch_area_idx) {
+            rc = nffs_restore_area_contents(i, nffs_restore_ckpt_curs[i]);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Searches for a valid nffs file system among the specified areas.  This
+ * function succeeds if a file system is detected among any subset of the
+ * supplied areas.  If the area set does not contain a valid file system,
+ * a new one can be created via a call to nffs_format().
+ *
+ * If the scratch area holds a valid checkpoint (see nffs_checkpoint()), only
+ * the objects written since are read from flash.  Otherwise, every object in
+ * every area is read and validated.
+ *
+ * @param area_descs        The area set to search.  This array must be
+ *                              terminated with a 0-length area.
+ *
+ * @return                  0 on success;
+ *                          FS_ECORRUPT if no valid file system was detected;
+ *                          other nonzero on error.
+ */
+int
+nffs_restore_full(const struct nffs_area_desc *area_descs)
+{
+    int rc;
+    int i;
+
+    rc = nffs_restore_detect_areas(area_descs);
+    if (rc != 0) {
+        goto err;
+    }
+
+    rc = nffs_restore_from_ckpt();
+    if (rc != 0) {
+        free(nffs_restore_ckpt_curs);
+        nffs_restore_ckpt_curs = NULL;
+
+        if (rc != FS_ENOENT) {
+            /* Start over, without the checkpoint. */
+            NFFS_LOG(INFO, "checkpoint not used; rc=%d\n", rc);
+            rc = nffs_restore_detect_areas(area_descs);
+            if (rc != 0) {
+                goto err;
+            }
+        }
+
+        for (i = 0; i < nffs_num_areas; i++) {
+            if (i != nffs_scratch_area_idx) {
+                nffs_restore_area_contents(i, sizeof (struct nffs_disk_area));
             }
         }
     }
@@ -1164,6 +1389,9 @@ nffs_restore_full(const struct nffs_area_desc *area_descs)
      */
     nffs_restore_sweep();
 
+    free(nffs_restore_ckpt_curs);
+    nffs_restore_ckpt_curs = NULL;
+
     /* Set the maximum data block size according to the size of the smallest
      * area.
      */
@@ -1174,10 +1402,14 @@ nffs_restore_full(const struct nffs_area_desc *area_descs)
 
     NFFS_LOG(DEBUG, "CONTENTS\n");
     nffs_log_contents();
+    nffs_restore_log_hash_stats("inode", &nffs_hash_inodes);
+    nffs_restore_log_hash_stats("block", &nffs_hash_blocks);
 
     return 0;
 
 err:
+    free(nffs_restore_ckpt_curs);
+    nffs_restore_ckpt_curs = NULL;
     nffs_misc_reset();
     return rc;
 }
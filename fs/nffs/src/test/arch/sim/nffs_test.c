@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <errno.h>
 #include "hal/hal_flash.h"
+#include "hal/hal_cputime.h"
+#include "mcu/mcu_sim.h"
 #include "testutil/testutil.h"
 #include "fs/fs.h"
 #include "nffs/nffs.h"
@@ -2563,6 +2565,467 @@ TEST_CASE(nffs_test_gc_on_oom)
     nffs_test_assert_system(expected_system, area_descs_two);
 }
 
+TEST_CASE(nffs_test_checkpoint)
+{
+    struct fs_file *file;
+    unsigned int restore_count;
+    uint32_t offset;
+    int rc;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+    struct nffs_test_block_desc blocks[3] = { {
+        .data = "abc",
+        .data_len = 3,
+    }, {
+        .data = "def",
+        .data_len = 3,
+    }, {
+        .data = "ghi",
+        .data_len = 3,
+    } };
+
+    /*** Setup. */
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_mkdir("/mydir");
+    TEST_ASSERT(rc == 0);
+    rc = fs_mkdir("/mydir/sub");
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_create_file_blocks("/mydir/multi.txt", blocks, 3);
+    nffs_test_util_create_file("/mydir/gone.txt", "gone", 4);
+    nffs_test_util_create_file("/mydir/sub/a.txt", "aaaa", 4);
+    nffs_test_util_create_file("/b.txt", "bbbb", 4);
+
+    rc = nffs_checkpoint();
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /* Nothing changed since the checkpoint. */
+    restore_count = nffs_ckpt_restore_count;
+    rc = nffs_misc_reset();
+    TEST_ASSERT(rc == 0);
+    rc = nffs_detect(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(nffs_ckpt_restore_count == restore_count + 1);
+
+    /*** Change the file system after the checkpoint. */
+    rc = nffs_checkpoint();
+    TEST_ASSERT_FATAL(rc == 0);
+
+    nffs_test_util_append_file("/mydir/multi.txt", "jkl", 3);
+
+    rc = fs_open("/mydir/multi.txt", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_seek(file, 3);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, "DEF", 3);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_unlink("/mydir/gone.txt");
+    TEST_ASSERT(rc == 0);
+    rc = fs_rename("/b.txt", "/mydir/sub/b.txt");
+    TEST_ASSERT(rc == 0);
+    rc = fs_mkdir("/newdir");
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_create_file("/newdir/c.txt", "cccc", 4);
+
+    struct nffs_test_file_desc *expected_system =
+        (struct nffs_test_file_desc[]) { {
+            .filename = "",
+            .is_dir = 1,
+            .children = (struct nffs_test_file_desc[]) { {
+                .filename = "mydir",
+                .is_dir = 1,
+                .children = (struct nffs_test_file_desc[]) { {
+                    .filename = "multi.txt",
+                    .contents = "abcDEFghijkl",
+                    .contents_len = 12,
+                }, {
+                    .filename = "sub",
+                    .is_dir = 1,
+                    .children = (struct nffs_test_file_desc[]) { {
+                        .filename = "a.txt",
+                        .contents = "aaaa",
+                        .contents_len = 4,
+                    }, {
+                        .filename = "b.txt",
+                        .contents = "bbbb",
+                        .contents_len = 4,
+                    }, {
+                        .filename = NULL,
+                    } },
+                }, {
+                    .filename = NULL,
+                } },
+            }, {
+                .filename = "newdir",
+                .is_dir = 1,
+                .children = (struct nffs_test_file_desc[]) { {
+                    .filename = "c.txt",
+                    .contents = "cccc",
+                    .contents_len = 4,
+                }, {
+                    .filename = NULL,
+                } },
+            }, {
+                .filename = NULL,
+            } },
+    } };
+
+    /* The checkpoint is used, and the later changes are replayed. */
+    restore_count = nffs_ckpt_restore_count;
+    rc = nffs_misc_reset();
+    TEST_ASSERT(rc == 0);
+    rc = nffs_detect(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(nffs_ckpt_restore_count == restore_count + 1);
+    nffs_test_assert_system_once(expected_system);
+
+    /* Newly allocated IDs don't collide with ones from before the reboot. */
+    nffs_test_util_create_file("/d.txt", "dddd", 4);
+    rc = fs_unlink("/d.txt");
+    TEST_ASSERT(rc == 0);
+
+    /*** A corrupt checkpoint is ignored; the areas are scanned instead. */
+    rc = nffs_checkpoint();
+    TEST_ASSERT_FATAL(rc == 0);
+
+    offset = area_descs_two[nffs_scratch_area_idx].nad_offset +
+             sizeof (struct nffs_disk_area) +
+             sizeof (struct nffs_disk_ckpt) +
+             2 * sizeof (struct nffs_disk_ckpt_area) + 4;
+    rc = flash_native_memset(offset, 0x00, 1);
+    TEST_ASSERT(rc == 0);
+
+    restore_count = nffs_ckpt_restore_count;
+    rc = nffs_misc_reset();
+    TEST_ASSERT(rc == 0);
+    rc = nffs_detect(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(nffs_ckpt_restore_count == restore_count);
+    TEST_ASSERT(nffs_ckpt_present(nffs_scratch_area_idx));
+
+    /* Garbage collection discards the checkpoint. */
+    nffs_test_assert_system(expected_system, area_descs_two);
+    TEST_ASSERT(!nffs_ckpt_present(nffs_scratch_area_idx));
+}
+
+/**
+ * A reset in the middle of a checkpoint leaves a file system that can still
+ * be detected, whether it hits the first write to a clean scratch area or
+ * the erase of an old checkpoint.
+ */
+TEST_CASE(nffs_test_ckpt_power_cut)
+{
+    unsigned int restore_count;
+    int rc;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+    struct nffs_test_file_desc *expected_system =
+        (struct nffs_test_file_desc[]) { {
+            .filename = "",
+            .is_dir = 1,
+            .children = (struct nffs_test_file_desc[]) { {
+                .filename = "mydir",
+                .is_dir = 1,
+                .children = (struct nffs_test_file_desc[]) { {
+                    .filename = "a.txt",
+                    .contents = "aaaa",
+                    .contents_len = 4,
+                }, {
+                    .filename = NULL,
+                } },
+            }, {
+                .filename = "b.txt",
+                .contents = "bbbb",
+                .contents_len = 4,
+            }, {
+                .filename = NULL,
+            } },
+    } };
+
+    /*** Setup. */
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_mkdir("/mydir");
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_create_file("/mydir/a.txt", "aaaa", 4);
+    nffs_test_util_create_file("/b.txt", "bbbb", 4);
+
+    /*** The scratch area is clean, so the cut hits the first write. */
+    native_flash_power_cut(0);
+    rc = nffs_checkpoint();
+    TEST_ASSERT(rc != 0);
+    native_flash_power_cut(-1);
+
+    rc = nffs_misc_reset();
+    TEST_ASSERT(rc == 0);
+    rc = nffs_detect(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+    nffs_test_assert_system_once(expected_system);
+
+    /*** Erasing the old checkpoint is cut short. */
+    rc = nffs_checkpoint();
+    TEST_ASSERT_FATAL(rc == 0);
+
+    native_flash_power_cut(0);
+    rc = nffs_checkpoint();
+    TEST_ASSERT(rc != 0);
+    native_flash_power_cut(-1);
+
+    rc = nffs_misc_reset();
+    TEST_ASSERT(rc == 0);
+    rc = nffs_detect(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(nffs_scratch_area_idx != NFFS_AREA_ID_NONE);
+    TEST_ASSERT(!nffs_ckpt_present(nffs_scratch_area_idx));
+    nffs_test_assert_system_once(expected_system);
+
+    /* The new scratch area takes a checkpoint. */
+    rc = nffs_checkpoint();
+    TEST_ASSERT_FATAL(rc == 0);
+    restore_count = nffs_ckpt_restore_count;
+    rc = nffs_misc_reset();
+    TEST_ASSERT(rc == 0);
+    rc = nffs_detect(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(nffs_ckpt_restore_count == restore_count + 1);
+
+    nffs_test_assert_system(expected_system, area_descs_two);
+}
+
+static void
+nffs_test_assert_hash_table(const struct nffs_hash_table *table,
+                            uint32_t pool_size, int expect_blocks)
+{
+    struct nffs_hash_stats stats;
+    struct nffs_hash_entry *entry;
+    struct nffs_hash_entry *next;
+    int i;
+
+    /* Sized for the pool, but no larger than that. */
+    TEST_ASSERT(table->nht_size * NFFS_HASH_LOAD_FACTOR >= pool_size);
+    TEST_ASSERT(table->nht_size == 1 << NFFS_HASH_MIN_BITS ||
+                table->nht_size / 2 * NFFS_HASH_LOAD_FACTOR < pool_size);
+
+    NFFS_HASH_TABLE_FOREACH(table, entry, i, next) {
+        TEST_ASSERT(nffs_hash_id_is_block(entry->nhe_id) == expect_blocks);
+    }
+
+    /* Sequential IDs are spread evenly. */
+    nffs_hash_table_stats(table, &stats);
+    TEST_ASSERT(stats.nhs_num_buckets == table->nht_size);
+    TEST_ASSERT(stats.nhs_num_entries == table->nht_num_entries);
+    TEST_ASSERT(stats.nhs_max_chain <=
+                stats.nhs_num_entries / stats.nhs_num_buckets + 2);
+}
+
+TEST_CASE(nffs_test_hash)
+{
+    struct nffs_hash_stats stats;
+    char filename[32];
+    int rc;
+    int i;
+
+    /*** Setup. */
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_mkdir("/dir");
+    TEST_ASSERT(rc == 0);
+    for (i = 0; i < 200; i++) {
+        sprintf(filename, "/dir/file%03d", i);
+        nffs_test_util_create_file(filename, "abc", 3);
+        nffs_test_util_append_file(filename, "def", 3);
+        nffs_test_util_append_file(filename, "ghi", 3);
+    }
+
+    nffs_test_assert_hash_table(&nffs_hash_inodes, nffs_config.nc_num_inodes,
+                                0);
+    nffs_test_assert_hash_table(&nffs_hash_blocks, nffs_config.nc_num_blocks,
+                                1);
+
+    /* Root, lost+found, /dir, and the files; 3 blocks per file. */
+    nffs_hash_table_stats(&nffs_hash_inodes, &stats);
+    TEST_ASSERT(stats.nhs_num_entries == 3 + 200);
+    nffs_hash_table_stats(&nffs_hash_blocks, &stats);
+    TEST_ASSERT(stats.nhs_num_entries == 3 * 200);
+
+    TEST_ASSERT(nffs_hash_find(NFFS_ID_NONE) == NULL);
+    TEST_ASSERT(nffs_hash_find(NFFS_ID_ROOT_DIR) ==
+                &nffs_root_dir->nie_hash_entry);
+
+    /* Unlinking removes the file's inode and blocks from both tables. */
+    rc = fs_unlink("/dir/file000");
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_hash_inodes.nht_num_entries == 3 + 199);
+    TEST_ASSERT(nffs_hash_blocks.nht_num_entries == 3 * 199);
+
+    rc = nffs_misc_reset();
+    TEST_ASSERT(rc == 0);
+    rc = nffs_detect(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_hash_inodes.nht_num_entries == 3 + 199);
+    TEST_ASSERT(nffs_hash_blocks.nht_num_entries == 3 * 199);
+}
+
+/* Flash layout of the mount time benchmark: an 8MB part. */
+#define NFFS_TEST_BENCH_FLASH       "16x512k"
+#define NFFS_TEST_BENCH_NUM_AREAS   16
+#define NFFS_TEST_BENCH_AREA_SZ     (512 * 1024)
+#define NFFS_TEST_BENCH_NUM_DIRS    100
+
+static struct nffs_area_desc
+    nffs_test_bench_area_descs[NFFS_TEST_BENCH_NUM_AREAS + 1];
+
+/* Result of one detect in the mount time benchmark. */
+struct nffs_test_bench_result {
+    uint32_t ntbr_usecs;
+    uint32_t ntbr_read_bytes;   /* Flash read. */
+};
+
+/**
+ * Reboots, and measures the detect.  The number of inodes and blocks in RAM
+ * is written to out_num_entries.
+ */
+static void
+nffs_test_bench_detect(struct nffs_test_bench_result *out_result,
+                       int *out_num_entries)
+{
+    struct nffs_hash_entry *entry;
+    struct nffs_hash_entry *next;
+    uint64_t read_bytes;
+    uint32_t start;
+    int rc;
+    int i;
+
+    rc = nffs_misc_reset();
+    TEST_ASSERT_FATAL(rc == 0);
+
+    read_bytes = native_flash_stats.nfs_read_bytes;
+    start = cputime_get32();
+    rc = nffs_detect(nffs_test_bench_area_descs);
+    out_result->ntbr_usecs = cputime_ticks_to_usecs(cputime_get32() - start);
+    out_result->ntbr_read_bytes = native_flash_stats.nfs_read_bytes -
+                                  read_bytes;
+    TEST_ASSERT_FATAL(rc == 0);
+
+    *out_num_entries = 0;
+    NFFS_HASH_FOREACH(entry, i, next) {
+        (*out_num_entries)++;
+    }
+}
+
+/**
+ * Creates num_files small files, spread over NFFS_TEST_BENCH_NUM_DIRS
+ * directories, and measures how long a detect takes, with and without a
+ * checkpoint.
+ */
+static void
+nffs_test_bench_mount(int num_files, struct nffs_test_bench_result *out_scan,
+                      struct nffs_test_bench_result *out_ckpt)
+{
+    unsigned int restore_count;
+    char contents[16];
+    char filename[32];
+    int num_entries_scan;
+    int num_entries_ckpt;
+    int rc;
+    int i;
+
+    rc = native_flash_configure(NFFS_TEST_BENCH_FLASH);
+    TEST_ASSERT_FATAL(rc == 0);
+    for (i = 0; i < NFFS_TEST_BENCH_NUM_AREAS; i++) {
+        nffs_test_bench_area_descs[i].nad_offset = i * NFFS_TEST_BENCH_AREA_SZ;
+        nffs_test_bench_area_descs[i].nad_length = NFFS_TEST_BENCH_AREA_SZ;
+    }
+
+    rc = cputime_init(1000000);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = nffs_format(nffs_test_bench_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    for (i = 0; i < NFFS_TEST_BENCH_NUM_DIRS; i++) {
+        sprintf(filename, "/dir%02d", i);
+        rc = fs_mkdir(filename);
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+    for (i = 0; i < num_files; i++) {
+        sprintf(filename, "/dir%02d/file%05d", i % NFFS_TEST_BENCH_NUM_DIRS,
+                i);
+        sprintf(contents, "%08d", i);
+        nffs_test_util_create_file(filename, contents, 8);
+    }
+
+    nffs_test_bench_detect(out_scan, &num_entries_scan);
+
+    rc = nffs_checkpoint();
+    TEST_ASSERT_FATAL(rc == 0);
+
+    restore_count = nffs_ckpt_restore_count;
+    nffs_test_bench_detect(out_ckpt, &num_entries_ckpt);
+    TEST_ASSERT(nffs_ckpt_restore_count == restore_count + 1);
+
+    /* Root, lost+found, the directories, and an inode and a block per
+     * file.
+     */
+    TEST_ASSERT(num_entries_scan ==
+                2 + NFFS_TEST_BENCH_NUM_DIRS + 2 * num_files);
+    TEST_ASSERT(num_entries_ckpt == num_entries_scan);
+    nffs_test_util_assert_contents("/dir00/file00000", "00000000", 8);
+    sprintf(filename, "/dir%02d/file%05d",
+            (num_files - 1) % NFFS_TEST_BENCH_NUM_DIRS, num_files - 1);
+    sprintf(contents, "%08d", num_files - 1);
+    nffs_test_util_assert_contents(filename, contents, 8);
+
+    rc = native_flash_configure(NULL);
+    TEST_ASSERT(rc == 0);
+}
+
+TEST_CASE(nffs_test_ckpt_mount_1k)
+{
+    struct nffs_test_bench_result scan;
+    struct nffs_test_bench_result ckpt;
+
+    nffs_test_bench_mount(1000, &scan, &ckpt);
+
+    TEST_PASS("1000 files: scan %lu usec, %lu bytes read; "
+              "checkpoint %lu usec, %lu bytes read",
+              (unsigned long)scan.ntbr_usecs,
+              (unsigned long)scan.ntbr_read_bytes,
+              (unsigned long)ckpt.ntbr_usecs,
+              (unsigned long)ckpt.ntbr_read_bytes);
+}
+
+TEST_CASE(nffs_test_ckpt_mount_10k)
+{
+    struct nffs_test_bench_result scan;
+    struct nffs_test_bench_result ckpt;
+
+    nffs_test_bench_mount(10000, &scan, &ckpt);
+
+    TEST_PASS("10000 files: scan %lu usec, %lu bytes read; "
+              "checkpoint %lu usec, %lu bytes read",
+              (unsigned long)scan.ntbr_usecs,
+              (unsigned long)scan.ntbr_read_bytes,
+              (unsigned long)ckpt.ntbr_usecs,
+              (unsigned long)ckpt.ntbr_read_bytes);
+}
+
 TEST_SUITE(nffs_suite_cache)
 {
     int rc;
@@ -2577,6 +3040,21 @@ TEST_SUITE(nffs_suite_cache)
     nffs_test_cache_large_file();
 }
 
+TEST_SUITE(nffs_suite_ckpt)
+{
+    int rc;
+
+    memset(&nffs_config, 0, sizeof nffs_config);
+    nffs_config.nc_num_inodes = 1024 * 12;
+    nffs_config.nc_num_blocks = 1024 * 12;
+
+    rc = nffs_init();
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_ckpt_mount_1k();
+    nffs_test_ckpt_mount_10k();
+}
+
 static void
 nffs_test_gen(void)
 {
@@ -2610,6 +3088,9 @@ nffs_test_gen(void)
     nffs_test_readdir();
     nffs_test_split_file();
     nffs_test_gc_on_oom();
+    nffs_test_checkpoint();
+    nffs_test_ckpt_power_cut();
+    nffs_test_hash();
 }
 
 TEST_SUITE(gen_1_1)
@@ -2643,6 +3124,7 @@ nffs_test_all(void)
     gen_4_32();
     gen_32_1024();
     nffs_suite_cache();
+    nffs_suite_ckpt();
 
     return tu_any_failed;
 }
@@ -86,6 +86,55 @@ int flash_area_erase(const struct flash_area *, uint32_t off, uint32_t len);
  */
 uint8_t flash_area_align(const struct flash_area *);
 
+#if defined(FLASH_MAP_WC) && !defined(FLASH_MAP_CACHE)
+#error "FLASH_MAP_WC needs FLASH_MAP_CACHE"
+#endif
+
+#ifdef FLASH_MAP_CACHE
+#include <stats/stats.h>
+
+/*
+ * With FLASH_MAP_CACHE, reads go through a small LRU cache. Writes go
+ * straight to flash, dropping the cache lines they cover.
+ *
+ * FLASH_MAP_WC adds write combining: small sequential writes are combined
+ * into one program operation per FLASH_MAP_WC_SIZE sized page. Direct
+ * hal_flash calls see the same data; buffered writes are programmed before
+ * anything reads, writes or erases the range. Until then a successful
+ * flash_area_write() has only reached RAM, so callers have to
+ * flash_area_flush() where the data has to survive a reset, and a write
+ * error can show up from a later call.
+ */
+#ifndef FLASH_MAP_CACHE_LINE_SIZE
+#define FLASH_MAP_CACHE_LINE_SIZE       64      /* Power of two */
+#endif
+#ifndef FLASH_MAP_CACHE_LINES
+#define FLASH_MAP_CACHE_LINES           8
+#endif
+#ifdef FLASH_MAP_WC
+#ifndef FLASH_MAP_WC_SIZE
+#define FLASH_MAP_WC_SIZE               256     /* Power of two */
+#endif
+#endif
+
+STATS_SECT_START(flash_map_stats)
+    STATS_SECT_ENTRY(read_hits)
+    STATS_SECT_ENTRY(read_misses)
+    STATS_SECT_ENTRY(read_bypass)
+    STATS_SECT_ENTRY(invals)
+#ifdef FLASH_MAP_WC
+    STATS_SECT_ENTRY(wc_writes)
+    STATS_SECT_ENTRY(wc_flushes)
+#endif
+STATS_SECT_END
+extern STATS_SECT_DECL(flash_map_stats) flash_map_stats;
+
+/*
+ * Program buffered writes now. Does nothing without FLASH_MAP_WC.
+ */
+int flash_area_flush(void);
+#endif
+
 /*
  * Given flash map index, return info about sectors within the area.
  */
@@ -0,0 +1,80 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef H_HAL_FLASH_ASYNC_
+#define H_HAL_FLASH_ASYNC_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include "os/os.h"
+
+/*
+ * Queued flash operations.  A request, set up with hal_flash_req_init(), is
+ * handed to hal_flash_submit() and carried out by the flash task, in the
+ * order requests were submitted.  The submitter carries on, and learns the
+ * outcome from the request's event, which is put to its event queue once
+ * the operation is done.
+ *
+ * A request that continues the one queued before it is merged with it and
+ * carried out as one operation: a read or program of the next addresses
+ * from/to the next bytes of the buffer, or an erase of an overlapping or
+ * adjacent range.
+ */
+
+#define HAL_FLASH_OP_READ       (0)
+#define HAL_FLASH_OP_WRITE      (1)
+#define HAL_FLASH_OP_ERASE      (2)
+
+struct hal_flash_req {
+    /*
+     * Put to hfr_evq when the operation is done, with ev_arg pointing to
+     * the request.  The submitter picks ev_type.
+     */
+    struct os_event hfr_ev;
+    struct os_eventq *hfr_evq;  /* NULL if no event is wanted */
+    uint8_t hfr_op;             /* HAL_FLASH_OP_xxx */
+    uint8_t hfr_flash_id;
+    int hfr_rc;                 /* Result of hal_flash_read() etc. */
+    uint32_t hfr_addr;
+    uint32_t hfr_len;
+    void *hfr_buf;              /* Not used by erase */
+
+    /* Private */
+    uint8_t hfr_busy;           /* Submitted, and not done yet */
+    uint8_t hfr_merged;         /* Carried out with the request before it */
+    /* Range of the operation this request heads, merged requests included */
+    uint32_t hfr_op_addr;
+    uint32_t hfr_op_len;
+    STAILQ_ENTRY(hal_flash_req) hfr_next;
+};
+
+int hal_flash_async_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size);
+void hal_flash_req_init(struct hal_flash_req *req, struct os_eventq *evq,
+                        uint8_t ev_type);
+int hal_flash_submit(struct hal_flash_req *req);
+void hal_flash_async_stats(uint32_t *reqs, uint32_t *ops);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* H_HAL_FLASH_ASYNC_ */
@@ -53,6 +53,14 @@ uint32_t hal_flash_sector_size(const struct hal_flash *hf, int sec_idx);
 /* External function prototype supplied by BSP */
 const struct hal_flash *bsp_flash_dev(uint8_t flash_id);
 
+#ifdef FLASH_MAP_CACHE
+/*
+ * Keeps the flash_map cache coherent; called before the range is read,
+ * or with modify set before it is written or erased.
+ */
+int flash_map_cache_sync(uint8_t id, uint32_t addr, uint32_t len, int modify);
+#endif
+
 
 #ifdef __cplusplus
 }
@@ -24,15 +24,349 @@
 #include <nffs/nffs.h>
 #endif
 #include "hal/flash_map.h"
+#ifdef FLASH_MAP_CACHE
+#include <os/os.h>
+#include <stats/stats.h>
+#endif
 
 static const struct flash_area *flash_map;
 static int flash_map_entries;
 
+#ifdef FLASH_MAP_CACHE
+
+STATS_SECT_DECL(flash_map_stats) flash_map_stats;
+
+STATS_NAME_START(flash_map_stats)
+    STATS_NAME(flash_map_stats, read_hits)
+    STATS_NAME(flash_map_stats, read_misses)
+    STATS_NAME(flash_map_stats, read_bypass)
+    STATS_NAME(flash_map_stats, invals)
+#ifdef FLASH_MAP_WC
+    STATS_NAME(flash_map_stats, wc_writes)
+    STATS_NAME(flash_map_stats, wc_flushes)
+#endif
+STATS_NAME_END(flash_map_stats)
+
+static int flash_map_stats_registered;
+
+/*
+ * Read cache. Lines hold FLASH_MAP_CACHE_LINE_SIZE bytes from a line
+ * aligned address; the least recently used one gets replaced on a miss.
+ */
+struct flash_map_line {
+    uint32_t fml_addr;
+    uint32_t fml_len;           /* 0 if the line is empty */
+    uint32_t fml_used;          /* LRU stamp */
+    uint8_t fml_flash_id;
+    uint8_t fml_data[FLASH_MAP_CACHE_LINE_SIZE];
+};
+
+static struct flash_map_line flash_map_lines[FLASH_MAP_CACHE_LINES];
+static uint32_t flash_map_lru;
+
+#ifdef FLASH_MAP_WC
+/*
+ * Write combining buffer. Collects sequential writes until they reach a
+ * FLASH_MAP_WC_SIZE boundary, and programs them in one go.
+ */
+static struct {
+    uint32_t fwc_addr;
+    uint32_t fwc_len;           /* 0 if the buffer is empty */
+    uint8_t fwc_flash_id;
+    uint8_t fwc_data[FLASH_MAP_WC_SIZE];
+} flash_map_wc;
+#endif
+
+/* Protects the above; recursive, as hal_flash calls back into the cache */
+static struct os_mutex flash_map_mtx;
+
+static void
+flash_map_lock(void)
+{
+    os_mutex_pend(&flash_map_mtx, OS_WAIT_FOREVER);
+}
+
+static void
+flash_map_unlock(void)
+{
+    os_mutex_release(&flash_map_mtx);
+}
+
+static void
+flash_map_cache_reset(void)
+{
+    memset(flash_map_lines, 0, sizeof(flash_map_lines));
+#ifdef FLASH_MAP_WC
+    flash_map_wc.fwc_len = 0;
+#endif
+    flash_map_lru = 0;
+}
+
+#ifdef FLASH_MAP_WC
+/*
+ * Program the contents of the write combining buffer. The buffer is
+ * emptied first, so that the write does not find it again through
+ * flash_map_cache_sync().
+ */
+static int
+flash_map_wc_flush(void)
+{
+    uint32_t len;
+
+    len = flash_map_wc.fwc_len;
+    if (len == 0) {
+        return 0;
+    }
+    flash_map_wc.fwc_len = 0;
+    STATS_INC(flash_map_stats, wc_flushes);
+    return hal_flash_write(flash_map_wc.fwc_flash_id, flash_map_wc.fwc_addr,
+      flash_map_wc.fwc_data, len);
+}
+
+static int
+flash_map_wc_overlaps(uint8_t id, uint32_t addr, uint32_t len)
+{
+    return flash_map_wc.fwc_len && flash_map_wc.fwc_flash_id == id &&
+      addr < flash_map_wc.fwc_addr + flash_map_wc.fwc_len &&
+      addr + len > flash_map_wc.fwc_addr;
+}
+#endif
+
+/*
+ * Called by hal_flash before it touches flash. Buffered writes to the
+ * range are programmed first, and if the range is about to change,
+ * cache lines covering it are dropped.
+ */
+int
+flash_map_cache_sync(uint8_t id, uint32_t addr, uint32_t len, int modify)
+{
+    struct flash_map_line *fml;
+    int rc = 0;
+    int i;
+
+    flash_map_lock();
+#ifdef FLASH_MAP_WC
+    if (flash_map_wc_overlaps(id, addr, len)) {
+        rc = flash_map_wc_flush();
+    }
+#endif
+    if (modify) {
+        for (i = 0; i < FLASH_MAP_CACHE_LINES; i++) {
+            fml = &flash_map_lines[i];
+            if (fml->fml_len && fml->fml_flash_id == id &&
+              addr < fml->fml_addr + fml->fml_len &&
+              addr + len > fml->fml_addr) {
+                fml->fml_len = 0;
+                STATS_INC(flash_map_stats, invals);
+            }
+        }
+    }
+    flash_map_unlock();
+    return rc;
+}
+
+static struct flash_map_line *
+flash_map_line_find(uint8_t id, uint32_t line_addr)
+{
+    struct flash_map_line *fml;
+    int i;
+
+    for (i = 0; i < FLASH_MAP_CACHE_LINES; i++) {
+        fml = &flash_map_lines[i];
+        if (fml->fml_len && fml->fml_flash_id == id &&
+          fml->fml_addr == line_addr) {
+            return fml;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Read a line into the cache, replacing an empty or the least recently
+ * used line. The line is cut short at the end of flash.
+ */
+static struct flash_map_line *
+flash_map_line_fill(uint8_t id, uint32_t line_addr)
+{
+    const struct hal_flash *hf;
+    struct flash_map_line *fml;
+    struct flash_map_line *victim;
+    uint32_t len;
+    int i;
+
+    hf = bsp_flash_dev(id);
+    if (!hf || line_addr < hf->hf_base_addr) {
+        return NULL;
+    }
+    len = hf->hf_base_addr + hf->hf_size - line_addr;
+    if (len > FLASH_MAP_CACHE_LINE_SIZE) {
+        len = FLASH_MAP_CACHE_LINE_SIZE;
+    }
+
+    victim = &flash_map_lines[0];
+    for (i = 0; i < FLASH_MAP_CACHE_LINES; i++) {
+        fml = &flash_map_lines[i];
+        if (!fml->fml_len) {
+            victim = fml;
+            break;
+        }
+        if ((int32_t)(fml->fml_used - victim->fml_used) < 0) {
+            victim = fml;
+        }
+    }
+    victim->fml_len = 0;
+    if (hal_flash_read(id, line_addr, victim->fml_data, len)) {
+        return NULL;
+    }
+    victim->fml_flash_id = id;
+    victim->fml_addr = line_addr;
+    victim->fml_len = len;
+    return victim;
+}
+
+static int
+flash_map_cache_read(uint8_t id, uint32_t addr, uint8_t *dst, uint32_t len)
+{
+    struct flash_map_line *fml;
+    uint32_t line_addr;
+    uint32_t off;
+    uint32_t cnt;
+    int rc = 0;
+
+    flash_map_lock();
+#ifdef FLASH_MAP_WC
+    if (flash_map_wc_overlaps(id, addr, len)) {
+        rc = flash_map_wc_flush();
+    }
+#endif
+    while (rc == 0 && len > 0) {
+        line_addr = addr & ~(FLASH_MAP_CACHE_LINE_SIZE - 1);
+        off = addr - line_addr;
+        cnt = FLASH_MAP_CACHE_LINE_SIZE - off;
+        if (cnt > len) {
+            cnt = len;
+        }
+
+        fml = flash_map_line_find(id, line_addr);
+        if (fml && off + cnt <= fml->fml_len) {
+            STATS_INC(flash_map_stats, read_hits);
+        } else if (off == 0 && cnt == FLASH_MAP_CACHE_LINE_SIZE) {
+            /*
+             * Whole lines are copied straight to the caller; a large
+             * sequential read does not wipe out the cache.
+             */
+            cnt = len & ~(FLASH_MAP_CACHE_LINE_SIZE - 1);
+            STATS_INC(flash_map_stats, read_bypass);
+            rc = hal_flash_read(id, addr, dst, cnt);
+            fml = NULL;
+        } else {
+            STATS_INC(flash_map_stats, read_misses);
+            fml = flash_map_line_fill(id, line_addr);
+            if (!fml || off + cnt > fml->fml_len) {
+                rc = hal_flash_read(id, addr, dst, cnt);
+                fml = NULL;
+            }
+        }
+        if (fml) {
+            fml->fml_used = ++flash_map_lru;
+            memcpy(dst, fml->fml_data + off, cnt);
+        }
+        addr += cnt;
+        dst += cnt;
+        len -= cnt;
+    }
+    flash_map_unlock();
+    return rc;
+}
+
+#ifdef FLASH_MAP_WC
+static int
+flash_map_cache_write(uint8_t id, uint32_t addr, const uint8_t *src,
+  uint32_t len)
+{
+    uint32_t cnt;
+    int rc = 0;
+
+    flash_map_lock();
+    if (flash_map_wc.fwc_len && (flash_map_wc.fwc_flash_id != id ||
+        flash_map_wc.fwc_addr + flash_map_wc.fwc_len != addr)) {
+        rc = flash_map_wc_flush();
+    }
+    if (rc) {
+        goto out;
+    }
+
+    /*
+     * Large writes, and ones the flash could not take as a part of
+     * a bigger write, go straight through.
+     */
+    if (len >= FLASH_MAP_WC_SIZE || addr % hal_flash_align(id)) {
+        rc = flash_map_wc_flush();
+        if (rc == 0) {
+            rc = hal_flash_write(id, addr, src, len);
+        }
+        goto out;
+    }
+
+    STATS_INC(flash_map_stats, wc_writes);
+    while (len > 0) {
+        if (flash_map_wc.fwc_len == 0) {
+            flash_map_wc.fwc_flash_id = id;
+            flash_map_wc.fwc_addr = addr;
+        }
+        cnt = FLASH_MAP_WC_SIZE - (addr % FLASH_MAP_WC_SIZE);
+        if (cnt > len) {
+            cnt = len;
+        }
+        memcpy(flash_map_wc.fwc_data + flash_map_wc.fwc_len, src, cnt);
+        flash_map_wc.fwc_len += cnt;
+        addr += cnt;
+        src += cnt;
+        len -= cnt;
+        if (addr % FLASH_MAP_WC_SIZE == 0) {
+            rc = flash_map_wc_flush();
+            if (rc) {
+                break;
+            }
+        }
+    }
+out:
+    flash_map_unlock();
+    return rc;
+}
+
+#endif /* FLASH_MAP_WC */
+
+int
+flash_area_flush(void)
+{
+    int rc = 0;
+
+#ifdef FLASH_MAP_WC
+    flash_map_lock();
+    rc = flash_map_wc_flush();
+    flash_map_unlock();
+#endif
+    return rc;
+}
+
+#endif /* FLASH_MAP_CACHE */
+
 void
 flash_area_init(const struct flash_area *map, int map_entries)
 {
     flash_map = map;
     flash_map_entries = map_entries;
+#ifdef FLASH_MAP_CACHE
+    os_mutex_init(&flash_map_mtx);
+    flash_map_cache_reset();
+    if (!flash_map_stats_registered) {
+        stats_init_and_reg(STATS_HDR(flash_map_stats),
+          STATS_SIZE_INIT_PARMS(flash_map_stats, STATS_SIZE_32),
+          STATS_NAME_INIT_PARMS(flash_map_stats), "flash_map");
+        flash_map_stats_registered = 1;
+    }
+#endif
     /*
      * XXX should we validate this against current flashes?
      */
@@ -159,7 +493,11 @@ flash_area_read(const struct flash_area *fa, uint32_t off, void *dst,
     if (off > fa->fa_size || off + len > fa->fa_size) {
         return -1;
     }
+#ifdef FLASH_MAP_CACHE
+    return flash_map_cache_read(fa->fa_flash_id, fa->fa_off + off, dst, len);
+#else
     return hal_flash_read(fa->fa_flash_id, fa->fa_off + off, dst, len);
+#endif
 }
 
 int
@@ -169,7 +507,11 @@ flash_area_write(const struct flash_area *fa, uint32_t off, void *src,
     if (off > fa->fa_size || off + len > fa->fa_size) {
         return -1;
     }
+#ifdef FLASH_MAP_WC
+    return flash_map_cache_write(fa->fa_flash_id, fa->fa_off + off, src, len);
+#else
     return hal_flash_write(fa->fa_flash_id, fa->fa_off + off, src, len);
+#endif
 }
 
 int
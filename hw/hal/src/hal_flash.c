@@ -88,6 +88,11 @@ hal_flash_read(uint8_t id, uint32_t address, void *dst, uint32_t num_bytes)
       hal_flash_check_addr(hf, address + num_bytes)) {
         return -1;
     }
+#ifdef FLASH_MAP_CACHE
+    if (flash_map_cache_sync(id, address, num_bytes, 0)) {
+        return -1;
+    }
+#endif
     return hf->hf_itf->hff_read(address, dst, num_bytes);
 }
 
@@ -105,6 +110,11 @@ hal_flash_write(uint8_t id, uint32_t address, const void *src,
       hal_flash_check_addr(hf, address + num_bytes)) {
         return -1;
     }
+#ifdef FLASH_MAP_CACHE
+    if (flash_map_cache_sync(id, address, num_bytes, 1)) {
+        return -1;
+    }
+#endif
     return hf->hf_itf->hff_write(address, src, num_bytes);
 }
 
@@ -112,6 +122,10 @@ int
 hal_flash_erase_sector(uint8_t id, uint32_t sector_address)
 {
     const struct hal_flash *hf;
+#ifdef FLASH_MAP_CACHE
+    uint32_t start, size;
+    int i;
+#endif
 
     hf = bsp_flash_dev(id);
     if (!hf) {
@@ -120,6 +134,17 @@ hal_flash_erase_sector(uint8_t id, uint32_t sector_address)
     if (hal_flash_check_addr(hf, sector_address)) {
         return -1;
     }
+#ifdef FLASH_MAP_CACHE
+    for (i = 0; i < hf->hf_sector_cnt; i++) {
+        if (hf->hf_itf->hff_sector_info(i, &start, &size) == 0 &&
+          start == sector_address) {
+            if (flash_map_cache_sync(id, start, size, 1)) {
+                return -1;
+            }
+            break;
+        }
+    }
+#endif
     return hf->hf_itf->hff_erase_sector(sector_address);
 }
 
@@ -159,6 +184,11 @@ hal_flash_erase(uint8_t id, uint32_t address, uint32_t num_bytes)
              * If some region of eraseable area falls inside sector,
              * erase the sector.
              */
+#ifdef FLASH_MAP_CACHE
+            if (flash_map_cache_sync(id, start, size, 1)) {
+                return -1;
+            }
+#endif
             if (hf->hf_itf->hff_erase_sector(start)) {
                 return -1;
             }
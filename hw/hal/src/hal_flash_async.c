@@ -0,0 +1,265 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <bsp/bsp.h>
+
+#include "os/os.h"
+#include "hal/hal_flash.h"
+#include "hal/hal_flash_int.h"
+#include "hal/hal_flash_async.h"
+
+static struct os_task hal_flash_async_task;
+static struct os_sem hal_flash_async_sem;
+static int hal_flash_async_started;
+
+/* Requests not started yet, in submission order */
+static STAILQ_HEAD(, hal_flash_req) hal_flash_async_q =
+    STAILQ_HEAD_INITIALIZER(hal_flash_async_q);
+
+/* The last request in the queue that heads an operation, or NULL */
+static struct hal_flash_req *hal_flash_async_last;
+
+static uint32_t hal_flash_async_reqs;
+static uint32_t hal_flash_async_ops;
+
+/*
+ * Returns 1 if 'req' continues the operation headed by 'head', so that the
+ * two can be carried out as one.
+ */
+static int
+hal_flash_async_can_merge(struct hal_flash_req *head, struct hal_flash_req *req)
+{
+    if (head->hfr_op != req->hfr_op ||
+        head->hfr_flash_id != req->hfr_flash_id) {
+        return 0;
+    }
+
+    switch (req->hfr_op) {
+    case HAL_FLASH_OP_READ:
+    case HAL_FLASH_OP_WRITE:
+        return (req->hfr_addr == head->hfr_op_addr + head->hfr_op_len &&
+                req->hfr_buf == (uint8_t *)head->hfr_buf + head->hfr_op_len);
+
+    case HAL_FLASH_OP_ERASE:
+        return (req->hfr_addr <= head->hfr_op_addr + head->hfr_op_len &&
+                req->hfr_addr + req->hfr_len >= head->hfr_op_addr);
+
+    default:
+        return 0;
+    }
+}
+
+static void
+hal_flash_async_merge(struct hal_flash_req *head, struct hal_flash_req *req)
+{
+    uint32_t end;
+
+    end = head->hfr_op_addr + head->hfr_op_len;
+    if (req->hfr_addr + req->hfr_len > end) {
+        end = req->hfr_addr + req->hfr_len;
+    }
+    if (req->hfr_addr < head->hfr_op_addr) {
+        head->hfr_op_addr = req->hfr_addr;
+    }
+    head->hfr_op_len = end - head->hfr_op_addr;
+    req->hfr_merged = 1;
+}
+
+static int
+hal_flash_async_exec(struct hal_flash_req *head)
+{
+    switch (head->hfr_op) {
+    case HAL_FLASH_OP_READ:
+        return hal_flash_read(head->hfr_flash_id, head->hfr_op_addr,
+                              head->hfr_buf, head->hfr_op_len);
+    case HAL_FLASH_OP_WRITE:
+        return hal_flash_write(head->hfr_flash_id, head->hfr_op_addr,
+                               head->hfr_buf, head->hfr_op_len);
+    case HAL_FLASH_OP_ERASE:
+        return hal_flash_erase(head->hfr_flash_id, head->hfr_op_addr,
+                               head->hfr_op_len);
+    default:
+        assert(0);
+        return -1;
+    }
+}
+
+static void
+hal_flash_async_done(struct hal_flash_req *req, int rc)
+{
+    req->hfr_rc = rc;
+    req->hfr_busy = 0;
+    if (req->hfr_evq) {
+        req->hfr_ev.ev_arg = req;
+        os_eventq_put(req->hfr_evq, &req->hfr_ev);
+    }
+}
+
+static void
+hal_flash_async_task_handler(void *arg)
+{
+    struct hal_flash_req *head;
+    struct hal_flash_req *req;
+    struct hal_flash_req *next;
+    os_sr_t sr;
+    int rc;
+
+    while (1) {
+        os_sem_pend(&hal_flash_async_sem, OS_TIMEOUT_NEVER);
+
+        /*
+         * Take the operation off the queue, so that nothing more is merged
+         * into it while it runs.  The requests merged into it follow it.
+         */
+        OS_ENTER_CRITICAL(sr);
+        head = STAILQ_FIRST(&hal_flash_async_q);
+        assert(head != NULL && !head->hfr_merged);
+        STAILQ_REMOVE_HEAD(&hal_flash_async_q, hfr_next);
+        next = STAILQ_FIRST(&hal_flash_async_q);
+        while (next != NULL && next->hfr_merged) {
+            STAILQ_REMOVE_HEAD(&hal_flash_async_q, hfr_next);
+            next = STAILQ_FIRST(&hal_flash_async_q);
+        }
+        if (hal_flash_async_last == head) {
+            hal_flash_async_last = NULL;
+        }
+        OS_EXIT_CRITICAL(sr);
+
+        rc = hal_flash_async_exec(head);
+        hal_flash_async_ops++;
+
+        /* The merged requests are still linked behind the head. */
+        req = head;
+        do {
+            next = STAILQ_NEXT(req, hfr_next);
+            hal_flash_async_done(req, rc);
+            req = next;
+        } while (req != NULL && req->hfr_merged);
+    }
+}
+
+/**
+ * Starts the flash task, which carries out the requests handed to
+ * hal_flash_submit().
+ *
+ * @param prio          Priority of the flash task
+ * @param stack         Stack of the flash task
+ * @param stack_size    Size of the stack, in os_stack_t units
+ *
+ * @return 0 on success, non-zero on failure.
+ */
+int
+hal_flash_async_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size)
+{
+    int rc;
+
+    os_sem_init(&hal_flash_async_sem, 0);
+    STAILQ_INIT(&hal_flash_async_q);
+    hal_flash_async_last = NULL;
+
+    rc = os_task_init(&hal_flash_async_task, "flash",
+                      hal_flash_async_task_handler, NULL, prio,
+                      OS_WAIT_FOREVER, stack, stack_size);
+    if (rc != 0) {
+        return rc;
+    }
+    hal_flash_async_started = 1;
+
+    return 0;
+}
+
+/**
+ * Sets up a flash request.  The caller fills in the operation before each
+ * hal_flash_submit().
+ *
+ * @param req           The request
+ * @param evq           Where the request's event is put when it is done;
+ *                      NULL if no event is wanted
+ * @param ev_type       Type of the event
+ */
+void
+hal_flash_req_init(struct hal_flash_req *req, struct os_eventq *evq,
+                   uint8_t ev_type)
+{
+    memset(req, 0, sizeof(*req));
+    req->hfr_ev.ev_type = ev_type;
+    req->hfr_evq = evq;
+}
+
+/**
+ * Queues a flash read, program or erase.  The request belongs to the flash
+ * task until its event has been put; it must not be changed or submitted
+ * again before that.  Requests submitted from one task are carried out in
+ * the order they were submitted, but not in order with the synchronous
+ * hal_flash calls.
+ *
+ * @param req           The operation.  hfr_rc holds its result once done.
+ *
+ * @return 0 if the request was queued, -1 if it is not valid or the flash
+ *         task has not been started.
+ */
+int
+hal_flash_submit(struct hal_flash_req *req)
+{
+    os_sr_t sr;
+
+    if (!hal_flash_async_started || bsp_flash_dev(req->hfr_flash_id) == NULL ||
+        req->hfr_op > HAL_FLASH_OP_ERASE || req->hfr_len == 0 ||
+        (req->hfr_op != HAL_FLASH_OP_ERASE && req->hfr_buf == NULL) ||
+        req->hfr_busy || OS_EVENT_QUEUED(&req->hfr_ev)) {
+        return -1;
+    }
+
+    req->hfr_busy = 1;
+    req->hfr_merged = 0;
+    req->hfr_rc = 0;
+
+    OS_ENTER_CRITICAL(sr);
+    hal_flash_async_reqs++;
+    if (hal_flash_async_last != NULL &&
+        hal_flash_async_can_merge(hal_flash_async_last, req)) {
+        hal_flash_async_merge(hal_flash_async_last, req);
+        STAILQ_INSERT_TAIL(&hal_flash_async_q, req, hfr_next);
+        OS_EXIT_CRITICAL(sr);
+        return 0;
+    }
+
+    req->hfr_op_addr = req->hfr_addr;
+    req->hfr_op_len = req->hfr_len;
+    STAILQ_INSERT_TAIL(&hal_flash_async_q, req, hfr_next);
+    hal_flash_async_last = req;
+    OS_EXIT_CRITICAL(sr);
+
+    os_sem_release(&hal_flash_async_sem);
+
+    return 0;
+}
+
+/**
+ * Reports how many requests have been submitted, and how many operations
+ * they were carried out as.
+ */
+void
+hal_flash_async_stats(uint32_t *reqs, uint32_t *ops)
+{
+    *reqs = hal_flash_async_reqs;
+    *ops = hal_flash_async_ops;
+}
@@ -0,0 +1,189 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <os/os.h>
+#include <testutil/testutil.h>
+#include "hal/hal_flash.h"
+#include "hal/hal_flash_int.h"
+#include "mcu/mcu_sim.h"
+#include "hal_test_priv.h"
+
+/**
+ * The layout and alignment come from the configuration; a bad one changes
+ * nothing.
+ */
+TEST_CASE(native_flash_test_config)
+{
+    const struct hal_flash *hf;
+    char path[] = "/tmp/native_flash_testXXXXXX";
+    uint32_t addr;
+    uint32_t size;
+    FILE *fp;
+    int fd;
+    int rc;
+
+    hf = bsp_flash_dev(0);
+
+    rc = native_flash_configure("2x4k, 1x8k align=4 # small part");
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(hf->hf_sector_cnt == 3);
+    TEST_ASSERT(hf->hf_size == 16 * 1024);
+    TEST_ASSERT(hal_flash_align(0) == 4);
+    rc = hf->hf_itf->hff_sector_info(2, &addr, &size);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(addr == 8 * 1024 && size == 8 * 1024);
+
+    TEST_ASSERT(native_flash_configure("3x") == -1);
+    TEST_ASSERT(native_flash_configure("1x4k speed=1") == -1);
+    TEST_ASSERT(native_flash_configure("align=3") == -1);
+    TEST_ASSERT(hf->hf_sector_cnt == 3);
+    TEST_ASSERT(hal_flash_align(0) == 4);
+
+    /* From a file */
+    fd = mkstemp(path);
+    TEST_ASSERT_FATAL(fd >= 0);
+    fp = fdopen(fd, "w");
+    fprintf(fp, "# external NOR\n256x4k\nalign=1\nerase_us=45000\n");
+    fclose(fp);
+    rc = native_flash_configure(path);
+    unlink(path);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(hf->hf_sector_cnt == 256);
+    TEST_ASSERT(hf->hf_size == 1024 * 1024);
+    TEST_ASSERT(native_flash_timing.nft_erase_us == 45000);
+
+    rc = native_flash_configure(NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(hf->hf_sector_cnt == 12);
+    TEST_ASSERT(hf->hf_size == 1024 * 1024);
+    TEST_ASSERT(native_flash_timing.nft_erase_us == 0);
+}
+
+/**
+ * Programming only clears bits, and erases and operations are counted.
+ */
+TEST_CASE(native_flash_test_model)
+{
+    char dump[1024];
+    uint8_t buf[4];
+    size_t len;
+    FILE *fp;
+    int rc;
+
+    rc = native_flash_configure("2x4k 1x8k prog_op_us=5 prog_ns=1000");
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = hal_flash_erase_sector(0, 0x1000);
+    TEST_ASSERT(rc == 0);
+    rc = hal_flash_erase(0, 0x1000, 1);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(native_flash_erase_count(0) == 0);
+    TEST_ASSERT(native_flash_erase_count(1) == 2);
+
+    memset(buf, 0xf0, sizeof(buf));
+    rc = hal_flash_write(0, 0x1000, buf, sizeof(buf));
+    TEST_ASSERT(rc == 0);
+
+    /* Setting bits takes an erase. */
+    memset(buf, 0x0f, sizeof(buf));
+    rc = hal_flash_write(0, 0x1000, buf, sizeof(buf));
+    TEST_ASSERT(rc == -1);
+
+    memset(buf, 0x30, sizeof(buf));
+    rc = hal_flash_write(0, 0x1000, buf, sizeof(buf));
+    TEST_ASSERT(rc == 0);
+    rc = hal_flash_read(0, 0x1000, buf, sizeof(buf));
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(buf[0] == 0x30 && buf[3] == 0x30);
+
+    TEST_ASSERT(native_flash_stats.nfs_erases == 2);
+    TEST_ASSERT(native_flash_stats.nfs_progs == 2);
+    TEST_ASSERT(native_flash_stats.nfs_prog_errs == 1);
+    TEST_ASSERT(native_flash_stats.nfs_prog_bytes == 8);
+    TEST_ASSERT(native_flash_stats.nfs_reads == 1);
+    TEST_ASSERT(native_flash_stats.nfs_busy_ns == 2 * (5000 + 4 * 1000));
+
+    fp = tmpfile();
+    TEST_ASSERT_FATAL(fp != NULL);
+    native_flash_stats_dump(fp);
+    rewind(fp);
+    len = fread(dump, 1, sizeof(dump) - 1, fp);
+    fclose(fp);
+    dump[len] = '\0';
+    TEST_ASSERT(strstr(dump, "programs 2 (8 bytes), 1 refused") != NULL);
+    TEST_ASSERT(strstr(dump, "0x00001000    4096 bytes      2 erases") != NULL);
+
+    native_flash_configure(NULL);
+}
+
+/**
+ * A power cut leaves the operation it hits half done, and the flash dead
+ * until power is back.
+ */
+TEST_CASE(native_flash_test_power_cut)
+{
+    uint8_t buf[4];
+    int rc;
+
+    rc = native_flash_configure("2x4k 1x8k");
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = hal_flash_erase_sector(0, 0);
+    TEST_ASSERT(rc == 0);
+
+    /* One write completes, the second is cut. */
+    native_flash_power_cut(1);
+    memset(buf, 0, sizeof(buf));
+    rc = hal_flash_write(0, 0, buf, sizeof(buf));
+    TEST_ASSERT(rc == 0);
+    rc = hal_flash_write(0, 4, buf, sizeof(buf));
+    TEST_ASSERT(rc == -1);
+    rc = hal_flash_read(0, 4, buf, sizeof(buf));
+    TEST_ASSERT(rc == -1);
+    rc = hal_flash_erase_sector(0, 0);
+    TEST_ASSERT(rc == -1);
+
+    native_flash_power_cut(-1);
+    rc = hal_flash_read(0, 4, buf, sizeof(buf));
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(buf[0] == 0 && buf[1] == 0 && buf[2] == 0xff && buf[3] == 0xff);
+
+    /* An erase cut short leaves the end of the sector as it was. */
+    rc = hal_flash_write(0, 3 * 1024, buf, 1);
+    TEST_ASSERT(rc == 0);
+    native_flash_power_cut(0);
+    rc = hal_flash_erase_sector(0, 0);
+    TEST_ASSERT(rc == -1);
+    native_flash_power_cut(-1);
+    rc = hal_flash_read(0, 0, buf, sizeof(buf));
+    TEST_ASSERT(rc == 0 && buf[0] == 0xff);
+    rc = hal_flash_read(0, 3 * 1024, buf, 1);
+    TEST_ASSERT(rc == 0 && buf[0] == 0);
+
+    native_flash_configure(NULL);
+}
+
+TEST_SUITE(native_flash_test_suite)
+{
+    native_flash_test_config();
+    native_flash_test_model();
+    native_flash_test_power_cut();
+}
@@ -25,6 +25,7 @@
 
 #include "hal/hal_flash.h"
 #include "hal/hal_flash_int.h"
+#include "hal_test_priv.h"
 
 /*
  * Test flash_area_to_sectors()
@@ -147,23 +148,130 @@ TEST_CASE(flash_map_test_case_2)
     }
 }
 
-TEST_SUITE(flash_map_test_suite)
+#ifdef FLASH_MAP_CACHE
+#ifdef FLASH_MAP_WC
+#define FLASH_MAP_TEST_PAGE     FLASH_MAP_WC_SIZE
+#else
+#define FLASH_MAP_TEST_PAGE     256
+#endif
+
+/*
+ * Test the read cache, and write combining if it is on
+ */
+TEST_CASE(flash_map_test_case_cache)
 {
-    flash_map_test_case_1();
-    flash_map_test_case_2();
-}
+    const struct flash_area *fa;
+    STATS_SECT_DECL(flash_map_stats) st;
+    uint8_t wd[FLASH_MAP_TEST_PAGE];
+    uint8_t rd[FLASH_MAP_TEST_PAGE];
+    uint32_t off;
+    int i;
+    int rc;
 
-#ifdef MYNEWT_SELFTEST
+    os_init();
 
-int
-main(int argc, char **argv)
-{
-    tu_config.tc_print_results = 1;
-    tu_init();
+    rc = flash_area_open(FLASH_AREA_IMAGE_0, &fa);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_open() fail");
+    rc = flash_area_erase(fa, 0, FLASH_MAP_TEST_PAGE * 2);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_erase() fail");
+
+    for (i = 0; i < sizeof(wd); i++) {
+        wd[i] = i;
+    }
 
-    flash_map_test_suite();
+    /* Small sequential writes get programmed once a page is full */
+    st = flash_map_stats;
+    for (off = 0; off < FLASH_MAP_TEST_PAGE; off += 16) {
+        rc = flash_area_write(fa, off, wd + off, 16);
+        TEST_ASSERT_FATAL(rc == 0, "flash_area_write() fail");
+    }
+#ifdef FLASH_MAP_WC
+    TEST_ASSERT(flash_map_stats.swc_writes - st.swc_writes ==
+      FLASH_MAP_TEST_PAGE / 16);
+    TEST_ASSERT(flash_map_stats.swc_flushes - st.swc_flushes == 1);
+#endif
+    rc = hal_flash_read(fa->fa_flash_id, fa->fa_off, rd, sizeof(rd));
+    TEST_ASSERT_FATAL(rc == 0, "hal_flash_read() fail");
+    TEST_ASSERT(memcmp(wd, rd, sizeof(rd)) == 0, "read data != write data");
+
+    /* A partial page is programmed before hal_flash reads it */
+    rc = flash_area_write(fa, FLASH_MAP_TEST_PAGE, wd, 8);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_write() fail");
+    rc = hal_flash_read(fa->fa_flash_id, fa->fa_off + FLASH_MAP_TEST_PAGE,
+      rd, 8);
+    TEST_ASSERT_FATAL(rc == 0, "hal_flash_read() fail");
+    TEST_ASSERT(memcmp(wd, rd, 8) == 0, "buffered write not flushed");
+
+    /* Second read of the same line is a hit */
+    st = flash_map_stats;
+    rc = flash_area_read(fa, 4, rd, 16);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_read() fail");
+    rc = flash_area_read(fa, 4, rd, 16);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_read() fail");
+    TEST_ASSERT(memcmp(wd + 4, rd, 16) == 0, "read data != write data");
+    TEST_ASSERT(flash_map_stats.sread_misses - st.sread_misses == 1);
+    TEST_ASSERT(flash_map_stats.sread_hits - st.sread_hits == 1);
+
+    /* Whole lines skip the cache */
+    st = flash_map_stats;
+    rc = flash_area_read(fa, 0, rd, sizeof(rd));
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_read() fail");
+    TEST_ASSERT(memcmp(wd, rd, sizeof(rd)) == 0, "read data != write data");
+    TEST_ASSERT(flash_map_stats.sread_bypass - st.sread_bypass >= 1);
+    TEST_ASSERT(flash_map_stats.sread_misses == st.sread_misses);
+
+    /* Writing behind the cache's back drops the line */
+    rc = flash_area_read(fa, FLASH_MAP_TEST_PAGE + 8, rd, 4);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_read() fail");
+    TEST_ASSERT(rd[0] == 0xff, "area not erased");
+    st = flash_map_stats;
+    rc = hal_flash_write(fa->fa_flash_id, fa->fa_off + FLASH_MAP_TEST_PAGE + 8,
+      wd + 8, 4);
+    TEST_ASSERT_FATAL(rc == 0, "hal_flash_write() fail");
+    TEST_ASSERT(flash_map_stats.sinvals - st.sinvals == 1);
+    rc = flash_area_read(fa, FLASH_MAP_TEST_PAGE + 8, rd, 4);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_read() fail");
+    TEST_ASSERT(memcmp(wd + 8, rd, 4) == 0, "stale cache line");
+
+    /* And so does erasing */
+    rc = flash_area_read(fa, 4, rd, 16);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_read() fail");
+    rc = flash_area_erase(fa, 0, FLASH_MAP_TEST_PAGE);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_erase() fail");
+    rc = flash_area_read(fa, 4, rd, 16);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_read() fail");
+    for (i = 0; i < 16; i++) {
+        TEST_ASSERT_FATAL(rd[i] == 0xff, "area not erased");
+    }
 
-    return tu_any_failed;
+    /* Nothing is left in the buffer after a flush */
+    rc = flash_area_write(fa, 0, wd, 4);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_write() fail");
+    st = flash_map_stats;
+    rc = flash_area_flush();
+    TEST_ASSERT(rc == 0);
+#ifdef FLASH_MAP_WC
+    TEST_ASSERT(flash_map_stats.swc_flushes - st.swc_flushes == 1);
+#endif
+    rc = flash_area_flush();
+    TEST_ASSERT(rc == 0);
+#ifdef FLASH_MAP_WC
+    TEST_ASSERT(flash_map_stats.swc_flushes - st.swc_flushes == 1);
+#else
+    /* Without write combining the write was on flash already */
+    rc = hal_flash_read(fa->fa_flash_id, fa->fa_off, rd, 4);
+    TEST_ASSERT_FATAL(rc == 0, "hal_flash_read() fail");
+    TEST_ASSERT(memcmp(wd, rd, 4) == 0, "write not on flash");
+#endif
 }
+#endif
 
+TEST_SUITE(flash_map_test_suite)
+{
+    flash_map_test_case_1();
+    flash_map_test_case_2();
+#ifdef FLASH_MAP_CACHE
+    flash_map_test_case_cache();
 #endif
+}
+
@@ -0,0 +1,198 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include <string.h>
+
+#include <os/os.h>
+#include <testutil/testutil.h>
+#include "hal/flash_map.h"
+#include "hal/hal_flash.h"
+#include "hal/hal_flash_int.h"
+#include "hal/hal_flash_async.h"
+#ifdef ARCH_sim
+#include "mcu/mcu_sim.h"
+#endif
+#include "hal_test_priv.h"
+
+#ifdef ARCH_sim
+#define FLASH_ASYNC_TEST_STACK_SIZE     1024
+#else
+#define FLASH_ASYNC_TEST_STACK_SIZE     256
+#endif
+
+/* The flash task runs below the test task, so that requests queue up. */
+#define FLASH_ASYNC_TEST_PRIO           (10)
+#define FLASH_ASYNC_TEST_FLASH_PRIO     (11)
+
+#define FLASH_ASYNC_TEST_EV_T           (OS_EVENT_T_PERUSER)
+
+static struct os_task flash_async_test_task;
+static os_stack_t
+flash_async_test_stack[OS_STACK_ALIGN(FLASH_ASYNC_TEST_STACK_SIZE)];
+static os_stack_t
+flash_async_test_flash_stack[OS_STACK_ALIGN(FLASH_ASYNC_TEST_STACK_SIZE)];
+
+static struct os_eventq flash_async_test_evq;
+static struct hal_flash_req flash_async_test_reqs[5];
+static uint8_t flash_async_test_wbuf[512];
+static uint8_t flash_async_test_rbuf[512];
+
+static void
+flash_async_test_req(struct hal_flash_req *req, uint8_t op, uint32_t addr,
+                     void *buf, uint32_t len)
+{
+    hal_flash_req_init(req, &flash_async_test_evq, FLASH_ASYNC_TEST_EV_T);
+    req->hfr_op = op;
+    req->hfr_addr = addr;
+    req->hfr_buf = buf;
+    req->hfr_len = len;
+}
+
+/* Waits for the next request to complete, and checks it is 'req'. */
+static void
+flash_async_test_wait(struct hal_flash_req *req, int rc)
+{
+    struct os_event *ev;
+
+    ev = os_eventq_get(&flash_async_test_evq);
+    TEST_ASSERT_FATAL(ev == &req->hfr_ev);
+    TEST_ASSERT(ev->ev_type == FLASH_ASYNC_TEST_EV_T);
+    TEST_ASSERT(ev->ev_arg == req);
+    TEST_ASSERT(req->hfr_rc == rc);
+}
+
+static void
+flash_async_test_handler(void *arg)
+{
+    const struct flash_area *fa;
+    const struct hal_flash *hf;
+    struct hal_flash_req *reqs;
+    uint32_t reqs_before;
+    uint32_t ops_before;
+    uint32_t nreqs;
+    uint32_t nops;
+    uint32_t addr;
+    os_time_t start;
+    int rc;
+    int i;
+
+    reqs = flash_async_test_reqs;
+    rc = flash_area_open(FLASH_AREA_IMAGE_1, &fa);
+    TEST_ASSERT_FATAL(rc == 0);
+    addr = fa->fa_off;
+
+    for (i = 0; i < sizeof(flash_async_test_wbuf); i++) {
+        flash_async_test_wbuf[i] = i;
+    }
+
+    /* Invalid requests are turned down. */
+    flash_async_test_req(&reqs[0], HAL_FLASH_OP_READ, addr, NULL, 16);
+    TEST_ASSERT(hal_flash_submit(&reqs[0]) == -1);
+    flash_async_test_req(&reqs[0], HAL_FLASH_OP_ERASE, addr, NULL, 0);
+    TEST_ASSERT(hal_flash_submit(&reqs[0]) == -1);
+
+    /*
+     * Two erases of the same sector, two programs of adjacent halves of
+     * the buffer and two reads: three operations.
+     */
+    hal_flash_async_stats(&reqs_before, &ops_before);
+    flash_async_test_req(&reqs[0], HAL_FLASH_OP_ERASE, addr, NULL, 4096);
+    flash_async_test_req(&reqs[1], HAL_FLASH_OP_ERASE, addr, NULL, 1);
+    flash_async_test_req(&reqs[2], HAL_FLASH_OP_WRITE, addr,
+                         flash_async_test_wbuf, 256);
+    flash_async_test_req(&reqs[3], HAL_FLASH_OP_WRITE, addr + 256,
+                         flash_async_test_wbuf + 256, 256);
+    flash_async_test_req(&reqs[4], HAL_FLASH_OP_READ, addr,
+                         flash_async_test_rbuf, sizeof(flash_async_test_rbuf));
+    for (i = 0; i < 5; i++) {
+        rc = hal_flash_submit(&reqs[i]);
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+
+    /* Not done yet, so it cannot be submitted again. */
+    TEST_ASSERT(hal_flash_submit(&reqs[4]) == -1);
+
+    for (i = 0; i < 5; i++) {
+        flash_async_test_wait(&reqs[i], 0);
+    }
+    TEST_ASSERT(reqs[0].hfr_op_len == 4096);
+    TEST_ASSERT(reqs[2].hfr_op_len == 512);
+    TEST_ASSERT(reqs[3].hfr_merged);
+    TEST_ASSERT(memcmp(flash_async_test_wbuf, flash_async_test_rbuf,
+                       sizeof(flash_async_test_wbuf)) == 0);
+
+    hal_flash_async_stats(&nreqs, &nops);
+    TEST_ASSERT(nreqs - reqs_before == 5);
+    TEST_ASSERT(nops - ops_before == 3);
+
+    /* A failed operation reports its error to every merged request. */
+    hf = bsp_flash_dev(fa->fa_flash_id);
+    addr = hf->hf_base_addr + hf->hf_size;
+    flash_async_test_req(&reqs[0], HAL_FLASH_OP_WRITE, addr - 2,
+                         flash_async_test_wbuf, 2);
+    flash_async_test_req(&reqs[1], HAL_FLASH_OP_WRITE, addr,
+                         flash_async_test_wbuf + 2, 2);
+    TEST_ASSERT_FATAL(hal_flash_submit(&reqs[0]) == 0);
+    TEST_ASSERT_FATAL(hal_flash_submit(&reqs[1]) == 0);
+    flash_async_test_wait(&reqs[0], -1);
+    flash_async_test_wait(&reqs[1], -1);
+    addr = fa->fa_off;
+
+#ifdef ARCH_sim
+    /* A slow erase does not hold up the submitter. */
+    native_flash_timing.nft_erase_us = 20000;
+    flash_async_test_req(&reqs[0], HAL_FLASH_OP_ERASE, addr, NULL, 4096);
+    start = os_time_get();
+    rc = hal_flash_submit(&reqs[0]);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(os_time_get() == start);
+    flash_async_test_wait(&reqs[0], 0);
+    TEST_ASSERT(os_time_get() - start >= 20 * OS_TICKS_PER_SEC / 1000);
+    native_flash_timing.nft_erase_us = 0;
+#else
+    (void)start;
+#endif
+
+    tu_restart();
+}
+
+/**
+ * Requests complete in the order they were submitted, and requests that
+ * continue one another are carried out as one operation.
+ */
+TEST_CASE(hal_flash_async_test_submit)
+{
+    os_init();
+    os_eventq_init(&flash_async_test_evq);
+
+    hal_flash_async_init(FLASH_ASYNC_TEST_FLASH_PRIO,
+                         flash_async_test_flash_stack,
+                         OS_STACK_ALIGN(FLASH_ASYNC_TEST_STACK_SIZE));
+
+    os_task_init(&flash_async_test_task, "flash_async_test",
+                 flash_async_test_handler, NULL, FLASH_ASYNC_TEST_PRIO,
+                 OS_WAIT_FOREVER, flash_async_test_stack,
+                 OS_STACK_ALIGN(FLASH_ASYNC_TEST_STACK_SIZE));
+
+    os_start();
+}
+
+TEST_SUITE(hal_flash_async_test_suite)
+{
+    hal_flash_async_test_submit();
+}
@@ -19,9 +19,42 @@
 #ifndef __MCU_SIM_H__
 #define __MCU_SIM_H__
 
+#include <inttypes.h>
+#include <stdio.h>
+
 #define OS_TICKS_PER_SEC    (1000)
 
+/*
+ * How long native flash operations take.  A task that calls the flash
+ * driver sleeps for that long; all 0, the default, makes them instant.
+ */
+struct native_flash_timing {
+    uint32_t nft_read_ns;       /* Per byte read */
+    uint32_t nft_prog_ns;       /* Per byte programmed */
+    uint32_t nft_prog_op_us;    /* Per program operation */
+    uint32_t nft_erase_us;      /* Per sector erased */
+};
+
+/* Native flash operation counts */
+struct native_flash_stats {
+    uint32_t nfs_reads;
+    uint32_t nfs_progs;
+    uint32_t nfs_prog_errs;     /* Programs refused for setting bits */
+    uint32_t nfs_erases;
+    uint64_t nfs_read_bytes;
+    uint64_t nfs_prog_bytes;
+    uint64_t nfs_busy_ns;       /* Time the operations took, as modelled */
+};
+
 extern char *native_flash_file;
+extern char *native_flash_config;
+extern struct native_flash_timing native_flash_timing;
+extern struct native_flash_stats native_flash_stats;
+
+int native_flash_configure(const char *conf);
+uint32_t native_flash_erase_count(int idx);
+void native_flash_power_cut(int ops);
+void native_flash_stats_dump(FILE *fp);
 extern char *native_uart_log_file;
 
 void mcu_sim_parse_args(int argc, char **argv);
@@ -19,6 +19,6 @@
 #ifndef H_NATIVE_BSP_
 #define H_NATIVE_BSP_
 
-extern const struct hal_flash native_flash_dev;
+extern struct hal_flash native_flash_dev;
 
 #endif /* H_NATIVE_BSP_ */
@@ -18,18 +18,20 @@
  */
 #include <stdint.h>
 #include <assert.h>
+#include <time.h>
 #include "os/os.h"
 #include "hal/hal_cputime.h"
 
+#define NATIVE_CPUTIME_NSECS_PER_SEC    (1000000000U)
+
 /* CPUTIME data */
 struct cputime_data
 {
-    uint32_t ticks_per_usec;    /* number of ticks per usec */
+    uint32_t clock_freq;        /* number of ticks per second */
     uint32_t timer_isrs;        /* Number of timer interrupts */
     uint32_t ocmp_ints;         /* Number of ocmp interrupts */
     uint32_t uif_ints;          /* Number of overflow interrupts */
-    uint32_t last_ostime;
-    uint64_t cputime;           /* 64-bit cputime */
+    uint64_t epoch_nsecs;       /* Host monotonic time at cputime 0 */
 };
 struct cputime_data g_cputime;
 
@@ -37,14 +39,39 @@ struct cputime_data g_cputime;
 TAILQ_HEAD(cputime_qhead, cpu_timer) g_cputimer_q;
 
 /* For native cpu implementation */
-#define NATIVE_CPUTIME_STACK_SIZE   (1024)
+#ifdef OS_EVPOOL
+/* An event task in the default pool rather than a task of its own */
+struct os_evtask g_native_cputime_evtask;
+#else
+#define NATIVE_CPUTIME_STACK_SIZE   OS_STACK_ALIGN(1024)
 os_stack_t g_native_cputime_stack[NATIVE_CPUTIME_STACK_SIZE];
 struct os_task g_native_cputime_task;
 
-struct os_callout_func g_native_cputimer;
 struct os_eventq g_native_cputime_evq;
-static uint32_t g_native_cputime_cputicks_per_ostick;
+#endif
+
+struct os_callout_func g_native_cputimer;
 
+/**
+ * Returns the host's monotonic clock, in nanoseconds. With OS_SIM_VTIME
+ * this is the sim's virtual clock instead.
+ */
+static uint64_t
+native_cputime_host_nsecs(void)
+{
+#ifdef OS_SIM_VTIME
+    /* Skip ahead together with the os time. */
+    return os_arch_sim_vtime_nsecs();
+#else
+    struct timespec ts;
+    int rc;
+
+    rc = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(rc == 0);
+
+    return (uint64_t)ts.tv_sec * NATIVE_CPUTIME_NSECS_PER_SEC + ts.tv_nsec;
+#endif
+}
 
 /**
  * Convert cpu time ticks to os ticks.
@@ -59,7 +86,12 @@ native_cputime_ticks_to_osticks(uint32_t cputicks)
 {
     uint32_t osticks;
 
-    osticks = cputicks / g_native_cputime_cputicks_per_ostick;
+    /*
+     * Round up; cputime follows the host clock, so a timer that fires a
+     * tick early would only be rescheduled.
+     */
+    osticks = ((uint64_t)cputicks * OS_TICKS_PER_SEC +
+               g_cputime.clock_freq - 1) / g_cputime.clock_freq;
     return osticks;
 }
 
@@ -136,6 +168,18 @@ native_cputimer_cb(void *arg)
     cputime_chk_expiration();
 }
 
+#ifdef OS_EVPOOL
+static void
+native_cputime_evtask_handler(struct os_evtask *et, struct os_event *ev)
+{
+    struct os_callout_func *cf;
+
+    assert(ev->ev_type == OS_EVENT_T_TIMER);
+    cf = (struct os_callout_func *)ev;
+    assert(cf->cf_func);
+    cf->cf_func(CF_ARG(cf));
+}
+#else
 void
 native_cputime_task_handler(void *arg)
 {
@@ -156,6 +200,7 @@ native_cputime_task_handler(void *arg)
         }
     }
 }
+#endif
 
 /**
  * cputime init 
@@ -171,8 +216,11 @@ native_cputime_task_handler(void *arg)
 int
 cputime_init(uint32_t clock_freq)
 {
-    /* Clock frequency must be at least 1 MHz */
-    if (clock_freq < 1000000U) {
+    /*
+     * Any rate up to the host clock's resolution works, so that slow
+     * timers such as a 32.768 kHz RTC can be simulated as well.
+     */
+    if (clock_freq == 0 || clock_freq > NATIVE_CPUTIME_NSECS_PER_SEC) {
         return -1;
     }
 
@@ -180,9 +228,22 @@ cputime_init(uint32_t clock_freq)
     TAILQ_INIT(&g_cputimer_q);
 
     /* Set the clock frequency */
-    g_cputime.ticks_per_usec = clock_freq / 1000000U;
-    g_native_cputime_cputicks_per_ostick = clock_freq / OS_TICKS_PER_SEC;
+    g_cputime.clock_freq = clock_freq;
+    g_cputime.epoch_nsecs = native_cputime_host_nsecs();
 
+#ifdef OS_EVPOOL
+    if (os_evtask_init(&g_native_cputime_evtask, &g_os_evpool,
+                       "native_cputimer", native_cputime_evtask_handler,
+                       NULL, 0) != OS_OK) {
+        return -1;
+    }
+
+    /* Initialize the callout function */
+    os_callout_func_init(&g_native_cputimer,
+                         os_evtask_eventq(&g_native_cputime_evtask),
+                         native_cputimer_cb,
+                         NULL);
+#else
     os_task_init(&g_native_cputime_task, 
                  "native_cputimer", 
                  native_cputime_task_handler, 
@@ -200,6 +261,7 @@ cputime_init(uint32_t clock_freq)
                          &g_native_cputime_evq,
                          native_cputimer_cb,
                          NULL);
+#endif
 
     return 0;
 }
@@ -214,8 +276,16 @@ cputime_init(uint32_t clock_freq)
 uint64_t 
 cputime_get64(void)
 {
-    cputime_get32();
-    return g_cputime.cputime;
+    uint64_t nsecs;
+
+    /*
+     * cputime runs off the host's monotonic clock rather than the os tick,
+     * so it has sub-tick resolution like a hardware timer would.
+     */
+    nsecs = native_cputime_host_nsecs() - g_cputime.epoch_nsecs;
+    return (nsecs / NATIVE_CPUTIME_NSECS_PER_SEC) * g_cputime.clock_freq +
+           (nsecs % NATIVE_CPUTIME_NSECS_PER_SEC) * g_cputime.clock_freq /
+           NATIVE_CPUTIME_NSECS_PER_SEC;
 }
 
 /**
@@ -228,22 +298,7 @@ cputime_get64(void)
 uint32_t
 cputime_get32(void)
 {
-    os_sr_t sr;
-    uint32_t ostime;
-    uint32_t delta_osticks;
-
-    OS_ENTER_CRITICAL(sr);
-    ostime = os_time_get();
-    delta_osticks = (uint32_t)(ostime - g_cputime.last_ostime);
-    if (delta_osticks) {
-        g_cputime.last_ostime = ostime;
-        g_cputime.cputime +=
-            (uint64_t)g_native_cputime_cputicks_per_ostick * delta_osticks;
-
-    }
-    OS_EXIT_CRITICAL(sr);
-
-    return (uint32_t)g_cputime.cputime;
+    return (uint32_t)cputime_get64();
 }
 
 /**
@@ -260,7 +315,8 @@ cputime_nsecs_to_ticks(uint32_t nsecs)
 {
     uint32_t ticks;
 
-    ticks = ((nsecs * g_cputime.ticks_per_usec) + 999) / 1000;
+    ticks = ((uint64_t)nsecs * g_cputime.clock_freq +
+             NATIVE_CPUTIME_NSECS_PER_SEC - 1) / NATIVE_CPUTIME_NSECS_PER_SEC;
     return ticks;
 }
 
@@ -278,8 +334,8 @@ cputime_ticks_to_nsecs(uint32_t ticks)
 {
     uint32_t nsecs;
 
-    nsecs = ((ticks * 1000) + (g_cputime.ticks_per_usec - 1)) / 
-            g_cputime.ticks_per_usec;
+    nsecs = ((uint64_t)ticks * NATIVE_CPUTIME_NSECS_PER_SEC +
+             g_cputime.clock_freq - 1) / g_cputime.clock_freq;
 
     return nsecs;
 }
@@ -298,7 +354,7 @@ cputime_usecs_to_ticks(uint32_t usecs)
 {
     uint32_t ticks;
 
-    ticks = (usecs * g_cputime.ticks_per_usec);
+    ticks = ((uint64_t)usecs * g_cputime.clock_freq + 999999) / 1000000;
     return ticks;
 }
 
@@ -316,7 +372,8 @@ cputime_ticks_to_usecs(uint32_t ticks)
 {
     uint32_t us;
 
-    us =  (ticks + (g_cputime.ticks_per_usec - 1)) / g_cputime.ticks_per_usec;
+    us = ((uint64_t)ticks * 1000000 + g_cputime.clock_freq - 1) /
+         g_cputime.clock_freq;
     return us;
 }
 
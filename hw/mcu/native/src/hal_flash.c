@@ -17,18 +17,45 @@
  * under the License.
  */
 
+/*
+ * Flash simulator.  The contents live in a file, mmap'd.  The sector
+ * layout, write alignment and the time operations take can be changed with
+ * native_flash_configure(); see there for the format.  Like NOR flash,
+ * programming can only clear bits, and only an erase sets them again.  The
+ * simulator counts operations, and erases per sector, for
+ * native_flash_stats_dump(), and can lose power in the middle of an
+ * operation, see native_flash_power_cut().
+ */
+
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <ctype.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include "os/os.h"
 #include "hal/hal_flash_int.h"
 #include "mcu/mcu_sim.h"
 
+#define NATIVE_FLASH_MAX_SECTORS    (1024)
+
 char *native_flash_file;
+char *native_flash_config;
+struct native_flash_timing native_flash_timing;
+struct native_flash_stats native_flash_stats;
+/* Operation time not slept off yet, because it was less than a tick */
+static uint64_t native_flash_owed_ns;
+/* Programs and erases to go before the power is cut, or -1 */
+static int native_flash_ops_left = -1;
+static int native_flash_powered_off;
 static int file;
 static void *file_loc;
+static int native_flash_configured;
 
 static int native_flash_init(void);
 static int native_flash_read(uint32_t address, void *dst, uint32_t length);
@@ -45,7 +72,8 @@ static const struct hal_flash_funcs native_flash_funcs = {
     .hff_init = native_flash_init
 };
 
-static const uint32_t native_flash_sectors[] = {
+/* STM32F4 style layout, used unless configured otherwise */
+static const uint32_t native_flash_dflt_sectors[] = {
     0x00000000, /* 16 * 1024 */
     0x00004000, /* 16 * 1024 */
     0x00008000, /* 16 * 1024 */
@@ -60,29 +88,84 @@ static const uint32_t native_flash_sectors[] = {
     0x000e0000, /* 128 * 1024 */
 };
 
-#define FLASH_NUM_AREAS   (int)(sizeof native_flash_sectors /           \
-                                sizeof native_flash_sectors[0])
+#define NATIVE_FLASH_DFLT_SECTORS   (int)(sizeof native_flash_dflt_sectors / \
+                                          sizeof native_flash_dflt_sectors[0])
+#define NATIVE_FLASH_DFLT_SIZE      (1024 * 1024)
+
+/* Start of every sector, and the number of times it was erased */
+static uint32_t native_flash_sectors[NATIVE_FLASH_MAX_SECTORS] = {
+    0x00000000, 0x00004000, 0x00008000, 0x0000c000, 0x00010000, 0x00020000,
+    0x00040000, 0x00060000, 0x00080000, 0x000a0000, 0x000c0000, 0x000e0000,
+};
+static uint32_t native_flash_erases[NATIVE_FLASH_MAX_SECTORS];
 
-const struct hal_flash native_flash_dev = {
+struct hal_flash native_flash_dev = {
     .hf_itf = &native_flash_funcs,
     .hf_base_addr = 0,
-    .hf_size = 1024 * 1024,
-    .hf_sector_cnt = FLASH_NUM_AREAS,
+    .hf_size = NATIVE_FLASH_DFLT_SIZE,
+    .hf_sector_cnt = NATIVE_FLASH_DFLT_SECTORS,
     .hf_align = 1
 };
 
+/*
+ * Makes the calling task sleep for the time an operation takes.  Time is
+ * only slept off in whole os ticks; the rest is carried over to the next
+ * operation.  Before the OS runs operations stay instant.
+ */
+static void
+flash_native_delay(uint64_t ns)
+{
+    const uint64_t tick_ns = 1000000000 / OS_TICKS_PER_SEC;
+    os_time_t ticks;
+
+    native_flash_stats.nfs_busy_ns += ns;
+    native_flash_owed_ns += ns;
+    if (!os_started() || native_flash_owed_ns < tick_ns) {
+        return;
+    }
+    ticks = native_flash_owed_ns / tick_ns;
+    native_flash_owed_ns -= (uint64_t)ticks * tick_ns;
+    os_time_delay(ticks);
+}
+
+/*
+ * Returns 1 if the power goes out during the program or erase about to be
+ * done.
+ */
+static int
+flash_native_power_lost(void)
+{
+    if (native_flash_ops_left < 0) {
+        return 0;
+    }
+    if (native_flash_ops_left-- > 0) {
+        return 0;
+    }
+    native_flash_powered_off = 1;
+    return 1;
+}
+
 static void
 flash_native_erase(uint32_t addr, uint32_t len)
 {
     memset(file_loc + addr, 0xff, len);
 }
 
+static void
+flash_native_file_close(void)
+{
+    if (file > 0) {
+        munmap(file_loc, native_flash_dev.hf_size);
+        close(file);
+        file = 0;
+    }
+}
+
 static void
 flash_native_file_open(char *name)
 {
-    int created = 0;
-    extern char *tmpnam(char *s);
-    extern int ftruncate(int fd, off_t length);
+    struct stat st;
+    off_t old_size;
 
     if (!name) {
         name = tmpnam(NULL);
@@ -91,7 +174,12 @@ flash_native_file_open(char *name)
     if (file < 0) {
         file = open(name, O_RDWR | O_CREAT, 0660);
         assert(file > 0);
-        created = 1;
+    }
+    if (fstat(file, &st) < 0) {
+        assert(0);
+    }
+    old_size = st.st_size;
+    if (old_size < native_flash_dev.hf_size) {
         if (ftruncate(file, native_flash_dev.hf_size) < 0) {
             assert(0);
         }
@@ -99,59 +187,220 @@ flash_native_file_open(char *name)
     file_loc = mmap(0, native_flash_dev.hf_size,
           PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
     assert(file_loc != MAP_FAILED);
-    if (created) {
-        flash_native_erase(0, native_flash_dev.hf_size);
+    if (old_size < native_flash_dev.hf_size) {
+        /* New flash, or it grew; the new part starts out erased. */
+        flash_native_erase(old_size, native_flash_dev.hf_size - old_size);
     }
 }
 
 static void
 flash_native_ensure_file_open(void)
 {
+    int rc;
+
+    if (!native_flash_configured && native_flash_config) {
+        rc = native_flash_configure(native_flash_config);
+        assert(rc == 0);
+    }
     if (file == 0) {
-        flash_native_file_open(NULL);
+        flash_native_file_open(native_flash_file);
     }
 }
 
+/*
+ * Parses "<count>x<size>", where size can have a k or m suffix, and adds
+ * the sectors to the layout being built.
+ */
 static int
-flash_native_write_internal(uint32_t address, const void *src, uint32_t length,
-                            int allow_overwrite)
+flash_native_parse_sectors(const char *tok, uint32_t *addr, int *cnt)
 {
-    static uint8_t buf[256];
-    uint32_t cur;
-    uint32_t end;
-    int chunk_sz;
-    int rc;
+    unsigned long count;
+    unsigned long size;
+    char *end;
+
+    count = strtoul(tok, &end, 0);
+    if (end == tok || (*end != 'x' && *end != '*')) {
+        return -1;
+    }
+    tok = end + 1;
+    size = strtoul(tok, &end, 0);
+    if (end == tok) {
+        return -1;
+    }
+    if (*end == 'k' || *end == 'K') {
+        size *= 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        size *= 1024 * 1024;
+        end++;
+    }
+    if (*end != '\0' || size == 0 ||
+        *cnt + count > NATIVE_FLASH_MAX_SECTORS ||
+        *addr + (uint64_t)count * size > UINT32_MAX) {
+        return -1;
+    }
+
+    while (count-- > 0) {
+        native_flash_sectors[(*cnt)++] = *addr;
+        *addr += size;
+    }
+    return 0;
+}
+
+/*
+ * Parses "<name>=<value>" into the settings.
+ */
+static int
+flash_native_parse_setting(const char *tok, int *align,
+                           struct native_flash_timing *nft)
+{
+    static const struct {
+        const char *name;
+        size_t off;
+    } names[] = {
+        { "read_ns", offsetof(struct native_flash_timing, nft_read_ns) },
+        { "prog_ns", offsetof(struct native_flash_timing, nft_prog_ns) },
+        { "prog_op_us",
+          offsetof(struct native_flash_timing, nft_prog_op_us) },
+        { "erase_us", offsetof(struct native_flash_timing, nft_erase_us) },
+    };
+    unsigned long val;
+    const char *eq;
+    char *end;
     int i;
 
-    if (length == 0) {
+    eq = strchr(tok, '=');
+    if (eq == NULL) {
+        return -1;
+    }
+    val = strtoul(eq + 1, &end, 0);
+    if (end == eq + 1 || *end != '\0' || val > UINT32_MAX) {
+        return -1;
+    }
+
+    if (eq - tok == 5 && !strncmp(tok, "align", 5)) {
+        if (val == 0 || val > 128 || (val & (val - 1))) {
+            return -1;
+        }
+        *align = val;
         return 0;
     }
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strlen(names[i].name) == eq - tok &&
+            !strncmp(tok, names[i].name, eq - tok)) {
+            *(uint32_t *)((uint8_t *)nft + names[i].off) = val;
+            return 0;
+        }
+    }
+    return -1;
+}
 
-    end = address + length;
+/**
+ * Sets up the simulated flash.  Takes the name of a file holding the
+ * configuration, or the configuration itself: words separated by white
+ * space or commas, with '#' starting a comment that runs to the end of the
+ * line.  A word is either
+ *     <count>x<size>   'count' sectors of 'size' bytes, which can end in k
+ *                      or m; the sectors follow the ones listed before
+ *     align=<n>        write alignment, a power of two
+ *     read_ns=<n>      nsecs per byte read
+ *     prog_ns=<n>      nsecs per byte programmed
+ *     prog_op_us=<n>   usecs per program operation, on top of the bytes
+ *     erase_us=<n>     usecs per sector erased
+ * For example: "4x16k 1x64k 7x128k align=1 prog_ns=30 erase_us=1000000".
+ * If no sectors are given, the layout is left as it is.  NULL brings back
+ * the default layout, alignment 1 and instant operations.
+ *
+ * The flash file is reopened with the new size; flash added at the end
+ * reads as erased.  The erase counters and statistics start from 0, and
+ * a pending power cut is called off.
+ *
+ * @return 0 on success, -1 if the configuration is not valid; nothing is
+ *         changed then.
+ */
+int
+native_flash_configure(const char *conf)
+{
+    static uint32_t sectors[NATIVE_FLASH_MAX_SECTORS];
+    struct native_flash_timing nft;
+    char buf[4096];
+    char *tok;
+    char *p;
+    uint32_t addr;
+    size_t len;
+    FILE *fp;
+    int align;
+    int cnt;
+    int rc;
 
-    flash_native_ensure_file_open();
+    native_flash_configured = 1;
+
+    memset(&nft, 0, sizeof(nft));
+    align = 1;
+    cnt = 0;
+    addr = 0;
+    if (conf != NULL) {
+        nft = native_flash_timing;
+        align = native_flash_dev.hf_align;
 
-    cur = address;
-    while (cur < end) {
-        if (end - cur < sizeof buf) {
-            chunk_sz = end - cur;
+        fp = fopen(conf, "r");
+        if (fp != NULL) {
+            len = fread(buf, 1, sizeof(buf) - 1, fp);
+            fclose(fp);
         } else {
-            chunk_sz = sizeof buf;
+            len = strlen(conf);
+            if (len >= sizeof(buf)) {
+                return -1;
+            }
+            memcpy(buf, conf, len);
+        }
+        buf[len] = '\0';
+
+        /* Strip comments. */
+        for (p = buf; (p = strchr(p, '#')) != NULL; ) {
+            while (*p != '\0' && *p != '\n') {
+                *p++ = ' ';
+            }
         }
 
-        /* Ensure data is not being overwritten. */
-        if (!allow_overwrite) {
-            rc = native_flash_read(cur, buf, chunk_sz);
-            assert(rc == 0);
-            for (i = 0; i < chunk_sz; i++) {
-                assert(buf[i] == 0xff);
+        /* Build the layout in place, keeping a copy of the old one. */
+        memcpy(sectors, native_flash_sectors, sizeof(sectors));
+        for (tok = strtok(buf, " \t\r\n,"); tok != NULL;
+             tok = strtok(NULL, " \t\r\n,")) {
+            if (isdigit((unsigned char)tok[0])) {
+                rc = flash_native_parse_sectors(tok, &addr, &cnt);
+            } else {
+                rc = flash_native_parse_setting(tok, &align, &nft);
             }
+            if (rc != 0) {
+                memcpy(native_flash_sectors, sectors, sizeof(sectors));
+                return -1;
+            }
+        }
+        if (cnt == 0) {
+            memcpy(native_flash_sectors, sectors, sizeof(sectors));
         }
+    }
+
+    flash_native_file_close();
 
-        cur += chunk_sz;
+    if (conf == NULL) {
+        memcpy(native_flash_sectors, native_flash_dflt_sectors,
+               sizeof(native_flash_dflt_sectors));
+        cnt = NATIVE_FLASH_DFLT_SECTORS;
+        addr = NATIVE_FLASH_DFLT_SIZE;
     }
+    if (cnt != 0) {
+        native_flash_dev.hf_sector_cnt = cnt;
+        native_flash_dev.hf_size = addr;
+    }
+    native_flash_dev.hf_align = align;
+    native_flash_timing = nft;
 
-    memcpy((char *)file_loc + address, src, length);
+    memset(native_flash_erases, 0, sizeof(native_flash_erases));
+    memset(&native_flash_stats, 0, sizeof(native_flash_stats));
+    native_flash_owed_ns = 0;
+    native_flash_power_cut(-1);
 
     return 0;
 }
@@ -159,8 +408,43 @@ flash_native_write_internal(uint32_t address, const void *src, uint32_t length,
 static int
 native_flash_write(uint32_t address, const void *src, uint32_t length)
 {
+    const uint8_t *s;
+    uint8_t *d;
+    uint32_t i;
+
     assert(address % native_flash_dev.hf_align == 0);
-    return flash_native_write_internal(address, src, length, 0);
+
+    if (length == 0) {
+        return 0;
+    }
+    if (native_flash_powered_off) {
+        return -1;
+    }
+
+    flash_native_ensure_file_open();
+
+    /* Programming can clear bits, but cannot set them. */
+    s = src;
+    d = (uint8_t *)file_loc + address;
+    for (i = 0; i < length; i++) {
+        if (s[i] & ~d[i]) {
+            native_flash_stats.nfs_prog_errs++;
+            return -1;
+        }
+    }
+
+    if (flash_native_power_lost()) {
+        memcpy(d, src, length / 2);
+        return -1;
+    }
+
+    memcpy(d, src, length);
+    native_flash_stats.nfs_progs++;
+    native_flash_stats.nfs_prog_bytes += length;
+    flash_native_delay((uint64_t)native_flash_timing.nft_prog_op_us * 1000 +
+                       (uint64_t)length * native_flash_timing.nft_prog_ns);
+
+    return 0;
 }
 
 int
@@ -173,8 +457,15 @@ flash_native_memset(uint32_t offset, uint8_t c, uint32_t len)
 static int
 native_flash_read(uint32_t address, void *dst, uint32_t length)
 {
+    if (native_flash_powered_off) {
+        return -1;
+    }
+
     flash_native_ensure_file_open();
     memcpy(dst, (char *)file_loc + address, length);
+    native_flash_stats.nfs_reads++;
+    native_flash_stats.nfs_read_bytes += length;
+    flash_native_delay((uint64_t)length * native_flash_timing.nft_read_ns);
 
     return 0;
 }
@@ -184,7 +475,7 @@ find_area(uint32_t address)
 {
     int i;
 
-    for (i = 0; i < FLASH_NUM_AREAS; i++) {
+    for (i = 0; i < native_flash_dev.hf_sector_cnt; i++) {
         if (native_flash_sectors[i] == address) {
             return i;
         }
@@ -198,7 +489,7 @@ flash_sector_len(int sector)
 {
     uint32_t end;
 
-    if (sector == FLASH_NUM_AREAS - 1) {
+    if (sector == native_flash_dev.hf_sector_cnt - 1) {
         end = native_flash_dev.hf_size + native_flash_sectors[0];
     } else {
         end = native_flash_sectors[sector + 1];
@@ -212,6 +503,10 @@ native_flash_erase_sector(uint32_t sector_address)
     int area_id;
     uint32_t len;
 
+    if (native_flash_powered_off) {
+        return -1;
+    }
+
     flash_native_ensure_file_open();
 
     area_id = find_area(sector_address);
@@ -219,26 +514,97 @@ native_flash_erase_sector(uint32_t sector_address)
         return -1;
     }
     len = flash_sector_len(area_id);
+    if (flash_native_power_lost()) {
+        flash_native_erase(sector_address, len / 2);
+        return -1;
+    }
     flash_native_erase(sector_address, len);
+    native_flash_erases[area_id]++;
+    native_flash_stats.nfs_erases++;
+    flash_native_delay((uint64_t)native_flash_timing.nft_erase_us * 1000);
     return 0;
 }
 
 static int
 native_flash_sector_info(int idx, uint32_t *address, uint32_t *size)
 {
-    assert(idx < FLASH_NUM_AREAS);
+    assert(idx < native_flash_dev.hf_sector_cnt);
 
     *address = native_flash_sectors[idx];
     *size = flash_sector_len(idx);
     return 0;
 }
 
+/**
+ * Cuts the power to the flash in the middle of a program or erase, to test
+ * recovery from it.  The next 'ops' program or erase operations complete;
+ * of the one after them only the first half gets done, and it fails.  So
+ * 0 cuts the very next operation.  Every operation after the cut fails
+ * too, until the power is restored by calling this with -1.
+ */
+void
+native_flash_power_cut(int ops)
+{
+    native_flash_ops_left = ops;
+    native_flash_powered_off = 0;
+}
+
+/**
+ * Returns how many times sector 'idx' has been erased.
+ */
+uint32_t
+native_flash_erase_count(int idx)
+{
+    assert(idx < native_flash_dev.hf_sector_cnt);
+
+    return native_flash_erases[idx];
+}
+
+/**
+ * Prints the operation counts, and the layout with the erase count of
+ * every sector.
+ */
+void
+native_flash_stats_dump(FILE *fp)
+{
+    struct native_flash_stats *nfs;
+    uint32_t max;
+    int i;
+
+    nfs = &native_flash_stats;
+    fprintf(fp, "flash: %d sectors, %" PRIu32 " bytes, align %d\n",
+            native_flash_dev.hf_sector_cnt, native_flash_dev.hf_size,
+            native_flash_dev.hf_align);
+    fprintf(fp, "  reads %" PRIu32 " (%" PRIu64 " bytes)\n",
+            nfs->nfs_reads, nfs->nfs_read_bytes);
+    fprintf(fp, "  programs %" PRIu32 " (%" PRIu64 " bytes), %" PRIu32
+            " refused\n", nfs->nfs_progs, nfs->nfs_prog_bytes,
+            nfs->nfs_prog_errs);
+    fprintf(fp, "  erases %" PRIu32 "\n", nfs->nfs_erases);
+    fprintf(fp, "  busy %" PRIu64 " usec\n", nfs->nfs_busy_ns / 1000);
+
+    max = 0;
+    for (i = 0; i < native_flash_dev.hf_sector_cnt; i++) {
+        fprintf(fp, "  sector %3d 0x%08" PRIx32 " %7d bytes %6" PRIu32
+                " erases\n", i, native_flash_sectors[i], flash_sector_len(i),
+                native_flash_erases[i]);
+        if (native_flash_erases[i] > max) {
+            max = native_flash_erases[i];
+        }
+    }
+    fprintf(fp, "  most erased sector: %" PRIu32 " erases\n", max);
+}
+
 static int
 native_flash_init(void)
 {
+    if (!native_flash_configured && native_flash_config) {
+        if (native_flash_configure(native_flash_config)) {
+            return -1;
+        }
+    }
     if (native_flash_file) {
         flash_native_file_open(native_flash_file);
     }
     return 0;
 }
-
@@ -30,6 +30,12 @@ system_reset(void)
     while(1);
 }
 
+static void
+native_flash_stats_exit(void)
+{
+    native_flash_stats_dump(stderr);
+}
+
 /*
  * When running projects within simulator, it's useful to be able to
  * pass operating info as parameters to simulator program.
@@ -39,9 +45,17 @@ static void
 usage(char *progname, int rc)
 {
     const char msg[] =
-      "Usage: %s [-f flash_file] [-u uart_log_file]\n"
+      "Usage: %s [-f flash_file] [-g flash_config] [-s]\n"
+      "          [-t read,prog,erase] [-u uart_log_file]\n"
       "     -f flash_file tells where binary flash file is located. It gets\n"
       "        created if it doesn't already exist.\n"
+      "     -g flash_config sets the flash sector layout, alignment and\n"
+      "        timing, e.g. \"4x16k,1x64k,7x128k,prog_ns=30\", or names a\n"
+      "        file holding that; see native_flash_configure().\n"
+      "     -s prints flash statistics and erase counts at exit.\n"
+      "     -t read,prog,erase sets how long flash operations take: nsecs\n"
+      "        per byte read, nsecs per byte programmed and usecs per sector\n"
+      "        erased.\n"
       "     -u uart_log_file puts all UART data exchanges into a logfile.\n";
 
     write(2, msg, strlen(msg));
@@ -54,11 +68,24 @@ mcu_sim_parse_args(int argc, char **argv)
     int ch;
     char *progname = argv[0];
 
-    while ((ch = getopt(argc, argv, "hf:u:")) != -1) {
+    while ((ch = getopt(argc, argv, "hf:g:st:u:")) != -1) {
         switch (ch) {
         case 'f':
             native_flash_file = optarg;
             break;
+        case 'g':
+            native_flash_config = optarg;
+            break;
+        case 's':
+            atexit(native_flash_stats_exit);
+            break;
+        case 't':
+            if (sscanf(optarg, "%u,%u,%u", &native_flash_timing.nft_read_ns,
+                       &native_flash_timing.nft_prog_ns,
+                       &native_flash_timing.nft_erase_us) != 3) {
+                usage(progname, -1);
+            }
+            break;
         case 'u':
             native_uart_log_file = optarg;
             break;
@@ -33,6 +33,9 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#ifdef OS_SIM_EPOLL
+#include <sys/epoll.h>
+#endif
 
 #define UART_MAX_BYTES_PER_POLL	64
 #define UART_POLLER_STACK_SZ	OS_STACK_ALIGN(1024)
@@ -60,6 +63,10 @@ static struct uart uarts[UART_CNT];
 static int uart_poller_running;
 static struct os_task uart_poller_task;
 static os_stack_t uart_poller_stack[UART_POLLER_STACK_SZ];
+#ifdef OS_SIM_EPOLL
+/* Wakes the poller up when input arrives or transmission is started */
+static struct os_sem uart_poll_sem;
+#endif
 
 static void
 uart_open_log(void)
@@ -206,10 +213,30 @@ uart_poller(void *arg)
             }
         }
         uart_log_data(NULL, 0, 0);
+#ifdef OS_SIM_EPOLL
+        os_sem_pend(&uart_poll_sem, 10);
+#else
         os_time_delay(10);
+#endif
     }
 }
 
+#ifdef OS_SIM_EPOLL
+static void
+uart_poll_wakeup(void)
+{
+    if (uart_poll_sem.sem_tokens == 0) {
+        os_sem_release(&uart_poll_sem);
+    }
+}
+
+static void
+uart_fd_ready(int fd, uint32_t events, void *arg)
+{
+    uart_poll_wakeup();
+}
+#endif
+
 static void
 set_nonblock(int fd)
 {
@@ -295,6 +322,11 @@ hal_uart_start_tx(int port)
          */
         uart_transmit_char(&uarts[port]);
     }
+#ifdef OS_SIM_EPOLL
+    else {
+        uart_poll_wakeup();
+    }
+#endif
     OS_EXIT_CRITICAL(sr);
 }
 
@@ -338,6 +370,9 @@ hal_uart_init_cbs(int port, hal_uart_tx_char tx_func, hal_uart_tx_done tx_done,
 
     if (!uart_poller_running) {
         uart_poller_running = 1;
+#ifdef OS_SIM_EPOLL
+        os_sem_init(&uart_poll_sem, 0);
+#endif
         rc = os_task_init(&uart_poller_task, "uart_poller", uart_poller, NULL,
           UART_POLLER_PRIO, OS_WAIT_FOREVER, uart_poller_stack,
           UART_POLLER_STACK_SZ);
@@ -366,6 +401,9 @@ hal_uart_config(int port, int32_t baudrate, uint8_t databits, uint8_t stopbits,
         return -1;
     }
     set_nonblock(uart->u_fd);
+#ifdef OS_SIM_EPOLL
+    os_arch_sim_fd_add(uart->u_fd, EPOLLIN, uart_fd_ready, uart);
+#endif
 
     uart_open_log();
     uart->u_open = 1;
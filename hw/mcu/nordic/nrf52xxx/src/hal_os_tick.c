@@ -73,6 +73,7 @@ nrf52_timer_handler(void)
     uint32_t counter;
 
     OS_ENTER_CRITICAL(sr);
+    os_isr_enter();
 
     /*
      * Calculate elapsed ticks and advance OS time.
@@ -90,6 +91,7 @@ nrf52_timer_handler(void)
     /* Update the output compare to interrupt at the next tick */
     nrf52_os_tick_set_ocmp(lastocmp + timer_ticks_per_ostick);
 
+    os_isr_exit();
     OS_EXIT_CRITICAL(sr);
 }
 
@@ -0,0 +1,14 @@
+/*
+ * malloc.h
+ *
+ * The allocator is declared in stdlib.h, together with its extensions
+ * (malloc_usable_size() and the heap status calls). This header is here
+ * for code that also builds against libcs that declare those in malloc.h.
+ */
+
+#ifndef _MALLOC_H
+#define _MALLOC_H
+
+#include <stdlib.h>
+
+#endif				/* _MALLOC_H */
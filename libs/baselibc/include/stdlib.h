@@ -40,6 +40,9 @@ __extern void *realloc(void *, size_t);
 /* Giving malloc some memory from which to allocate */
 __extern void add_malloc_block(void *, size_t);
 __extern void get_malloc_memory_status(size_t *, size_t *);
+/* Percentage of free memory outside the largest free block */
+__extern unsigned int get_malloc_fragmentation(void);
+__extern size_t malloc_usable_size(void *);
 
 /* Malloc locking
  * Until the callbacks are set, malloc doesn't do any locking.
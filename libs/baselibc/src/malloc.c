@@ -1,7 +1,18 @@
 /*
  * malloc.c
  *
- * Very simple linked-list based malloc()/free().
+ * Two-level segregated fit (TLSF) malloc()/free().
+ *
+ * Free blocks are kept on one list per size class.  The first level picks
+ * the power of two a size falls in, the second level one of
+ * 2^MALLOC_SL_LOG2 equal ranges within it.  A bitmap per level tells which
+ * lists are non-empty, so finding a block that fits is a couple of
+ * find-first-set operations, and freeing a block merges it with its
+ * physical neighbours through the header links.  malloc() and free() are
+ * O(1) no matter how fragmented the heap is.
+ *
+ * Every memory area handed to add_malloc_block() ends in a zero-sized used
+ * block, so merging never crosses the end of an area.
  */
 
 #include <stdbool.h>
@@ -9,19 +20,27 @@
 #include <assert.h>
 #include "malloc.h"
 
-/* Both the arena list and the free memory list are double linked
-   list with head node.  This the head node. Note that the arena list
-   is sorted in order of address. */
-static struct free_arena_header __malloc_head = {
-	{
-		ARENA_TYPE_HEAD,
-		0,
-		&__malloc_head,
-		&__malloc_head,
-	},
-	&__malloc_head,
-	&__malloc_head
-};
+#define ARENA_ALIGN_LOG2	(sizeof(struct arena_header) == 16 ? 4 : 3)
+
+#define SL_COUNT	(1 << MALLOC_SL_LOG2)
+#define FL_SHIFT	(MALLOC_SL_LOG2 + ARENA_ALIGN_LOG2)
+#define FL_COUNT	(MALLOC_FL_MAX_LOG2 - FL_SHIFT + 1)
+
+/* Sizes below this all go in first level list 0, in steps of one unit */
+#define SMALL_BLOCK	((size_t)1 << FL_SHIFT)
+#define MIN_BLOCK	sizeof(struct free_arena_header)
+#define MAX_BLOCK	(((size_t)1 << MALLOC_FL_MAX_LOG2) - \
+			 sizeof(struct arena_header))
+
+static struct free_arena_header *__free_lists[FL_COUNT][SL_COUNT];
+static uint32_t __fl_map;
+static uint32_t __sl_map[FL_COUNT];
+
+/* Total size of the free blocks */
+static size_t __malloc_free_bytes;
+
+/* End marker of the area added last */
+static struct arena_header *__malloc_end;
 
 static bool malloc_lock_nop() {return true;}
 static void malloc_unlock_nop() {}
@@ -29,151 +48,229 @@ static void malloc_unlock_nop() {}
 static malloc_lock_t malloc_lock = &malloc_lock_nop;
 static malloc_unlock_t malloc_unlock = &malloc_unlock_nop;
 
-static inline void mark_block_dead(struct free_arena_header *ah)
+static inline int fls_size(size_t size)
 {
-#ifdef DEBUG_MALLOC
-	ah->a.type = ARENA_TYPE_DEAD;
-#endif
+	return (int)(sizeof(unsigned long) * 8 - 1) -
+	    __builtin_clzl((unsigned long)size);
+}
+
+static inline void mapping_insert(size_t size, int *fl, int *sl)
+{
+	int f;
+
+	if (size < SMALL_BLOCK) {
+		*fl = 0;
+		*sl = size >> ARENA_ALIGN_LOG2;
+	} else {
+		f = fls_size(size);
+		*fl = f - FL_SHIFT + 1;
+		*sl = (size >> (f - MALLOC_SL_LOG2)) ^ SL_COUNT;
+	}
+}
+
+/*
+ * Size class to start searching from: the first one whose blocks are all
+ * at least 'size' bytes.
+ */
+static inline size_t mapping_search_size(size_t size)
+{
+	if (size >= SMALL_BLOCK) {
+		size += ((size_t)1 << (fls_size(size) - MALLOC_SL_LOG2)) - 1;
+	}
+	return size;
 }
 
-static inline void remove_from_main_chain(struct free_arena_header *ah)
+static void insert_free(struct arena_header *ah)
 {
-	struct free_arena_header *ap, *an;
+	struct free_arena_header *fp = (struct free_arena_header *)ah;
+	int fl, sl;
+
+	mapping_insert(arena_size(ah), &fl, &sl);
 
-	mark_block_dead(ah);
+	ah->size |= ARENA_FLAG_FREE;
+	fp->prev_free = NULL;
+	fp->next_free = __free_lists[fl][sl];
+	if (fp->next_free)
+		fp->next_free->prev_free = fp;
+	__free_lists[fl][sl] = fp;
 
-	ap = ah->a.prev;
-	an = ah->a.next;
-	ap->a.next = an;
-	an->a.prev = ap;
+	__fl_map |= 1U << fl;
+	__sl_map[fl] |= 1U << sl;
+	__malloc_free_bytes += arena_size(ah);
 }
 
-static inline void remove_from_free_chain(struct free_arena_header *ah)
+static void remove_free(struct arena_header *ah)
 {
-	struct free_arena_header *ap, *an;
+	struct free_arena_header *fp = (struct free_arena_header *)ah;
+	int fl, sl;
 
-	ap = ah->prev_free;
-	an = ah->next_free;
-	ap->next_free = an;
-	an->prev_free = ap;
+	mapping_insert(arena_size(ah), &fl, &sl);
+
+	if (fp->next_free)
+		fp->next_free->prev_free = fp->prev_free;
+	if (fp->prev_free) {
+		fp->prev_free->next_free = fp->next_free;
+	} else {
+		__free_lists[fl][sl] = fp->next_free;
+		if (!fp->next_free) {
+			__sl_map[fl] &= ~(1U << sl);
+			if (!__sl_map[fl])
+				__fl_map &= ~(1U << fl);
+		}
+	}
+
+	ah->size &= ~ARENA_FLAG_FREE;
+	__malloc_free_bytes -= arena_size(ah);
 }
 
-static inline void remove_from_chains(struct free_arena_header *ah)
+/* Find a free block of at least 'size' bytes, or NULL */
+static struct arena_header *__find_free_block(size_t size)
 {
-	remove_from_free_chain(ah);
-	remove_from_main_chain(ah);
+	uint32_t map;
+	int fl, sl;
+
+	size = mapping_search_size(size);
+	mapping_insert(size, &fl, &sl);
+	if (fl >= FL_COUNT)
+		return NULL;
+
+	map = __sl_map[fl] & (~0U << sl);
+	if (!map) {
+		map = __fl_map & (~0U << (fl + 1));
+		if (!map)
+			return NULL;
+		fl = __builtin_ctz(map);
+		map = __sl_map[fl];
+	}
+	sl = __builtin_ctz(map);
+
+	return &__free_lists[fl][sl]->a;
 }
 
-static void *__malloc_from_block(struct free_arena_header *fp, size_t size)
+static void *__malloc_from_block(struct arena_header *ah, size_t size)
 {
-	size_t fsize;
-	struct free_arena_header *nfp, *na, *fpn, *fpp;
+	struct arena_header *nah;
+	size_t rsize;
 
-	fsize = fp->a.size;
+	remove_free(ah);
 
-	/* We need the 2* to account for the larger requirements of a
-	   free block */
-	if (fsize >= size + 2 * sizeof(struct arena_header)) {
+	rsize = arena_size(ah) - size;
+	if (rsize >= MIN_BLOCK) {
 		/* Bigger block than required -- split block */
-		nfp = (struct free_arena_header *)((char *)fp + size);
-		na = fp->a.next;
-
-		nfp->a.type = ARENA_TYPE_FREE;
-		nfp->a.size = fsize - size;
-		fp->a.type = ARENA_TYPE_USED;
-		fp->a.size = size;
-
-		/* Insert into all-block chain */
-		nfp->a.prev = fp;
-		nfp->a.next = na;
-		na->a.prev = nfp;
-		fp->a.next = nfp;
-
-		/* Replace current block on free chain */
-		nfp->next_free = fpn = fp->next_free;
-		nfp->prev_free = fpp = fp->prev_free;
-		fpn->prev_free = nfp;
-		fpp->next_free = nfp;
-	} else {
-		fp->a.type = ARENA_TYPE_USED; /* Allocate the whole block */
-		remove_from_free_chain(fp);
+		nah = (struct arena_header *)((char *)ah + size);
+		nah->prev_phys = ah;
+		nah->size = rsize;
+		arena_next(nah)->prev_phys = nah;
+		ah->size = size;
+		insert_free(nah);
 	}
 
-	return (void *)(&fp->a + 1);
+	return (void *)(ah + 1);
 }
 
-static struct free_arena_header *__free_block(struct free_arena_header *ah)
+/* Merge a block that is not on any list with its free neighbours */
+static void __free_block(struct arena_header *ah)
 {
-	struct free_arena_header *pah, *nah;
+	struct arena_header *pah, *nah;
 
-	pah = ah->a.prev;
-	nah = ah->a.next;
-	if (pah->a.type == ARENA_TYPE_FREE &&
-	    (char *)pah + pah->a.size == (char *)ah) {
+	pah = ah->prev_phys;
+	if (pah && arena_is_free(pah) &&
+	    arena_size(pah) + arena_size(ah) <= MAX_BLOCK) {
 		/* Coalesce into the previous block */
-		pah->a.size += ah->a.size;
-		pah->a.next = nah;
-		nah->a.prev = pah;
-		mark_block_dead(ah);
-
+		remove_free(pah);
+		pah->size += arena_size(ah);
 		ah = pah;
-		pah = ah->a.prev;
-	} else {
-		/* Need to add this block to the free chain */
-		ah->a.type = ARENA_TYPE_FREE;
+	}
 
-		ah->next_free = __malloc_head.next_free;
-		ah->prev_free = &__malloc_head;
-		__malloc_head.next_free = ah;
-		ah->next_free->prev_free = ah;
+	nah = arena_next(ah);
+	if (arena_is_free(nah) &&
+	    arena_size(ah) + arena_size(nah) <= MAX_BLOCK) {
+		remove_free(nah);
+		ah->size += arena_size(nah);
 	}
 
-	/* In either of the previous cases, we might be able to merge
-	   with the subsequent block... */
-	if (nah->a.type == ARENA_TYPE_FREE &&
-	    (char *)ah + ah->a.size == (char *)nah) {
-		ah->a.size += nah->a.size;
+	arena_next(ah)->prev_phys = ah;
+	insert_free(ah);
+}
 
-		/* Remove the old block from the chains */
-		remove_from_chains(nah);
+static void __add_malloc_block(void *buf, size_t size)
+{
+	struct arena_header *ah, *prev;
+	char *start;
+	size_t chunk;
+
+	/* Round the start up and the size down to the alignment unit */
+	start = (char *)(((uintptr_t)buf + sizeof(struct arena_header) - 1) &
+	    ARENA_SIZE_MASK);
+	if ((size_t)(start - (char *)buf) >= size)
+		return; // Too small.
+	size = (size - (start - (char *)buf)) & ARENA_SIZE_MASK;
+
+	/* Memory right after the last area, e.g. from _sbrk(); the end
+	   marker of that area becomes the start of the new block. */
+	prev = NULL;
+	if (__malloc_end && start == (char *)(__malloc_end + 1) &&
+	    size >= MIN_BLOCK) {
+		start = (char *)__malloc_end;
+		size += sizeof(struct arena_header);
+		prev = __malloc_end->prev_phys;
 	}
 
-	/* Return the block that contains the called block */
-	return ah;
+	while (size >= MIN_BLOCK + sizeof(struct arena_header)) {
+		chunk = size;
+		if (chunk > MAX_BLOCK + sizeof(struct arena_header))
+			chunk = MAX_BLOCK + sizeof(struct arena_header);
+
+		ah = (struct arena_header *)start;
+		ah->prev_phys = prev;
+		ah->size = chunk - sizeof(struct arena_header);
+
+		/* Used, zero sized end marker */
+		__malloc_end = arena_next(ah);
+		__malloc_end->prev_phys = ah;
+		__malloc_end->size = 0;
+
+		__free_block(ah);
+
+		start += chunk;
+		size -= chunk;
+		prev = NULL;
+	}
 }
 
 void *malloc(size_t size)
 {
-	struct free_arena_header *fp;
+	struct arena_header *ah;
+	size_t more;
         void *more_mem;
         extern void *_sbrk(int incr);
 
-	if (size == 0)
+	if (size == 0 || size > MAX_BLOCK - sizeof(struct arena_header))
 		return NULL;
 
 	/* Add the obligatory arena header, and round up */
 	size = (size + 2 * sizeof(struct arena_header) - 1) & ARENA_SIZE_MASK;
+	if (size < MIN_BLOCK)
+		size = MIN_BLOCK;
 
         if (!malloc_lock())
                 return NULL;
 
         void *result = NULL;
-retry_alloc:
-	for (fp = __malloc_head.next_free; fp->a.type != ARENA_TYPE_HEAD;
-	     fp = fp->next_free) {
-		if (fp->a.size >= size) {
-			/* Found fit -- allocate out of this block */
-			result = __malloc_from_block(fp, size);
-                        break;
-		}
-	}
-        if (result == NULL) {
-            more_mem = _sbrk(size);
+	ah = __find_free_block(size);
+        if (ah == NULL) {
+            /* Enough for a block of the search size class, plus the end
+               marker; keep the break aligned so the areas merge. */
+            more = (mapping_search_size(size) +
+                    3 * sizeof(struct arena_header) - 1) & ARENA_SIZE_MASK;
+            more_mem = _sbrk(more);
             if (more_mem != (void *)-1) {
-                add_malloc_block(more_mem, size);
-                goto retry_alloc;
+                __add_malloc_block(more_mem, more);
+                ah = __find_free_block(size);
             }
         }
+        if (ah != NULL)
+            result = __malloc_from_block(ah, size);
         malloc_unlock();
 	return result;
 }
@@ -181,85 +278,86 @@ retry_alloc:
 /* Call this to give malloc some memory to allocate from */
 void add_malloc_block(void *buf, size_t size)
 {
-	struct free_arena_header *fp = buf;
-	struct free_arena_header *pah;
-
-	if (size < sizeof(struct free_arena_header))
-		return; // Too small.
-
-	/* Insert the block into the management chains.  We need to set
-	   up the size and the main block list pointer, the rest of
-	   the work is logically identical to free(). */
-	fp->a.type = ARENA_TYPE_FREE;
-	fp->a.size = size;
-
         if (!malloc_lock())
             return;
 
-	/* We need to insert this into the main block list in the proper
-	   place -- this list is required to be sorted.  Since we most likely
-	   get memory assignments in ascending order, search backwards for
-	   the proper place. */
-	for (pah = __malloc_head.a.prev; pah->a.type != ARENA_TYPE_HEAD;
-	     pah = pah->a.prev) {
-		if (pah < fp)
-			break;
-	}
-
-	/* Now pah points to the node that should be the predecessor of
-	   the new node */
-	fp->a.next = pah->a.next;
-	fp->a.prev = pah;
-	pah->a.next = fp;
-	fp->a.next->a.prev = fp;
-
-	/* Insert into the free chain and coalesce with adjacent blocks */
-	fp = __free_block(fp);
+	__add_malloc_block(buf, size);
 
         malloc_unlock();
 }
 
 void free(void *ptr)
 {
-	struct free_arena_header *ah;
+	struct arena_header *ah;
 
 	if (!ptr)
 		return;
 
-	ah = (struct free_arena_header *)
-	    ((struct arena_header *)ptr - 1);
+	ah = (struct arena_header *)ptr - 1;
 
 #ifdef DEBUG_MALLOC
-	assert(ah->a.type == ARENA_TYPE_USED);
+	assert(!arena_is_free(ah));
 #endif
 
         if (!malloc_lock())
             return;
 
 	/* Merge into adjacent free blocks */
-	ah = __free_block(ah);
+	__free_block(ah);
         malloc_unlock();
 }
 
+size_t malloc_usable_size(void *ptr)
+{
+	if (!ptr)
+		return 0;
+
+	return arena_size((struct arena_header *)ptr - 1) -
+	    sizeof(struct arena_header);
+}
+
 void get_malloc_memory_status(size_t *free_bytes, size_t *largest_block)
 {
     struct free_arena_header *fp;
+    int fl, sl;
+
     *free_bytes = 0;
     *largest_block = 0;
 
     if (!malloc_lock())
             return;
 
-    for (fp = __malloc_head.next_free; fp->a.type != ARENA_TYPE_HEAD; fp = fp->next_free) {
-        *free_bytes += fp->a.size;
-        if (fp->a.size >= *largest_block) {
-            *largest_block = fp->a.size;
+    *free_bytes = __malloc_free_bytes;
+
+    /* The largest block is on the highest non-empty list */
+    if (__fl_map) {
+        fl = 31 - __builtin_clz(__fl_map);
+        sl = 31 - __builtin_clz(__sl_map[fl]);
+        for (fp = __free_lists[fl][sl]; fp; fp = fp->next_free) {
+            if (arena_size(&fp->a) >= *largest_block) {
+                *largest_block = arena_size(&fp->a);
+            }
         }
     }
 
     malloc_unlock();
 }
 
+/*
+ * Percentage of the free memory that cannot be handed out in one piece:
+ * 0 if all of it is one block, approaching 100 as it splinters.
+ */
+unsigned int get_malloc_fragmentation(void)
+{
+    size_t free_bytes, largest_block;
+
+    get_malloc_memory_status(&free_bytes, &largest_block);
+    if (free_bytes == 0)
+        return 0;
+
+    return 100 - (unsigned int)((uint64_t)largest_block * 100 / free_bytes);
+}
+
 void set_malloc_locking(malloc_lock_t lock, malloc_unlock_t unlock)
 {
     if (lock)
@@ -8,36 +8,54 @@
 #include <stddef.h>
 
 /*
- * This structure should be a power of two.  This becomes the
- * alignment unit.
+ * Every block, free or used, starts with this header.  Its size is the
+ * alignment unit, and must be a power of two.
  */
-struct free_arena_header;
-
 struct arena_header {
-	size_t type;
-	size_t size;
-	struct free_arena_header *next, *prev;
+	struct arena_header *prev_phys;	/* Previous block in memory, or NULL */
+	size_t size;			/* Size including header, and flags */
 };
 
-#ifdef DEBUG_MALLOC
-#define ARENA_TYPE_USED 0x64e69c70
-#define ARENA_TYPE_FREE 0x012d610a
-#define ARENA_TYPE_HEAD 0x971676b5
-#define ARENA_TYPE_DEAD 0xeeeeeeee
-#else
-#define ARENA_TYPE_USED 0
-#define ARENA_TYPE_FREE 1
-#define ARENA_TYPE_HEAD 2
-#endif
+/* Flags kept in the low bits of the size */
+#define ARENA_FLAG_FREE	1
 
 #define ARENA_SIZE_MASK (~(sizeof(struct arena_header)-1))
 
 /*
- * This structure should be no more than twice the size of the
- * previous structure.
+ * A free block additionally links into the list of its size class, so
+ * this is the smallest block there is.
  */
 struct free_arena_header {
 	struct arena_header a;
 	struct free_arena_header *next_free, *prev_free;
 };
 
+static inline size_t arena_size(const struct arena_header *ah)
+{
+	return ah->size & ARENA_SIZE_MASK;
+}
+
+static inline int arena_is_free(const struct arena_header *ah)
+{
+	return (ah->size & ARENA_FLAG_FREE) != 0;
+}
+
+static inline struct arena_header *arena_next(const struct arena_header *ah)
+{
+	return (struct arena_header *)((char *)ah + arena_size(ah));
+}
+
+/*
+ * Segregated fit parameters.  Free blocks are binned by the position of
+ * their highest set bit (first level), and each power of two is split in
+ * 2^MALLOC_SL_LOG2 linear ranges (second level).  Blocks never grow beyond
+ * 2^MALLOC_FL_MAX_LOG2 bytes; larger memory areas are split up when they
+ * are added.
+ */
+#ifndef MALLOC_SL_LOG2
+#define MALLOC_SL_LOG2		3
+#endif
+
+#ifndef MALLOC_FL_MAX_LOG2
+#define MALLOC_FL_MAX_LOG2	24
+#endif
@@ -11,7 +11,7 @@
 
 void *realloc(void *ptr, size_t size)
 {
-	struct free_arena_header *ah;
+	struct arena_header *ah;
 	void *newptr;
 	size_t oldsize;
 
@@ -23,13 +23,10 @@ void *realloc(void *ptr, size_t size)
 		return NULL;
 	}
 
-	/* Add the obligatory arena header, and round up */
-	size = (size + 2 * sizeof(struct arena_header) - 1) & ARENA_SIZE_MASK;
+	ah = (struct arena_header *)ptr - 1;
+	oldsize = arena_size(ah) - sizeof(struct arena_header);
 
-	ah = (struct free_arena_header *)
-	    ((struct arena_header *)ptr - 1);
-
-	if (ah->a.size >= size && size >= (ah->a.size >> 2)) {
+	if (oldsize >= size && size >= (oldsize >> 2)) {
 		/* This field is a good size already. */
 		return ptr;
 	} else {
@@ -37,8 +34,6 @@ void *realloc(void *ptr, size_t size)
 		   be checking the following block to see if we can do an
 		   in-place adjustment... fix that later. */
 
-		oldsize = ah->a.size - sizeof(struct arena_header);
-
 		newptr = malloc(size);
                 if(newptr) {
                     memcpy(newptr, ptr, (size < oldsize) ? size : oldsize);
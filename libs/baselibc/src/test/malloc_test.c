@@ -0,0 +1,321 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutil/testutil.h"
+
+/*
+ * The tests only look at the allocator through its public calls, so they
+ * work whether or not the heap already holds memory of its own. Each test
+ * frees everything it allocated and then expects the heap to be exactly as
+ * it found it: the same number of free bytes in the same largest block,
+ * which only holds if every freed block was merged with its neighbours.
+ */
+
+#define MALLOC_TEST_AREA_SIZE   (16 * 1024)
+
+/* Blocks held at once by the split and the stress tests */
+#define MALLOC_TEST_BLOCKS      (64)
+
+/* Most a request is rounded up by: alignment plus the smallest block */
+#define MALLOC_TEST_SLACK       (32)
+
+#define MALLOC_TEST_STRESS_OPS  (20000)
+
+static uint8_t malloc_test_area[MALLOC_TEST_AREA_SIZE]
+    __attribute__((aligned(16)));
+static int malloc_test_area_added;
+
+static uint8_t *malloc_test_ptrs[MALLOC_TEST_BLOCKS];
+static size_t malloc_test_sizes[MALLOC_TEST_BLOCKS];
+
+static uint32_t malloc_test_seed;
+
+static uint32_t
+malloc_test_rand(void)
+{
+    malloc_test_seed = malloc_test_seed * 1103515245 + 12345;
+    return malloc_test_seed >> 8;
+}
+
+static void
+malloc_test_fill(int idx)
+{
+    size_t i;
+
+    for (i = 0; i < malloc_test_sizes[idx]; i++) {
+        malloc_test_ptrs[idx][i] = idx + i;
+    }
+}
+
+static int
+malloc_test_check(int idx, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (malloc_test_ptrs[idx][i] != (uint8_t)(idx + i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Hands the test area to the allocator, once, and records the state that
+ * every test has to leave the heap in.
+ */
+static void
+malloc_test_setup(size_t *free_bytes, size_t *largest_block)
+{
+    if (!malloc_test_area_added) {
+        add_malloc_block(malloc_test_area, sizeof malloc_test_area);
+        malloc_test_area_added = 1;
+    }
+    memset(malloc_test_ptrs, 0, sizeof malloc_test_ptrs);
+    get_malloc_memory_status(free_bytes, largest_block);
+    TEST_ASSERT_FATAL(*largest_block >= MALLOC_TEST_AREA_SIZE / 2);
+}
+
+static void
+malloc_test_free_all(void)
+{
+    int i;
+
+    for (i = 0; i < MALLOC_TEST_BLOCKS; i++) {
+        free(malloc_test_ptrs[i]);
+        malloc_test_ptrs[i] = NULL;
+    }
+}
+
+static void
+malloc_test_check_restored(size_t free_bytes, size_t largest_block)
+{
+    size_t free_now;
+    size_t largest_now;
+
+    get_malloc_memory_status(&free_now, &largest_now);
+    TEST_ASSERT(free_now == free_bytes);
+    TEST_ASSERT(largest_now == largest_block);
+}
+
+/**
+ * Blocks are split off free memory, don't overlap, and merge back into
+ * one when freed, in any order.
+ */
+TEST_CASE(malloc_test_split_coalesce)
+{
+    size_t free_bytes, largest_block;
+    size_t free_now, largest_now;
+    unsigned int frag;
+    int i;
+
+    malloc_test_setup(&free_bytes, &largest_block);
+    frag = get_malloc_fragmentation();
+
+    for (i = 0; i < MALLOC_TEST_BLOCKS; i++) {
+        malloc_test_sizes[i] = 16 + i;
+        malloc_test_ptrs[i] = malloc(malloc_test_sizes[i]);
+        TEST_ASSERT_FATAL(malloc_test_ptrs[i] != NULL);
+        TEST_ASSERT(((uintptr_t)malloc_test_ptrs[i] & 7) == 0);
+        malloc_test_fill(i);
+    }
+    get_malloc_memory_status(&free_now, &largest_now);
+    TEST_ASSERT(free_now < free_bytes);
+
+    /* Free every other block: holes that cannot merge yet. */
+    for (i = 0; i < MALLOC_TEST_BLOCKS; i += 2) {
+        free(malloc_test_ptrs[i]);
+        malloc_test_ptrs[i] = NULL;
+    }
+    for (i = 1; i < MALLOC_TEST_BLOCKS; i += 2) {
+        TEST_ASSERT(malloc_test_check(i, malloc_test_sizes[i]));
+    }
+    TEST_ASSERT(get_malloc_fragmentation() > frag);
+
+    /* Freeing the rest fills the holes and merges everything again. */
+    malloc_test_free_all();
+    malloc_test_check_restored(free_bytes, largest_block);
+    TEST_ASSERT(get_malloc_fragmentation() == frag);
+}
+
+/**
+ * realloc() keeps the contents when it grows or shrinks a block, and
+ * behaves like malloc() and free() for a NULL block and a zero size.
+ */
+TEST_CASE(malloc_test_realloc)
+{
+    size_t free_bytes, largest_block;
+    uint8_t *p;
+
+    malloc_test_setup(&free_bytes, &largest_block);
+
+    malloc_test_sizes[0] = 40;
+    malloc_test_ptrs[0] = realloc(NULL, malloc_test_sizes[0]);
+    TEST_ASSERT_FATAL(malloc_test_ptrs[0] != NULL);
+    malloc_test_fill(0);
+
+    /* Something right behind it, so growing has to move the block. */
+    malloc_test_ptrs[1] = malloc(8);
+    TEST_ASSERT_FATAL(malloc_test_ptrs[1] != NULL);
+
+    p = realloc(malloc_test_ptrs[0], 1000);
+    TEST_ASSERT_FATAL(p != NULL);
+    malloc_test_ptrs[0] = p;
+    TEST_ASSERT(malloc_test_check(0, 40));
+    TEST_ASSERT(malloc_usable_size(p) >= 1000);
+    malloc_test_sizes[0] = 1000;
+    malloc_test_fill(0);
+
+    p = realloc(malloc_test_ptrs[0], 100);
+    TEST_ASSERT_FATAL(p != NULL);
+    malloc_test_ptrs[0] = p;
+    TEST_ASSERT(malloc_test_check(0, 100));
+
+    p = realloc(malloc_test_ptrs[0], 0);
+    TEST_ASSERT(p == NULL);
+    malloc_test_ptrs[0] = NULL;
+
+    malloc_test_free_all();
+    malloc_test_check_restored(free_bytes, largest_block);
+}
+
+/**
+ * malloc_usable_size() covers the request, without much slack, and all
+ * of it can be written without touching the neighbouring blocks.
+ */
+TEST_CASE(malloc_test_usable_size)
+{
+    size_t free_bytes, largest_block;
+    size_t usable;
+    size_t len;
+    int i;
+
+    malloc_test_setup(&free_bytes, &largest_block);
+
+    TEST_ASSERT(malloc_usable_size(NULL) == 0);
+
+    for (len = 1; len <= 256; len++) {
+        for (i = 0; i < 3; i++) {
+            malloc_test_ptrs[i] = malloc(len);
+            TEST_ASSERT_FATAL(malloc_test_ptrs[i] != NULL);
+            usable = malloc_usable_size(malloc_test_ptrs[i]);
+            TEST_ASSERT_FATAL(usable >= len);
+            TEST_ASSERT(usable < len + MALLOC_TEST_SLACK);
+            malloc_test_sizes[i] = usable;
+            malloc_test_fill(i);
+        }
+        for (i = 0; i < 3; i++) {
+            TEST_ASSERT_FATAL(malloc_test_check(i, malloc_test_sizes[i]));
+        }
+        malloc_test_free_all();
+    }
+
+    malloc_test_check_restored(free_bytes, largest_block);
+}
+
+/**
+ * Random malloc(), realloc() and free() calls of mixed sizes never hand
+ * out overlapping memory, and leave no splinters behind.
+ */
+TEST_CASE(malloc_test_stress)
+{
+    size_t free_bytes, largest_block;
+    size_t len;
+    uint8_t *p;
+    int idx;
+    int i;
+
+    malloc_test_setup(&free_bytes, &largest_block);
+    malloc_test_seed = 1;
+
+    for (i = 0; i < MALLOC_TEST_STRESS_OPS; i++) {
+        idx = malloc_test_rand() % MALLOC_TEST_BLOCKS;
+        if (malloc_test_rand() % 8 == 0) {
+            len = malloc_test_rand() % 512 + 1;
+        } else {
+            len = malloc_test_rand() % 64 + 1;
+        }
+
+        if (malloc_test_ptrs[idx] == NULL) {
+            p = malloc(len);
+            if (p == NULL) {
+                continue;
+            }
+            malloc_test_ptrs[idx] = p;
+            malloc_test_sizes[idx] = len;
+            malloc_test_fill(idx);
+            continue;
+        }
+
+        TEST_ASSERT_FATAL(malloc_test_check(idx, malloc_test_sizes[idx]));
+        if (malloc_test_rand() % 4 == 0) {
+            p = realloc(malloc_test_ptrs[idx], len);
+            if (p == NULL) {
+                /* The old block is still there. */
+                continue;
+            }
+            malloc_test_ptrs[idx] = p;
+            if (len > malloc_test_sizes[idx]) {
+                len = malloc_test_sizes[idx];
+            }
+            TEST_ASSERT_FATAL(malloc_test_check(idx, len));
+            malloc_test_sizes[idx] = malloc_usable_size(p);
+            malloc_test_fill(idx);
+        } else {
+            free(malloc_test_ptrs[idx]);
+            malloc_test_ptrs[idx] = NULL;
+        }
+    }
+
+    malloc_test_free_all();
+    malloc_test_check_restored(free_bytes, largest_block);
+}
+
+TEST_SUITE(malloc_test_suite)
+{
+    malloc_test_split_coalesce();
+    malloc_test_realloc();
+    malloc_test_usable_size();
+    malloc_test_stress();
+}
+
+int
+baselibc_test_all(void)
+{
+    malloc_test_suite();
+    return tu_case_failed;
+}
+
+#ifdef MYNEWT_SELFTEST
+
+int
+main(int argc, char **argv)
+{
+    tu_config.tc_print_results = 1;
+    tu_init();
+
+    baselibc_test_all();
+
+    return tu_any_failed;
+}
+
+#endif
@@ -60,6 +60,7 @@
 #define NMGR_ID_MPSTATS         3
 #define NMGR_ID_DATETIME_STR    4
 #define NMGR_ID_RESET           5
+#define NMGR_ID_TRACE           6
 
 struct nmgr_hdr {
     uint8_t  nh_op;             /* NMGR_OP_XXX */
@@ -75,6 +76,7 @@ struct nmgr_jbuf {
     struct json_buffer njb_buf;
     struct json_encoder njb_enc;
     struct os_mbuf *njb_in_m;
+    struct os_mbuf_iter njb_in_iter;
     struct os_mbuf *njb_out_m;
     struct nmgr_hdr *njb_hdr;
     uint16_t njb_off;
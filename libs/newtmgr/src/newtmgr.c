@@ -53,6 +53,9 @@ static const struct nmgr_handler nmgr_def_group_handlers[] = {
     [NMGR_ID_MPSTATS] = {nmgr_def_mpstat_read, NULL},
     [NMGR_ID_DATETIME_STR] = {nmgr_datetime_get, nmgr_datetime_set},
     [NMGR_ID_RESET] = {NULL, nmgr_reset},
+#ifdef OS_TRACE
+    [NMGR_ID_TRACE] = {nmgr_def_trace_read, NULL},
+#endif
 };
 
 /* JSON buffer for NMGR task
@@ -250,7 +253,7 @@ static char
 nmgr_jbuf_read_next(struct json_buffer *jb)
 {
     struct nmgr_jbuf *njb;
-    char c;
+    uint8_t c;
     int rc;
 
     njb = (struct nmgr_jbuf *) jb;
@@ -259,7 +262,7 @@ nmgr_jbuf_read_next(struct json_buffer *jb)
         return '\0';
     }
 
-    rc = os_mbuf_copydata(njb->njb_in_m, njb->njb_off, 1, &c);
+    rc = os_mbuf_iter_read_u8(&njb->njb_in_iter, &c);
     if (rc == -1) {
         c = '\0';
     }
@@ -272,7 +275,8 @@ static char
 nmgr_jbuf_read_prev(struct json_buffer *jb)
 {
     struct nmgr_jbuf *njb;
-    char c;
+    struct os_mbuf_iter it;
+    uint8_t c;
     int rc;
 
     njb = (struct nmgr_jbuf *) jb;
@@ -281,8 +285,13 @@ nmgr_jbuf_read_prev(struct json_buffer *jb)
         return '\0';
     }
 
+    /* The chain cannot be walked backwards; seek from its start. */
     --njb->njb_off;
-    rc = os_mbuf_copydata(njb->njb_in_m, njb->njb_off, 1, &c);
+    rc = os_mbuf_iter_init(&njb->njb_in_iter, njb->njb_in_m, njb->njb_off);
+    if (rc == 0) {
+        it = njb->njb_in_iter;
+        rc = os_mbuf_iter_read_u8(&it, &c);
+    }
     if (rc == -1) {
         c = '\0';
     }
@@ -294,6 +303,7 @@ static int
 nmgr_jbuf_readn(struct json_buffer *jb, char *buf, int size)
 {
     struct nmgr_jbuf *njb;
+    struct os_mbuf_iter it;
     int read;
     int left;
     int rc;
@@ -303,7 +313,8 @@ nmgr_jbuf_readn(struct json_buffer *jb, char *buf, int size)
     left = njb->njb_end - njb->njb_off;
     read = size > left ? left : size;
 
-    rc = os_mbuf_copydata(njb->njb_in_m, njb->njb_off, read, buf);
+    it = njb->njb_in_iter;
+    rc = os_mbuf_iter_read(&it, buf, read);
     if (rc != 0) {
         goto err;
     }
@@ -350,12 +361,16 @@ static int
 nmgr_jbuf_setibuf(struct nmgr_jbuf *njb, struct os_mbuf *m,
         uint16_t off, uint16_t len)
 {
+    int rc;
+
     njb->njb_off = off;
     njb->njb_end = off + len;
     njb->njb_in_m = m;
     njb->njb_enc.je_wr_commas = 0;
 
-    return (0);
+    rc = os_mbuf_iter_init(&njb->njb_in_iter, m, off);
+
+    return (rc);
 }
 
 static int
@@ -489,10 +504,12 @@ err:
 void
 nmgr_process(struct nmgr_transport *nt)
 {
+    struct os_mqueue_batch batch;
     struct os_mbuf *m;
 
+    os_mqueue_get_batch(&nt->nt_imq, &batch, 0);
     while (1) {
-        m = os_mqueue_get(&nt->nt_imq);
+        m = os_mqueue_batch_next(&batch);
         if (!m) {
             break;
         }
@@ -70,6 +70,10 @@ nmgr_def_taskstat_read(struct nmgr_jbuf *njb)
         json_encode_object_entry(&njb->njb_enc, "cswcnt", &jv);
         JSON_VALUE_UINT(&jv, oti.oti_runtime);
         json_encode_object_entry(&njb->njb_enc, "runtime", &jv);
+#ifdef OS_TASK_CPUTIME
+        JSON_VALUE_UINT(&jv, oti.oti_cputime);
+        json_encode_object_entry(&njb->njb_enc, "cputime", &jv);
+#endif
         JSON_VALUE_UINT(&jv, oti.oti_last_checkin);
         json_encode_object_entry(&njb->njb_enc, "last_checkin", &jv);
         JSON_VALUE_UINT(&jv, oti.oti_next_checkin);
@@ -77,6 +81,10 @@ nmgr_def_taskstat_read(struct nmgr_jbuf *njb)
         json_encode_object_finish(&njb->njb_enc);
     }
     json_encode_object_finish(&njb->njb_enc);
+#ifdef OS_TASK_CPUTIME
+    JSON_VALUE_UINT(&jv, os_cputime_isr_usecs());
+    json_encode_object_entry(&njb->njb_enc, "isr_cputime", &jv);
+#endif
     json_encode_object_finish(&njb->njb_enc);
 
     return (0);
@@ -118,6 +126,24 @@ nmgr_def_mpstat_read(struct nmgr_jbuf *njb)
         json_encode_object_entry(&njb->njb_enc, "nblks", &jv);
         JSON_VALUE_UINT(&jv, omi.omi_num_free);
         json_encode_object_entry(&njb->njb_enc, "nfree", &jv);
+#ifdef OS_MEMPOOL_STATS
+        JSON_VALUE_UINT(&jv, omi.omi_min_free);
+        json_encode_object_entry(&njb->njb_enc, "minfree", &jv);
+        JSON_VALUE_UINT(&jv, omi.omi_num_allocs);
+        json_encode_object_entry(&njb->njb_enc, "nalloc", &jv);
+        JSON_VALUE_UINT(&jv, omi.omi_num_fails);
+        json_encode_object_entry(&njb->njb_enc, "nfail", &jv);
+        if (omi.omi_num_fails != 0) {
+            JSON_VALUE_UINT(&jv, omi.omi_first_fail);
+            json_encode_object_entry(&njb->njb_enc, "firstfail", &jv);
+            JSON_VALUE_UINT(&jv, (uintptr_t)omi.omi_fail_caller);
+            json_encode_object_entry(&njb->njb_enc, "failcaller", &jv);
+        }
+        if (omi.omi_owner[0] != '\0') {
+            JSON_VALUE_STRING(&jv, omi.omi_owner);
+            json_encode_object_entry(&njb->njb_enc, "owner", &jv);
+        }
+#endif
         json_encode_object_finish(&njb->njb_enc);
     }
 
@@ -133,6 +159,83 @@ nmgr_def_mpstat_write(struct nmgr_jbuf *njb)
     return (OS_EINVAL);
 }
 
+#ifdef OS_TRACE
+/* Most trace records returned by one request */
+#define NMGR_TRACE_MAX_RECS     (16)
+
+/**
+ * Returns the trace records of core "cpu", starting at sequence number
+ * "seq". "next" in the response is the sequence number to ask for next.
+ */
+int
+nmgr_def_trace_read(struct nmgr_jbuf *njb)
+{
+    unsigned long long cpu;
+    unsigned long long seq;
+    struct os_trace_rec rec;
+    struct json_value jv;
+    uint32_t next;
+    int rc;
+    int i;
+    const struct json_attr_t trace_attr[3] = {
+        [0] = {
+            .attribute = "cpu",
+            .type = t_uinteger,
+            .addr.uinteger = &cpu,
+        },
+        [1] = {
+            .attribute = "seq",
+            .type = t_uinteger,
+            .addr.uinteger = &seq,
+        },
+        [2] = {
+            .attribute = NULL
+        }
+    };
+
+    cpu = 0;
+    seq = 0;
+    rc = json_read_object(&njb->njb_buf, trace_attr);
+    if (rc != 0 || cpu >= OS_CPUS) {
+        return (OS_EINVAL);
+    }
+
+    json_encode_object_start(&njb->njb_enc);
+    JSON_VALUE_INT(&jv, NMGR_ERR_EOK);
+    json_encode_object_entry(&njb->njb_enc, "rc", &jv);
+
+    json_encode_array_name(&njb->njb_enc, "recs");
+    json_encode_array_start(&njb->njb_enc);
+
+    next = seq;
+    for (i = 0; i < NMGR_TRACE_MAX_RECS; i++) {
+        if (os_trace_read(cpu, &next, &rec) != 0) {
+            break;
+        }
+
+        json_encode_object_start(&njb->njb_enc);
+        JSON_VALUE_UINT(&jv, next - 1);
+        json_encode_object_entry(&njb->njb_enc, "seq", &jv);
+        JSON_VALUE_UINT(&jv, rec.otr_time);
+        json_encode_object_entry(&njb->njb_enc, "time", &jv);
+        JSON_VALUE_UINT(&jv, rec.otr_type);
+        json_encode_object_entry(&njb->njb_enc, "type", &jv);
+        JSON_VALUE_UINT(&jv, rec.otr_taskid);
+        json_encode_object_entry(&njb->njb_enc, "tid", &jv);
+        JSON_VALUE_UINT(&jv, rec.otr_arg);
+        json_encode_object_entry(&njb->njb_enc, "arg", &jv);
+        json_encode_object_finish(&njb->njb_enc);
+    }
+
+    json_encode_array_finish(&njb->njb_enc);
+    JSON_VALUE_UINT(&jv, next);
+    json_encode_object_entry(&njb->njb_enc, "next", &jv);
+    json_encode_object_finish(&njb->njb_enc);
+
+    return (0);
+}
+#endif
+
 int
 nmgr_datetime_get(struct nmgr_jbuf *njb)
 {
@@ -27,5 +27,8 @@ int nmgr_def_logs_read(struct nmgr_jbuf *);
 int nmgr_datetime_get(struct nmgr_jbuf *);
 int nmgr_datetime_set(struct nmgr_jbuf *);
 int nmgr_reset(struct nmgr_jbuf *);
+#ifdef OS_TRACE
+int nmgr_def_trace_read(struct nmgr_jbuf *);
+#endif
 
 #endif
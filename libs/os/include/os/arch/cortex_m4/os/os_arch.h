@@ -53,6 +53,9 @@ typedef uint32_t os_stack_t;
 #define OS_EXIT_CRITICAL(__os_sr) (os_arch_restore_sr(__os_sr))
 #define OS_ASSERT_CRITICAL() (assert(os_arch_in_critical()))
 
+/* Atomic compare-and-swap is available (LDREX/STREX) */
+#define OS_ARCH_HAS_CAS
+
 os_stack_t *os_arch_task_stack_init(struct os_task *, os_stack_t *, int);
 void timer_handler(void);
 void os_arch_ctx_sw(struct os_task *);
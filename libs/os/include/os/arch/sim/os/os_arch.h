@@ -60,6 +60,9 @@ typedef unsigned int os_stack_t;
 #define OS_EXIT_CRITICAL(__os_sr) (os_arch_restore_sr(__os_sr))
 #define OS_ASSERT_CRITICAL() (assert(os_arch_in_critical()))
 
+/* Atomic compare-and-swap is available (host atomics) */
+#define OS_ARCH_HAS_CAS
+
 void _Die(char *file, int line);
 
 os_stack_t *os_arch_task_stack_init(struct os_task *, os_stack_t *, int);
@@ -71,6 +74,30 @@ os_error_t os_arch_os_init(void);
 void os_arch_os_stop(void);
 os_error_t os_arch_os_start(void);
 
+#ifdef OS_SIM_EPOLL
+/* Simulated peripherals multiplexed into the idle/tick event loop */
+typedef void (*os_arch_sim_fd_cb)(int fd, uint32_t events, void *arg);
+
+int os_arch_sim_fd_add(int fd, uint32_t events, os_arch_sim_fd_cb cb,
+                       void *arg);
+int os_arch_sim_fd_del(int fd);
+#endif
+
+#ifdef OS_SIM_VTIME
+/* Host monotonic time plus the time skipped while idle, in nanoseconds */
+uint64_t os_arch_sim_vtime_nsecs(void);
+#endif
+
+#ifdef OS_SMP
+/* Cores are simulated by host threads, see os_arch_sim_smp.c */
+#define OS_ARCH_SMP
+#define OS_SPIN_RELAX() os_arch_spin_relax()
+
+int os_arch_cpu_id(void);
+void os_arch_cpu_kick(int cpu);
+void os_arch_spin_relax(void);
+#endif
+
 void os_bsp_init(void);
 
 #endif /* _OS_ARCH_SIM_H */
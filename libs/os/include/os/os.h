@@ -85,14 +85,18 @@ void os_init_idle_task(void);
 
 #include "os/os_sanity.h"
 #include "os/os_arch.h"
+#include "os/os_smp.h"
 #include "os/os_time.h"
 #include "os/os_task.h"
 #include "os/os_sched.h"
+#include "os/os_trace.h"
 #include "os/os_eventq.h"
 #include "os/os_callout.h" 
 #include "os/os_heap.h"
 #include "os/os_mutex.h"
 #include "os/os_sem.h"
+#include "os/os_evgroup.h"
+#include "os/os_evtask.h"
 #include "os/os_mempool.h"
 #include "os/os_mbuf.h"
 
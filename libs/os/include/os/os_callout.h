@@ -21,13 +21,19 @@
 #ifndef _OS_CALLOUT_H
 #define _OS_CALLOUT_H
 
+#include "os/os_wheel.h"
+
 #define OS_CALLOUT_F_QUEUED (0x01)
 
 struct os_callout {
     struct os_event c_ev;
     struct os_eventq *c_evq;
     uint32_t c_ticks;
+#ifdef OS_TIMER_WHEEL
+    struct os_wheel_entry c_wheel;
+#else
     TAILQ_ENTRY(os_callout) c_next;
+#endif
 };
 
 typedef void (*os_callout_func_t)(void *);
@@ -51,7 +57,11 @@ os_time_t os_callout_wakeup_ticks(os_time_t now);
 static inline int
 os_callout_queued(struct os_callout *c)
 {
+#ifdef OS_TIMER_WHEEL
+    return os_wheel_entry_queued(&c->c_wheel);
+#else
     return c->c_next.tqe_prev != NULL;
+#endif
 }
 
 #endif /* _OS_CALLOUT_H */
@@ -26,6 +26,7 @@
 struct os_event {
     uint8_t ev_queued;
     uint8_t ev_type;
+    uint8_t ev_prio;        /* Level the event is queued at */
     void *ev_arg;
     STAILQ_ENTRY(os_event) ev_next;
 };
@@ -36,16 +37,61 @@ struct os_event {
 #define OS_EVENT_T_MQUEUE_DATA (2) 
 #define OS_EVENT_T_PERUSER (16)
 
+/*
+ * Priority levels of an event queue.  Level 0 is the most urgent; every get
+ * drains the more urgent levels first, and events of the same level come
+ * out in the order they were put.  os_eventq_put() queues at
+ * OS_EVENTQ_PRIO_NORMAL, the least urgent level.
+ *
+ * The levels are only kept apart with OS_EVENTQ_PRIO.  Without it a queue
+ * is a single FIFO, and os_eventq_put_prio() queues at the normal level
+ * whatever level it is given.
+ */
+#ifndef OS_EVENTQ_PRIOS
+#define OS_EVENTQ_PRIOS         (3)
+#endif
+#if OS_EVENTQ_PRIOS < 2 || OS_EVENTQ_PRIOS > 8
+#error "OS_EVENTQ_PRIOS must be between 2 and 8"
+#endif
+#define OS_EVENTQ_PRIO_URGENT   (0)
+#define OS_EVENTQ_PRIO_NORMAL   (OS_EVENTQ_PRIOS - 1)
+
+STAILQ_HEAD(os_event_list, os_event);
+
+struct os_evgroup;
+
 struct os_eventq {
     struct os_task *evq_task;
-    STAILQ_HEAD(, os_event) evq_list;
+    /* Events at OS_EVENTQ_PRIO_NORMAL */
+    struct os_event_list evq_list;
+#ifdef OS_EVENTQ_PRIO
+    /* Events at the more urgent levels */
+    struct os_event_list evq_prio_list[OS_EVENTQ_PRIOS - 1];
+    /* Bit n is set while level n has events */
+    uint8_t evq_prio_map;
+#endif
+    /* Event group signalled when an event is put, see os_eventq_set_evgroup */
+    struct os_evgroup *evq_evg;
+    uint32_t evq_evg_bits;
+
+#ifdef OS_EVENTQ_PRIO
+    /* Per level: events queued now, the most there have been, and puts */
+    uint16_t evq_depth[OS_EVENTQ_PRIOS];
+    uint16_t evq_max_depth[OS_EVENTQ_PRIOS];
+    uint32_t evq_puts[OS_EVENTQ_PRIOS];
+#endif
 };
 
 void os_eventq_init(struct os_eventq *);
 void os_eventq_put(struct os_eventq *, struct os_event *);
+void os_eventq_put_prio(struct os_eventq *, struct os_event *, uint8_t prio);
 struct os_event *os_eventq_get(struct os_eventq *);
+struct os_event *os_eventq_get_no_wait(struct os_eventq *);
+struct os_event *os_eventq_peek(struct os_eventq *);
 struct os_event *os_eventq_poll(struct os_eventq **, int, os_time_t);
 void os_eventq_remove(struct os_eventq *, struct os_event *);
+void os_eventq_set_evgroup(struct os_eventq *, struct os_evgroup *,
+        uint32_t);
 
 #endif /* _OS_EVENTQ_H */
 
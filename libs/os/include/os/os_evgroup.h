@@ -0,0 +1,66 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _OS_EVGROUP_H_
+#define _OS_EVGROUP_H_
+
+#include <inttypes.h>
+#include "os/queue.h"
+
+/*
+ * Event group: 32 flag bits that tasks and interrupt handlers set and clear,
+ * and that tasks wait on, for any or all of a mask.  An event queue can be
+ * told to set bits in a group whenever an event is put on it (see
+ * os_eventq_set_evgroup()), so a task serving many queues sleeps on one
+ * group instead of polling the queues.
+ */
+struct os_evgroup
+{
+    SLIST_HEAD(, os_task) evg_head;     /* chain of waiting tasks */
+    uint32_t    evg_bits;
+};
+
+/* Options for os_evgroup_wait() */
+#define OS_EVGROUP_WAIT_ANY     (0x00)  /* Any bit of the mask will do */
+#define OS_EVGROUP_WAIT_ALL     (0x01)  /* Wait for all bits of the mask */
+#define OS_EVGROUP_CLEAR        (0x02)  /* Clear the bits waited for */
+
+/* Initialize an event group */
+os_error_t os_evgroup_init(struct os_evgroup *evg);
+
+/* Set bits, waking the tasks this satisfies */
+os_error_t os_evgroup_set(struct os_evgroup *evg, uint32_t bits);
+
+/* Clear bits */
+os_error_t os_evgroup_clear(struct os_evgroup *evg, uint32_t bits);
+
+/* Wait for any or all of a mask of bits */
+os_error_t os_evgroup_wait(struct os_evgroup *evg, uint32_t bits,
+        uint8_t opts, uint32_t timeout, uint32_t *out_bits);
+
+/* Current bits of an event group */
+#define os_evgroup_get(__evg)   ((__evg)->evg_bits)
+
+/*
+ * Set bits from inside a critical section; returns 1 if a task was woken
+ * and the caller should call os_sched() once it has left the section.
+ */
+int os_evgroup_set_locked(struct os_evgroup *evg, uint32_t bits);
+
+#endif  /* _OS_EVGROUP_H_ */
@@ -0,0 +1,89 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _OS_EVTASK_H_
+#define _OS_EVTASK_H_
+
+#include <inttypes.h>
+#include "os/os_task.h"
+#include "os/os_eventq.h"
+#include "os/os_evgroup.h"
+
+/*
+ * Event tasks: services that only ever wait on one event queue, run as
+ * handlers on a shared stack instead of as tasks with their own.
+ *
+ * An event task pool is one OS task, with one stack, serving up to 32
+ * event tasks. An event task owns an event queue; whenever that queue has
+ * events, the pool's worker calls the handler with them one at a time.
+ * Handlers run to completion and must not block. Within a pool the event
+ * task with the lowest et_prio goes first, checked again after every
+ * event, so urgent work waits for at most one handler. Event tasks in a
+ * pool whose worker has a higher OS priority preempt them outright.
+ */
+struct os_evtask;
+
+typedef void (*os_evtask_func_t)(struct os_evtask *et, struct os_event *ev);
+
+struct os_evtask {
+    struct os_eventq et_evq;        /* Events for this event task */
+    os_evtask_func_t et_func;
+    void *et_arg;
+    const char *et_name;
+    struct os_evpool *et_pool;
+    uint8_t et_prio;                /* 0 is the most urgent in the pool */
+    uint32_t et_runs;               /* Events handled */
+};
+
+#define OS_EVPOOL_MAX_EVTASKS   (32)
+
+struct os_evpool {
+    struct os_task ep_task;         /* Worker, on the shared stack */
+    struct os_evgroup ep_evg;       /* Bit n: event task n has events */
+    uint32_t ep_pending;            /* Bits taken but not yet drained */
+    struct os_evtask *ep_evtasks[OS_EVPOOL_MAX_EVTASKS];
+};
+
+os_error_t os_evpool_init(struct os_evpool *ep, char *name, uint8_t prio,
+        os_stack_t *stack_bottom, uint16_t stack_size);
+os_error_t os_evtask_init(struct os_evtask *et, struct os_evpool *ep,
+        const char *name, os_evtask_func_t func, void *arg, uint8_t prio);
+void os_evtask_remove(struct os_evtask *et);
+
+/* The queue to put an event task's events on */
+#define os_evtask_eventq(__et)  (&(__et)->et_evq)
+
+#ifdef OS_EVPOOL
+/*
+ * Default pool, started by os_init() for the system's own event tasks and
+ * for the application's.
+ */
+#ifndef OS_EVPOOL_PRIO
+#define OS_EVPOOL_PRIO          (0)
+#endif
+#ifndef OS_EVPOOL_STACK_SIZE
+#define OS_EVPOOL_STACK_SIZE    (OS_IDLE_STACK_SIZE)
+#endif
+
+extern struct os_evpool g_os_evpool;
+
+void os_evpool_dflt_init(void);
+#endif
+
+#endif  /* _OS_EVTASK_H_ */
@@ -26,5 +26,9 @@ void *os_malloc(size_t size);
 void os_free(void *mem);
 void *os_realloc(void *ptr, size_t size);
 
+#ifdef OS_MALLOC_CACHE
+void os_malloc_cache_flush(void);
+#endif
+
 #endif
 
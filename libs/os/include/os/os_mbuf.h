@@ -20,6 +20,7 @@
 #ifndef _OS_MBUF_H 
 #define _OS_MBUF_H 
 
+#include <string.h>
 #include "os/queue.h"
 #include "os/os_eventq.h"
 
@@ -45,6 +46,17 @@ struct os_mbuf_pool {
      */
     struct os_mempool *omp_pool;
 
+    /**
+     * msys allocations by size class: mbufs handed out from this pool, how
+     * many of those were for a smaller class that had run out, how often
+     * this pool had run out itself, and how many requests were larger than
+     * its blocks while no larger class was registered.
+     */
+    uint32_t omp_msys_nget;
+    uint32_t omp_msys_nfallback;
+    uint32_t omp_msys_nmiss;
+    uint32_t omp_msys_nbig;
+
     /**
      * Link to the next mbuf pool for system memory pools.
      */
@@ -64,12 +76,55 @@ struct os_mbuf_pkthdr {
      * Flags
      */
     uint16_t omp_flags;
+#ifdef OS_MQUEUE_PKT_WAIT
+    /**
+     * When the packet was last put on a mbuf queue.
+     */
+    os_time_t omp_enq_time;
+#endif
     /**
      * Next packet in the mbuf chain.
      */
     STAILQ_ENTRY(os_mbuf_pkthdr) omp_next;
 };
 
+struct os_mbuf_ext;
+
+/**
+ * Called when the last mbuf referencing a piece of external storage is
+ * freed.
+ */
+typedef void (*os_mbuf_ext_free_func_t)(struct os_mbuf_ext *ext);
+
+/**
+ * External storage that mbufs can carry data in, instead of their own data
+ * buffer.  The descriptor is owned by the caller and must stay valid until
+ * its free function gets called.  Any number of mbufs can reference (parts
+ * of) the same storage; it is never written through the mbuf functions.
+ */
+struct os_mbuf_ext {
+    /**
+     * Start of the storage
+     */
+    uint8_t *ome_buf;
+    /**
+     * Length of the storage
+     */
+    uint32_t ome_len;
+    /**
+     * Number of mbufs referencing the storage
+     */
+    uint16_t ome_refcnt;
+    /**
+     * Called once the storage is no longer referenced; can be NULL
+     */
+    os_mbuf_ext_free_func_t ome_free;
+    /**
+     * Argument for the free function
+     */
+    void *ome_arg;
+};
+
 /**
  * Chained memory buffer.
  */
@@ -107,11 +162,68 @@ struct os_mbuf {
     uint8_t om_databuf[0];
 };
 
+/**
+ * Cursor for reading through an mbuf chain in place.  Data only gets
+ * copied when a value straddles two buffers of the chain.
+ */
+struct os_mbuf_iter {
+    /**
+     * The mbuf the cursor is in, NULL at the end of the chain
+     */
+    struct os_mbuf *omi_om;
+    /**
+     * Offset of the cursor within omi_om
+     */
+    uint16_t omi_off;
+};
+
+/**
+ * One contiguous segment of an mbuf chain, see os_mbuf_iov_get().
+ */
+struct os_mbuf_iov {
+    void *omv_base;
+    uint16_t omv_len;
+};
+
+struct os_mqueue;
+
+/**
+ * Called when a mbuf queue crosses its high watermark (throttle set) or
+ * drops back to its low watermark (throttle clear).
+ */
+typedef void (*os_mqueue_wm_func_t)(struct os_mqueue *mq, int throttle,
+                                    void *arg);
+
 struct os_mqueue {
     STAILQ_HEAD(, os_mbuf_pkthdr) mq_head;
     struct os_event mq_ev;
+
+    /* Packets queued now, and the most there have been at once */
+    uint16_t mq_len;
+    uint16_t mq_max_len;
+    /* Packets put since os_mqueue_init() */
+    uint32_t mq_num_puts;
+#ifndef OS_MQUEUE_PKT_WAIT
+    /* When the queue last went from empty to non-empty */
+    os_time_t mq_busy_since;
+#endif
+    /*
+     * Longest a packet has waited on the queue before a get took it off.
+     * Without OS_MQUEUE_PKT_WAIT, the longest the queue had been non-empty
+     * when a get took packets off it: no packet has waited longer.
+     */
+    os_time_t mq_max_wait;
+
+    uint16_t mq_high_wm;
+    uint16_t mq_low_wm;
+    uint8_t mq_throttled;
+    os_mqueue_wm_func_t mq_wm_func;
+    void *mq_wm_arg;
 };
 
+/* Packets taken off a mbuf queue together by os_mqueue_get_batch() */
+STAILQ_HEAD(os_mqueue_batch, os_mbuf_pkthdr);
+
 /*
  * Given a flag number, provide the mask for it
  *
@@ -119,6 +231,47 @@ struct os_mqueue {
  */
 #define OS_MBUF_F_MASK(__n) (1 << (__n))
 
+/* The data is in external storage (OS_MBUF_EXT()), not in om_databuf */
+#define OS_MBUF_F_EXT       (0)
+
+/*
+ * Checks whether the data of a given mbuf is in external storage
+ *
+ * @param __om The mbuf to check
+ */
+#define OS_MBUF_IS_EXT(__om) \
+    ((__om)->om_flags & OS_MBUF_F_MASK(OS_MBUF_F_EXT))
+
+/*
+ * Where an mbuf with OS_MBUF_F_EXT keeps its external storage descriptor.
+ * Such an mbuf holds no data in its own buffer, so the pointer goes in the
+ * last bytes of it, out of the way of a packet header.
+ *
+ * @param __om The mbuf
+ */
+#define OS_MBUF_EXT_SLOT(__om)                                          \
+    (&(__om)->om_databuf[0] + (__om)->om_omp->omp_databuf_len -         \
+     sizeof (struct os_mbuf_ext *))
+
+/* Called by OS_MBUF_EXT() macro. */
+static inline struct os_mbuf_ext *
+_os_mbuf_ext(struct os_mbuf *om)
+{
+    struct os_mbuf_ext *ext;
+
+    /* The slot is not necessarily aligned. */
+    memcpy(&ext, OS_MBUF_EXT_SLOT(om), sizeof ext);
+
+    return (ext);
+}
+
+/*
+ * Returns the external storage of an mbuf with OS_MBUF_F_EXT set
+ *
+ * @param __om The mbuf
+ */
+#define OS_MBUF_EXT(__om) _os_mbuf_ext(__om)
+
 /* 
  * Checks whether a given mbuf is a packet header mbuf 
  *
@@ -176,6 +329,11 @@ _os_mbuf_leadingspace(struct os_mbuf *om)
     uint16_t startoff;
     uint16_t leadingspace;
 
+    /* External storage is read-only */
+    if (OS_MBUF_IS_EXT(om)) {
+        return (0);
+    }
+
     startoff = 0;
     if (OS_MBUF_IS_PKTHDR(om)) {
         startoff = om->om_pkthdr_len;
@@ -205,6 +363,10 @@ _os_mbuf_trailingspace(struct os_mbuf *om)
 {
     struct os_mbuf_pool *omp;
 
+    if (OS_MBUF_IS_EXT(om)) {
+        return (0);
+    }
+
     omp = om->om_omp;
 
     return (&om->om_databuf[0] + omp->omp_databuf_len) -
@@ -233,6 +395,17 @@ struct os_mbuf *os_mqueue_get(struct os_mqueue *);
 /* Put an element in a mbuf queue */
 int os_mqueue_put(struct os_mqueue *, struct os_eventq *, struct os_mbuf *);
 
+/* Get up to max elements from a mbuf queue at once */
+int os_mqueue_get_batch(struct os_mqueue *, struct os_mqueue_batch *batch,
+        int max);
+
+/* Get the next element of a batch */
+struct os_mbuf *os_mqueue_batch_next(struct os_mqueue_batch *batch);
+
+/* Set the watermarks and the backpressure callback of a mbuf queue */
+int os_mqueue_set_watermarks(struct os_mqueue *, uint16_t high, uint16_t low,
+        os_mqueue_wm_func_t func, void *arg);
+
 /* Register an mbuf pool with the system pool registry */
 int os_msys_register(struct os_mbuf_pool *);
 
@@ -245,6 +418,12 @@ void os_msys_reset(void);
 /* Return a packet header mbuf from the system pool */
 struct os_mbuf *os_msys_get_pkthdr(uint16_t dsize, uint16_t user_hdr_len);
 
+/* Repack a chain into the fewest system pool blocks */
+struct os_mbuf *os_msys_pack(struct os_mbuf *om);
+
+/* Walk the pools registered with the system pool registry */
+struct os_mbuf_pool *os_msys_pool_get_next(struct os_mbuf_pool *prev);
+
 /* Initialize a mbuf pool */
 int os_mbuf_pool_init(struct os_mbuf_pool *, struct os_mempool *mp, 
         uint16_t, uint16_t);
@@ -256,6 +435,18 @@ struct os_mbuf *os_mbuf_get(struct os_mbuf_pool *omp, uint16_t);
 struct os_mbuf *os_mbuf_get_pkthdr(struct os_mbuf_pool *omp, 
         uint8_t pkthdr_len);
 
+/* Initialize an external storage descriptor */
+void os_mbuf_ext_init(struct os_mbuf_ext *ext, void *buf, uint32_t len,
+        os_mbuf_ext_free_func_t free_func, void *arg);
+
+/* Allocate a new mbuf referencing external storage */
+struct os_mbuf *os_mbuf_get_ext(struct os_mbuf_pool *omp,
+        struct os_mbuf_ext *ext, uint32_t off, uint16_t len);
+
+/* Append external storage onto a mbuf, without copying it */
+int os_mbuf_append_ext(struct os_mbuf *om, struct os_mbuf_ext *ext,
+        uint32_t off, uint32_t len);
+
 /* Duplicate a mbuf from the pool */
 struct os_mbuf *os_mbuf_dup(struct os_mbuf *m);
 
@@ -273,6 +464,18 @@ int os_mbuf_free(struct os_mbuf *mb);
 /* Free a mbuf chain */
 int os_mbuf_free_chain(struct os_mbuf *om);
 
+/* Reading an mbuf chain without copying it */
+int os_mbuf_iter_init(struct os_mbuf_iter *it, struct os_mbuf *om, int off);
+void *os_mbuf_iter_peek(struct os_mbuf_iter *it, uint16_t *out_len);
+int os_mbuf_iter_advance(struct os_mbuf_iter *it, int len);
+void *os_mbuf_iter_get(struct os_mbuf_iter *it, int len, void *buf);
+int os_mbuf_iter_read(struct os_mbuf_iter *it, void *dst, int len);
+int os_mbuf_iter_read_u8(struct os_mbuf_iter *it, uint8_t *val);
+int os_mbuf_iter_read_le16(struct os_mbuf_iter *it, uint16_t *val);
+int os_mbuf_iter_read_le32(struct os_mbuf_iter *it, uint32_t *val);
+int os_mbuf_iov_get(struct os_mbuf *om, int off, int len,
+        struct os_mbuf_iov *iov, int iovcnt);
+
 void os_mbuf_adj(struct os_mbuf *mp, int req_len);
 int os_mbuf_memcmp(const struct os_mbuf *om, int off, const void *data,
                    int len);
@@ -33,6 +33,23 @@ struct os_memblock {
     SLIST_ENTRY(os_memblock) mb_next;
 };
 
+/*
+ * With OS_MEMPOOL_LOCKFREE the free list is a lock-free stack: gets and
+ * puts do not disable interrupts, and on SMP builds they do not take the
+ * kernel lock. This needs compare-and-swap (or LL/SC) from the
+ * architecture. The head is kept in mp_head as a 16-bit generation tag and
+ * a 16-bit block index (1-based, 0 is empty) so a plain 32-bit CAS detects
+ * ABA. Pools with more blocks than fit in the index fall back to the
+ * critical section. In lock-free pools SLIST_FIRST() is only valid right
+ * after os_mempool_init().
+ */
+#ifdef OS_MEMPOOL_LOCKFREE
+#ifndef OS_ARCH_HAS_CAS
+#error "OS_MEMPOOL_LOCKFREE needs an architecture with compare-and-swap"
+#endif
+#define OS_MEMPOOL_LF_MAX_BLOCKS    (0xfffe)
+#endif
+
 /* XXX: Change this structure so that we keep the first address in the pool? */
 /* XXX: add memory debug structure and associated code */
 /* XXX: Change how I coded the SLIST_HEAD here. It should be named:
@@ -47,6 +64,17 @@ struct os_mempool {
     STAILQ_ENTRY(os_mempool) mp_list;
     SLIST_HEAD(,os_memblock);   /* Pointer to list of free blocks */
     char *name;                 /* Name for memory block */
+#ifdef OS_MEMPOOL_LOCKFREE
+    volatile uint32_t mp_head;  /* Tagged free list head, see below */
+#endif
+#ifdef OS_MEMPOOL_STATS
+    int mp_min_free;            /* Fewest free blocks since init */
+    uint32_t mp_num_allocs;     /* Blocks handed out since init */
+    uint32_t mp_num_fails;      /* Gets that found the pool empty */
+    os_time_t mp_first_fail;    /* OS time of the first failed get */
+    void *mp_fail_caller;       /* Caller of the last failed get */
+    const char *mp_owner;       /* Optional owner tag */
+#endif
 };
 
 #define OS_MEMPOOL_INFO_NAME_LEN (32)
@@ -56,6 +84,14 @@ struct os_mempool_info {
     int omi_num_blocks;
     int omi_num_free;
     char omi_name[OS_MEMPOOL_INFO_NAME_LEN];
+#ifdef OS_MEMPOOL_STATS
+    int omi_min_free;
+    uint32_t omi_num_allocs;
+    uint32_t omi_num_fails;
+    os_time_t omi_first_fail;
+    void *omi_fail_caller;
+    char omi_owner[OS_MEMPOOL_INFO_NAME_LEN];
+#endif
 };
 
 struct os_mempool *os_mempool_info_get_next(struct os_mempool *, 
@@ -82,10 +118,53 @@ typedef uint64_t os_membuf_t;
 os_error_t os_mempool_init(struct os_mempool *mp, int blocks, int block_size, 
                            void *membuf, char *name);
 
+/*
+ * Usage statistics, enabled with the OS_MEMPOOL_STATS feature. The owner
+ * tag names the subsystem a pool belongs to, so a pool that runs dry can
+ * be traced back to its user; set it after os_mempool_init().
+ */
+#ifdef OS_MEMPOOL_STATS
+void os_mempool_set_owner(struct os_mempool *mp, const char *owner);
+#else
+#define os_mempool_set_owner(__mp, __owner)
+#endif
+
 /* Get a memory block from the pool */
 void *os_memblock_get(struct os_mempool *mp);
 
 /* Put the memory block back into the pool */
 os_error_t os_memblock_put(struct os_mempool *mp, void *block_addr);
 
+/* Get up to n blocks from the pool; returns the number of blocks taken */
+int os_memblock_get_n(struct os_mempool *mp, void **blocks, int n);
+
+/* Put n blocks back into the pool */
+os_error_t os_memblock_put_n(struct os_mempool *mp, void **blocks, int n);
+
+/*
+ * Magazine: a small per-task cache of blocks from one pool, in the style
+ * of the per-CPU caches of a slab allocator. Gets and puts are served from
+ * the magazine's slot array; the pool is only touched to exchange half a
+ * magazine at a time with os_memblock_get_n()/os_memblock_put_n(). Pools
+ * opt in by having their users allocate through a magazine instead of
+ * calling os_memblock_get() directly.
+ *
+ * A magazine belongs to one task and must not be shared, or used from
+ * interrupt context. Blocks held in a magazine are not free in the pool;
+ * call os_mempool_mag_flush() to give them back.
+ */
+struct os_mempool_mag {
+    struct os_mempool *mm_pool;
+    void **mm_slots;
+    uint16_t mm_size;
+    uint16_t mm_count;
+};
+
+os_error_t os_mempool_mag_init(struct os_mempool_mag *mag,
+                               struct os_mempool *mp, void **slots,
+                               int nslots);
+void *os_mempool_mag_get(struct os_mempool_mag *mag);
+os_error_t os_mempool_mag_put(struct os_mempool_mag *mag, void *block_addr);
+void os_mempool_mag_flush(struct os_mempool_mag *mag);
+
 #endif  /* _OS_MEMPOOL_H_ */
@@ -30,6 +30,13 @@ struct os_mutex
     uint8_t     mu_prio;            /* owner's default priority*/
     uint16_t    mu_level;           /* call nesting level */
     struct os_task *mu_owner;       /* owners task */
+#ifdef OS_MUTEX_STATS
+    uint32_t    mu_num_pends;       /* times the mutex was acquired */
+    uint32_t    mu_num_waits;       /* pends that had to wait */
+    uint32_t    mu_acquired;        /* cputime of the last acquisition */
+    uint32_t    mu_max_hold;        /* longest hold, in cputime ticks */
+    uint64_t    mu_total_hold;      /* sum of all holds, in cputime ticks */
+#endif
 };
 
 /* 
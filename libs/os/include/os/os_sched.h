@@ -22,6 +22,7 @@
 
 #include "os/os_task.h"
 
+void os_sched_init(void);
 void os_sched_ctx_sw_hook(struct os_task *);
 struct os_task *os_sched_get_current_task(void);
 void os_sched_set_current_task(struct os_task *);
@@ -33,5 +34,26 @@ int os_sched_sleep(struct os_task *, os_time_t nticks);
 int os_sched_wakeup(struct os_task *);
 void os_sched_resort(struct os_task *);
 os_time_t os_sched_wakeup_ticks(os_time_t now);
+#ifdef OS_SMP
+void os_sched_requeue(struct os_task *);
+#endif
+
+/*
+ * Interrupt handlers call these on entry and exit. With OS_TASK_CPUTIME the
+ * time they take is not charged to the task they interrupted, and with
+ * OS_TRACE they show up in the trace.
+ */
+#if defined(OS_TASK_CPUTIME) || defined(OS_TRACE)
+void os_isr_enter(void);
+void os_isr_exit(void);
+#else
+#define os_isr_enter()
+#define os_isr_exit()
+#endif
+
+#ifdef OS_TASK_CPUTIME
+uint64_t os_cputime_isr_usecs(void);
+uint64_t os_cputime_to_usecs(uint64_t ticks);
+#endif
 
 #endif /* _OS_SCHED_H */
@@ -0,0 +1,115 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _OS_SMP_H
+#define _OS_SMP_H
+
+#include <stdint.h>
+
+/*
+ * Multi-core support, enabled with the OS_SMP feature.
+ *
+ * Every core has its own current task and its own run list. A task that
+ * becomes ready is queued on the allowed core running the least important
+ * task, and that core is told to reschedule if the new task should preempt
+ * it. A core that has nothing better to run takes the most important
+ * waiting task off another core's run list.
+ *
+ * Kernel objects are protected by a single kernel spinlock: on an SMP build
+ * OS_ENTER_CRITICAL() disables interrupts on the local core and takes the
+ * kernel lock, so code written for the single core kernel keeps working.
+ * os_spin_lock() and friends are available for driver data that must not
+ * depend on the kernel lock.
+ */
+
+/* Bitmask of cores, bit N for core N */
+typedef uint8_t os_cpumask_t;
+
+#ifdef OS_SMP
+
+#ifndef OS_CPUS
+#define OS_CPUS             (2)
+#endif
+
+#if OS_CPUS < 2 || OS_CPUS > 8
+#error "OS_CPUS must be between 2 and 8"
+#endif
+
+#ifndef OS_ARCH_SMP
+#error "OS_SMP is not supported on this architecture"
+#endif
+
+#define OS_CPU_MASK_ALL     ((os_cpumask_t)((1U << OS_CPUS) - 1))
+
+int os_smp_set_ncpus(int ncpus);
+int os_smp_ncpus(void);
+uint32_t os_smp_steals(int cpu);
+
+#define os_smp_cpu_id()     os_arch_cpu_id()
+
+#else
+
+#define OS_CPUS             (1)
+#define OS_CPU_MASK_ALL     ((os_cpumask_t)1)
+
+#define os_smp_ncpus()      (1)
+#define os_smp_cpu_id()     (0)
+
+#endif /* OS_SMP */
+
+#ifndef OS_SPIN_RELAX
+#define OS_SPIN_RELAX()
+#endif
+
+typedef volatile uint32_t os_spinlock_t;
+
+#define OS_SPINLOCK_INIT    (0)
+
+static inline void
+os_spin_init(os_spinlock_t *lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * Returns 1 if the lock was taken, 0 if it is held by someone else.
+ */
+static inline int
+os_spin_trylock(os_spinlock_t *lock)
+{
+    return (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE) == 0);
+}
+
+static inline void
+os_spin_lock(os_spinlock_t *lock)
+{
+    while (!os_spin_trylock(lock)) {
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED) != 0) {
+            OS_SPIN_RELAX();
+        }
+    }
+}
+
+static inline void
+os_spin_unlock(os_spinlock_t *lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+#endif /* _OS_SMP_H */
@@ -22,6 +22,8 @@
 
 #include "os/os.h"
 #include "os/os_sanity.h" 
+#include "os/os_smp.h"
+#include "os/os_wheel.h"
 #include "os/queue.h"
 
 /* The highest and lowest task priorities */
@@ -49,6 +51,9 @@ typedef enum os_task_state {
 #define OS_TASK_FLAG_NO_TIMEOUT     (0x01U)
 #define OS_TASK_FLAG_SEM_WAIT       (0x02U)
 #define OS_TASK_FLAG_MUTEX_WAIT     (0x04U)
+#define OS_TASK_FLAG_EVG_WAIT       (0x08U)
+#define OS_TASK_FLAG_EVG_ALL        (0x10U)
+#define OS_TASK_FLAG_EVG_CLEAR      (0x20U)
 
 typedef void (*os_task_func_t)(void *);
 
@@ -59,7 +64,12 @@ struct os_task {
     os_stack_t *t_stacktop;
     
     uint16_t t_stacksize;
-    uint16_t t_pad;
+    uint8_t t_run_prio;     /* priority the task is queued at when ready */
+#ifdef OS_SMP
+    uint8_t t_cpu;          /* core whose run list the task is on */
+#else
+    uint8_t t_pad;
+#endif
 
     uint8_t t_taskid;
     uint8_t t_prio;
@@ -71,12 +81,21 @@ struct os_task {
     void *t_arg;
 
     void *t_obj;
+    /*
+     * Event group bits the task waits for; once woken, the bits of the
+     * group that woke it.
+     */
+    uint32_t t_evg_bits;
 
     struct os_sanity_check t_sanity_check; 
 
     os_time_t t_next_wakeup;
     os_time_t t_run_time;
     uint32_t t_ctx_sw_cnt;
+#ifdef OS_TASK_CPUTIME
+    /* Time spent running, in cputime ticks */
+    uint64_t t_cputime;
+#endif
    
     /* Global list of all tasks, irrespective of run or sleep lists */
     STAILQ_ENTRY(os_task) t_os_task_list;
@@ -86,6 +105,16 @@ struct os_task {
 
     /* Used to chain task to an object such as a semaphore or mutex */
     SLIST_ENTRY(os_task) t_obj_list;
+
+#ifdef OS_TIMER_WHEEL
+    /* Sleep timeout, when sleeping with one */
+    struct os_wheel_entry t_wheel;
+#endif
+
+#ifdef OS_SMP
+    /* Cores the task may run on */
+    os_cpumask_t t_affinity;
+#endif
 };
 
 int os_task_init(struct os_task *, char *, os_task_func_t, void *, uint8_t,
@@ -93,6 +122,10 @@ int os_task_init(struct os_task *, char *, os_task_func_t, void *, uint8_t,
 
 uint8_t os_task_count(void);
 
+#ifdef OS_SMP
+int os_task_set_affinity(struct os_task *, os_cpumask_t mask);
+#endif
+
 struct os_task_info {
     uint8_t oti_prio;
     uint8_t oti_taskid;
@@ -104,6 +137,9 @@ struct os_task_info {
     uint32_t oti_runtime;
     os_time_t oti_last_checkin;
     os_time_t oti_next_checkin;
+#ifdef OS_TASK_CPUTIME
+    uint64_t oti_cputime;       /* Time spent running, in microseconds */
+#endif
 
     char oti_name[OS_TASK_MAX_NAME_LEN];
 };
@@ -57,6 +57,11 @@
 
 typedef uint32_t os_time_t;
 
+/* The tracer takes its timestamps from the monotonic clock. */
+#if defined(OS_TRACE) && !defined(OS_TIME_CPUTIME)
+#define OS_TIME_CPUTIME
+#endif
+
 #ifndef UINT32_MAX
 #define UINT32_MAX  0xFFFFFFFFU
 #endif
@@ -68,6 +73,11 @@ os_time_t os_time_get(void);
 void os_time_advance(int ticks);
 void os_time_delay(int32_t osticks);
 
+uint64_t os_time_mono_usecs(void);
+uint64_t os_time_mono_nsecs(void);
+os_time_t os_time_usecs_to_ticks(uint64_t usecs);
+uint64_t os_time_ticks_to_usecs(os_time_t ticks);
+
 #define OS_TIME_TICK_LT(__t1, __t2) ((int32_t) ((__t1) - (__t2)) < 0)
 #define OS_TIME_TICK_GT(__t1, __t2) ((int32_t) ((__t1) - (__t2)) > 0)
 #define OS_TIME_TICK_GEQ(__t1, __t2) ((int32_t) ((__t1) - (__t2)) >= 0)
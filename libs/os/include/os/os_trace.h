@@ -0,0 +1,97 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _OS_TRACE_H
+#define _OS_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Kernel event tracer, enabled with the OS_TRACE feature.
+ *
+ * Every core records into its own ring of OS_TRACE_RING_SIZE records,
+ * overwriting the oldest ones. A record holds the time it was taken at, in
+ * microseconds of the monotonic clock (os_time_mono_usecs()), the task
+ * that was running and one argument, normally the address of the kernel
+ * object involved. Recording does not take the kernel lock; a slot
+ * is claimed with an atomic increment where the architecture has one.
+ */
+
+/* Record types */
+#define OS_TRACE_CTX_SW         (1)     /* arg: id of the next task */
+#define OS_TRACE_ISR_ENTER      (2)
+#define OS_TRACE_ISR_EXIT       (3)
+#define OS_TRACE_EVQ_PUT        (4)     /* arg: event queue */
+#define OS_TRACE_EVQ_GET        (5)     /* arg: event queue */
+#define OS_TRACE_MUTEX_PEND     (6)     /* arg: mutex */
+#define OS_TRACE_MUTEX_RELEASE  (7)     /* arg: mutex */
+#define OS_TRACE_SEM_PEND       (8)     /* arg: semaphore */
+#define OS_TRACE_SEM_RELEASE    (9)     /* arg: semaphore */
+#define OS_TRACE_CALLOUT        (10)    /* arg: callout that fired */
+
+/* Applications can record their own types starting from here */
+#define OS_TRACE_USER           (128)
+
+/* otr_taskid of records taken before the first task ran */
+#define OS_TRACE_NO_TASK        (0xff)
+
+struct os_trace_rec {
+    /* Sequence number of the record plus one; 0 while it is written */
+    uint32_t otr_seq;
+    uint32_t otr_time;          /* os_time_mono_usecs(), low 32 bits */
+    uint32_t otr_arg;
+    uint8_t otr_type;
+    uint8_t otr_taskid;         /* Task that was running */
+    uint16_t otr_pad;
+};
+
+/* Called with the data the trace export produces */
+typedef int (*os_trace_write_func_t)(void *arg, const char *buf, int len);
+
+#ifdef OS_TRACE
+
+/* Records per core; must be a power of two */
+#ifndef OS_TRACE_RING_SIZE
+#define OS_TRACE_RING_SIZE      (256)
+#endif
+
+extern volatile uint8_t g_os_trace_enabled;
+
+void os_trace_init(void);
+void os_trace_enable(int on);
+void os_trace_event(uint8_t type, uint32_t arg);
+int os_trace_read(int cpu, uint32_t *seq, struct os_trace_rec *rec);
+int os_trace_export_chrome(os_trace_write_func_t func, void *arg);
+#ifdef ARCH_sim
+int os_trace_dump_file(const char *path);
+#endif
+
+#define os_trace(__type, __arg) do {                                    \
+    if (g_os_trace_enabled) {                                           \
+        os_trace_event((__type), (uint32_t)(uintptr_t)(__arg));         \
+    }                                                                   \
+} while (0)
+
+#else
+
+#define os_trace(__type, __arg)
+
+#endif /* OS_TRACE */
+
+#endif /* _OS_TRACE_H */
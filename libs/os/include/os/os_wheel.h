@@ -0,0 +1,81 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _OS_WHEEL_H
+#define _OS_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "os/os_time.h"
+#include "os/queue.h"
+
+/*
+ * Hierarchical timing wheel, used by callouts and the task sleep list when
+ * the OS_TIMER_WHEEL feature is enabled.
+ *
+ * Level 0 has one slot per tick; every slot of level N covers a whole
+ * revolution of level N - 1. Entries are cascaded down a level when the
+ * wheel reaches the start of their slot, so inserting or removing an entry
+ * is constant time regardless of how many entries are pending.
+ */
+#ifndef OS_WHEEL_SLOT_BITS
+#define OS_WHEEL_SLOT_BITS  (5)
+#endif
+#ifndef OS_WHEEL_LEVELS
+#define OS_WHEEL_LEVELS     (4)
+#endif
+
+#define OS_WHEEL_SLOTS      (1 << OS_WHEEL_SLOT_BITS)
+
+struct os_wheel_entry {
+    LIST_ENTRY(os_wheel_entry) we_next;
+    os_time_t we_expiry;
+};
+
+LIST_HEAD(os_wheel_slot, os_wheel_entry);
+
+/* Get the structure of type '__type' that 'we' is the '__field' member of */
+#define OS_WHEEL_CONTAINER(__we, __type, __field) \
+    ((__type *)((char *)(__we) - offsetof(__type, __field)))
+
+struct os_wheel {
+    /* Next tick the wheel has to process */
+    os_time_t w_next;
+    /* Expired entries that have not been handed out yet */
+    struct os_wheel_slot w_expired;
+    /* Bitmap of non-empty slots, one word per level */
+    uint32_t w_map[OS_WHEEL_LEVELS];
+    struct os_wheel_slot w_slots[OS_WHEEL_LEVELS][OS_WHEEL_SLOTS];
+};
+
+void os_wheel_init(struct os_wheel *, os_time_t now);
+void os_wheel_insert(struct os_wheel *, struct os_wheel_entry *,
+        os_time_t expiry);
+void os_wheel_remove(struct os_wheel *, struct os_wheel_entry *);
+struct os_wheel_entry *os_wheel_expire(struct os_wheel *, os_time_t now);
+os_time_t os_wheel_next_ticks(struct os_wheel *, os_time_t now);
+
+static inline int
+os_wheel_entry_queued(struct os_wheel_entry *we)
+{
+    return we->we_next.le_prev != NULL;
+}
+
+#endif /* _OS_WHEEL_H */
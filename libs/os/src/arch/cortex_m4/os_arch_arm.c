@@ -93,7 +93,9 @@ uint32_t os_flags = OS_RUN_PRIV;
 void
 timer_handler(void)
 {
+    os_isr_enter();
     os_time_advance(1);
+    os_isr_exit();
 }
 
 void
@@ -17,6 +17,8 @@
  * under the License.
  */
 
+#if !defined(OS_SIM_UCONTEXT) && !defined(OS_SMP)
+
 #include "os/os.h"
 #include "os_priv.h"
 
@@ -49,6 +51,22 @@ CTASSERT(offsetof(struct stack_frame, sf_jb) == 8);
 
 extern void os_arch_frame_init(struct stack_frame *sf);
 
+#ifdef OS_SIM_EPOLL
+extern void sim_epoll_init(void);
+extern void sim_epoll_start_timer(void);
+extern void sim_epoll_stop_timer(void);
+extern int sim_epoll_ticks(void);
+extern void sim_epoll_poll(void);
+extern void sim_epoll_idle(os_time_t ticks);
+#endif
+
+#ifdef OS_SIM_VTIME
+extern void sim_vtime_start_timer(void);
+extern void sim_vtime_stop_timer(void);
+extern int sim_vtime_ticks(void);
+extern void sim_vtime_idle(os_time_t ticks);
+#endif
+
 #define sim_setjmp(__jb) sigsetjmp(__jb, 0)
 #define sim_longjmp(__jb, __ret) siglongjmp(__jb, __ret)
 
@@ -220,6 +238,31 @@ static struct {
 
 #define NUMSIGS     (sizeof(signals)/sizeof(signals[0]))
 
+#ifdef OS_SIM_EPOLL
+void
+os_tick_idle(os_time_t ticks)
+{
+    OS_ASSERT_CRITICAL();
+
+    /*
+     * All signals are blocked in here, so only the idle deadline or one of
+     * the registered fds wakes us up. Account for the time slept right
+     * away; a SIGALRM left pending meanwhile then finds no ticks to add.
+     */
+    sim_epoll_idle(ticks);
+    timer_handler(SIGALRM);
+}
+#elif defined(OS_SIM_VTIME)
+void
+os_tick_idle(os_time_t ticks)
+{
+    OS_ASSERT_CRITICAL();
+
+    /* Every task is blocked; go straight to the next deadline. */
+    sim_vtime_idle(ticks);
+    timer_handler(SIGALRM);
+}
+#else
 void
 os_tick_idle(os_time_t ticks)
 {
@@ -275,6 +318,7 @@ os_tick_idle(os_time_t ticks)
         assert(rc == 0);
     }
 }
+#endif
 
 static void
 signals_init(void)
@@ -322,11 +366,13 @@ signals_cleanup(void)
 static void
 timer_handler(int sig)
 {
+#if !defined(OS_SIM_EPOLL) && !defined(OS_SIM_VTIME)
     struct timeval time_now, time_diff;
     int ticks;
 
     static struct timeval time_last;
     static int time_inited;
+#endif
 
     OS_ASSERT_CRITICAL();
 
@@ -340,6 +386,14 @@ timer_handler(int sig)
         return;
     }
 
+    os_isr_enter();
+
+#ifdef OS_SIM_EPOLL
+    os_time_advance(sim_epoll_ticks());
+    sim_epoll_poll();
+#elif defined(OS_SIM_VTIME)
+    os_time_advance(sim_vtime_ticks());
+#else
     if (!time_inited) {
         gettimeofday(&time_last, NULL);
         time_inited = 1;
@@ -367,8 +421,23 @@ timer_handler(int sig)
 
         os_time_advance(ticks);
     }
+#endif
+    os_isr_exit();
 }
 
+#ifdef OS_SIM_EPOLL
+static void
+start_timer(void)
+{
+    sim_epoll_start_timer();
+}
+#elif defined(OS_SIM_VTIME)
+static void
+start_timer(void)
+{
+    sim_vtime_start_timer();
+}
+#else
 static void
 start_timer(void)
 {
@@ -384,7 +453,21 @@ start_timer(void)
     rc = setitimer(ITIMER_REAL, &it, NULL);
     assert(rc == 0);
 }
+#endif
 
+#ifdef OS_SIM_EPOLL
+static void
+stop_timer(void)
+{
+    sim_epoll_stop_timer();
+}
+#elif defined(OS_SIM_VTIME)
+static void
+stop_timer(void)
+{
+    sim_vtime_stop_timer();
+}
+#else
 static void
 stop_timer(void)
 {
@@ -396,6 +479,7 @@ stop_timer(void)
     rc = setitimer(ITIMER_REAL, &it, NULL);
     assert(rc == 0);
 }
+#endif
 
 os_error_t
 os_arch_os_init(void)
@@ -404,8 +488,10 @@ os_arch_os_init(void)
     g_current_task = NULL;
 
     TAILQ_INIT(&g_os_task_list);
-    TAILQ_INIT(&g_os_run_list);
-    TAILQ_INIT(&g_os_sleep_list);
+    os_sched_init();
+#ifdef OS_SIM_EPOLL
+    sim_epoll_init();
+#endif
 
     /*
      * Setup all interrupt handlers.
@@ -462,3 +548,5 @@ os_arch_os_stop(void)
     signals_cleanup();
     g_os_started = 0;
 }
+
+#endif /* !OS_SIM_UCONTEXT && !OS_SMP */
@@ -0,0 +1,321 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Linux timing backend for the sim arch, selected with the OS_SIM_EPOLL
+ * feature. Used by both the signal and the ucontext backends.
+ *
+ * - OS time is derived from CLOCK_MONOTONIC against a fixed epoch, so late
+ *   or coalesced timer signals never make the tick drift, and changes to
+ *   the wall clock do not affect it.
+ * - The idle task blocks in epoll_pwait() until a timerfd armed with the
+ *   exact absolute deadline expires, or until one of the registered fds
+ *   becomes ready. The periodic tick is stopped meanwhile and restarted in
+ *   phase with the tick grid.
+ * - Simulated peripherals register their fds with os_arch_sim_fd_add().
+ *   Their callbacks run in interrupt context: from the tick while tasks
+ *   are running, immediately when the process is idle.
+ *
+ * A timerfd cannot raise a signal, so preempting a running task still
+ * needs the periodic SIGALRM; only its phase and the time keeping change.
+ */
+#ifdef OS_SIM_EPOLL
+
+#include "os/os.h"
+#include "os_priv.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/time.h>
+#include <assert.h>
+
+#define SIM_EPOLL_MAX_FDS   (8)
+
+#define SIM_NSEC_PER_SEC    (1000000000ULL)
+#define SIM_NSEC_PER_TICK   (SIM_NSEC_PER_SEC / OS_TICKS_PER_SEC)
+
+struct sim_epoll_fd {
+    int sef_fd;
+    os_arch_sim_fd_cb sef_cb;
+    void *sef_arg;
+};
+
+static int sim_epfd = -1;
+static int sim_timerfd = -1;
+
+static struct sim_epoll_fd sim_epoll_fds[SIM_EPOLL_MAX_FDS];
+static int sim_epoll_nfds;
+
+/* CLOCK_MONOTONIC at OS tick 0, and the number of ticks handed out */
+static uint64_t sim_epoch;
+static uint64_t sim_ticks;
+
+static uint64_t
+sim_monotonic(void)
+{
+    struct timespec ts;
+    int rc;
+
+    rc = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(rc == 0);
+
+    return ((uint64_t)ts.tv_sec * SIM_NSEC_PER_SEC + ts.tv_nsec);
+}
+
+static void
+sim_set_itimer(uint64_t first_ns)
+{
+    struct itimerval it;
+    int rc;
+
+    memset(&it, 0, sizeof(it));
+    if (first_ns != 0) {
+        it.it_value.tv_sec = first_ns / SIM_NSEC_PER_SEC;
+        it.it_value.tv_usec = (first_ns % SIM_NSEC_PER_SEC) / 1000;
+        if (it.it_value.tv_sec == 0 && it.it_value.tv_usec == 0) {
+            it.it_value.tv_usec = 1;
+        }
+        it.it_interval.tv_usec = SIM_NSEC_PER_TICK / 1000;
+    }
+
+    rc = setitimer(ITIMER_REAL, &it, NULL);
+    assert(rc == 0);
+}
+
+/**
+ * Create the epoll instance and the idle timer. Called from
+ * os_arch_os_init(); fds registered by a previous run stay registered.
+ */
+void
+sim_epoll_init(void)
+{
+    struct epoll_event ev;
+    int rc;
+
+    if (sim_epfd < 0) {
+        sim_epfd = epoll_create1(EPOLL_CLOEXEC);
+        assert(sim_epfd >= 0);
+
+        sim_timerfd = timerfd_create(CLOCK_MONOTONIC,
+                                     TFD_NONBLOCK | TFD_CLOEXEC);
+        assert(sim_timerfd >= 0);
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        rc = epoll_ctl(sim_epfd, EPOLL_CTL_ADD, sim_timerfd, &ev);
+        assert(rc == 0);
+    }
+
+    sim_epoch = 0;
+    sim_ticks = 0;
+}
+
+/**
+ * Start the periodic tick; OS tick 0 is now.
+ */
+void
+sim_epoll_start_timer(void)
+{
+    sim_epoch = sim_monotonic();
+    sim_ticks = 0;
+    sim_set_itimer(SIM_NSEC_PER_TICK);
+}
+
+void
+sim_epoll_stop_timer(void)
+{
+    sim_set_itimer(0);
+}
+
+/**
+ * Returns the number of ticks that have elapsed since the last call.
+ */
+int
+sim_epoll_ticks(void)
+{
+    uint64_t now;
+    uint64_t delta;
+
+    now = (sim_monotonic() - sim_epoch) / SIM_NSEC_PER_TICK;
+    delta = now - sim_ticks;
+    sim_ticks = now;
+
+    return ((int)delta);
+}
+
+/**
+ * Run the callbacks of registered fds that are ready. Must be called with
+ * interrupts disabled.
+ */
+void
+sim_epoll_poll(void)
+{
+    struct epoll_event evs[SIM_EPOLL_MAX_FDS + 1];
+    struct sim_epoll_fd *sef;
+    int n;
+    int i;
+
+    OS_ASSERT_CRITICAL();
+
+    if (sim_epoll_nfds == 0) {
+        return;
+    }
+
+    n = epoll_wait(sim_epfd, evs, SIM_EPOLL_MAX_FDS + 1, 0);
+    for (i = 0; i < n; i++) {
+        sef = evs[i].data.ptr;
+        if (sef != NULL && sef->sef_cb != NULL) {
+            sef->sef_cb(sef->sef_fd, evs[i].events, sef->sef_arg);
+        }
+    }
+}
+
+/**
+ * Sleep until 'ticks' ticks after the last one handed out, or until a
+ * registered fd becomes ready. SIGALRM is blocked while waiting, and the
+ * periodic tick is stopped; it is restarted on the tick grid afterwards.
+ * Must be called with interrupts disabled.
+ */
+void
+sim_epoll_idle(os_time_t ticks)
+{
+    struct itimerspec its;
+    struct epoll_event ev;
+    sigset_t mask;
+    uint64_t deadline;
+    uint64_t now;
+    int rc;
+
+    OS_ASSERT_CRITICAL();
+
+    if (ticks == 0) {
+        ticks = 1;
+    }
+    deadline = sim_epoch + (sim_ticks + ticks) * SIM_NSEC_PER_TICK;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = deadline / SIM_NSEC_PER_SEC;
+    its.it_value.tv_nsec = deadline % SIM_NSEC_PER_SEC;
+    rc = timerfd_settime(sim_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    assert(rc == 0);
+
+    if (ticks > 1) {
+        sim_set_itimer(0);
+    }
+
+    sigprocmask(SIG_SETMASK, NULL, &mask);
+    sigaddset(&mask, SIGALRM);
+    do {
+        rc = epoll_pwait(sim_epfd, &ev, 1, -1, &mask);
+    } while (rc < 0);
+
+    /* Disarm the idle timer; this also clears its expiration count. */
+    memset(&its, 0, sizeof(its));
+    timerfd_settime(sim_timerfd, 0, &its, NULL);
+
+    if (ticks > 1) {
+        now = sim_monotonic() - sim_epoch;
+        sim_set_itimer(SIM_NSEC_PER_TICK - now % SIM_NSEC_PER_TICK);
+    }
+}
+
+/**
+ * Add a file descriptor to the sim event loop. 'cb' is called with
+ * interrupts disabled whenever any of 'events' (EPOLLIN, EPOLLOUT, ...) is
+ * pending on 'fd'; the fd is level-triggered, so the callback, or a task it
+ * wakes up, has to consume the event.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int
+os_arch_sim_fd_add(int fd, uint32_t events, os_arch_sim_fd_cb cb, void *arg)
+{
+    struct sim_epoll_fd *sef;
+    struct epoll_event ev;
+    os_sr_t sr;
+    int rc;
+    int i;
+
+    if (sim_epfd < 0) {
+        return (-1);
+    }
+
+    OS_ENTER_CRITICAL(sr);
+    sef = NULL;
+    for (i = 0; i < SIM_EPOLL_MAX_FDS; i++) {
+        if (sim_epoll_fds[i].sef_cb == NULL) {
+            sef = &sim_epoll_fds[i];
+            break;
+        }
+    }
+    if (sef == NULL) {
+        OS_EXIT_CRITICAL(sr);
+        return (-1);
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = sef;
+    rc = epoll_ctl(sim_epfd, EPOLL_CTL_ADD, fd, &ev);
+    if (rc == 0) {
+        sef->sef_fd = fd;
+        sef->sef_cb = cb;
+        sef->sef_arg = arg;
+        sim_epoll_nfds++;
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    return (rc == 0 ? 0 : -1);
+}
+
+/**
+ * Remove a file descriptor added with os_arch_sim_fd_add().
+ *
+ * @return 0 on success, -1 if the fd was not registered.
+ */
+int
+os_arch_sim_fd_del(int fd)
+{
+    os_sr_t sr;
+    int i;
+
+    OS_ENTER_CRITICAL(sr);
+    for (i = 0; i < SIM_EPOLL_MAX_FDS; i++) {
+        if (sim_epoll_fds[i].sef_cb != NULL &&
+            sim_epoll_fds[i].sef_fd == fd) {
+
+            epoll_ctl(sim_epfd, EPOLL_CTL_DEL, fd, NULL);
+            memset(&sim_epoll_fds[i], 0, sizeof(sim_epoll_fds[i]));
+            sim_epoll_nfds--;
+            OS_EXIT_CRITICAL(sr);
+            return (0);
+        }
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    return (-1);
+}
+
+#endif /* OS_SIM_EPOLL */
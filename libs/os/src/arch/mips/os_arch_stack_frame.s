@@ -17,6 +17,8 @@
  * under the License.
  */
 
+#if !defined(OS_SIM_UCONTEXT) && !defined(OS_SMP)
+
 #define sigsetjmp   __sigsetjmp
 
     .text
@@ -63,3 +65,5 @@ os_arch_frame_init_start:
     move    $a1, $v0
     j       os_arch_task_start      /* jump to task, never to return */
     nop
+
+#endif /* !OS_SIM_UCONTEXT && !OS_SMP */
@@ -0,0 +1,582 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * SMP sim backend, selected with the OS_SMP feature. Each core is a host
+ * thread; core 0 is the thread that calls os_start().
+ *
+ * It works like the ucontext backend (see os_arch_sim_ucontext.c), with
+ * per-thread state:
+ *
+ * - The "interrupts disabled" flag and the pending interrupt flags are
+ *   thread local, i.e. per core. The outermost critical section of a core
+ *   also holds the kernel spinlock.
+ * - Tasks are switched with swapcontext()/setcontext() and may be resumed
+ *   by a different thread than the one that suspended them; that is how
+ *   tasks move between cores. A jmp_buf must not be jumped to from another
+ *   thread, so setjmp()/longjmp() are only used to get a core's own thread
+ *   out when the OS stops.
+ * - os_arch_os_stop() has to be called on core 0, the thread the test
+ *   framework or main() returns to.
+ * - SIGALRM is the tick and may be taken by any core. SIGURG sent with
+ *   pthread_kill() is the inter-processor interrupt that makes a core
+ *   reschedule.
+ * - An idle core releases the kernel lock and sleeps in sigsuspend() until
+ *   it is interrupted. The periodic tick is never stopped.
+ */
+#ifdef OS_SMP
+
+#include "os/os.h"
+#include "os_priv.h"
+
+#ifdef __APPLE__
+#define _XOPEN_SOURCE
+#endif
+
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <sys/time.h>
+#include <assert.h>
+#include <util/util.h>
+
+#ifdef OS_SIM_EPOLL
+#error "OS_SIM_EPOLL is not supported with OS_SMP"
+#endif
+
+struct stack_frame {
+    ucontext_t sf_uc;
+};
+
+#define sim_setjmp(__jb) sigsetjmp(__jb, 0)
+#define sim_longjmp(__jb, __ret) siglongjmp(__jb, __ret)
+
+#define OS_USEC_PER_TICK    (1000000 / OS_TICKS_PER_SEC)
+
+struct sim_cpu {
+    pthread_t sc_thread;
+    /* Set once the thread can be stopped */
+    volatile int sc_ready;
+    /* Where the thread of a core other than 0 goes when the OS stops */
+    sigjmp_buf sc_exit_jb;
+};
+
+static struct sim_cpu sim_cpus[OS_CPUS];
+static int sim_ncpus_started;
+static volatile sig_atomic_t sim_stopping;
+
+/* Index of the core the calling thread is */
+static __thread int sim_cpu_idx;
+
+/* "Interrupts" are disabled on this core */
+static volatile __thread sig_atomic_t sim_crit;
+
+/* Interrupts that arrived, or were raised, while 'sim_crit' was set */
+static volatile __thread sig_atomic_t sim_timer_pending;
+static volatile __thread sig_atomic_t sim_ctxsw_pending;
+
+/* Held by the outermost critical section of whichever core has one */
+static os_spinlock_t sim_kernel_lock;
+
+static void timer_handler(int sig);
+
+int
+os_arch_cpu_id(void)
+{
+    return (sim_cpu_idx);
+}
+
+void
+os_arch_spin_relax(void)
+{
+    sched_yield();
+}
+
+/* The signals that act as interrupts */
+static void
+sim_irq_sigset(sigset_t *set)
+{
+    sigemptyset(set);
+    sigaddset(set, SIGALRM);
+    sigaddset(set, SIGURG);
+}
+
+/*
+ * First function to run on a new task's stack, when the task is switched to
+ * for the first time. The task is already the current task of this core.
+ */
+static void
+sim_task_bootstrap(void)
+{
+    struct os_task *task;
+
+    task = os_sched_get_current_task();
+
+    /*
+     * Interrupts are disabled when a task starts executing. This happens in
+     * two different ways:
+     * - via os_arch_os_start() or sim_cpu_main() for the first task.
+     * - via os_sched() for all other tasks.
+     *
+     * Enable interrupts before starting the task.
+     */
+    OS_EXIT_CRITICAL(0);
+
+    task->t_func(task->t_arg);
+
+    /* This should never return */
+    assert(0);
+}
+
+os_stack_t *
+os_arch_task_stack_init(struct os_task *t, os_stack_t *stack_top, int size)
+{
+    struct stack_frame *sf;
+    int rc;
+
+    sf = (struct stack_frame *)
+        (((uintptr_t)stack_top - sizeof(*sf)) & ~(OS_STACK_ALIGNMENT - 1));
+    rc = getcontext(&sf->sf_uc);
+    assert(rc == 0);
+    sf->sf_uc.uc_stack.ss_sp = stack_top - size;
+    sf->sf_uc.uc_stack.ss_size = (uint8_t *)sf - (uint8_t *)(stack_top - size);
+    sf->sf_uc.uc_link = NULL;
+    makecontext(&sf->sf_uc, sim_task_bootstrap, 0);
+
+    return ((os_stack_t *)sf);
+}
+
+/*
+ * Switch this core to the task it should run. Called with interrupts
+ * disabled and the kernel lock held; returns when the current task is
+ * switched back to, possibly on another core.
+ */
+static void
+sim_ctx_sw(void)
+{
+    struct os_task *t, *next_t;
+    struct stack_frame *sf, *next_sf;
+    int rc;
+
+    t = os_sched_get_current_task();
+    next_t = os_sched_next_task();
+    if (t == next_t) {
+        /*
+         * Context switch not needed - just return.
+         */
+        return;
+    }
+
+    os_sched_ctx_sw_hook(next_t);
+
+    os_sched_set_current_task(next_t);
+
+    next_sf = (struct stack_frame *) next_t->t_stackptr;
+    if (t) {
+        sf = (struct stack_frame *) t->t_stackptr;
+        rc = swapcontext(&sf->sf_uc, &next_sf->sf_uc);
+        assert(rc == 0);
+        OS_ASSERT_CRITICAL();
+    } else {
+        setcontext(&next_sf->sf_uc);
+        assert(0);
+    }
+}
+
+void
+os_arch_ctx_sw(struct os_task *next_t)
+{
+    /* Made when the outermost critical section is exited. */
+    sim_ctxsw_pending = 1;
+}
+
+/**
+ * Make core 'cpu' reschedule.
+ */
+void
+os_arch_cpu_kick(int cpu)
+{
+    if (cpu == sim_cpu_idx) {
+        sim_ctxsw_pending = 1;
+    } else if (cpu < sim_ncpus_started) {
+        pthread_kill(sim_cpus[cpu].sc_thread, SIGURG);
+    }
+}
+
+/*
+ * Disable interrupts on this core and take the kernel lock.
+ *
+ * Returns 1 if we were already inside a critical section and 0 otherwise.
+ */
+os_sr_t
+os_arch_save_sr(void)
+{
+    if (sim_crit) {
+        return (1);
+    }
+
+    sim_crit = 1;
+    os_spin_lock(&sim_kernel_lock);
+
+    return (0);
+}
+
+void
+os_arch_restore_sr(os_sr_t osr)
+{
+    OS_ASSERT_CRITICAL();
+    assert(osr == 0 || osr == 1);
+
+    if (osr == 1) {
+        /* Exiting a nested critical section */
+        return;
+    }
+
+    do {
+        /*
+         * Run deferred interrupts, the timer first so that OS time is
+         * correct by the time tasks run. After a context switch this code
+         * may continue on another core; all of the state used here belongs
+         * to whichever core that is.
+         *
+         * Before os_start() there is no task to switch away from; a tick
+         * left over from a previous run (unit tests) stays pending.
+         */
+        while (g_os_started && (sim_timer_pending || sim_ctxsw_pending)) {
+            if (sim_timer_pending) {
+                sim_timer_pending = 0;
+                timer_handler(SIGALRM);
+            } else {
+                sim_ctxsw_pending = 0;
+                sim_ctx_sw();
+            }
+        }
+        os_spin_unlock(&sim_kernel_lock);
+        sim_crit = 0;
+
+        /* An interrupt may have arrived after the last check. */
+    } while (g_os_started && (sim_timer_pending || sim_ctxsw_pending) &&
+             os_arch_save_sr() == 0);
+}
+
+int
+os_arch_in_critical(void)
+{
+    return (sim_crit);
+}
+
+/*
+ * Handler for both the tick (SIGALRM) and the inter-processor interrupt
+ * (SIGURG). If interrupts are disabled on this core the interrupt is left
+ * pending for os_arch_restore_sr(); otherwise it is taken right away,
+ * which may preempt the running task.
+ */
+static void
+sim_irq_handler(int sig)
+{
+    if (sig == SIGURG && sim_stopping && sim_cpu_idx != 0) {
+        sim_longjmp(sim_cpus[sim_cpu_idx].sc_exit_jb, 1);
+    }
+
+    if (sig == SIGALRM) {
+        sim_timer_pending = 1;
+    } else {
+        sim_ctxsw_pending = 1;
+    }
+    if (os_arch_save_sr() == 0) {
+        os_arch_restore_sr(0);
+    }
+}
+
+void
+os_tick_idle(os_time_t ticks)
+{
+    sigset_t irqs, omask;
+
+    OS_ASSERT_CRITICAL();
+
+    /*
+     * Let the other cores use the kernel while this one sleeps. Interrupts
+     * stay disabled, so anything that arrives meanwhile is handled when the
+     * idle task exits its critical section.
+     */
+    os_spin_unlock(&sim_kernel_lock);
+
+    sim_irq_sigset(&irqs);
+    pthread_sigmask(SIG_BLOCK, &irqs, &omask);
+    if (!sim_timer_pending && !sim_ctxsw_pending && !sim_stopping) {
+        sigsuspend(&omask);
+    }
+    pthread_sigmask(SIG_SETMASK, &omask, NULL);
+
+    os_spin_lock(&sim_kernel_lock);
+}
+
+static void
+signals_init(void)
+{
+    struct sigaction sa;
+    int error;
+
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = sim_irq_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_NODEFER;
+    error = sigaction(SIGALRM, &sa, NULL);
+    assert(error == 0);
+    error = sigaction(SIGURG, &sa, NULL);
+    assert(error == 0);
+}
+
+static void
+signals_cleanup(void)
+{
+    struct sigaction sa;
+    int error;
+
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = SIG_DFL;
+    error = sigaction(SIGALRM, &sa, NULL);
+    assert(error == 0);
+    error = sigaction(SIGURG, &sa, NULL);
+    assert(error == 0);
+}
+
+static void
+timer_handler(int sig)
+{
+    struct timeval time_now, time_diff;
+    int ticks;
+
+    static struct timeval time_last;
+    static int time_inited;
+
+    OS_ASSERT_CRITICAL();
+    os_isr_enter();
+
+    if (!time_inited) {
+        gettimeofday(&time_last, NULL);
+        time_inited = 1;
+    }
+
+    gettimeofday(&time_now, NULL);
+    if (timercmp(&time_now, &time_last, <)) {
+        /*
+         * System time going backwards.
+         */
+        time_last = time_now;
+    } else {
+        timersub(&time_now, &time_last, &time_diff);
+
+        ticks = time_diff.tv_sec * OS_TICKS_PER_SEC;
+        ticks += time_diff.tv_usec / OS_USEC_PER_TICK;
+
+        /*
+         * Update 'time_last' but account for the remainder usecs that did not
+         * contribute towards whole 'ticks'.
+         */
+        time_diff.tv_sec = 0;
+        time_diff.tv_usec %= OS_USEC_PER_TICK;
+        timersub(&time_now, &time_diff, &time_last);
+
+        os_time_advance(ticks);
+    }
+    os_isr_exit();
+}
+
+static void
+start_timer(void)
+{
+    struct itimerval it;
+    int rc;
+
+    memset(&it, 0, sizeof(it));
+    it.it_value.tv_sec = 0;
+    it.it_value.tv_usec = OS_USEC_PER_TICK;
+    it.it_interval.tv_sec = 0;
+    it.it_interval.tv_usec = OS_USEC_PER_TICK;
+
+    rc = setitimer(ITIMER_REAL, &it, NULL);
+    assert(rc == 0);
+}
+
+static void
+stop_timer(void)
+{
+    struct itimerval it;
+    int rc;
+
+    memset(&it, 0, sizeof(it));
+
+    rc = setitimer(ITIMER_REAL, &it, NULL);
+    assert(rc == 0);
+}
+
+/*
+ * Thread of a core other than core 0. Waits for the kernel lock and starts
+ * running whatever task the scheduler picks for this core.
+ */
+static void *
+sim_cpu_main(void *arg)
+{
+    struct stack_frame *sf;
+    struct os_task *t;
+    sigset_t irqs;
+
+    /*
+     * The thread starts with interrupts blocked; they cannot be taken
+     * before the thread knows which core it is.
+     */
+    sim_cpu_idx = (intptr_t)arg;
+    if (sim_setjmp(sim_cpus[sim_cpu_idx].sc_exit_jb) != 0) {
+        return (NULL);
+    }
+    sim_cpus[sim_cpu_idx].sc_ready = 1;
+
+    (void)os_arch_save_sr();
+    sim_irq_sigset(&irqs);
+    pthread_sigmask(SIG_UNBLOCK, &irqs, NULL);
+
+    t = os_sched_next_task();
+    os_sched_set_current_task(t);
+
+    sf = (struct stack_frame *) t->t_stackptr;
+    setcontext(&sf->sf_uc);
+    assert(0);
+
+    return (NULL);
+}
+
+os_error_t
+os_arch_os_init(void)
+{
+    /* Forget any state left behind by a previous run (unit tests). */
+    assert(sim_cpu_idx == 0);
+    sim_crit = 0;
+    sim_timer_pending = 0;
+    sim_ctxsw_pending = 0;
+    os_spin_init(&sim_kernel_lock);
+
+    TAILQ_INIT(&g_os_task_list);
+    os_sched_init();
+
+    signals_init();
+
+    os_init_idle_task();
+    os_sanity_task_init(1);
+
+    os_bsp_init();
+
+    return OS_OK;
+}
+
+os_error_t
+os_arch_os_start(void)
+{
+    struct stack_frame *sf;
+    struct os_task *t;
+    sigset_t irqs, omask;
+    os_sr_t sr;
+    int cpu;
+    int rc;
+
+    /*
+     * Disable interrupts before enabling any interrupt sources. Pending
+     * interrupts will be recognized when the first task starts executing.
+     */
+    OS_ENTER_CRITICAL(sr);
+    assert(sr == 0);
+
+    /* Enable the interrupt sources */
+    start_timer();
+
+    /* Bring up the other cores; they wait for the kernel lock. */
+    sim_stopping = 0;
+    sim_cpus[0].sc_thread = pthread_self();
+    sim_irq_sigset(&irqs);
+    pthread_sigmask(SIG_BLOCK, &irqs, &omask);
+    for (cpu = 1; cpu < os_smp_ncpus(); cpu++) {
+        sim_cpus[cpu].sc_ready = 0;
+        rc = pthread_create(&sim_cpus[cpu].sc_thread, NULL, sim_cpu_main,
+                            (void *)(intptr_t)cpu);
+        assert(rc == 0);
+    }
+    pthread_sigmask(SIG_SETMASK, &omask, NULL);
+    sim_ncpus_started = os_smp_ncpus();
+
+    t = os_sched_next_task();
+    os_sched_set_current_task(t);
+
+    g_os_started = 1;
+
+    sim_ctxsw_pending = 0;
+    sf = (struct stack_frame *) t->t_stackptr;
+    setcontext(&sf->sf_uc);
+    assert(0);
+
+    return 0;
+}
+
+/**
+ * Stops the tick timer and the other cores, and clears the "started" flag.
+ * This function is only implemented for sim, and must be called on core 0.
+ */
+void
+os_arch_os_stop(void)
+{
+    int cpu;
+
+    assert(sim_cpu_idx == 0);
+
+    stop_timer();
+
+    /*
+     * Hold the kernel lock while the other cores are stopped, so that none
+     * of them is kicking a core that has already gone away. A core waiting
+     * for the lock leaves as soon as it is told to stop.
+     */
+    (void)os_arch_save_sr();
+    sim_stopping = 1;
+    for (cpu = 1; cpu < sim_ncpus_started; cpu++) {
+        while (!sim_cpus[cpu].sc_ready) {
+            sched_yield();
+        }
+        pthread_kill(sim_cpus[cpu].sc_thread, SIGURG);
+    }
+    for (cpu = 1; cpu < sim_ncpus_started; cpu++) {
+        pthread_join(sim_cpus[cpu].sc_thread, NULL);
+    }
+    sim_ncpus_started = 0;
+
+    signals_cleanup();
+    g_os_started = 0;
+
+    sim_timer_pending = 0;
+    sim_ctxsw_pending = 0;
+    os_spin_unlock(&sim_kernel_lock);
+    sim_crit = 0;
+}
+
+#endif /* OS_SMP */
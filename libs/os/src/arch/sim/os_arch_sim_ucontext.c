@@ -0,0 +1,541 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Alternative sim backend, selected with the OS_SIM_UCONTEXT feature.
+ *
+ * The default backend implements critical sections with sigprocmask() and
+ * switches tasks from a SIGURG handler, so every critical section and every
+ * context switch costs one or more system calls. This backend keeps the
+ * "interrupts disabled" state in a plain variable instead:
+ *
+ * - OS_ENTER_CRITICAL() sets 'sim_crit'; nothing is masked in the kernel.
+ * - The SIGALRM handler checks 'sim_crit'. If it is set, the tick is only
+ *   marked pending and is processed when the critical section is exited.
+ * - os_arch_ctx_sw() marks a context switch pending. The switch itself is
+ *   done with sigsetjmp()/siglongjmp() without saving the signal mask when
+ *   the outermost critical section is exited, i.e. without a system call.
+ *
+ * Task stacks are set up with makecontext()/swapcontext(), which is the
+ * only portable way of getting onto a fresh stack; that cost is paid once
+ * per os_task_init().
+ */
+#if defined(OS_SIM_UCONTEXT) && !defined(OS_SMP)
+
+#include "os/os.h"
+#include "os_priv.h"
+
+#ifdef __APPLE__
+#define _XOPEN_SOURCE
+#endif
+
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/time.h>
+#include <assert.h>
+#include <util/util.h>
+
+struct stack_frame {
+    sigjmp_buf sf_jb;
+    struct os_task *sf_task;
+};
+
+#define sim_setjmp(__jb) sigsetjmp(__jb, 0)
+#define sim_longjmp(__jb, __ret) siglongjmp(__jb, __ret)
+
+#define OS_USEC_PER_TICK    (1000000 / OS_TICKS_PER_SEC)
+
+#ifdef OS_SIM_EPOLL
+extern void sim_epoll_init(void);
+extern void sim_epoll_start_timer(void);
+extern void sim_epoll_stop_timer(void);
+extern int sim_epoll_ticks(void);
+extern void sim_epoll_poll(void);
+extern void sim_epoll_idle(os_time_t ticks);
+#endif
+
+#ifdef OS_SIM_VTIME
+extern void sim_vtime_start_timer(void);
+extern void sim_vtime_stop_timer(void);
+extern int sim_vtime_ticks(void);
+extern void sim_vtime_idle(os_time_t ticks);
+#endif
+
+/* "Interrupts" are disabled */
+static volatile sig_atomic_t sim_crit;
+
+/* Interrupts that arrived, or were raised, while 'sim_crit' was set */
+static volatile sig_atomic_t sim_timer_pending;
+static volatile sig_atomic_t sim_ctxsw_pending;
+
+/* Used to hand a new task's frame to sim_task_bootstrap() */
+static ucontext_t sim_init_uc;
+static struct stack_frame *sim_init_sf;
+
+static void timer_handler(int sig);
+
+/*
+ * First function to run on a new task's stack. Records the task's initial
+ * context and goes straight back to os_arch_task_stack_init(); the task
+ * starts executing when it is switched to for the first time.
+ */
+static void
+sim_task_bootstrap(void)
+{
+    struct stack_frame *sf;
+    struct os_task *task;
+
+    sf = sim_init_sf;
+    if (sim_setjmp(sf->sf_jb) == 0) {
+        setcontext(&sim_init_uc);
+        assert(0);
+    }
+
+    /*
+     * Interrupts are disabled when a task starts executing. This happens in
+     * two different ways:
+     * - via os_arch_os_start() for the first task.
+     * - via os_sched() for all other tasks.
+     *
+     * Enable interrupts before starting the task.
+     */
+    OS_EXIT_CRITICAL(0);
+
+    task = sf->sf_task;
+    task->t_func(task->t_arg);
+
+    /* This should never return */
+    assert(0);
+}
+
+os_stack_t *
+os_arch_task_stack_init(struct os_task *t, os_stack_t *stack_top, int size)
+{
+    struct stack_frame *sf;
+    ucontext_t uc;
+    int rc;
+
+    sf = (struct stack_frame *)
+        (((uintptr_t)stack_top - sizeof(*sf)) & ~(OS_STACK_ALIGNMENT - 1));
+    sf->sf_task = t;
+
+    rc = getcontext(&uc);
+    assert(rc == 0);
+    uc.uc_stack.ss_sp = stack_top - size;
+    uc.uc_stack.ss_size = (uint8_t *)sf - (uint8_t *)(stack_top - size);
+    uc.uc_link = NULL;
+    makecontext(&uc, sim_task_bootstrap, 0);
+
+    sim_init_sf = sf;
+    rc = swapcontext(&sim_init_uc, &uc);
+    assert(rc == 0);
+
+    return ((os_stack_t *)sf);
+}
+
+/*
+ * Switch to the task at the head of the run list. Called with 'sim_crit'
+ * set; returns when the current task is switched back to.
+ */
+static void
+sim_ctx_sw(void)
+{
+    struct os_task *t, *next_t;
+    struct stack_frame *sf;
+
+    t = os_sched_get_current_task();
+    next_t = os_sched_next_task();
+    if (t == next_t) {
+        /*
+         * Context switch not needed - just return.
+         */
+        return;
+    }
+
+    if (t) {
+        sf = (struct stack_frame *) t->t_stackptr;
+        if (sim_setjmp(sf->sf_jb) != 0) {
+            OS_ASSERT_CRITICAL();
+            return;
+        }
+    }
+
+    os_sched_ctx_sw_hook(next_t);
+
+    os_sched_set_current_task(next_t);
+
+    sf = (struct stack_frame *) next_t->t_stackptr;
+    sim_longjmp(sf->sf_jb, 1);
+}
+
+void
+os_arch_ctx_sw(struct os_task *next_t)
+{
+    /*
+     * Always called with interrupts disabled; the switch is made when the
+     * outermost critical section is exited, like PendSV on Cortex-M.
+     */
+    sim_ctxsw_pending = 1;
+}
+
+/*
+ * Enter a critical section.
+ *
+ * Returns 1 if we were already inside a critical section and 0 otherwise.
+ */
+os_sr_t
+os_arch_save_sr(void)
+{
+    os_sr_t osr;
+
+    osr = sim_crit;
+    sim_crit = 1;
+
+    return (osr);
+}
+
+void
+os_arch_restore_sr(os_sr_t osr)
+{
+    OS_ASSERT_CRITICAL();
+    assert(osr == 0 || osr == 1);
+
+    if (osr == 1) {
+        /* Exiting a nested critical section */
+        return;
+    }
+
+    do {
+        /*
+         * Run deferred interrupts with 'sim_crit' still set, the timer
+         * first so that OS time is correct by the time tasks run. Each flag
+         * is cleared before it is serviced so that a tick arriving meanwhile
+         * is not lost.
+         */
+        while (sim_timer_pending || sim_ctxsw_pending) {
+            if (sim_timer_pending) {
+                sim_timer_pending = 0;
+                timer_handler(SIGALRM);
+            } else {
+                sim_ctxsw_pending = 0;
+                sim_ctx_sw();
+            }
+        }
+        sim_crit = 0;
+
+        /* A tick may have arrived after the last check. */
+    } while (sim_timer_pending && os_arch_save_sr() == 0);
+}
+
+int
+os_arch_in_critical(void)
+{
+    return (sim_crit);
+}
+
+/*
+ * SIGALRM handler. If the running task has interrupts disabled the tick is
+ * left pending for os_arch_restore_sr(); otherwise the task is interrupted
+ * as it would be on hardware, including being preempted from within this
+ * handler. SA_NODEFER keeps SIGALRM unmasked while the handler runs so that
+ * the task that is switched to can still be interrupted.
+ */
+static void
+sigalrm_handler(int sig)
+{
+    sim_timer_pending = 1;
+    if (os_arch_save_sr() == 0) {
+        os_arch_restore_sr(0);
+    }
+}
+
+#ifdef OS_SIM_EPOLL
+void
+os_tick_idle(os_time_t ticks)
+{
+    OS_ASSERT_CRITICAL();
+
+    sim_epoll_idle(ticks);
+    timer_handler(SIGALRM);
+}
+#elif defined(OS_SIM_VTIME)
+void
+os_tick_idle(os_time_t ticks)
+{
+    OS_ASSERT_CRITICAL();
+
+    /* Every task is blocked; go straight to the next deadline. */
+    sim_vtime_idle(ticks);
+    timer_handler(SIGALRM);
+}
+#else
+void
+os_tick_idle(os_time_t ticks)
+{
+    sigset_t alrm, omask;
+    struct itimerval it;
+    int rc;
+
+    OS_ASSERT_CRITICAL();
+
+    if (ticks > 0) {
+        /*
+         * Enter tickless regime and set the timer to fire after 'ticks'
+         * worth of time has elapsed.
+         */
+        it.it_value.tv_sec = ticks / OS_TICKS_PER_SEC;
+        it.it_value.tv_usec = (ticks % OS_TICKS_PER_SEC) * OS_USEC_PER_TICK;
+        it.it_interval.tv_sec = 0;
+        it.it_interval.tv_usec = OS_USEC_PER_TICK;
+        rc = setitimer(ITIMER_REAL, &it, NULL);
+        assert(rc == 0);
+    }
+
+    /*
+     * Block SIGALRM while checking for a pending tick so that one arriving
+     * just before sigsuspend() does not go unnoticed. The tick itself is
+     * processed when the idle task exits its critical section.
+     */
+    sigemptyset(&alrm);
+    sigaddset(&alrm, SIGALRM);
+    sigprocmask(SIG_BLOCK, &alrm, &omask);
+    if (!sim_timer_pending) {
+        sigsuspend(&omask);
+    }
+    sigprocmask(SIG_SETMASK, &omask, NULL);
+
+    if (ticks > 0) {
+        /*
+         * Enable the periodic timer interrupt.
+         */
+        it.it_value.tv_sec = 0;
+        it.it_value.tv_usec = OS_USEC_PER_TICK;
+        it.it_interval.tv_sec = 0;
+        it.it_interval.tv_usec = OS_USEC_PER_TICK;
+        rc = setitimer(ITIMER_REAL, &it, NULL);
+        assert(rc == 0);
+    }
+}
+#endif
+
+static void
+signals_init(void)
+{
+    struct sigaction sa;
+    int error;
+
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = sigalrm_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_NODEFER;
+    error = sigaction(SIGALRM, &sa, NULL);
+    assert(error == 0);
+}
+
+static void
+signals_cleanup(void)
+{
+    struct sigaction sa;
+    int error;
+
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = SIG_DFL;
+    error = sigaction(SIGALRM, &sa, NULL);
+    assert(error == 0);
+}
+
+static void
+timer_handler(int sig)
+{
+#if !defined(OS_SIM_EPOLL) && !defined(OS_SIM_VTIME)
+    struct timeval time_now, time_diff;
+    int ticks;
+
+    static struct timeval time_last;
+    static int time_inited;
+#endif
+
+    OS_ASSERT_CRITICAL();
+    os_isr_enter();
+
+#ifdef OS_SIM_EPOLL
+    os_time_advance(sim_epoll_ticks());
+    sim_epoll_poll();
+#elif defined(OS_SIM_VTIME)
+    os_time_advance(sim_vtime_ticks());
+#else
+    if (!time_inited) {
+        gettimeofday(&time_last, NULL);
+        time_inited = 1;
+    }
+
+    gettimeofday(&time_now, NULL);
+    if (timercmp(&time_now, &time_last, <)) {
+        /*
+         * System time going backwards.
+         */
+        time_last = time_now;
+    } else {
+        timersub(&time_now, &time_last, &time_diff);
+
+        ticks = time_diff.tv_sec * OS_TICKS_PER_SEC;
+        ticks += time_diff.tv_usec / OS_USEC_PER_TICK;
+
+        /*
+         * Update 'time_last' but account for the remainder usecs that did not
+         * contribute towards whole 'ticks'.
+         */
+        time_diff.tv_sec = 0;
+        time_diff.tv_usec %= OS_USEC_PER_TICK;
+        timersub(&time_now, &time_diff, &time_last);
+
+        os_time_advance(ticks);
+    }
+#endif
+    os_isr_exit();
+}
+
+#ifdef OS_SIM_EPOLL
+static void
+start_timer(void)
+{
+    sim_epoll_start_timer();
+}
+#elif defined(OS_SIM_VTIME)
+static void
+start_timer(void)
+{
+    sim_vtime_start_timer();
+}
+#else
+static void
+start_timer(void)
+{
+    struct itimerval it;
+    int rc;
+
+    memset(&it, 0, sizeof(it));
+    it.it_value.tv_sec = 0;
+    it.it_value.tv_usec = OS_USEC_PER_TICK;
+    it.it_interval.tv_sec = 0;
+    it.it_interval.tv_usec = OS_USEC_PER_TICK;
+
+    rc = setitimer(ITIMER_REAL, &it, NULL);
+    assert(rc == 0);
+}
+#endif
+
+#ifdef OS_SIM_EPOLL
+static void
+stop_timer(void)
+{
+    sim_epoll_stop_timer();
+}
+#elif defined(OS_SIM_VTIME)
+static void
+stop_timer(void)
+{
+    sim_vtime_stop_timer();
+}
+#else
+static void
+stop_timer(void)
+{
+    struct itimerval it;
+    int rc;
+
+    memset(&it, 0, sizeof(it));
+
+    rc = setitimer(ITIMER_REAL, &it, NULL);
+    assert(rc == 0);
+}
+#endif
+
+os_error_t
+os_arch_os_init(void)
+{
+    g_current_task = NULL;
+
+    /* Forget any state left behind by a previous run (unit tests). */
+    sim_crit = 0;
+    sim_timer_pending = 0;
+    sim_ctxsw_pending = 0;
+
+    TAILQ_INIT(&g_os_task_list);
+    os_sched_init();
+#ifdef OS_SIM_EPOLL
+    sim_epoll_init();
+#endif
+
+    signals_init();
+
+    os_init_idle_task();
+    os_sanity_task_init(1);
+
+    os_bsp_init();
+
+    return OS_OK;
+}
+
+os_error_t
+os_arch_os_start(void)
+{
+    struct stack_frame *sf;
+    struct os_task *t;
+    os_sr_t sr;
+
+    /*
+     * Disable interrupts before enabling any interrupt sources. Pending
+     * interrupts will be recognized when the first task starts executing.
+     */
+    OS_ENTER_CRITICAL(sr);
+    assert(sr == 0);
+
+    /* Enable the interrupt sources */
+    start_timer();
+
+    t = os_sched_next_task();
+    os_sched_set_current_task(t);
+
+    g_os_started = 1;
+
+    sim_ctxsw_pending = 0;
+    sf = (struct stack_frame *) t->t_stackptr;
+    sim_longjmp(sf->sf_jb, 1);
+
+    return 0;
+}
+
+/**
+ * Stops the tick timer and clears the "started" flag.  This function is only
+ * implemented for sim.
+ */
+void
+os_arch_os_stop(void)
+{
+    stop_timer();
+    signals_cleanup();
+    g_os_started = 0;
+}
+
+#endif /* OS_SIM_UCONTEXT && !OS_SMP */
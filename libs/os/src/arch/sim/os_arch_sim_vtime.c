@@ -0,0 +1,165 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Virtual time backend for the sim arch, selected with the OS_SIM_VTIME
+ * feature. Used by both the signal and the ucontext backends.
+ *
+ * - OS time follows a virtual clock: the host's CLOCK_MONOTONIC plus all
+ *   the time skipped so far.
+ * - When the idle task runs, every task is blocked and nothing can happen
+ *   before the next sleep or callout deadline. Instead of waiting for it,
+ *   the virtual clock skips ahead to that deadline and the ticks are
+ *   handed out right away. With nothing armed, time runs at host speed.
+ * - While tasks are running, the periodic SIGALRM still advances the
+ *   clock and preempts them, so tasks that spin on os_time_get() work.
+ *
+ * Timeouts in test suites therefore cost no wall clock time, and a test
+ * whose tasks only block sees exactly the same tick values every run.
+ * The native cputime follows the same clock, see os_arch_sim_vtime_nsecs().
+ */
+#ifdef OS_SIM_VTIME
+
+#ifdef OS_SIM_EPOLL
+#error "OS_SIM_VTIME is not supported with OS_SIM_EPOLL"
+#endif
+
+#ifdef OS_SMP
+#error "OS_SIM_VTIME is not supported with OS_SMP"
+#endif
+
+#include "os/os.h"
+#include "os_priv.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <assert.h>
+
+#define SIM_NSEC_PER_SEC    (1000000000ULL)
+#define SIM_NSEC_PER_TICK   (SIM_NSEC_PER_SEC / OS_TICKS_PER_SEC)
+
+/* Time skipped while idle; never goes back, so cputime stays monotonic */
+static volatile uint64_t sim_skipped;
+
+/* Virtual time at OS tick 0, and the number of ticks handed out */
+static uint64_t sim_epoch;
+static uint64_t sim_ticks;
+
+/**
+ * Returns the virtual clock, in nanoseconds.
+ */
+uint64_t
+os_arch_sim_vtime_nsecs(void)
+{
+    struct timespec ts;
+    int rc;
+
+    rc = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(rc == 0);
+
+    return ((uint64_t)ts.tv_sec * SIM_NSEC_PER_SEC + ts.tv_nsec +
+            sim_skipped);
+}
+
+static void
+sim_set_itimer(uint64_t period_ns)
+{
+    struct itimerval it;
+    int rc;
+
+    memset(&it, 0, sizeof(it));
+    it.it_value.tv_usec = period_ns / 1000;
+    it.it_interval.tv_usec = period_ns / 1000;
+
+    rc = setitimer(ITIMER_REAL, &it, NULL);
+    assert(rc == 0);
+}
+
+void
+sim_vtime_start_timer(void)
+{
+    sim_epoch = os_arch_sim_vtime_nsecs();
+    sim_ticks = 0;
+    sim_set_itimer(SIM_NSEC_PER_TICK);
+}
+
+void
+sim_vtime_stop_timer(void)
+{
+    sim_set_itimer(0);
+}
+
+/**
+ * Returns the number of ticks that have elapsed since the last call.
+ */
+int
+sim_vtime_ticks(void)
+{
+    uint64_t now;
+    uint64_t delta;
+
+    now = (os_arch_sim_vtime_nsecs() - sim_epoch) / SIM_NSEC_PER_TICK;
+    delta = now - sim_ticks;
+    sim_ticks = now;
+
+    return ((int)delta);
+}
+
+/**
+ * Skip the virtual clock ahead to 'ticks' ticks after the last one handed
+ * out; the next sim_vtime_ticks() returns them. Must be called with
+ * interrupts disabled.
+ *
+ * With no sleeper or callout armed there is no deadline to skip to, and the
+ * idle task would otherwise jump a full idle period on every pass. Wait for
+ * one real tick instead, so that only host events can wake a task up.
+ */
+void
+sim_vtime_idle(os_time_t ticks)
+{
+    struct timespec ts;
+    uint64_t deadline;
+    uint64_t now;
+    os_time_t otime;
+
+    OS_ASSERT_CRITICAL();
+
+    otime = os_time_get();
+    if (os_sched_wakeup_ticks(otime) == OS_TIMEOUT_NEVER &&
+        os_callout_wakeup_ticks(otime) == OS_TIMEOUT_NEVER) {
+        ts.tv_sec = 0;
+        ts.tv_nsec = SIM_NSEC_PER_TICK;
+        nanosleep(&ts, NULL);
+        return;
+    }
+
+    if (ticks == 0) {
+        ticks = 1;
+    }
+    deadline = sim_epoch + (sim_ticks + ticks) * SIM_NSEC_PER_TICK;
+
+    now = os_arch_sim_vtime_nsecs();
+    if (deadline > now) {
+        sim_skipped += deadline - now;
+    }
+}
+
+#endif /* OS_SIM_VTIME */
@@ -17,6 +17,8 @@
  * under the License.
  */
 
+#if !defined(OS_SIM_UCONTEXT) && !defined(OS_SMP)
+
 #if defined MN_LINUX
 #define sigsetjmp   __sigsetjmp
 #define CNAME(x)    x
@@ -99,3 +101,5 @@ CNAME(os_arch_frame_init):
     /* never returns */
 2:
     nop
+
+#endif /* !OS_SIM_UCONTEXT && !OS_SMP */
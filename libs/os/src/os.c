@@ -19,6 +19,7 @@
 
 #include "os/os.h"
 #include "os/queue.h"
+#include "os_priv.h"
 
 #include "hal/hal_os_tick.h"
 
@@ -27,6 +28,13 @@
 struct os_task g_idle_task;
 os_stack_t g_idle_task_stack[OS_STACK_ALIGN(OS_IDLE_STACK_SIZE)];
 
+#ifdef OS_SMP
+/* Idle tasks of the other cores; core 0 uses 'g_idle_task' */
+static struct os_task os_smp_idle_tasks[OS_CPUS - 1];
+static os_stack_t os_smp_idle_stacks[OS_CPUS - 1]
+                                    [OS_STACK_ALIGN(OS_IDLE_STACK_SIZE)];
+#endif
+
 uint32_t g_os_idle_ctr;
 /* Default zero.  Set by the architecture specific code when os is started.
  */
@@ -68,6 +76,10 @@ os_idle_task(void *arg)
         } else {
             /* NOTHING */
         }
+#ifdef OS_TIME_CPUTIME
+        /* The monotonic clock has to see a tick before cputime wraps. */
+        iticks = min(iticks, os_time_mono_max_idle());
+#endif
         /* Tell the architecture specific support to put the processor to sleep
          * for 'n' ticks.
          */
@@ -91,9 +103,24 @@ os_started(void)
 void
 os_init_idle_task(void)
 {
+#ifdef OS_SMP
+    int cpu;
+#endif
+
     os_task_init(&g_idle_task, "idle", os_idle_task, NULL,
             OS_IDLE_PRIO, OS_WAIT_FOREVER, g_idle_task_stack,
             OS_STACK_ALIGN(OS_IDLE_STACK_SIZE));
+
+#ifdef OS_SMP
+    os_task_set_affinity(&g_idle_task, 1 << 0);
+    for (cpu = 1; cpu < os_smp_ncpus(); cpu++) {
+        os_task_init(&os_smp_idle_tasks[cpu - 1], "idle", os_idle_task,
+                NULL, OS_IDLE_PRIO, OS_WAIT_FOREVER,
+                os_smp_idle_stacks[cpu - 1],
+                OS_STACK_ALIGN(OS_IDLE_STACK_SIZE));
+        os_task_set_affinity(&os_smp_idle_tasks[cpu - 1], 1 << cpu);
+    }
+#endif
 }
 
 /**
@@ -105,8 +132,16 @@ os_init(void)
 {
     os_error_t err;
 
+#ifdef OS_TRACE
+    os_trace_init();
+#endif
+
     err = os_arch_os_init();
     assert(err == OS_OK);
+
+#ifdef OS_EVPOOL
+    os_evpool_dflt_init();
+#endif
 }
 
 /**
@@ -22,8 +22,12 @@
 #include <assert.h>
 #include <string.h>
 
+#ifdef OS_TIMER_WHEEL
+struct os_wheel g_callout_wheel;
+#else
 TAILQ_HEAD(, os_callout) g_callout_list =
   TAILQ_HEAD_INITIALIZER(g_callout_list);
+#endif
 
 static void
 _os_callout_init(struct os_callout *c, struct os_eventq *evq, void *ev_arg)
@@ -72,8 +76,12 @@ os_callout_stop(struct os_callout *c)
     OS_ENTER_CRITICAL(sr);
 
     if (os_callout_queued(c)) {
+#ifdef OS_TIMER_WHEEL
+        os_wheel_remove(&g_callout_wheel, &c->c_wheel);
+#else
         TAILQ_REMOVE(&g_callout_list, c, c_next);
         c->c_next.tqe_prev = NULL;
+#endif
     }
 
     if (c->c_evq) {
@@ -94,7 +102,9 @@ os_callout_stop(struct os_callout *c)
 int
 os_callout_reset(struct os_callout *c, int32_t ticks)
 {
+#ifndef OS_TIMER_WHEEL
     struct os_callout *entry;
+#endif
     os_sr_t sr;
     int rc;
 
@@ -113,6 +123,9 @@ os_callout_reset(struct os_callout *c, int32_t ticks)
 
     c->c_ticks = os_time_get() + ticks;
 
+#ifdef OS_TIMER_WHEEL
+    os_wheel_insert(&g_callout_wheel, &c->c_wheel, c->c_ticks);
+#else
     entry = NULL;
     TAILQ_FOREACH(entry, &g_callout_list, c_next) {
         if (OS_TIME_TICK_LT(c->c_ticks, entry->c_ticks)) {
@@ -125,6 +138,7 @@ os_callout_reset(struct os_callout *c, int32_t ticks)
     } else {
         TAILQ_INSERT_TAIL(&g_callout_list, c, c_next);
     }
+#endif
 
     OS_EXIT_CRITICAL(sr);
 
@@ -144,12 +158,23 @@ os_callout_tick(void)
 {
     os_sr_t sr;
     struct os_callout *c;
+#ifdef OS_TIMER_WHEEL
+    struct os_wheel_entry *we;
+#endif
     uint32_t now;
 
     now = os_time_get();
 
     while (1) {
         OS_ENTER_CRITICAL(sr);
+#ifdef OS_TIMER_WHEEL
+        we = os_wheel_expire(&g_callout_wheel, now);
+        if (we) {
+            c = OS_WHEEL_CONTAINER(we, struct os_callout, c_wheel);
+        } else {
+            c = NULL;
+        }
+#else
         c = TAILQ_FIRST(&g_callout_list);
         if (c) {
             if (OS_TIME_TICK_GEQ(now, c->c_ticks)) {
@@ -159,9 +184,11 @@ os_callout_tick(void)
                 c = NULL;
             }
         }
+#endif
         OS_EXIT_CRITICAL(sr);
 
         if (c) {
+            os_trace(OS_TRACE_CALLOUT, c);
             os_eventq_put(c->c_evq, &c->c_ev);
         } else {
             break;
@@ -181,10 +208,15 @@ os_time_t
 os_callout_wakeup_ticks(os_time_t now)
 {
     os_time_t rt;
+#ifndef OS_TIMER_WHEEL
     struct os_callout *c;
+#endif
 
     OS_ASSERT_CRITICAL();
 
+#ifdef OS_TIMER_WHEEL
+    rt = os_wheel_next_ticks(&g_callout_wheel, now);
+#else
     c = TAILQ_FIRST(&g_callout_list);
     if (c != NULL) {
         if (OS_TIME_TICK_GEQ(c->c_ticks, now)) {
@@ -195,6 +227,7 @@ os_callout_wakeup_ticks(os_time_t now)
     } else {
         rt = OS_TIMEOUT_NEVER;
     }
+#endif
 
     return (rt);
 }
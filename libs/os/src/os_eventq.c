@@ -20,8 +20,73 @@
 
 #include "os/os.h"
 
+#include <assert.h>
 #include <string.h>
 
+#ifdef OS_EVENTQ_PRIO
+/*
+ * The list of events queued at level 'prio'.
+ */
+static struct os_event_list *
+os_eventq_lane(struct os_eventq *evq, uint8_t prio)
+{
+    if (prio == OS_EVENTQ_PRIO_NORMAL) {
+        return (&evq->evq_list);
+    }
+    return (&evq->evq_prio_list[prio]);
+}
+#else
+#define os_eventq_lane(__evq, __prio) (&(__evq)->evq_list)
+#endif
+
+/*
+ * The list holding the event a get would take next, or NULL if the queue
+ * is empty.  Must be called inside a critical section.
+ */
+static struct os_event_list *
+os_eventq_first_lane(struct os_eventq *evq)
+{
+#ifdef OS_EVENTQ_PRIO
+    if (evq->evq_prio_map == 0) {
+        return (NULL);
+    }
+    return (os_eventq_lane(evq, __builtin_ctz(evq->evq_prio_map)));
+#else
+    if (STAILQ_EMPTY(&evq->evq_list)) {
+        return (NULL);
+    }
+    return (&evq->evq_list);
+#endif
+}
+
+/*
+ * Takes the first event of the most urgent level that has any, or returns
+ * NULL if the queue is empty.  Must be called inside a critical section.
+ */
+static struct os_event *
+os_eventq_pull(struct os_eventq *evq)
+{
+    struct os_event_list *lane;
+    struct os_event *ev;
+
+    lane = os_eventq_first_lane(evq);
+    if (lane == NULL) {
+        return (NULL);
+    }
+
+    ev = STAILQ_FIRST(lane);
+    STAILQ_REMOVE_HEAD(lane, ev_next);
+#ifdef OS_EVENTQ_PRIO
+    if (STAILQ_EMPTY(lane)) {
+        evq->evq_prio_map &= ~(1 << ev->ev_prio);
+    }
+    evq->evq_depth[ev->ev_prio]--;
+#endif
+    ev->ev_queued = 0;
+
+    return (ev);
+}
+
 /**
  * Initialize the event queue
  *
@@ -30,22 +95,51 @@
 void
 os_eventq_init(struct os_eventq *evq)
 {
+#ifdef OS_EVENTQ_PRIO
+    int i;
+#endif
+
     memset(evq, 0, sizeof(*evq));
     STAILQ_INIT(&evq->evq_list);
+#ifdef OS_EVENTQ_PRIO
+    for (i = 0; i < OS_EVENTQ_PRIOS - 1; i++) {
+        STAILQ_INIT(&evq->evq_prio_list[i]);
+    }
+#endif
 }
 
 /**
- * Put an event on the event queue.
+ * Put an event on the event queue, at the normal priority level.
  *
  * @param evq The event queue to put an event on 
  * @param ev The event to put on the queue
  */
 void
 os_eventq_put(struct os_eventq *evq, struct os_event *ev)
+{
+    os_eventq_put_prio(evq, ev, OS_EVENTQ_PRIO_NORMAL);
+}
+
+/**
+ * Put an event on the event queue at a given priority level.  Gets return
+ * the events of more urgent levels first, so an urgent event does not
+ * wait behind the bulk work queued at the normal level.  An event that is
+ * already queued stays where it is.  Without OS_EVENTQ_PRIO the level is
+ * recorded in the event but the event goes at the end of the one list.
+ *
+ * @param evq The event queue to put an event on
+ * @param ev The event to put on the queue
+ * @param prio The level, from OS_EVENTQ_PRIO_URGENT (0) to
+ *             OS_EVENTQ_PRIO_NORMAL
+ */
+void
+os_eventq_put_prio(struct os_eventq *evq, struct os_event *ev, uint8_t prio)
 {
     int resched;
     os_sr_t sr;
 
+    assert(prio < OS_EVENTQ_PRIOS);
+
     OS_ENTER_CRITICAL(sr);
 
     /* Do not queue if already queued */
@@ -56,7 +150,16 @@ os_eventq_put(struct os_eventq *evq, struct os_event *ev)
 
     /* Queue the event */
     ev->ev_queued = 1;
-    STAILQ_INSERT_TAIL(&evq->evq_list, ev, ev_next);
+    ev->ev_prio = prio;
+    STAILQ_INSERT_TAIL(os_eventq_lane(evq, prio), ev, ev_next);
+#ifdef OS_EVENTQ_PRIO
+    evq->evq_prio_map |= 1 << prio;
+    if (++evq->evq_depth[prio] > evq->evq_max_depth[prio]) {
+        evq->evq_max_depth[prio] = evq->evq_depth[prio];
+    }
+    evq->evq_puts[prio]++;
+#endif
+    os_trace(OS_TRACE_EVQ_PUT, evq);
 
     resched = 0;
     if (evq->evq_task) {
@@ -74,6 +177,10 @@ os_eventq_put(struct os_eventq *evq, struct os_event *ev)
         evq->evq_task = NULL;
     }
 
+    if (evq->evq_evg) {
+        resched |= os_evgroup_set_locked(evq->evq_evg, evq->evq_evg_bits);
+    }
+
     OS_EXIT_CRITICAL(sr);
 
     if (resched) {
@@ -97,11 +204,8 @@ os_eventq_get(struct os_eventq *evq)
 
     OS_ENTER_CRITICAL(sr);
 pull_one:
-    ev = STAILQ_FIRST(&evq->evq_list);
-    if (ev) {
-        STAILQ_REMOVE(&evq->evq_list, ev, os_event, ev_next);
-        ev->ev_queued = 0;
-    } else {
+    ev = os_eventq_pull(evq);
+    if (!ev) {
         evq->evq_task = os_sched_get_current_task();
         os_sched_sleep(evq->evq_task, OS_TIMEOUT_NEVER);
         OS_EXIT_CRITICAL(sr);
@@ -114,6 +218,55 @@ pull_one:
     }
     OS_EXIT_CRITICAL(sr);
 
+    os_trace(OS_TRACE_EVQ_GET, evq);
+
+    return (ev);
+}
+
+/**
+ * Pull a single item from an event queue, without blocking.
+ *
+ * @param evq The event queue to pull an event from
+ *
+ * @return The event from the queue, or NULL if the queue is empty
+ */
+struct os_event *
+os_eventq_get_no_wait(struct os_eventq *evq)
+{
+    struct os_event *ev;
+    os_sr_t sr;
+
+    OS_ENTER_CRITICAL(sr);
+    ev = os_eventq_pull(evq);
+    OS_EXIT_CRITICAL(sr);
+
+    if (ev) {
+        os_trace(OS_TRACE_EVQ_GET, evq);
+    }
+
+    return (ev);
+}
+
+/**
+ * Look at the event a get would return next, without taking it off the
+ * queue.  Unlike looking at evq_list, this sees the events of every level.
+ *
+ * @param evq The event queue to look at
+ *
+ * @return The next event on the queue, or NULL if the queue is empty
+ */
+struct os_event *
+os_eventq_peek(struct os_eventq *evq)
+{
+    struct os_event_list *lane;
+    struct os_event *ev;
+    os_sr_t sr;
+
+    OS_ENTER_CRITICAL(sr);
+    lane = os_eventq_first_lane(evq);
+    ev = lane != NULL ? STAILQ_FIRST(lane) : NULL;
+    OS_EXIT_CRITICAL(sr);
+
     return (ev);
 }
 
@@ -143,10 +296,8 @@ os_eventq_poll(struct os_eventq **evq, int nevqs, os_time_t timo)
     cur_t = os_sched_get_current_task();
 
     for (i = 0; i < nevqs; i++) {
-        ev = STAILQ_FIRST(&evq[i]->evq_list);
+        ev = os_eventq_pull(evq[i]);
         if (ev) {
-            STAILQ_REMOVE(&evq[i]->evq_list, ev, os_event, ev_next);
-            ev->ev_queued = 0;
             /* Reset the items that already have an evq task set
              */
             for (j = 0; j < i; j++) {
@@ -154,6 +305,7 @@ os_eventq_poll(struct os_eventq **evq, int nevqs, os_time_t timo)
             }
 
             OS_EXIT_CRITICAL(sr);
+            os_trace(OS_TRACE_EVQ_GET, evq[i]);
             goto has_event;
         }
         evq[i]->evq_task = cur_t;
@@ -172,10 +324,9 @@ os_eventq_poll(struct os_eventq **evq, int nevqs, os_time_t timo)
          * we haven't found one.
          */
         if (!ev) {
-            ev = STAILQ_FIRST(&evq[i]->evq_list);
+            ev = os_eventq_pull(evq[i]);
             if (ev) {
-                STAILQ_REMOVE(&evq[i]->evq_list, ev, os_event, ev_next);
-                ev->ev_queued = 0;
+                os_trace(OS_TRACE_EVQ_GET, evq[i]);
             }
         }
         evq[i]->evq_task = NULL;
@@ -195,12 +346,53 @@ has_event:
 void
 os_eventq_remove(struct os_eventq *evq, struct os_event *ev)
 {
+    struct os_event_list *lane;
     os_sr_t sr;
 
     OS_ENTER_CRITICAL(sr);
     if (OS_EVENT_QUEUED(ev)) {
-        STAILQ_REMOVE(&evq->evq_list, ev, os_event, ev_next);
+        lane = os_eventq_lane(evq, ev->ev_prio);
+        STAILQ_REMOVE(lane, ev, os_event, ev_next);
+#ifdef OS_EVENTQ_PRIO
+        if (STAILQ_EMPTY(lane)) {
+            evq->evq_prio_map &= ~(1 << ev->ev_prio);
+        }
+        evq->evq_depth[ev->ev_prio]--;
+#endif
     }
     ev->ev_queued = 0;
     OS_EXIT_CRITICAL(sr);
 }
+
+/**
+ * Have an event queue set bits in an event group whenever an event is put
+ * on it.  A task serving several queues can then wait for any of their bits
+ * with os_evgroup_wait() and drain the queues whose bits are set with
+ * os_eventq_get_no_wait(), instead of polling all of them.
+ *
+ * @param evq  The event queue
+ * @param evg  The event group to signal, or NULL to stop signalling
+ * @param bits The bits to set in the group
+ */
+void
+os_eventq_set_evgroup(struct os_eventq *evq, struct os_evgroup *evg,
+                      uint32_t bits)
+{
+    os_sr_t sr;
+    int resched;
+
+    resched = 0;
+
+    OS_ENTER_CRITICAL(sr);
+    evq->evq_evg = evg;
+    evq->evq_evg_bits = bits;
+    /* Events queued before now count too. */
+    if (evg && os_eventq_first_lane(evq) != NULL) {
+        resched = os_evgroup_set_locked(evg, bits);
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    if (resched) {
+        os_sched(NULL);
+    }
+}
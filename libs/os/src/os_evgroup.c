@@ -0,0 +1,266 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "os/os.h"
+#include <assert.h>
+
+/* Returns 1 if 'bits' satisfy a task waiting on the group. */
+static int
+os_evgroup_satisfies(struct os_task *t, uint32_t bits)
+{
+    if (t->t_flags & OS_TASK_FLAG_EVG_ALL) {
+        return ((bits & t->t_evg_bits) == t->t_evg_bits);
+    } else {
+        return ((bits & t->t_evg_bits) != 0);
+    }
+}
+
+/**
+ * os evgroup init
+ *
+ * Initialize an event group with all bits clear.
+ *
+ * @param evg Pointer to the event group
+ *
+ * @return os_error_t
+ *      OS_INVALID_PARM     Event group passed in was NULL.
+ *      OS_OK               no error.
+ */
+os_error_t
+os_evgroup_init(struct os_evgroup *evg)
+{
+    if (!evg) {
+        return OS_INVALID_PARM;
+    }
+
+    SLIST_FIRST(&evg->evg_head) = NULL;
+    evg->evg_bits = 0;
+
+    return OS_OK;
+}
+
+int
+os_evgroup_set_locked(struct os_evgroup *evg, uint32_t bits)
+{
+    struct os_task *next;
+    struct os_task *t;
+    uint32_t clear;
+    int woken;
+
+    evg->evg_bits |= bits;
+
+    /*
+     * Waiters are in priority order, so when several of them clear the
+     * same bits the most important one gets them.
+     */
+    clear = 0;
+    woken = 0;
+    for (t = SLIST_FIRST(&evg->evg_head); t != NULL; t = next) {
+        next = SLIST_NEXT(t, t_obj_list);
+
+        if (!os_evgroup_satisfies(t, evg->evg_bits & ~clear)) {
+            continue;
+        }
+
+        /* Hand the task the bits that woke it. */
+        if (t->t_flags & OS_TASK_FLAG_EVG_CLEAR) {
+            clear |= t->t_evg_bits;
+        }
+        t->t_evg_bits = evg->evg_bits;
+        t->t_flags &= ~(OS_TASK_FLAG_EVG_WAIT | OS_TASK_FLAG_EVG_ALL |
+                        OS_TASK_FLAG_EVG_CLEAR);
+        os_sched_wakeup(t);
+        woken = 1;
+    }
+    evg->evg_bits &= ~clear;
+
+    return (woken);
+}
+
+/**
+ * os evgroup set
+ *
+ * Set bits in an event group, and wake up the waiting tasks this
+ * satisfies.  Can be called from interrupt handlers.
+ *
+ * @param evg Pointer to the event group
+ * @param bits Bits to set
+ *
+ * @return os_error_t
+ *      OS_INVALID_PARM     Event group passed in was NULL.
+ *      OS_OK               no error.
+ */
+os_error_t
+os_evgroup_set(struct os_evgroup *evg, uint32_t bits)
+{
+    os_sr_t sr;
+    int resched;
+
+    if (!evg) {
+        return OS_INVALID_PARM;
+    }
+
+    OS_ENTER_CRITICAL(sr);
+    resched = os_evgroup_set_locked(evg, bits);
+    OS_EXIT_CRITICAL(sr);
+
+    if (resched) {
+        os_sched(NULL);
+    }
+
+    return OS_OK;
+}
+
+/**
+ * os evgroup clear
+ *
+ * Clear bits in an event group.  Can be called from interrupt handlers.
+ *
+ * @param evg Pointer to the event group
+ * @param bits Bits to clear
+ *
+ * @return os_error_t
+ *      OS_INVALID_PARM     Event group passed in was NULL.
+ *      OS_OK               no error.
+ */
+os_error_t
+os_evgroup_clear(struct os_evgroup *evg, uint32_t bits)
+{
+    os_sr_t sr;
+
+    if (!evg) {
+        return OS_INVALID_PARM;
+    }
+
+    OS_ENTER_CRITICAL(sr);
+    evg->evg_bits &= ~bits;
+    OS_EXIT_CRITICAL(sr);
+
+    return OS_OK;
+}
+
+/**
+ * os evgroup wait
+ *
+ * Wait until any, or all, of 'bits' are set in an event group.
+ *
+ * @param evg Pointer to the event group
+ * @param bits Bits to wait for
+ * @param opts OS_EVGROUP_WAIT_ALL to wait for all of 'bits' rather than
+ *             any of them; OS_EVGROUP_CLEAR to clear 'bits' on success.
+ * @param timeout Timeout, in os ticks. A timeout of 0 means do not wait
+ *                if the bits are not set. A timeout of 0xFFFFFFFF means
+ *                wait forever.
+ * @param out_bits If not NULL, receives the bits of the group at the
+ *                 time the wait ended, before any clearing.
+ *
+ * @return os_error_t
+ *      OS_INVALID_PARM     Event group passed in was NULL, or bits was 0.
+ *      OS_NOT_STARTED      The bits were not set, and the OS is not
+ *                          running so the task cannot wait.
+ *      OS_TIMEOUT          The bits were not set in time.
+ *      OS_OK               no error.
+ */
+os_error_t
+os_evgroup_wait(struct os_evgroup *evg, uint32_t bits, uint8_t opts,
+                uint32_t timeout, uint32_t *out_bits)
+{
+    struct os_task *current;
+    struct os_task *entry;
+    struct os_task *last;
+    os_error_t rc;
+    os_sr_t sr;
+    int sched;
+
+    if (!evg || bits == 0) {
+        return OS_INVALID_PARM;
+    }
+
+    sched = 0;
+    current = os_sched_get_current_task();
+
+    OS_ENTER_CRITICAL(sr);
+
+    if ((opts & OS_EVGROUP_WAIT_ALL) ?
+        (evg->evg_bits & bits) == bits : (evg->evg_bits & bits) != 0) {
+        if (out_bits) {
+            *out_bits = evg->evg_bits;
+        }
+        if (opts & OS_EVGROUP_CLEAR) {
+            evg->evg_bits &= ~bits;
+        }
+        rc = OS_OK;
+    } else if (timeout == 0) {
+        rc = OS_TIMEOUT;
+    } else if (!g_os_started) {
+        rc = OS_NOT_STARTED;
+    } else {
+        /* Silence gcc maybe-uninitialized warning. */
+        rc = OS_OK;
+
+        current->t_obj = evg;
+        current->t_evg_bits = bits;
+        current->t_flags |= OS_TASK_FLAG_EVG_WAIT;
+        if (opts & OS_EVGROUP_WAIT_ALL) {
+            current->t_flags |= OS_TASK_FLAG_EVG_ALL;
+        }
+        if (opts & OS_EVGROUP_CLEAR) {
+            current->t_flags |= OS_TASK_FLAG_EVG_CLEAR;
+        }
+
+        /* Insert in priority order */
+        last = NULL;
+        SLIST_FOREACH(entry, &evg->evg_head, t_obj_list) {
+            if (current->t_prio < entry->t_prio) {
+                break;
+            }
+            last = entry;
+        }
+        if (last) {
+            SLIST_INSERT_AFTER(last, current, t_obj_list);
+        } else {
+            SLIST_INSERT_HEAD(&evg->evg_head, current, t_obj_list);
+        }
+
+        sched = 1;
+        os_sched_sleep(current, timeout);
+    }
+
+    OS_EXIT_CRITICAL(sr);
+
+    if (sched) {
+        os_sched(NULL);
+        /* Check if we timed out or were woken by os_evgroup_set() */
+        OS_ENTER_CRITICAL(sr);
+        if (current->t_flags & OS_TASK_FLAG_EVG_WAIT) {
+            current->t_flags &= ~(OS_TASK_FLAG_EVG_WAIT |
+                                  OS_TASK_FLAG_EVG_ALL |
+                                  OS_TASK_FLAG_EVG_CLEAR);
+            if (out_bits) {
+                *out_bits = evg->evg_bits;
+            }
+            rc = OS_TIMEOUT;
+        } else if (out_bits) {
+            *out_bits = current->t_evg_bits;
+        }
+        OS_EXIT_CRITICAL(sr);
+    }
+
+    return rc;
+}
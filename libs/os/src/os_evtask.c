@@ -0,0 +1,209 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "os/os.h"
+#include <assert.h>
+#include <string.h>
+
+#ifdef OS_EVPOOL
+struct os_evpool g_os_evpool;
+static os_stack_t g_os_evpool_stack[OS_STACK_ALIGN(OS_EVPOOL_STACK_SIZE)];
+#endif
+
+#define OS_EVPOOL_ALL   (0xffffffff)
+
+/*
+ * The worker of an event task pool. Takes the bits of the event tasks that
+ * got events and keeps draining the most urgent of them, one event at a
+ * time, until none of them has any left.
+ */
+static void
+os_evpool_loop(void *arg)
+{
+    struct os_evpool *ep;
+    struct os_evtask *et;
+    struct os_event *ev;
+    uint32_t bits;
+    int idx;
+
+    ep = arg;
+    while (1) {
+        os_evgroup_wait(&ep->ep_evg, OS_EVPOOL_ALL,
+                        OS_EVGROUP_WAIT_ANY | OS_EVGROUP_CLEAR,
+                        OS_TIMEOUT_NEVER, &bits);
+        ep->ep_pending |= bits;
+
+        while (1) {
+            /*
+             * Take the bits set since, so that the most urgent event task
+             * goes next even if it got its events after we woke up.
+             */
+            if (os_evgroup_wait(&ep->ep_evg, OS_EVPOOL_ALL,
+                                OS_EVGROUP_WAIT_ANY | OS_EVGROUP_CLEAR, 0,
+                                &bits) == OS_OK) {
+                ep->ep_pending |= bits;
+            }
+            if (!ep->ep_pending) {
+                break;
+            }
+
+            idx = __builtin_ctz(ep->ep_pending);
+            et = ep->ep_evtasks[idx];
+            ev = NULL;
+            if (et) {
+                ev = os_eventq_get_no_wait(&et->et_evq);
+            }
+            if (!ev) {
+                ep->ep_pending &= ~(1UL << idx);
+                continue;
+            }
+
+            et->et_runs++;
+            et->et_func(et, ev);
+        }
+    }
+}
+
+/**
+ * os evpool init
+ *
+ * Initialize an event task pool and create its worker task. Every event
+ * task of the pool runs on 'stack_bottom', so it has to be large enough
+ * for the deepest of their handlers.
+ *
+ * @param ep Pointer to the pool
+ * @param name Name of the worker task
+ * @param prio OS priority of the worker task
+ * @param stack_bottom The shared stack
+ * @param stack_size Size of the shared stack
+ *
+ * @return os_error_t
+ *      OS_INVALID_PARM     Pool passed in was NULL.
+ *      OS_OK               no error.
+ */
+os_error_t
+os_evpool_init(struct os_evpool *ep, char *name, uint8_t prio,
+               os_stack_t *stack_bottom, uint16_t stack_size)
+{
+    if (!ep) {
+        return OS_INVALID_PARM;
+    }
+
+    memset(ep, 0, sizeof(*ep));
+    os_evgroup_init(&ep->ep_evg);
+
+    return (os_task_init(&ep->ep_task, name, os_evpool_loop, ep, prio,
+                         OS_WAIT_FOREVER, stack_bottom, stack_size));
+}
+
+/**
+ * os evtask init
+ *
+ * Initialize an event task and add it to a pool. Events put on
+ * os_evtask_eventq(et) are handed to 'func' on the pool's worker task.
+ * Callouts can be pointed at the same queue.
+ *
+ * @param et Pointer to the event task
+ * @param ep The pool to run in
+ * @param name Name, for display only
+ * @param func Handler, called with each event
+ * @param arg Stored in et_arg for the handler
+ * @param prio Priority within the pool, 0 (most urgent) to
+ *             OS_EVPOOL_MAX_EVTASKS - 1. Each event task of a pool needs
+ *             a different one.
+ *
+ * @return os_error_t
+ *      OS_INVALID_PARM     Event task, pool or handler was NULL.
+ *      OS_EINVAL           Priority out of range, or already taken.
+ *      OS_OK               no error.
+ */
+os_error_t
+os_evtask_init(struct os_evtask *et, struct os_evpool *ep, const char *name,
+               os_evtask_func_t func, void *arg, uint8_t prio)
+{
+    os_sr_t sr;
+
+    if (!et || !ep || !func) {
+        return OS_INVALID_PARM;
+    }
+    if (prio >= OS_EVPOOL_MAX_EVTASKS) {
+        return OS_EINVAL;
+    }
+
+    memset(et, 0, sizeof(*et));
+    et->et_func = func;
+    et->et_arg = arg;
+    et->et_name = name;
+    et->et_pool = ep;
+    et->et_prio = prio;
+    os_eventq_init(&et->et_evq);
+
+    OS_ENTER_CRITICAL(sr);
+    if (ep->ep_evtasks[prio]) {
+        OS_EXIT_CRITICAL(sr);
+        return OS_EINVAL;
+    }
+    ep->ep_evtasks[prio] = et;
+    OS_EXIT_CRITICAL(sr);
+
+    os_eventq_set_evgroup(&et->et_evq, &ep->ep_evg, 1UL << prio);
+
+    return OS_OK;
+}
+
+/**
+ * os evtask remove
+ *
+ * Take an event task out of its pool. Events still on its queue are not
+ * handled, and stay queued.
+ *
+ * @param et Pointer to the event task
+ */
+void
+os_evtask_remove(struct os_evtask *et)
+{
+    struct os_evpool *ep;
+    os_sr_t sr;
+
+    os_eventq_set_evgroup(&et->et_evq, NULL, 0);
+
+    OS_ENTER_CRITICAL(sr);
+    ep = et->et_pool;
+    if (ep && ep->ep_evtasks[et->et_prio] == et) {
+        ep->ep_evtasks[et->et_prio] = NULL;
+    }
+    et->et_pool = NULL;
+    OS_EXIT_CRITICAL(sr);
+}
+
+#ifdef OS_EVPOOL
+/**
+ * Start the default pool. Called by os_init().
+ */
+void
+os_evpool_dflt_init(void)
+{
+    os_error_t err;
+
+    err = os_evpool_init(&g_os_evpool, "evpool", OS_EVPOOL_PRIO,
+                         g_os_evpool_stack,
+                         OS_STACK_ALIGN(OS_EVPOOL_STACK_SIZE));
+    assert(err == OS_OK);
+}
+#endif
@@ -19,6 +19,10 @@
 
 
 #include <assert.h>
+#ifdef OS_MALLOC_CACHE
+#include <malloc.h>
+#endif
+#include "os/os.h"
 #include "os/os_mutex.h"
 #include "os/os_heap.h"
 
@@ -46,11 +50,123 @@ os_malloc_unlock(void)
     }
 }
 
+#ifdef OS_MALLOC_CACHE
+/*
+ * Front caches for small allocations. Freed chunks of up to
+ * OS_MALLOC_CACHE_CLASSES * OS_MALLOC_CACHE_GRAIN bytes are kept on a list
+ * per size class, linked through their first word, and handed out again
+ * from a short critical section instead of going through the malloc mutex.
+ * Requests that could be served from a class are rounded up to the class
+ * size, so any chunk on a class list fits any request of that class.
+ */
+#define OS_MALLOC_CACHE_GRAIN       (16)
+#define OS_MALLOC_CACHE_CLASSES     (4)
+#define OS_MALLOC_CACHE_DEPTH       (8)
+
+struct os_malloc_cache {
+    void *omc_head;
+    int omc_count;
+};
+
+static struct os_malloc_cache os_malloc_caches[OS_MALLOC_CACHE_CLASSES];
+
+static void *
+os_malloc_cache_get(size_t size)
+{
+    struct os_malloc_cache *omc;
+    os_sr_t sr;
+    void *ptr;
+
+    if (size == 0 ||
+        size > OS_MALLOC_CACHE_GRAIN * OS_MALLOC_CACHE_CLASSES) {
+        return (NULL);
+    }
+
+    omc = &os_malloc_caches[(size - 1) / OS_MALLOC_CACHE_GRAIN];
+    OS_ENTER_CRITICAL(sr);
+    ptr = omc->omc_head;
+    if (ptr != NULL) {
+        omc->omc_head = *(void **)ptr;
+        omc->omc_count--;
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    return (ptr);
+}
+
+/*
+ * Returns 1 if 'ptr' went into a cache, 0 if it has to be freed.
+ */
+static int
+os_malloc_cache_put(void *ptr)
+{
+    struct os_malloc_cache *omc;
+    os_sr_t sr;
+    size_t size;
+    int rc;
+
+    /* Larger chunks go back to the heap; a class list would hold on to
+     * them and hand them out for small requests.
+     */
+    size = malloc_usable_size(ptr);
+    if (size > OS_MALLOC_CACHE_GRAIN * OS_MALLOC_CACHE_CLASSES) {
+        return (0);
+    }
+    size /= OS_MALLOC_CACHE_GRAIN;
+    if (size == 0) {
+        return (0);
+    }
+
+    omc = &os_malloc_caches[size - 1];
+    rc = 0;
+    OS_ENTER_CRITICAL(sr);
+    if (omc->omc_count < OS_MALLOC_CACHE_DEPTH) {
+        *(void **)ptr = omc->omc_head;
+        omc->omc_head = ptr;
+        omc->omc_count++;
+        rc = 1;
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    return (rc);
+}
+
+/**
+ * Hand all chunks held by the front caches back to malloc, e.g. before
+ * looking at the heap statistics.
+ */
+void
+os_malloc_cache_flush(void)
+{
+    void *ptr;
+    int i;
+
+    for (i = 0; i < OS_MALLOC_CACHE_CLASSES; i++) {
+        while ((ptr = os_malloc_cache_get((i + 1) * OS_MALLOC_CACHE_GRAIN))) {
+            os_malloc_lock();
+            free(ptr);
+            os_malloc_unlock();
+        }
+    }
+}
+#endif
+
 void *
 os_malloc(size_t size)
 {
     void *ptr;
 
+#ifdef OS_MALLOC_CACHE
+    ptr = os_malloc_cache_get(size);
+    if (ptr != NULL) {
+        return ptr;
+    }
+    if (size != 0 &&
+        size <= OS_MALLOC_CACHE_GRAIN * OS_MALLOC_CACHE_CLASSES) {
+        size = OS_ALIGN(size, OS_MALLOC_CACHE_GRAIN);
+    }
+#endif
+
     os_malloc_lock();
     ptr = malloc(size);
     os_malloc_unlock();
@@ -61,6 +177,12 @@ os_malloc(size_t size)
 void
 os_free(void *mem)
 {
+#ifdef OS_MALLOC_CACHE
+    if (mem != NULL && os_malloc_cache_put(mem)) {
+        return;
+    }
+#endif
+
     os_malloc_lock();
     free(mem);
     os_malloc_unlock();
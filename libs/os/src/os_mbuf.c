@@ -47,16 +47,82 @@ os_mqueue_init(struct os_mqueue *mq, void *arg)
 {
     struct os_event *ev;
 
+    memset(mq, 0, sizeof(*mq));
     STAILQ_INIT(&mq->mq_head);
     
     ev = &mq->mq_ev;
-    memset(ev, 0, sizeof(*ev));
     ev->ev_arg = arg;
     ev->ev_type = OS_EVENT_T_MQUEUE_DATA;
 
     return (0);
 }
 
+/**
+ * Sets the watermarks of a mbuf queue.  When a put brings the queue to
+ * 'high' packets, 'func' is called with throttle set; once gets bring it
+ * back down to 'low', it is called with throttle clear.  The callback runs
+ * in the context of the put or get, outside the critical section, and is
+ * only advisory: puts above the high watermark still succeed.
+ *
+ * @param mq The mbuf queue
+ * @param high High watermark, or 0 to disable the callbacks
+ * @param low Low watermark; must be below 'high'
+ * @param func Called when the queue crosses a watermark
+ * @param arg Passed to 'func'
+ *
+ * @return 0 on success, OS_EINVAL if the watermarks are inconsistent
+ */
+int
+os_mqueue_set_watermarks(struct os_mqueue *mq, uint16_t high, uint16_t low,
+                         os_mqueue_wm_func_t func, void *arg)
+{
+    os_sr_t sr;
+
+    if (high != 0 && (low >= high || func == NULL)) {
+        return (OS_EINVAL);
+    }
+
+    OS_ENTER_CRITICAL(sr);
+    mq->mq_high_wm = high;
+    mq->mq_low_wm = low;
+    mq->mq_wm_func = func;
+    mq->mq_wm_arg = arg;
+    mq->mq_throttled = 0;
+    OS_EXIT_CRITICAL(sr);
+
+    return (0);
+}
+
+/*
+ * Accounts for 'cnt' packets taken off the queue, the oldest of which is
+ * 'mp'.  Must be called inside the critical section; returns 1 if the low
+ * watermark callback is due.
+ *
+ * Without OS_MQUEUE_PKT_WAIT packets carry no timestamp, and the wait
+ * charged is how long the queue has been non-empty: an upper bound that
+ * keeps growing while the queue never drains.
+ */
+static int
+_os_mqueue_taken(struct os_mqueue *mq, struct os_mbuf_pkthdr *mp, int cnt)
+{
+    os_time_t wait;
+
+#ifdef OS_MQUEUE_PKT_WAIT
+    wait = os_time_get() - mp->omp_enq_time;
+#else
+    wait = os_time_get() - mq->mq_busy_since;
+#endif
+    if (OS_TIME_TICK_GT(wait, mq->mq_max_wait)) {
+        mq->mq_max_wait = wait;
+    }
+
+    mq->mq_len -= cnt;
+    if (mq->mq_throttled && mq->mq_len <= mq->mq_low_wm) {
+        mq->mq_throttled = 0;
+        return (1);
+    }
+    return (0);
+}
 
 struct os_mbuf *
 os_mqueue_get(struct os_mqueue *mq)
@@ -64,14 +130,22 @@ os_mqueue_get(struct os_mqueue *mq)
     struct os_mbuf_pkthdr *mp;
     struct os_mbuf *m;
     os_sr_t sr;
+    int unthrottle;
+
+    unthrottle = 0;
 
     OS_ENTER_CRITICAL(sr);
     mp = STAILQ_FIRST(&mq->mq_head);
     if (mp) {
         STAILQ_REMOVE_HEAD(&mq->mq_head, omp_next);
+        unthrottle = _os_mqueue_taken(mq, mp, 1);
     }
     OS_EXIT_CRITICAL(sr);
 
+    if (unthrottle) {
+        mq->mq_wm_func(mq, 0, mq->mq_wm_arg);
+    }
+
     if (mp) {
         m = OS_MBUF_PKTHDR_TO_MBUF(mp);
     } else {
@@ -81,11 +155,87 @@ os_mqueue_get(struct os_mqueue *mq)
     return (m);
 }
 
+/**
+ * Takes up to 'max' packets off a mbuf queue in one critical section.
+ * Consumers that get woken by the queue event can process a burst without
+ * going back to the queue for every packet; bounding the batch keeps a
+ * long burst from delaying the other events of the consumer task.
+ *
+ * @param mq The mbuf queue
+ * @param batch Receives the packets, oldest first; take them off with
+ *     os_mqueue_batch_next()
+ * @param max Most packets to take, or 0 for all of them
+ *
+ * @return The number of packets taken
+ */
+int
+os_mqueue_get_batch(struct os_mqueue *mq, struct os_mqueue_batch *batch,
+                    int max)
+{
+    struct os_mbuf_pkthdr *last;
+    os_sr_t sr;
+    int unthrottle;
+    int cnt;
+    int i;
+
+    STAILQ_INIT(batch);
+    unthrottle = 0;
+
+    OS_ENTER_CRITICAL(sr);
+    cnt = mq->mq_len;
+    if (cnt != 0) {
+        if (max == 0 || max >= cnt) {
+            STAILQ_FIRST(batch) = STAILQ_FIRST(&mq->mq_head);
+            batch->stqh_last = mq->mq_head.stqh_last;
+            STAILQ_INIT(&mq->mq_head);
+        } else {
+            cnt = max;
+            last = STAILQ_FIRST(&mq->mq_head);
+            for (i = 1; i < cnt; i++) {
+                last = STAILQ_NEXT(last, omp_next);
+            }
+            STAILQ_FIRST(batch) = STAILQ_FIRST(&mq->mq_head);
+            STAILQ_REMOVE_HEAD_UNTIL(&mq->mq_head, last, omp_next);
+            STAILQ_NEXT(last, omp_next) = NULL;
+            batch->stqh_last = &STAILQ_NEXT(last, omp_next);
+        }
+        unthrottle = _os_mqueue_taken(mq, STAILQ_FIRST(batch), cnt);
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    if (unthrottle) {
+        mq->mq_wm_func(mq, 0, mq->mq_wm_arg);
+    }
+
+    return (cnt);
+}
+
+/**
+ * Takes the next packet off a batch returned by os_mqueue_get_batch().
+ * The batch belongs to the caller, so this needs no locking.
+ *
+ * @return The packet, or NULL once the batch is empty
+ */
+struct os_mbuf *
+os_mqueue_batch_next(struct os_mqueue_batch *batch)
+{
+    struct os_mbuf_pkthdr *mp;
+
+    mp = STAILQ_FIRST(batch);
+    if (!mp) {
+        return (NULL);
+    }
+    STAILQ_REMOVE_HEAD(batch, omp_next);
+
+    return (OS_MBUF_PKTHDR_TO_MBUF(mp));
+}
+
 int 
 os_mqueue_put(struct os_mqueue *mq, struct os_eventq *evq, struct os_mbuf *m)
 {
     struct os_mbuf_pkthdr *mp;
     os_sr_t sr;
+    int throttle;
     int rc;
 
     if (!OS_MBUF_IS_PKTHDR(m)) {
@@ -94,11 +244,34 @@ os_mqueue_put(struct os_mqueue *mq, struct os_eventq *evq, struct os_mbuf *m)
     }
 
     mp = OS_MBUF_PKTHDR(m);
+    throttle = 0;
 
     OS_ENTER_CRITICAL(sr);
+#ifdef OS_MQUEUE_PKT_WAIT
+    mp->omp_enq_time = os_time_get();
     STAILQ_INSERT_TAIL(&mq->mq_head, mp, omp_next);
+    mq->mq_len++;
+#else
+    STAILQ_INSERT_TAIL(&mq->mq_head, mp, omp_next);
+    if (mq->mq_len++ == 0) {
+        mq->mq_busy_since = os_time_get();
+    }
+#endif
+    if (mq->mq_len > mq->mq_max_len) {
+        mq->mq_max_len = mq->mq_len;
+    }
+    mq->mq_num_puts++;
+    if (mq->mq_high_wm != 0 && !mq->mq_throttled &&
+        mq->mq_len >= mq->mq_high_wm) {
+        mq->mq_throttled = 1;
+        throttle = 1;
+    }
     OS_EXIT_CRITICAL(sr);
 
+    if (throttle) {
+        mq->mq_wm_func(mq, 1, mq->mq_wm_arg);
+    }
+
     /* Only post an event to the queue if its specified */
     if (evq) {
         os_eventq_put(evq, &mq->mq_ev);
@@ -109,22 +282,52 @@ err:
     return (rc);
 }
 
+/*
+ * Counts an msys allocation event against a size class.  msys gets can run
+ * on several cores and in interrupts, so the counters are bumped
+ * atomically where the architecture has atomics, and under a critical
+ * section elsewhere.
+ */
+#ifdef OS_ARCH_HAS_CAS
+#define OS_MSYS_STAT_INC(__pool, __field) \
+    __atomic_add_fetch(&(__pool)->__field, 1, __ATOMIC_RELAXED)
+#else
+#define OS_MSYS_STAT_INC(__pool, __field) do {                          \
+    os_sr_t __sr;                                                       \
+                                                                        \
+    OS_ENTER_CRITICAL(__sr);                                            \
+    (__pool)->__field++;                                                \
+    OS_EXIT_CRITICAL(__sr);                                             \
+} while (0)
+#endif
+
+/**
+ * Registers an mbuf pool with msys.  Pools are kept sorted by block size,
+ * smallest first; pools of the same size are used in the order they were
+ * registered.
+ *
+ * @param new_pool The pool to register
+ *
+ * @return 0 on success
+ */
 int 
 os_msys_register(struct os_mbuf_pool *new_pool)  
 {
+    struct os_mbuf_pool *prev;
     struct os_mbuf_pool *pool;
 
-    pool = NULL;
+    prev = NULL;
     STAILQ_FOREACH(pool, &g_msys_pool_list, omp_next) {
-        if (new_pool->omp_databuf_len > pool->omp_databuf_len) {
+        if (new_pool->omp_databuf_len < pool->omp_databuf_len) {
             break;
         }
+        prev = pool;
     }
 
-    if (pool) {
-        STAILQ_INSERT_AFTER(&g_msys_pool_list, pool, new_pool, omp_next);
+    if (prev) {
+        STAILQ_INSERT_AFTER(&g_msys_pool_list, prev, new_pool, omp_next);
     } else {
-        STAILQ_INSERT_TAIL(&g_msys_pool_list, new_pool, omp_next);
+        STAILQ_INSERT_HEAD(&g_msys_pool_list, new_pool, omp_next);
     }
 
     return (0);
@@ -139,6 +342,27 @@ os_msys_reset(void)
     STAILQ_INIT(&g_msys_pool_list);
 }
 
+/**
+ * Walks the pools registered with msys, smallest blocks first.
+ *
+ * @param prev The pool returned by the previous call, or NULL to start
+ *     with the first one
+ *
+ * @return The next pool, or NULL after the last one
+ */
+struct os_mbuf_pool *
+os_msys_pool_get_next(struct os_mbuf_pool *prev)
+{
+    if (prev == NULL) {
+        return (STAILQ_FIRST(&g_msys_pool_list));
+    }
+    return (STAILQ_NEXT(prev, omp_next));
+}
+
+/*
+ * Returns the best fitting pool for 'dsize' bytes: the one with the smallest
+ * blocks that still hold them, or the largest pool if none does.
+ */
 static struct os_mbuf_pool *
 _os_msys_find_pool(uint16_t dsize) 
 {
@@ -158,40 +382,62 @@ _os_msys_find_pool(uint16_t dsize)
     return (pool);
 }
 
-struct os_mbuf *
-os_msys_get(uint16_t dsize, uint16_t leadingspace)
+/*
+ * Allocates from the best fitting pool for 'dsize'.  If that pool is
+ * exhausted, the next larger ones are tried in turn: a block that is too
+ * big wastes memory for a while, failing the allocation drops the packet.
+ * 'arg' is the leading space, or the user header length of a packet header
+ * mbuf.
+ */
+static struct os_mbuf *
+_os_msys_get(uint16_t dsize, int pkthdr, uint16_t arg)
 {
-    struct os_mbuf *m;
+    struct os_mbuf_pool *best;
     struct os_mbuf_pool *pool;
+    struct os_mbuf *om;
 
-    pool = _os_msys_find_pool(dsize);
-    if (!pool) {
+    best = _os_msys_find_pool(dsize);
+    if (!best) {
         goto err;
     }
 
-    m = os_mbuf_get(pool, leadingspace);
-    return (m);
+    if (dsize > best->omp_databuf_len) {
+        OS_MSYS_STAT_INC(best, omp_msys_nbig);
+    }
+
+    for (pool = best; pool != NULL; pool = STAILQ_NEXT(pool, omp_next)) {
+        if (pkthdr) {
+            om = os_mbuf_get_pkthdr(pool, arg);
+        } else {
+            om = os_mbuf_get(pool, arg);
+        }
+        if (om) {
+            OS_MSYS_STAT_INC(pool, omp_msys_nget);
+            if (pool != best) {
+                OS_MSYS_STAT_INC(pool, omp_msys_nfallback);
+            }
+            return (om);
+        }
+        OS_MSYS_STAT_INC(pool, omp_msys_nmiss);
+    }
+
 err:
     return (NULL);
 }
 
+struct os_mbuf *
+os_msys_get(uint16_t dsize, uint16_t leadingspace)
+{
+    return (_os_msys_get(dsize, 0, leadingspace));
+}
+
 struct os_mbuf *
 os_msys_get_pkthdr(uint16_t dsize, uint16_t user_hdr_len)
 {
     uint16_t total_pkthdr_len;
-    struct os_mbuf *m;
-    struct os_mbuf_pool *pool;
 
     total_pkthdr_len =  user_hdr_len + sizeof(struct os_mbuf_pkthdr);
-    pool = _os_msys_find_pool(dsize + total_pkthdr_len);
-    if (!pool) {
-        goto err;
-    }
-    
-    m = os_mbuf_get_pkthdr(pool, user_hdr_len);
-    return (m);
-err:
-    return (NULL);
+    return (_os_msys_get(dsize + total_pkthdr_len, 1, user_hdr_len));
 }
 
 
@@ -212,6 +458,10 @@ os_mbuf_pool_init(struct os_mbuf_pool *omp, struct os_mempool *mp,
     omp->omp_databuf_len = buf_len - sizeof(struct os_mbuf);
     omp->omp_mbuf_count = nbufs;
     omp->omp_pool = mp;
+    omp->omp_msys_nget = 0;
+    omp->omp_msys_nfallback = 0;
+    omp->omp_msys_nmiss = 0;
+    omp->omp_msys_nbig = 0;
 
     return (0);
 }
@@ -280,6 +530,192 @@ os_mbuf_get_pkthdr(struct os_mbuf_pool *omp, uint8_t user_pkthdr_len)
     return om;
 }
 
+/**
+ * Initialize a descriptor for external mbuf storage.  The storage is not
+ * referenced by any mbuf yet.
+ *
+ * @param ext       The descriptor to initialize
+ * @param buf       The start of the storage
+ * @param len       The length of the storage
+ * @param free_func Called when the last mbuf referencing the storage is
+ *                  freed, can be NULL
+ * @param arg       Argument for free_func, kept in ome_arg
+ */
+void
+os_mbuf_ext_init(struct os_mbuf_ext *ext, void *buf, uint32_t len,
+                 os_mbuf_ext_free_func_t free_func, void *arg)
+{
+    ext->ome_buf = buf;
+    ext->ome_len = len;
+    ext->ome_refcnt = 0;
+    ext->ome_free = free_func;
+    ext->ome_arg = arg;
+}
+
+/* Take a reference to external storage; returns 0 on success */
+static int
+_os_mbuf_ext_ref(struct os_mbuf_ext *ext)
+{
+    os_sr_t sr;
+    int rc;
+
+    OS_ENTER_CRITICAL(sr);
+    if (ext->ome_refcnt == UINT16_MAX) {
+        rc = OS_ENOMEM;
+    } else {
+        ext->ome_refcnt++;
+        rc = 0;
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    return (rc);
+}
+
+/* Drop a reference to external storage, freeing it with the last one */
+static void
+_os_mbuf_ext_unref(struct os_mbuf_ext *ext)
+{
+    os_sr_t sr;
+    int last;
+
+    OS_ENTER_CRITICAL(sr);
+    assert(ext->ome_refcnt > 0);
+    last = (--ext->ome_refcnt == 0);
+    OS_EXIT_CRITICAL(sr);
+
+    if (last && ext->ome_free) {
+        ext->ome_free(ext);
+    }
+}
+
+/* Point an mbuf from the pool at external storage */
+static struct os_mbuf *
+_os_mbuf_get_ext(struct os_mbuf_pool *omp, struct os_mbuf_ext *ext,
+                 uint8_t *data, uint16_t len)
+{
+    struct os_mbuf *om;
+
+    /* The descriptor pointer is kept in the mbuf's own buffer. */
+    if (omp->omp_databuf_len < sizeof ext) {
+        goto err;
+    }
+
+    om = os_mbuf_get(omp, 0);
+    if (!om) {
+        goto err;
+    }
+
+    if (_os_mbuf_ext_ref(ext) != 0) {
+        os_mbuf_free(om);
+        goto err;
+    }
+
+    om->om_flags |= OS_MBUF_F_MASK(OS_MBUF_F_EXT);
+    memcpy(OS_MBUF_EXT_SLOT(om), &ext, sizeof ext);
+    om->om_data = data;
+    om->om_len = len;
+
+    return (om);
+err:
+    return (NULL);
+}
+
+/**
+ * Get an mbuf from the mbuf pool whose data is a region of external
+ * storage.  The mbuf takes a reference to the storage, which it drops when
+ * it is freed.  The data is not copied, and has no leading or trailing
+ * space.
+ *
+ * @param omp The mbuf pool to allocate the mbuf out of
+ * @param ext The external storage
+ * @param off The offset of the data in the storage
+ * @param len The length of the data
+ *
+ * @return An initialized mbuf on success, and NULL on failure.
+ */
+struct os_mbuf *
+os_mbuf_get_ext(struct os_mbuf_pool *omp, struct os_mbuf_ext *ext,
+                uint32_t off, uint16_t len)
+{
+    if (off > ext->ome_len || len > ext->ome_len - off) {
+        return (NULL);
+    }
+
+    return (_os_mbuf_get_ext(omp, ext, ext->ome_buf + off, len));
+}
+
+/**
+ * Append a region of external storage onto a mbuf chain, without copying
+ * it.  As many mbufs as are needed to hold the length get allocated from
+ * the pool of the chain, each referencing the storage.
+ *
+ * @param om  The mbuf chain to append onto
+ * @param ext The external storage
+ * @param off The offset of the data in the storage
+ * @param len The length of the data
+ *
+ * @return 0 on success, and an error code on failure.  On failure nothing
+ *         is appended.
+ */
+int
+os_mbuf_append_ext(struct os_mbuf *om, struct os_mbuf_ext *ext,
+                   uint32_t off, uint32_t len)
+{
+    struct os_mbuf *head;
+    struct os_mbuf *last;
+    struct os_mbuf *new;
+    uint32_t remainder;
+    uint8_t *data;
+    int rc;
+
+    if (om == NULL || off > ext->ome_len || len > ext->ome_len - off) {
+        rc = OS_EINVAL;
+        goto err;
+    }
+
+    /* Build the new part of the chain first, so that a failure leaves the
+     * original chain as it was.
+     */
+    head = NULL;
+    last = NULL;
+    data = ext->ome_buf + off;
+    remainder = len;
+    while (remainder > 0) {
+        new = _os_mbuf_get_ext(om->om_omp, ext, data,
+                               min(remainder, UINT16_MAX));
+        if (!new) {
+            os_mbuf_free_chain(head);
+            rc = OS_ENOMEM;
+            goto err;
+        }
+
+        data += new->om_len;
+        remainder -= new->om_len;
+        if (last) {
+            SLIST_NEXT(last, om_next) = new;
+        } else {
+            head = new;
+        }
+        last = new;
+    }
+
+    if (head) {
+        last = om;
+        while (SLIST_NEXT(last, om_next) != NULL) {
+            last = SLIST_NEXT(last, om_next);
+        }
+        SLIST_NEXT(last, om_next) = head;
+
+        if (OS_MBUF_IS_PKTHDR(om)) {
+            OS_MBUF_PKTHDR(om)->omp_len += len;
+        }
+    }
+
+    return (0);
+err:
+    return (rc);
+}
+
 /**
  * Release a mbuf back to the pool
  *
@@ -293,6 +729,10 @@ os_mbuf_free(struct os_mbuf *om)
 {
     int rc;
 
+    if (OS_MBUF_IS_EXT(om)) {
+        _os_mbuf_ext_unref(OS_MBUF_EXT(om));
+    }
+
     if (om->om_omp != NULL) {
         rc = os_memblock_put(om->om_omp->omp_pool, om);
         if (rc != 0) {
@@ -437,8 +877,25 @@ err:
 }
 
 
+/**
+ * Allocate the copy of a single mbuf for os_mbuf_dup().  Data in external
+ * storage is shared with the original rather than copied.
+ */
+static struct os_mbuf *
+_os_mbuf_dup_get(struct os_mbuf_pool *omp, struct os_mbuf *om)
+{
+    if (OS_MBUF_IS_EXT(om)) {
+        return (_os_mbuf_get_ext(omp, OS_MBUF_EXT(om), om->om_data,
+                                 om->om_len));
+    } else {
+        return (os_mbuf_get(omp, OS_MBUF_LEADINGSPACE(om)));
+    }
+}
+
 /**
  * Duplicate a chain of mbufs.  Return the start of the duplicated chain.
+ * Data in the mbufs' own buffers is copied; data in external storage is
+ * not, the duplicate references the same storage.
  *
  * @param omp The mbuf pool to duplicate out of 
  * @param om  The mbuf chain to duplicate 
@@ -459,8 +916,7 @@ os_mbuf_dup(struct os_mbuf *om)
 
     for (; om != NULL; om = SLIST_NEXT(om, om_next)) {
         if (head) {
-            SLIST_NEXT(copy, om_next) = os_mbuf_get(omp, 
-                    OS_MBUF_LEADINGSPACE(om)); 
+            SLIST_NEXT(copy, om_next) = _os_mbuf_dup_get(omp, om);
             if (!SLIST_NEXT(copy, om_next)) {
                 os_mbuf_free_chain(head);
                 goto err;
@@ -468,16 +924,25 @@ os_mbuf_dup(struct os_mbuf *om)
 
             copy = SLIST_NEXT(copy, om_next);
         } else {
-            head = os_mbuf_get(omp, OS_MBUF_LEADINGSPACE(om));
+            head = _os_mbuf_dup_get(omp, om);
             if (!head) {
                 goto err;
             }
 
             if (OS_MBUF_IS_PKTHDR(om)) {
-                _os_mbuf_copypkthdr(head, om);
+                if (OS_MBUF_IS_EXT(om)) {
+                    memcpy(&head->om_databuf[0], &om->om_databuf[0],
+                           om->om_pkthdr_len);
+                    head->om_pkthdr_len = om->om_pkthdr_len;
+                } else {
+                    _os_mbuf_copypkthdr(head, om);
+                }
             }
             copy = head;
         }
+        if (OS_MBUF_IS_EXT(om)) {
+            continue;
+        }
         copy->om_flags = om->om_flags;
         copy->om_len = om->om_len;
         memcpy(OS_MBUF_DATA(copy, uint8_t *), OS_MBUF_DATA(om, uint8_t *),
@@ -489,6 +954,104 @@ err:
     return (NULL);
 }
 
+/**
+ * Repacks a chain into as few msys blocks as its length allows: blocks of
+ * the largest class for the bulk of the data, and the best fitting class
+ * for the rest.  The packet header moves to the new chain; data starts at
+ * the beginning of each block, so any leading space is lost.
+ *
+ * The chain is left alone if it is already that short, if it references
+ * external storage, which packing would copy, or if msys runs out of
+ * blocks.
+ *
+ * @param om The chain to pack
+ *
+ * @return The packed chain, in which case 'om' has been freed; or 'om'
+ *     itself if it was left alone.
+ */
+struct os_mbuf *
+os_msys_pack(struct os_mbuf *om)
+{
+    struct os_mbuf_pool *pool;
+    struct os_mbuf_iter it;
+    struct os_mbuf *head;
+    struct os_mbuf *tail;
+    struct os_mbuf *m;
+    uint32_t left;
+    uint32_t need;
+    uint16_t chunk;
+    uint16_t hdr;
+    int nbufs;
+    int rc;
+
+    nbufs = 0;
+    left = 0;
+    for (m = om; m != NULL; m = SLIST_NEXT(m, om_next)) {
+        if (OS_MBUF_IS_EXT(m)) {
+            return (om);
+        }
+        left += m->om_len;
+        nbufs++;
+    }
+
+    /* Count the blocks the packed chain takes. */
+    hdr = om->om_pkthdr_len;
+    need = left;
+    do {
+        pool = _os_msys_find_pool(min(hdr + need, UINT16_MAX));
+        if (!pool || pool->omp_databuf_len <= hdr) {
+            return (om);
+        }
+        need -= min(need, pool->omp_databuf_len - hdr);
+        hdr = 0;
+        nbufs--;
+    } while (need > 0);
+    if (nbufs <= 0) {
+        return (om);
+    }
+
+    rc = os_mbuf_iter_init(&it, om, 0);
+    if (rc != 0) {
+        return (om);
+    }
+
+    head = NULL;
+    tail = NULL;
+    hdr = om->om_pkthdr_len;
+    do {
+        m = _os_msys_get(min(hdr + left, UINT16_MAX), 0, 0);
+        if (!m) {
+            goto err;
+        }
+
+        if (head) {
+            SLIST_NEXT(tail, om_next) = m;
+        } else {
+            head = m;
+            if (OS_MBUF_IS_PKTHDR(om)) {
+                _os_mbuf_copypkthdr(head, om);
+            }
+            head->om_flags = om->om_flags;
+        }
+        tail = m;
+
+        chunk = min(left, OS_MBUF_TRAILINGSPACE(m));
+        os_mbuf_iter_read(&it, OS_MBUF_DATA(m, uint8_t *), chunk);
+        m->om_len = chunk;
+        left -= chunk;
+        hdr = 0;
+    } while (left > 0);
+
+    os_mbuf_free_chain(om);
+
+    return (head);
+err:
+    if (head) {
+        os_mbuf_free_chain(head);
+    }
+    return (om);
+}
+
 /**
  * Locates the specified absolute offset within an mbuf chain.  The offset
  * can be one past than the total length of the chain, but no greater.
@@ -567,6 +1130,278 @@ os_mbuf_copydata(const struct os_mbuf *m, int off, int len, void *dst)
     return (len > 0 ? -1 : 0);
 }
 
+/* Move the cursor off the end of its mbuf, and past any empty ones. */
+static void
+_os_mbuf_iter_norm(struct os_mbuf_iter *it)
+{
+    while (it->omi_om != NULL && it->omi_off >= it->omi_om->om_len) {
+        it->omi_off -= it->omi_om->om_len;
+        it->omi_om = SLIST_NEXT(it->omi_om, om_next);
+    }
+}
+
+/**
+ * Initialize a cursor for reading an mbuf chain.
+ *
+ * @param it                    The cursor to initialize.
+ * @param om                    The start of the mbuf chain to read.
+ * @param off                   The offset to start reading at.  It can be
+ *                                  the length of the chain, but no more.
+ *
+ * @return                      0 on success;
+ *                              -1 if the offset is out of bounds.
+ */
+int
+os_mbuf_iter_init(struct os_mbuf_iter *it, struct os_mbuf *om, int off)
+{
+    /* Skip whole buffers here; omi_off is only 16 bits. */
+    while (om != NULL && off > om->om_len) {
+        off -= om->om_len;
+        om = SLIST_NEXT(om, om_next);
+    }
+    if (om == NULL && off > 0) {
+        it->omi_om = NULL;
+        it->omi_off = 0;
+        return (-1);
+    }
+
+    it->omi_om = om;
+    it->omi_off = off;
+    _os_mbuf_iter_norm(it);
+
+    return (0);
+}
+
+/**
+ * Gets the data at the cursor that is contiguous in memory, without
+ * advancing.
+ *
+ * @param it                    The cursor.
+ * @param out_len               On success, the number of contiguous bytes.
+ *
+ * @return                      A pointer to the data at the cursor;
+ *                              NULL at the end of the chain.
+ */
+void *
+os_mbuf_iter_peek(struct os_mbuf_iter *it, uint16_t *out_len)
+{
+    if (it->omi_om == NULL) {
+        *out_len = 0;
+        return (NULL);
+    }
+
+    *out_len = it->omi_om->om_len - it->omi_off;
+    return (it->omi_om->om_data + it->omi_off);
+}
+
+/**
+ * Advances the cursor.
+ *
+ * @param it                    The cursor.
+ * @param len                   The number of bytes to skip.
+ *
+ * @return                      0 on success;
+ *                              -1 if the chain ends first, in which case the
+ *                                  cursor is left at the end.
+ */
+int
+os_mbuf_iter_advance(struct os_mbuf_iter *it, int len)
+{
+    int chunk;
+
+    while (len > 0) {
+        if (it->omi_om == NULL) {
+            return (-1);
+        }
+
+        chunk = min(it->omi_om->om_len - it->omi_off, len);
+        it->omi_off += chunk;
+        len -= chunk;
+        _os_mbuf_iter_norm(it);
+    }
+
+    return (0);
+}
+
+/**
+ * Reads a value of len bytes at the cursor and advances past it.  If the
+ * value is contiguous in one mbuf a pointer to it is returned; only when it
+ * straddles buffers is it copied into the caller's buffer.
+ *
+ * @param it                    The cursor.
+ * @param len                   The length of the value.
+ * @param buf                   At least len bytes to assemble the value in.
+ *
+ * @return                      A pointer to the value on success;
+ *                              NULL if the chain is too short, in which case
+ *                                  the cursor is not moved.
+ */
+void *
+os_mbuf_iter_get(struct os_mbuf_iter *it, int len, void *buf)
+{
+    struct os_mbuf_iter start;
+    uint8_t *data;
+
+    if (it->omi_om != NULL && it->omi_om->om_len - it->omi_off >= len) {
+        data = it->omi_om->om_data + it->omi_off;
+        it->omi_off += len;
+        _os_mbuf_iter_norm(it);
+        return (data);
+    }
+
+    start = *it;
+    if (os_mbuf_iter_read(it, buf, len) != 0) {
+        *it = start;
+        return (NULL);
+    }
+
+    return (buf);
+}
+
+/**
+ * Copies data at the cursor to a flat buffer and advances past it.
+ *
+ * @param it                    The cursor.
+ * @param dst                   The buffer to copy to.
+ * @param len                   The number of bytes to copy.
+ *
+ * @return                      0 on success;
+ *                              -1 if the chain ends first, in which case the
+ *                                  cursor is left at the end.
+ */
+int
+os_mbuf_iter_read(struct os_mbuf_iter *it, void *dst, int len)
+{
+    uint8_t *udst;
+    int chunk;
+
+    udst = dst;
+    while (len > 0) {
+        if (it->omi_om == NULL) {
+            return (-1);
+        }
+
+        chunk = min(it->omi_om->om_len - it->omi_off, len);
+        memcpy(udst, it->omi_om->om_data + it->omi_off, chunk);
+        udst += chunk;
+        it->omi_off += chunk;
+        len -= chunk;
+        _os_mbuf_iter_norm(it);
+    }
+
+    return (0);
+}
+
+/**
+ * Reads one byte at the cursor and advances past it.
+ *
+ * @return                      0 on success; -1 at the end of the chain.
+ */
+int
+os_mbuf_iter_read_u8(struct os_mbuf_iter *it, uint8_t *val)
+{
+    if (it->omi_om == NULL) {
+        return (-1);
+    }
+
+    *val = it->omi_om->om_data[it->omi_off++];
+    _os_mbuf_iter_norm(it);
+
+    return (0);
+}
+
+/**
+ * Reads a little endian 16-bit value at the cursor and advances past it.
+ *
+ * @return                      0 on success;
+ *                              -1 if the chain is too short.
+ */
+int
+os_mbuf_iter_read_le16(struct os_mbuf_iter *it, uint16_t *val)
+{
+    uint8_t buf[2];
+    uint8_t *u8p;
+
+    u8p = os_mbuf_iter_get(it, sizeof buf, buf);
+    if (u8p == NULL) {
+        return (-1);
+    }
+
+    *val = (uint16_t)u8p[0] | ((uint16_t)u8p[1] << 8);
+
+    return (0);
+}
+
+/**
+ * Reads a little endian 32-bit value at the cursor and advances past it.
+ *
+ * @return                      0 on success;
+ *                              -1 if the chain is too short.
+ */
+int
+os_mbuf_iter_read_le32(struct os_mbuf_iter *it, uint32_t *val)
+{
+    uint8_t buf[4];
+    uint8_t *u8p;
+
+    u8p = os_mbuf_iter_get(it, sizeof buf, buf);
+    if (u8p == NULL) {
+        return (-1);
+    }
+
+    *val = (uint32_t)u8p[0] | ((uint32_t)u8p[1] << 8) |
+           ((uint32_t)u8p[2] << 16) | ((uint32_t)u8p[3] << 24);
+
+    return (0);
+}
+
+/**
+ * Describes a region of an mbuf chain as a list of contiguous segments,
+ * for handing it to code that takes scatter/gather lists.  Empty buffers
+ * are left out.
+ *
+ * @param om                    The start of the mbuf chain.
+ * @param off                   The offset of the region.
+ * @param len                   The length of the region.
+ * @param iov                   The segment list to fill in.
+ * @param iovcnt                The number of entries in iov.
+ *
+ * @return                      The number of segments on success;
+ *                              -1 if the chain is too short or the region
+ *                                  does not fit in iovcnt segments.
+ */
+int
+os_mbuf_iov_get(struct os_mbuf *om, int off, int len,
+                struct os_mbuf_iov *iov, int iovcnt)
+{
+    struct os_mbuf_iter it;
+    uint16_t chunk;
+    void *data;
+    int cnt;
+
+    if (os_mbuf_iter_init(&it, om, off) != 0) {
+        return (-1);
+    }
+
+    cnt = 0;
+    while (len > 0) {
+        data = os_mbuf_iter_peek(&it, &chunk);
+        if (data == NULL || cnt == iovcnt) {
+            return (-1);
+        }
+
+        chunk = min(chunk, len);
+        iov[cnt].omv_base = data;
+        iov[cnt].omv_len = chunk;
+        cnt++;
+
+        len -= chunk;
+        os_mbuf_iter_advance(&it, chunk);
+    }
+
+    return (cnt);
+}
+
 void
 os_mbuf_adj(struct os_mbuf *mp, int req_len)
 {
@@ -767,7 +1602,8 @@ os_mbuf_prepend(struct os_mbuf *om, int len)
  * Copies the contents of a flat buffer into an mbuf chain, starting at the
  * specified destination offset.  If the mbuf is too small for the source data,
  * it is extended as necessary.  If the destination mbuf contains a packet
- * header, the header length is updated.
+ * header, the header length is updated.  Data in external storage cannot
+ * be overwritten.
  *
  * @param omp                   The mbuf pool to allocate from.
  * @param om                    The mbuf chain to copy into.
@@ -793,6 +1629,17 @@ os_mbuf_copyinto(struct os_mbuf *om, int off, const void *src, int len)
         return -1;
     }
 
+    /* External storage is read-only; check before anything is written. */
+    copylen = -cur_off;
+    for (next = cur; next != NULL && copylen < len;
+         next = SLIST_NEXT(next, om_next)) {
+
+        if (OS_MBUF_IS_EXT(next) && next->om_len + copylen > 0) {
+            return -1;
+        }
+        copylen += next->om_len;
+    }
+
     /* Overwrite existing data until we reach the end of the chain. */
     sptr = src;
     while (1) {
@@ -66,6 +66,17 @@ os_mempool_init(struct os_mempool *mp, int blocks, int block_size, void *membuf,
     mp->mp_membuf_addr = (uint32_t)membuf;
     mp->name = name;
     SLIST_FIRST(mp) = membuf;
+#ifdef OS_MEMPOOL_LOCKFREE
+    mp->mp_head = 1;
+#endif
+#ifdef OS_MEMPOOL_STATS
+    mp->mp_min_free = blocks;
+    mp->mp_num_allocs = 0;
+    mp->mp_num_fails = 0;
+    mp->mp_first_fail = 0;
+    mp->mp_fail_caller = NULL;
+    mp->mp_owner = NULL;
+#endif
 
     /* Chain the memory blocks to the free list */
     block_addr = (uint8_t *)membuf;
@@ -85,6 +96,210 @@ os_mempool_init(struct os_mempool *mp, int blocks, int block_size, void *membuf,
     return OS_OK;
 }
 
+/**
+ * Checks that 'block_addr' is the start of one of the pool's blocks.
+ *
+ * @return 0 if it is, OS_INVALID_PARM otherwise.
+ */
+static os_error_t
+os_mempool_block_check(struct os_mempool *mp, void *block_addr)
+{
+    uint32_t end;
+    uint32_t true_block_size;
+    uint32_t baddr32;
+
+    if (block_addr == NULL) {
+        return OS_INVALID_PARM;
+    }
+
+    /* Check that the block we are freeing is a valid block! */
+    baddr32 = (uint32_t)(uintptr_t)block_addr;
+    true_block_size = OS_MEMPOOL_TRUE_BLOCK_SIZE(mp->mp_block_size);
+    end = mp->mp_membuf_addr + (mp->mp_num_blocks * true_block_size);
+    if ((baddr32 < mp->mp_membuf_addr) || (baddr32 >= end)) {
+        return OS_INVALID_PARM;
+    }
+
+    /* All freed blocks should be on true block size boundaries! */
+    if (((baddr32 - mp->mp_membuf_addr) % true_block_size) != 0) {
+        return OS_INVALID_PARM;
+    }
+
+    return OS_OK;
+}
+
+#ifdef OS_MEMPOOL_STATS
+/*
+ * Account for a get of 'cnt' blocks that left 'num_free' blocks in the
+ * pool; 'cnt' is 0 if the pool was empty. Lock-free pools call this
+ * without holding anything, the others from their critical section.
+ */
+static void
+os_mempool_stats_get(struct os_mempool *mp, int cnt, int num_free,
+                     void *caller)
+{
+#ifdef OS_MEMPOOL_LOCKFREE
+    int min_free;
+
+    if (cnt == 0) {
+        if (__atomic_fetch_add(&mp->mp_num_fails, 1, __ATOMIC_RELAXED) == 0) {
+            mp->mp_first_fail = os_time_get();
+        }
+        mp->mp_fail_caller = caller;
+        return;
+    }
+
+    __atomic_add_fetch(&mp->mp_num_allocs, cnt, __ATOMIC_RELAXED);
+    min_free = __atomic_load_n(&mp->mp_min_free, __ATOMIC_RELAXED);
+    while (num_free < min_free &&
+           !__atomic_compare_exchange_n(&mp->mp_min_free, &min_free,
+                                        num_free, 0, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+    }
+#else
+    if (cnt == 0) {
+        if (mp->mp_num_fails++ == 0) {
+            mp->mp_first_fail = os_time_get();
+        }
+        mp->mp_fail_caller = caller;
+        return;
+    }
+
+    mp->mp_num_allocs += cnt;
+    if (num_free < mp->mp_min_free) {
+        mp->mp_min_free = num_free;
+    }
+#endif
+}
+
+/**
+ * Tag a memory pool with the name of its owner, shown alongside the
+ * pool's statistics.
+ */
+void
+os_mempool_set_owner(struct os_mempool *mp, const char *owner)
+{
+    mp->mp_owner = owner;
+}
+
+#define OS_MEMPOOL_STATS_GET(__mp, __cnt, __num_free, __caller) \
+    os_mempool_stats_get((__mp), (__cnt), (__num_free), (__caller))
+#else
+#define OS_MEMPOOL_STATS_GET(__mp, __cnt, __num_free, __caller) \
+    ((void)(__num_free))
+#endif /* OS_MEMPOOL_STATS */
+
+#ifdef OS_MEMPOOL_LOCKFREE
+
+/* Address of block 'idx'; block indices are 1-based, 0 means no block */
+static struct os_memblock *
+os_mempool_block(struct os_mempool *mp, uint32_t idx)
+{
+    if (idx == 0) {
+        return (NULL);
+    }
+    return ((struct os_memblock *)(uintptr_t)(mp->mp_membuf_addr +
+        (idx - 1) * OS_MEMPOOL_TRUE_BLOCK_SIZE(mp->mp_block_size)));
+}
+
+/* Index of 'block', or 0 if it does not start one of the pool's blocks */
+static uint32_t
+os_mempool_block_idx(struct os_mempool *mp, struct os_memblock *block)
+{
+    uint32_t true_block_size;
+    uint32_t off;
+
+    off = (uint32_t)(uintptr_t)block - mp->mp_membuf_addr;
+    true_block_size = OS_MEMPOOL_TRUE_BLOCK_SIZE(mp->mp_block_size);
+    if (block == NULL || off >= mp->mp_num_blocks * true_block_size ||
+        off % true_block_size != 0) {
+        return (0);
+    }
+    return (off / true_block_size + 1);
+}
+
+#define OS_MEMPOOL_LF_IDX(__h)          ((__h) & 0xffff)
+#define OS_MEMPOOL_LF_HEAD(__h, __idx)  \
+    ((((__h) + 0x10000) & 0xffff0000) | (__idx))
+
+#define os_mempool_is_lockfree(__mp)    \
+    ((__mp)->mp_num_blocks <= OS_MEMPOOL_LF_MAX_BLOCKS)
+
+/*
+ * Pop up to 'n' blocks off the free list with a single CAS.
+ *
+ * The links are read without holding anything, so a block can be handed
+ * out, and its link overwritten, by someone else while we follow it. That
+ * is harmless: every get and put bumps the tag in the head, so the CAS
+ * fails and we start over. Links are only followed if they point inside
+ * the pool, which is always safe to read.
+ */
+static int
+os_mempool_lf_get(struct os_mempool *mp, void **blocks, int n, void *caller)
+{
+    struct os_memblock *block;
+    struct os_memblock *next;
+    uint32_t head;
+    uint32_t new_head;
+    int num_free;
+    int cnt;
+
+    head = __atomic_load_n(&mp->mp_head, __ATOMIC_ACQUIRE);
+    do {
+        block = os_mempool_block(mp, OS_MEMPOOL_LF_IDX(head));
+        if (block == NULL) {
+            OS_MEMPOOL_STATS_GET(mp, 0, 0, caller);
+            return (0);
+        }
+        cnt = 0;
+        while (1) {
+            blocks[cnt++] = block;
+            next = SLIST_NEXT(block, mb_next);
+            if (cnt == n || os_mempool_block_idx(mp, next) == 0) {
+                break;
+            }
+            block = next;
+        }
+        new_head = OS_MEMPOOL_LF_HEAD(head, os_mempool_block_idx(mp, next));
+    } while (!__atomic_compare_exchange_n(&mp->mp_head, &head, new_head, 0,
+                                          __ATOMIC_ACQUIRE,
+                                          __ATOMIC_ACQUIRE));
+
+    num_free = __atomic_sub_fetch(&mp->mp_num_free, cnt, __ATOMIC_RELAXED);
+    OS_MEMPOOL_STATS_GET(mp, cnt, num_free, caller);
+
+    return (cnt);
+}
+
+/*
+ * Push the chain of 'cnt' blocks from 'first' to 'last' with one CAS.
+ *
+ * The free count goes up before the blocks are published, so a getter that
+ * takes them straight away never sees the count drop below 0.
+ */
+static void
+os_mempool_lf_put(struct os_mempool *mp, struct os_memblock *first,
+                  struct os_memblock *last, int cnt)
+{
+    uint32_t head;
+    uint32_t new_head;
+    uint32_t idx;
+
+    __atomic_add_fetch(&mp->mp_num_free, cnt, __ATOMIC_RELAXED);
+
+    idx = os_mempool_block_idx(mp, first);
+    head = __atomic_load_n(&mp->mp_head, __ATOMIC_RELAXED);
+    do {
+        SLIST_NEXT(last, mb_next) =
+            os_mempool_block(mp, OS_MEMPOOL_LF_IDX(head));
+        new_head = OS_MEMPOOL_LF_HEAD(head, idx);
+    } while (!__atomic_compare_exchange_n(&mp->mp_head, &head, new_head, 0,
+                                          __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+}
+
+#endif /* OS_MEMPOOL_LOCKFREE */
+
 /**
  * os memblock get 
  *  
@@ -103,6 +318,14 @@ os_memblock_get(struct os_mempool *mp)
     /* Check to make sure they passed in a memory pool (or something) */
     block = NULL;
     if (mp) {
+#ifdef OS_MEMPOOL_LOCKFREE
+        if (os_mempool_is_lockfree(mp)) {
+            os_mempool_lf_get(mp, (void **)&block, 1,
+                              os_get_return_addr());
+            return (void *)block;
+        }
+#endif
+
         OS_ENTER_CRITICAL(sr);
         /* Check for any free */
         if (mp->mp_num_free) {
@@ -115,6 +338,8 @@ os_memblock_get(struct os_mempool *mp)
             /* Decrement number free by 1 */
             mp->mp_num_free--;
         }
+        OS_MEMPOOL_STATS_GET(mp, block != NULL, mp->mp_num_free,
+                             os_get_return_addr());
         OS_EXIT_CRITICAL(sr);
     }
 
@@ -135,9 +360,7 @@ os_error_t
 os_memblock_put(struct os_mempool *mp, void *block_addr)
 {
     os_sr_t sr;
-    uint32_t end;
-    uint32_t true_block_size;
-    uint32_t baddr32;
+    os_error_t rc;
     struct os_memblock *block;
 
     /* Make sure parameters are valid */
@@ -145,25 +368,19 @@ os_memblock_put(struct os_mempool *mp, void *block_addr)
         return OS_INVALID_PARM;
     }
 
-    /* Check that the block we are freeing is a valid block! */
-    baddr32 = (uint32_t)block_addr;
-    true_block_size = OS_MEMPOOL_TRUE_BLOCK_SIZE(mp->mp_block_size);
-    end = mp->mp_membuf_addr + (mp->mp_num_blocks * true_block_size);
-    if ((baddr32 < mp->mp_membuf_addr) || (baddr32 >= end)) {
-        return OS_INVALID_PARM;
+    rc = os_mempool_block_check(mp, block_addr);
+    if (rc != OS_OK) {
+        return rc;
     }
 
-    /* All freed blocks should be on true block size boundaries! */
-    if (((baddr32 - mp->mp_membuf_addr) % true_block_size) != 0) {
-        return OS_INVALID_PARM;
+    block = (struct os_memblock *)block_addr;
+#ifdef OS_MEMPOOL_LOCKFREE
+    if (os_mempool_is_lockfree(mp)) {
+        os_mempool_lf_put(mp, block, block, 1);
+        return OS_OK;
     }
+#endif
 
-    /* 
-     * XXX: we should do boundary checks here! The block had better be within 
-     * the pool. If it fails, do we return an error or assert()? Add this when 
-     * we add the memory debug. 
-     */ 
-    block = (struct os_memblock *)block_addr;
     OS_ENTER_CRITICAL(sr);
     
     /* Chain current free list pointer to this block; make this block head */
@@ -179,6 +396,196 @@ os_memblock_put(struct os_mempool *mp, void *block_addr)
     return OS_OK;
 }
 
+/**
+ * Get up to 'n' blocks from a memory pool at once. This costs the same as
+ * a single os_memblock_get(): one CAS on a lock-free pool, or one critical
+ * section.
+ *
+ * @param mp            Pointer to the memory pool
+ * @param blocks        Array receiving the blocks
+ * @param n             Number of blocks wanted
+ *
+ * @return int The number of blocks stored in 'blocks', less than 'n' if
+ *             the pool ran out.
+ */
+int
+os_memblock_get_n(struct os_mempool *mp, void **blocks, int n)
+{
+    struct os_memblock *block;
+    os_sr_t sr;
+    int cnt;
+
+    if ((mp == NULL) || (blocks == NULL) || (n <= 0)) {
+        return (0);
+    }
+
+#ifdef OS_MEMPOOL_LOCKFREE
+    if (os_mempool_is_lockfree(mp)) {
+        return (os_mempool_lf_get(mp, blocks, n, os_get_return_addr()));
+    }
+#endif
+
+    cnt = 0;
+    OS_ENTER_CRITICAL(sr);
+    while (cnt < n && mp->mp_num_free) {
+        block = SLIST_FIRST(mp);
+        SLIST_FIRST(mp) = SLIST_NEXT(block, mb_next);
+        mp->mp_num_free--;
+        blocks[cnt++] = block;
+    }
+    OS_MEMPOOL_STATS_GET(mp, cnt, mp->mp_num_free, os_get_return_addr());
+    OS_EXIT_CRITICAL(sr);
+
+    return (cnt);
+}
+
+/**
+ * Put 'n' blocks back into a memory pool at once. Either all of the blocks
+ * are returned to the pool, or, if any of them does not belong to it, none.
+ *
+ * @param mp            Pointer to the memory pool
+ * @param blocks        The blocks to free
+ * @param n             Number of blocks in 'blocks'
+ *
+ * @return os_error_t
+ */
+os_error_t
+os_memblock_put_n(struct os_mempool *mp, void **blocks, int n)
+{
+    struct os_memblock *first;
+    struct os_memblock *last;
+    os_error_t rc;
+    os_sr_t sr;
+    int i;
+
+    if ((mp == NULL) || (blocks == NULL) || (n < 0)) {
+        return OS_INVALID_PARM;
+    }
+    if (n == 0) {
+        return OS_OK;
+    }
+
+    for (i = 0; i < n; i++) {
+        rc = os_mempool_block_check(mp, blocks[i]);
+        if (rc != OS_OK) {
+            return rc;
+        }
+    }
+
+    /* Chain the blocks up front so they can be spliced in all at once. */
+    for (i = 0; i < n - 1; i++) {
+        SLIST_NEXT((struct os_memblock *)blocks[i], mb_next) = blocks[i + 1];
+    }
+    first = blocks[0];
+    last = blocks[n - 1];
+
+#ifdef OS_MEMPOOL_LOCKFREE
+    if (os_mempool_is_lockfree(mp)) {
+        os_mempool_lf_put(mp, first, last, n);
+        return OS_OK;
+    }
+#endif
+
+    OS_ENTER_CRITICAL(sr);
+    SLIST_NEXT(last, mb_next) = SLIST_FIRST(mp);
+    SLIST_FIRST(mp) = first;
+    mp->mp_num_free += n;
+    OS_EXIT_CRITICAL(sr);
+
+    return OS_OK;
+}
+
+/**
+ * Initialize a magazine caching blocks of 'mp'. The magazine starts out
+ * empty.
+ *
+ * @param mag           The magazine to initialize
+ * @param mp            The pool to cache blocks of
+ * @param slots         Storage for 'nslots' block pointers
+ * @param nslots        Number of blocks the magazine can hold
+ *
+ * @return os_error_t
+ */
+os_error_t
+os_mempool_mag_init(struct os_mempool_mag *mag, struct os_mempool *mp,
+                    void **slots, int nslots)
+{
+    if ((mag == NULL) || (mp == NULL) || (slots == NULL) ||
+        (nslots <= 0) || (nslots > UINT16_MAX)) {
+        return OS_INVALID_PARM;
+    }
+
+    mag->mm_pool = mp;
+    mag->mm_slots = slots;
+    mag->mm_size = nslots;
+    mag->mm_count = 0;
+
+    return OS_OK;
+}
+
+/**
+ * Get a block through a magazine. When the magazine is empty, it is
+ * refilled with half its size worth of blocks from the pool first.
+ *
+ * @return void* Pointer to block if available; NULL otherwise
+ */
+void *
+os_mempool_mag_get(struct os_mempool_mag *mag)
+{
+    if (mag->mm_count == 0) {
+        mag->mm_count = os_memblock_get_n(mag->mm_pool, mag->mm_slots,
+                                          (mag->mm_size + 1) / 2);
+        if (mag->mm_count == 0) {
+            return (NULL);
+        }
+    }
+
+    return (mag->mm_slots[--mag->mm_count]);
+}
+
+/**
+ * Put a block back through a magazine. When the magazine is full, the
+ * oldest half of its blocks goes back to the pool first.
+ *
+ * @return os_error_t
+ */
+os_error_t
+os_mempool_mag_put(struct os_mempool_mag *mag, void *block_addr)
+{
+    os_error_t rc;
+    int half;
+
+    rc = os_mempool_block_check(mag->mm_pool, block_addr);
+    if (rc != OS_OK) {
+        return rc;
+    }
+
+    if (mag->mm_count == mag->mm_size) {
+        half = max(mag->mm_size / 2, 1);
+        rc = os_memblock_put_n(mag->mm_pool, mag->mm_slots, half);
+        assert(rc == OS_OK);
+        memmove(mag->mm_slots, mag->mm_slots + half,
+                (mag->mm_count - half) * sizeof(mag->mm_slots[0]));
+        mag->mm_count -= half;
+    }
+
+    mag->mm_slots[mag->mm_count++] = block_addr;
+
+    return OS_OK;
+}
+
+/**
+ * Return all blocks held by a magazine to its pool.
+ */
+void
+os_mempool_mag_flush(struct os_mempool_mag *mag)
+{
+    os_error_t rc;
+
+    rc = os_memblock_put_n(mag->mm_pool, mag->mm_slots, mag->mm_count);
+    assert(rc == OS_OK);
+    mag->mm_count = 0;
+}
 
 struct os_mempool *
 os_mempool_info_get_next(struct os_mempool *mp, struct os_mempool_info *omi)
@@ -199,6 +606,15 @@ os_mempool_info_get_next(struct os_mempool *mp, struct os_mempool_info *omi)
     omi->omi_num_blocks = cur->mp_num_blocks;
     omi->omi_num_free = cur->mp_num_free;
     strncpy(omi->omi_name, cur->name, sizeof(omi->omi_name));
+#ifdef OS_MEMPOOL_STATS
+    omi->omi_min_free = cur->mp_min_free;
+    omi->omi_num_allocs = cur->mp_num_allocs;
+    omi->omi_num_fails = cur->mp_num_fails;
+    omi->omi_first_fail = cur->mp_first_fail;
+    omi->omi_fail_caller = cur->mp_fail_caller;
+    strncpy(omi->omi_owner, cur->mp_owner != NULL ? cur->mp_owner : "",
+            sizeof(omi->omi_owner));
+#endif
 
     return (cur);
 }
@@ -19,6 +19,145 @@
 
 #include "os/os.h"
 #include <assert.h>
+#ifdef OS_MUTEX_STATS
+#include "hal/hal_cputime.h"
+#endif
+
+/*
+ * A mutex is free when it has no owner.  Where the architecture has a
+ * compare-and-swap, an uncontended pend takes the mutex by swapping
+ * mu_owner from NULL to the current task, and an uncontended release
+ * clears mu_owner, neither of them entering a critical section.  Waiters
+ * still queue up inside one.
+ *
+ * A release that skips the critical section stores NULL to mu_owner and
+ * then looks for waiters; a task that is about to wait queues itself and
+ * then looks at mu_owner again.  Both sides use sequentially consistent
+ * accesses, so at least one of them sees the other: either the releaser
+ * finds the waiter and hands the mutex over, or the waiter finds the
+ * mutex free and takes it.
+ */
+#ifdef OS_ARCH_HAS_CAS
+#define OS_MUTEX_OWNER(__mu)                                            \
+    __atomic_load_n(&(__mu)->mu_owner, __ATOMIC_SEQ_CST)
+#define OS_MUTEX_SET_OWNER(__mu, __t)                                   \
+    __atomic_store_n(&(__mu)->mu_owner, (__t), __ATOMIC_SEQ_CST)
+#else
+#define OS_MUTEX_OWNER(__mu)            ((__mu)->mu_owner)
+#define OS_MUTEX_SET_OWNER(__mu, __t)   ((__mu)->mu_owner = (__t))
+#endif
+
+/* Longest chain of mutexes priority inheritance follows */
+#ifndef OS_MUTEX_PI_DEPTH
+#define OS_MUTEX_PI_DEPTH   (8)
+#endif
+
+#ifdef OS_MUTEX_STATS
+static void
+os_mutex_stats_acquired(struct os_mutex *mu)
+{
+    mu->mu_num_pends++;
+    mu->mu_acquired = cputime_get32();
+}
+
+static void
+os_mutex_stats_release(struct os_mutex *mu)
+{
+    uint32_t held;
+
+    held = cputime_get32() - mu->mu_acquired;
+    if (held > mu->mu_max_hold) {
+        mu->mu_max_hold = held;
+    }
+    mu->mu_total_hold += held;
+}
+#else
+#define os_mutex_stats_acquired(__mu)
+#define os_mutex_stats_release(__mu)
+#endif
+
+/*
+ * Takes the mutex if it is free.  Returns 1 if the current task now owns
+ * it.
+ */
+static int
+os_mutex_try_acquire(struct os_mutex *mu, struct os_task *current)
+{
+#ifdef OS_ARCH_HAS_CAS
+    struct os_task *none;
+
+    none = NULL;
+    if (!__atomic_compare_exchange_n(&mu->mu_owner, &none, current, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return (0);
+    }
+#else
+    if (mu->mu_owner != NULL) {
+        return (0);
+    }
+    mu->mu_owner = current;
+#endif
+
+    mu->mu_prio = current->t_prio;
+    mu->mu_level = 1;
+    os_mutex_stats_acquired(mu);
+
+    return (1);
+}
+
+/* Links a task into the waiters of a mutex, in priority order */
+static void
+os_mutex_insert_waiter(struct os_mutex *mu, struct os_task *t)
+{
+    struct os_task *entry;
+    struct os_task *last;
+
+    last = NULL;
+    SLIST_FOREACH(entry, &mu->mu_head, t_obj_list) {
+        if (t->t_prio < entry->t_prio) {
+            break;
+        }
+        last = entry;
+    }
+
+    if (last) {
+        SLIST_INSERT_AFTER(last, t, t_obj_list);
+    } else {
+        SLIST_INSERT_HEAD(&mu->mu_head, t, t_obj_list);
+    }
+}
+
+/*
+ * Raises the owner of a mutex to 'prio'.  If the owner itself waits on
+ * another mutex, the owner of that one is raised too, and so on down the
+ * chain.  Must be called inside a critical section.
+ */
+static void
+os_mutex_inherit(struct os_mutex *mu, uint8_t prio)
+{
+    struct os_task *owner;
+    int depth;
+
+    for (depth = 0; depth < OS_MUTEX_PI_DEPTH; depth++) {
+        owner = OS_MUTEX_OWNER(mu);
+        if (owner == NULL || owner->t_prio <= prio) {
+            break;
+        }
+
+        owner->t_prio = prio;
+        os_sched_resort(owner);
+
+        if (!(owner->t_flags & OS_TASK_FLAG_MUTEX_WAIT) ||
+            owner->t_obj == NULL) {
+            break;
+        }
+
+        /* Keep the wait list the owner is on in priority order. */
+        mu = owner->t_obj;
+        SLIST_REMOVE(&mu->mu_head, owner, os_task, t_obj_list);
+        os_mutex_insert_waiter(mu, owner);
+    }
+}
 
 /**
  * os mutex create
@@ -43,6 +182,13 @@ os_mutex_init(struct os_mutex *mu)
     mu->mu_level = 0;
     mu->mu_owner = NULL;
     SLIST_FIRST(&mu->mu_head) = NULL;
+#ifdef OS_MUTEX_STATS
+    mu->mu_num_pends = 0;
+    mu->mu_num_waits = 0;
+    mu->mu_acquired = 0;
+    mu->mu_max_hold = 0;
+    mu->mu_total_hold = 0;
+#endif
 
     return OS_OK;
 }
@@ -64,6 +210,7 @@ os_mutex_release(struct os_mutex *mu)
 {
     int resched;
     os_sr_t sr;
+    uint8_t prio;
     struct os_task *current;
     struct os_task *rdy;
 
@@ -77,6 +224,8 @@ os_mutex_release(struct os_mutex *mu)
         return OS_INVALID_PARM;
     }
 
+    os_trace(OS_TRACE_MUTEX_RELEASE, mu);
+
     /* We better own this mutex! */
     current = os_sched_get_current_task();
     if ((mu->mu_level == 0) || (mu->mu_owner != current)) {
@@ -89,29 +238,53 @@ os_mutex_release(struct os_mutex *mu)
         return (OS_OK);
     }
 
+    os_mutex_stats_release(mu);
+    prio = mu->mu_prio;
+
+#ifdef OS_ARCH_HAS_CAS
+    /* Nobody waits and our priority was not raised: just let go. */
+    if (current->t_prio == prio && SLIST_EMPTY(&mu->mu_head)) {
+        OS_MUTEX_SET_OWNER(mu, NULL);
+        if (__atomic_load_n(&SLIST_FIRST(&mu->mu_head),
+                            __ATOMIC_SEQ_CST) == NULL) {
+            return (OS_OK);
+        }
+        /* A task queued up as we let go; hand the mutex to it below. */
+    }
+#endif
+
     OS_ENTER_CRITICAL(sr);
 
     /* Restore owner task's priority; resort list if different  */
-    if (current->t_prio != mu->mu_prio) {
-        current->t_prio = mu->mu_prio;
+    if (current->t_prio != prio) {
+        current->t_prio = prio;
         os_sched_resort(current);
     }
 
     /* Check if tasks are waiting for the mutex */
     rdy = SLIST_FIRST(&mu->mu_head);
+    if (mu->mu_owner == current) {
+        /* Set new owner of mutex (or NULL if not owned) */
+        OS_MUTEX_SET_OWNER(mu, rdy);
+        if (rdy) {
+            mu->mu_level = 1;
+            mu->mu_prio = rdy->t_prio;
+            os_mutex_stats_acquired(mu);
+        }
+    } else if (rdy && !os_mutex_try_acquire(mu, rdy)) {
+        /*
+         * We let go without the critical section and another task took
+         * the mutex in the meantime; the waiters get it from that one.
+         */
+        rdy = NULL;
+    }
+
     if (rdy) {
         /* There is one waiting. Wake it up */
         assert(rdy->t_obj);
         os_sched_wakeup(rdy);
-
-        /* Set mutex internals */
-        mu->mu_level = 1;
-        mu->mu_prio = rdy->t_prio;
     }
 
-    /* Set new owner of mutex (or NULL if not owned) */
-    mu->mu_owner = rdy;
-
     /* Do we need to re-schedule? */
     resched = 0;
     rdy = os_sched_next_task();
@@ -150,8 +323,6 @@ os_mutex_pend(struct os_mutex *mu, uint32_t timeout)
     os_sr_t sr;
     os_error_t rc;
     struct os_task *current;
-    struct os_task *entry;
-    struct os_task *last;
 
     /* OS must be started when calling this function */
     if (!g_os_started) {
@@ -163,14 +334,21 @@ os_mutex_pend(struct os_mutex *mu, uint32_t timeout)
         return OS_INVALID_PARM;
     }
 
+    os_trace(OS_TRACE_MUTEX_PEND, mu);
+
+    current = os_sched_get_current_task();
+
+#ifdef OS_ARCH_HAS_CAS
+    /* Uncontended: take it without the critical section. */
+    if (os_mutex_try_acquire(mu, current)) {
+        return OS_OK;
+    }
+#endif
+
     OS_ENTER_CRITICAL(sr);
 
     /* Is this owned? */
-    current = os_sched_get_current_task();
-    if (mu->mu_level == 0) {
-        mu->mu_owner = current;
-        mu->mu_prio  = current->t_prio;
-        mu->mu_level = 1;
+    if (os_mutex_try_acquire(mu, current)) {
         OS_EXIT_CRITICAL(sr);
         return OS_OK;
     }
@@ -188,29 +366,25 @@ os_mutex_pend(struct os_mutex *mu, uint32_t timeout)
         return OS_TIMEOUT;
     }
 
-    /* Change priority of owner if needed */
-    if (mu->mu_owner->t_prio > current->t_prio) {
-        mu->mu_owner->t_prio = current->t_prio;
-        os_sched_resort(mu->mu_owner);
-    }
-
     /* Link current task to tasks waiting for mutex */
-    last = NULL;
-    if (!SLIST_EMPTY(&mu->mu_head)) {
-        /* Insert in priority order */
-        SLIST_FOREACH(entry, &mu->mu_head, t_obj_list) {
-            if (current->t_prio < entry->t_prio) { 
-                break;
-            }
-            last = entry;
-        }
-    }
+    os_mutex_insert_waiter(mu, current);
 
-    if (last) {
-        SLIST_INSERT_AFTER(last, current, t_obj_list);
-    } else {
-        SLIST_INSERT_HEAD(&mu->mu_head, current, t_obj_list);
+#ifdef OS_ARCH_HAS_CAS
+    /* The owner may have let go before it could see us queued. */
+    if (os_mutex_try_acquire(mu, current)) {
+        SLIST_REMOVE(&mu->mu_head, current, os_task, t_obj_list);
+        SLIST_NEXT(current, t_obj_list) = NULL;
+        OS_EXIT_CRITICAL(sr);
+        return OS_OK;
     }
+#endif
+
+#ifdef OS_MUTEX_STATS
+    mu->mu_num_waits++;
+#endif
+
+    /* Raise the owner, and whatever it waits for, to our priority */
+    os_mutex_inherit(mu, current->t_prio);
 
     /* Set mutex pointer in task */
     current->t_obj = mu;
@@ -233,4 +407,3 @@ os_mutex_pend(struct os_mutex *mu, uint32_t timeout)
 
     return rc;
 }
-
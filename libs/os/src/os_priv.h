@@ -22,9 +22,44 @@
 
 TAILQ_HEAD(os_task_list, os_task);
 
-extern struct os_task_list g_os_run_list;
 extern struct os_task_list g_os_sleep_list;
 extern struct os_task_list g_os_task_list;
+
+#ifdef OS_TIME_CPUTIME
+os_time_t os_time_mono_max_idle(void);
+#endif
+
+#ifdef OS_TASK_CPUTIME
+/* CPU time accounting state, one per core */
+struct os_cputime_state {
+    /* cputime when time was last charged to a task or to interrupts */
+    uint32_t ocs_last;
+    /* Time spent in interrupt handlers, in cputime ticks */
+    uint64_t ocs_isr_time;
+    /* Interrupt handlers currently running */
+    uint8_t ocs_isr_nest;
+};
+#endif
+
+#ifdef OS_SMP
+struct os_cpu {
+    /* Task running on this core */
+    struct os_task *oc_current;
+    /* Ready tasks queued on this core, including the running one */
+    struct os_task_list oc_run_list;
+    os_time_t oc_last_ctx_sw_time;
+    /* Tasks this core has taken from the run lists of other cores */
+    uint32_t oc_steals;
+#ifdef OS_TASK_CPUTIME
+    struct os_cputime_state oc_cputime;
+#endif
+};
+
+extern struct os_cpu g_os_cpus[OS_CPUS];
+extern uint8_t g_os_ncpus;
+#else
+extern struct os_task_list g_os_run_list;
 extern struct os_task *g_current_task;
+#endif
 
 #endif
@@ -19,17 +19,465 @@
 
 #include "os/os.h"
 #include "os/queue.h"
+#include "os_priv.h"
 
 #include <assert.h>
+#include <string.h>
 
-TAILQ_HEAD(, os_task) g_os_run_list = TAILQ_HEAD_INITIALIZER(g_os_run_list); 
+#ifdef OS_TASK_CPUTIME
+#include "hal/hal_cputime.h"
+#endif
 
-TAILQ_HEAD(, os_task) g_os_sleep_list = TAILQ_HEAD_INITIALIZER(g_os_sleep_list); 
+#ifndef OS_SMP
+struct os_task_list g_os_run_list = TAILQ_HEAD_INITIALIZER(g_os_run_list);
+#endif
 
-struct os_task *g_current_task; 
+struct os_task_list g_os_sleep_list = TAILQ_HEAD_INITIALIZER(g_os_sleep_list);
+
+#ifdef OS_TIMER_WHEEL
+/*
+ * Sleep timeouts. The sleep list is not kept sorted in this case; it just
+ * holds all sleeping tasks, and the wheel tells when they time out.
+ */
+static struct os_wheel g_os_sleep_wheel;
+#endif
 
 extern os_time_t g_os_time;
+
+#ifdef OS_SMP
+struct os_cpu g_os_cpus[OS_CPUS];
+
+/* Number of cores brought up by os_start() */
+uint8_t g_os_ncpus = OS_CPUS;
+#else
+struct os_task *g_current_task; 
+
 os_time_t g_os_last_ctx_sw_time;
+#endif
+
+#ifdef OS_TASK_CPUTIME
+#ifdef OS_SMP
+#define OS_CPUTIME_STATE()  (&g_os_cpus[os_arch_cpu_id()].oc_cputime)
+#else
+static struct os_cputime_state g_os_cputime;
+#define OS_CPUTIME_STATE()  (&g_os_cputime)
+#endif
+#endif
+
+#define OS_SCHED_PRIOS      (OS_TASK_PRI_LOWEST + 1)
+#define OS_SCHED_MAP_WORDS  (OS_SCHED_PRIOS / 32)
+
+/*
+ * A run list, plus its index when OS_SCHED_BITMAP is enabled.
+ *
+ * The run list stays sorted by priority, FIFO within a priority. For every
+ * priority that has ready tasks 'rq_tail' points at the last task queued at
+ * that priority and the priority's bit is set in a two-level bitmap: one
+ * bit per priority in 'rq_map' and one bit per map word in 'rq_grp'. A
+ * newly ready task goes in right after the tail of the closest occupied
+ * priority at or above its own, which is found with a couple of
+ * count-leading-zeros operations instead of a list walk.
+ */
+struct os_sched_rq {
+    struct os_task_list *rq_list;
+#ifdef OS_SCHED_BITMAP
+    struct os_task *rq_tail[OS_SCHED_PRIOS];
+    uint32_t rq_map[OS_SCHED_MAP_WORDS];
+    uint8_t rq_grp;
+#endif
+};
+
+#ifdef OS_SMP
+/* One run list per core */
+static struct os_sched_rq g_os_rqs[OS_CPUS];
+
+#define OS_SCHED_RQ(__cpu)      (&g_os_rqs[(__cpu)])
+#define OS_SCHED_TASK_RQ(__t)   OS_SCHED_RQ((__t)->t_cpu)
+#else
+static struct os_sched_rq g_os_rq = { &g_os_run_list };
+
+#define OS_SCHED_TASK_RQ(__t)   (&g_os_rq)
+#endif
+
+#ifdef OS_SCHED_BITMAP
+/* Index of the most significant bit set in 'x'; 'x' must be non-zero. */
+#define OS_SCHED_FLS(x) (31 - __builtin_clz(x))
+
+static void
+os_sched_map_set(struct os_sched_rq *rq, uint8_t prio)
+{
+    rq->rq_map[prio >> 5] |= 1UL << (prio & 31);
+    rq->rq_grp |= 1U << (prio >> 5);
+}
+
+static void
+os_sched_map_clear(struct os_sched_rq *rq, uint8_t prio)
+{
+    rq->rq_map[prio >> 5] &= ~(1UL << (prio & 31));
+    if (rq->rq_map[prio >> 5] == 0) {
+        rq->rq_grp &= ~(1U << (prio >> 5));
+    }
+}
+
+/*
+ * Returns the numerically largest priority below 'prio' that has ready
+ * tasks, i.e. the level a task of priority 'prio' has to be queued behind,
+ * or -1 if there is no such priority.
+ */
+static int
+os_sched_map_prev(struct os_sched_rq *rq, uint8_t prio)
+{
+    uint32_t bits;
+    int word;
+
+    word = prio >> 5;
+    bits = rq->rq_map[word] & ((1UL << (prio & 31)) - 1);
+    if (bits == 0) {
+        bits = rq->rq_grp & ((1U << word) - 1);
+        if (bits == 0) {
+            return (-1);
+        }
+        word = OS_SCHED_FLS(bits);
+        bits = rq->rq_map[word];
+    }
+
+    return ((word << 5) + OS_SCHED_FLS(bits));
+}
+#endif
+
+/*
+ * Queue a ready task on a run list behind all tasks of equal or higher
+ * priority. Must be called with interrupts disabled.
+ */
+static void
+os_sched_run_list_insert(struct os_sched_rq *rq, struct os_task *t)
+{
+    struct os_task *entry;
+#ifdef OS_SCHED_BITMAP
+    int prio;
+
+    entry = rq->rq_tail[t->t_prio];
+    if (entry == NULL) {
+        prio = os_sched_map_prev(rq, t->t_prio);
+        if (prio >= 0) {
+            entry = rq->rq_tail[prio];
+        }
+        os_sched_map_set(rq, t->t_prio);
+    }
+    if (entry) {
+        TAILQ_INSERT_AFTER(rq->rq_list, entry, t, t_os_list);
+    } else {
+        TAILQ_INSERT_HEAD(rq->rq_list, t, t_os_list);
+    }
+    rq->rq_tail[t->t_prio] = t;
+#else
+    TAILQ_FOREACH(entry, rq->rq_list, t_os_list) {
+        if (t->t_prio < entry->t_prio) { 
+            break;
+        }
+    }
+    if (entry) {
+        TAILQ_INSERT_BEFORE(entry, t, t_os_list);
+    } else {
+        TAILQ_INSERT_TAIL(rq->rq_list, t, t_os_list);
+    }
+#endif
+    t->t_run_prio = t->t_prio;
+}
+
+/*
+ * Take a task off a run list. The task is looked up by the priority it
+ * was queued at, which may differ from 't_prio' if the priority has been
+ * changed since. Must be called with interrupts disabled.
+ */
+static void
+os_sched_run_list_remove(struct os_sched_rq *rq, struct os_task *t)
+{
+#ifdef OS_SCHED_BITMAP
+    struct os_task *prev;
+
+    if (rq->rq_tail[t->t_run_prio] == t) {
+        prev = TAILQ_PREV(t, os_task_list, t_os_list);
+        if (prev && prev->t_run_prio == t->t_run_prio) {
+            rq->rq_tail[t->t_run_prio] = prev;
+        } else {
+            rq->rq_tail[t->t_run_prio] = NULL;
+            os_sched_map_clear(rq, t->t_run_prio);
+        }
+    }
+#endif
+    TAILQ_REMOVE(rq->rq_list, t, t_os_list);
+}
+
+static void
+os_sched_rq_init(struct os_sched_rq *rq, struct os_task_list *list)
+{
+    memset(rq, 0, sizeof(*rq));
+    rq->rq_list = list;
+    TAILQ_INIT(list);
+}
+
+/* Task running on this core; interrupts must be disabled. */
+static inline struct os_task *
+os_sched_cur(void)
+{
+#ifdef OS_SMP
+    return (g_os_cpus[os_arch_cpu_id()].oc_current);
+#else
+    return (g_current_task);
+#endif
+}
+
+#ifdef OS_SMP
+/* Cores that are up and that 't' may run on */
+static os_cpumask_t
+os_sched_smp_mask(struct os_task *t)
+{
+    return (t->t_affinity & ((1U << g_os_ncpus) - 1));
+}
+
+/* Returns the core 't' is running on, or -1 if it is not running. */
+static int
+os_sched_smp_running_on(struct os_task *t)
+{
+    int cpu;
+
+    for (cpu = 0; cpu < g_os_ncpus; cpu++) {
+        if (g_os_cpus[cpu].oc_current == t) {
+            return (cpu);
+        }
+    }
+    return (-1);
+}
+
+/* Priority of the task running on 'cpu'; lower than any task if none. */
+static int
+os_sched_smp_cur_prio(int cpu)
+{
+    struct os_task *cur;
+
+    cur = g_os_cpus[cpu].oc_current;
+    if (cur == NULL) {
+        return (OS_TASK_PRI_LOWEST + 1);
+    }
+    return (cur->t_prio);
+}
+
+/*
+ * Returns the allowed core, other than 'skip', that runs the least
+ * important task, preferring the core 't' was last queued on. Returns -1 if
+ * there is no such core.
+ */
+static int
+os_sched_smp_target(struct os_task *t, int skip)
+{
+    os_cpumask_t mask;
+    int best_prio;
+    int best;
+    int prio;
+    int cpu;
+
+    mask = os_sched_smp_mask(t);
+    best = -1;
+    best_prio = -1;
+    for (cpu = 0; cpu < g_os_ncpus; cpu++) {
+        if (cpu == skip || !(mask & (1U << cpu))) {
+            continue;
+        }
+        prio = os_sched_smp_cur_prio(cpu);
+        if (prio > best_prio || (prio == best_prio && cpu == t->t_cpu)) {
+            best = cpu;
+            best_prio = prio;
+        }
+    }
+
+    return (best);
+}
+
+/*
+ * Queue a ready task on the allowed core that runs the least important
+ * task, and have that core reschedule if the new task should preempt it.
+ * Rescheduling the local core is up to the caller, as on a single core.
+ */
+static void
+os_sched_smp_place(struct os_task *t)
+{
+    int cpu;
+
+    cpu = os_sched_smp_target(t, -1);
+    assert(cpu >= 0);
+
+    t->t_cpu = cpu;
+    os_sched_run_list_insert(OS_SCHED_RQ(cpu), t);
+
+    if (cpu != os_arch_cpu_id() && t->t_prio < os_sched_smp_cur_prio(cpu)) {
+        os_arch_cpu_kick(cpu);
+    }
+}
+
+/*
+ * 't' is ready but is not going to run on this core for now; let another
+ * core that would run it take it.
+ */
+static void
+os_sched_smp_offer(struct os_task *t)
+{
+    int cpu;
+
+    cpu = os_sched_smp_target(t, os_arch_cpu_id());
+    if (cpu >= 0 && t->t_prio < os_sched_smp_cur_prio(cpu)) {
+        os_arch_cpu_kick(cpu);
+    }
+}
+
+/*
+ * Returns the first task on the run list of 'cpu' that core 'me' may run:
+ * one that is allowed on 'me' and is not running on some other core.
+ */
+static struct os_task *
+os_sched_smp_first(int cpu, int me)
+{
+    struct os_task *t;
+    int running;
+
+    TAILQ_FOREACH(t, OS_SCHED_RQ(cpu)->rq_list, t_os_list) {
+        if (!(t->t_affinity & (1U << me))) {
+            continue;
+        }
+        running = os_sched_smp_running_on(t);
+        if (running >= 0 && running != me) {
+            continue;
+        }
+        return (t);
+    }
+    return (NULL);
+}
+
+/*
+ * Pick the task core 'me' should run: the head of its own run list, unless
+ * another core has a more important task waiting that 'me' may run. That
+ * task is moved over to the run list of 'me'.
+ */
+static struct os_task *
+os_sched_smp_next(int me)
+{
+    struct os_task *best;
+    struct os_task *t;
+    int victim;
+    int cpu;
+
+    best = os_sched_smp_first(me, me);
+    victim = -1;
+    for (cpu = 0; cpu < g_os_ncpus; cpu++) {
+        if (cpu == me) {
+            continue;
+        }
+        t = os_sched_smp_first(cpu, me);
+        if (t != NULL && (best == NULL || t->t_prio < best->t_prio)) {
+            best = t;
+            victim = cpu;
+        }
+    }
+
+    if (victim >= 0) {
+        os_sched_run_list_remove(OS_SCHED_RQ(victim), best);
+        best->t_cpu = me;
+        os_sched_run_list_insert(OS_SCHED_RQ(me), best);
+        g_os_cpus[me].oc_steals++;
+    }
+
+    return (best);
+}
+
+/**
+ * Set the number of cores os_start() brings up, between 1 and OS_CPUS.
+ * Must be called before os_init().
+ *
+ * @return 0 on success, OS_EINVAL if 'ncpus' is out of range.
+ */
+int
+os_smp_set_ncpus(int ncpus)
+{
+    if (ncpus < 1 || ncpus > OS_CPUS || g_os_started) {
+        return (OS_EINVAL);
+    }
+
+    g_os_ncpus = ncpus;
+    return (0);
+}
+
+/**
+ * Returns the number of cores that are up.
+ */
+int
+os_smp_ncpus(void)
+{
+    return (g_os_ncpus);
+}
+
+/**
+ * Returns the number of tasks core 'cpu' has taken from the run lists of
+ * other cores since os_init().
+ */
+uint32_t
+os_smp_steals(int cpu)
+{
+    return (g_os_cpus[cpu].oc_steals);
+}
+
+/**
+ * Queue 't' again according to its affinity. Called when the affinity of a
+ * task has changed. A task that is running on another core is left alone;
+ * it moves when it is next switched out. Must be called with interrupts
+ * disabled.
+ */
+void
+os_sched_requeue(struct os_task *t)
+{
+    int running;
+
+    if (t->t_state != OS_TASK_READY) {
+        return;
+    }
+
+    running = os_sched_smp_running_on(t);
+    if (running >= 0 && running != os_arch_cpu_id()) {
+        os_arch_cpu_kick(running);
+        return;
+    }
+
+    os_sched_run_list_remove(OS_SCHED_TASK_RQ(t), t);
+    os_sched_smp_place(t);
+}
+#endif /* OS_SMP */
+
+/**
+ * os sched init
+ *
+ * Empties the run and sleep lists. Called by the architecture specific code
+ * when the OS is initialized, before any task is created.
+ */
+void
+os_sched_init(void)
+{
+#ifdef OS_SMP
+    int cpu;
+
+    for (cpu = 0; cpu < OS_CPUS; cpu++) {
+        memset(&g_os_cpus[cpu], 0, sizeof(g_os_cpus[cpu]));
+        os_sched_rq_init(OS_SCHED_RQ(cpu), &g_os_cpus[cpu].oc_run_list);
+    }
+#else
+    os_sched_rq_init(&g_os_rq, &g_os_run_list);
+#ifdef OS_TASK_CPUTIME
+    memset(&g_os_cputime, 0, sizeof(g_os_cputime));
+#endif
+#endif
+    TAILQ_INIT(&g_os_sleep_list);
+#ifdef OS_TIMER_WHEEL
+    os_wheel_init(&g_os_sleep_wheel, os_time_get());
+#endif
+}
 
 /**
  * os sched insert
@@ -45,7 +493,6 @@ os_time_t g_os_last_ctx_sw_time;
 os_error_t
 os_sched_insert(struct os_task *t) 
 {
-    struct os_task *entry; 
     os_sr_t sr; 
     os_error_t rc;
 
@@ -54,18 +501,12 @@ os_sched_insert(struct os_task *t)
         goto err;
     }
 
-    entry = NULL;
     OS_ENTER_CRITICAL(sr); 
-    TAILQ_FOREACH(entry, &g_os_run_list, t_os_list) {
-        if (t->t_prio < entry->t_prio) { 
-            break;
-        }
-    }
-    if (entry) {
-        TAILQ_INSERT_BEFORE(entry, (struct os_task *) t, t_os_list);
-    } else {
-        TAILQ_INSERT_TAIL(&g_os_run_list, (struct os_task *) t, t_os_list);
-    }
+#ifdef OS_SMP
+    os_sched_smp_place(t);
+#else
+    os_sched_run_list_insert(&g_os_rq, t);
+#endif
     OS_EXIT_CRITICAL(sr);
 
     return (0);
@@ -73,16 +514,158 @@ err:
     return (rc);
 }
 
+#ifdef OS_TASK_CPUTIME
+/*
+ * Charges the cputime since the last call to the interrupt handlers if one
+ * is running, and to task 't' otherwise.
+ */
+static void
+os_cputime_charge(struct os_cputime_state *ocs, struct os_task *t)
+{
+    uint32_t now;
+    uint32_t delta;
+
+    now = cputime_get32();
+    delta = now - ocs->ocs_last;
+    ocs->ocs_last = now;
+
+    if (ocs->ocs_isr_nest != 0) {
+        ocs->ocs_isr_time += delta;
+    } else if (t != NULL) {
+        t->t_cputime += delta;
+    }
+}
+
+/**
+ * Converts a 64-bit amount of cputime to microseconds, rounded down. Works
+ * at any cputime rate, below 1 MHz included.
+ */
+uint64_t
+os_cputime_to_usecs(uint64_t ticks)
+{
+    uint32_t hz;
+
+    hz = cputime_usecs_to_ticks(1000000);
+    if (hz == 0) {
+        /* cputime_init() has not been called */
+        return (0);
+    }
+
+    return ((ticks / hz) * 1000000 + (ticks % hz) * 1000000 / hz);
+}
+
+/**
+ * Returns the time spent in interrupt handlers since os_init(), on all
+ * cores, in microseconds.
+ */
+uint64_t
+os_cputime_isr_usecs(void)
+{
+    uint64_t ticks;
+    os_sr_t sr;
+#ifdef OS_SMP
+    int cpu;
+#endif
+
+    OS_ENTER_CRITICAL(sr);
+#ifdef OS_SMP
+    ticks = 0;
+    for (cpu = 0; cpu < OS_CPUS; cpu++) {
+        ticks += g_os_cpus[cpu].oc_cputime.ocs_isr_time;
+    }
+#else
+    ticks = g_os_cputime.ocs_isr_time;
+#endif
+    OS_EXIT_CRITICAL(sr);
+
+    return (os_cputime_to_usecs(ticks));
+}
+#endif
+
+#if defined(OS_TASK_CPUTIME) || defined(OS_TRACE)
+/**
+ * Called by an interrupt handler when it starts. From here until the
+ * matching os_isr_exit() the cputime is charged to interrupts instead of
+ * to the current task.
+ */
+void
+os_isr_enter(void)
+{
+#ifdef OS_TASK_CPUTIME
+    struct os_cputime_state *ocs;
+    os_sr_t sr;
+
+    OS_ENTER_CRITICAL(sr);
+    ocs = OS_CPUTIME_STATE();
+    os_cputime_charge(ocs, os_sched_cur());
+    ocs->ocs_isr_nest++;
+    OS_EXIT_CRITICAL(sr);
+#endif
+    os_trace(OS_TRACE_ISR_ENTER, 0);
+}
+
+/**
+ * Called by an interrupt handler when it is done.
+ */
+void
+os_isr_exit(void)
+{
+#ifdef OS_TASK_CPUTIME
+    struct os_cputime_state *ocs;
+    os_sr_t sr;
+#endif
+
+    os_trace(OS_TRACE_ISR_EXIT, 0);
+#ifdef OS_TASK_CPUTIME
+    OS_ENTER_CRITICAL(sr);
+    ocs = OS_CPUTIME_STATE();
+    assert(ocs->ocs_isr_nest > 0);
+    os_cputime_charge(ocs, NULL);
+    ocs->ocs_isr_nest--;
+    OS_EXIT_CRITICAL(sr);
+#endif
+}
+#endif
+
 void
 os_sched_ctx_sw_hook(struct os_task *next_t)
 {
+#ifdef OS_SMP
+    struct os_cpu *oc;
+    struct os_task *cur;
+
+    oc = &g_os_cpus[os_arch_cpu_id()];
+    cur = oc->oc_current;
+    if (cur == next_t) {
+        return;
+    }
+
+#ifdef OS_TASK_CPUTIME
+    os_cputime_charge(&oc->oc_cputime, cur);
+#endif
+    os_trace(OS_TRACE_CTX_SW, next_t->t_taskid);
+    next_t->t_ctx_sw_cnt++;
+    if (cur != NULL) {
+        cur->t_run_time += g_os_time - oc->oc_last_ctx_sw_time;
+        if (cur->t_state == OS_TASK_READY) {
+            /* Preempted; another core may be able to run it. */
+            os_sched_smp_offer(cur);
+        }
+    }
+    oc->oc_last_ctx_sw_time = g_os_time;
+#else
     if (g_current_task == next_t) {
         return;
     }
 
+#ifdef OS_TASK_CPUTIME
+    os_cputime_charge(&g_os_cputime, g_current_task);
+#endif
+    os_trace(OS_TRACE_CTX_SW, next_t->t_taskid);
     next_t->t_ctx_sw_cnt++;
     g_current_task->t_run_time += g_os_time - g_os_last_ctx_sw_time;
     g_os_last_ctx_sw_time = g_os_time;
+#endif
 }
 
 
@@ -98,7 +681,19 @@ os_sched_ctx_sw_hook(struct os_task *next_t)
 struct os_task * 
 os_sched_get_current_task(void)
 {
+#ifdef OS_SMP
+    struct os_task *t;
+    os_sr_t sr;
+
+    /* Keep the task from moving to another core while looking it up. */
+    OS_ENTER_CRITICAL(sr);
+    t = os_sched_cur();
+    OS_EXIT_CRITICAL(sr);
+
+    return (t);
+#else
     return (g_current_task);
+#endif
 }
 
 /**
@@ -113,7 +708,17 @@ os_sched_get_current_task(void)
 void 
 os_sched_set_current_task(struct os_task *t) 
 {
+#ifdef OS_TASK_CPUTIME
+    /* Start counting when the first task on this core starts running. */
+    if (!g_os_started || os_sched_cur() == NULL) {
+        OS_CPUTIME_STATE()->ocs_last = cputime_get32();
+    }
+#endif
+#ifdef OS_SMP
+    g_os_cpus[os_arch_cpu_id()].oc_current = t;
+#else
     g_current_task = t;
+#endif
 }
 
 /**
@@ -136,7 +741,7 @@ os_sched(struct os_task *next_t)
         next_t = os_sched_next_task();
     }
 
-    if (next_t != g_current_task) {
+    if (next_t != os_sched_cur()) {
         os_arch_ctx_sw(next_t);
     }
 
@@ -159,17 +764,23 @@ os_sched(struct os_task *next_t)
 int 
 os_sched_sleep(struct os_task *t, os_time_t nticks) 
 {
+#ifndef OS_TIMER_WHEEL
     struct os_task *entry;
 
     entry = NULL; 
+#endif
 
-    TAILQ_REMOVE(&g_os_run_list, t, t_os_list);
+    os_sched_run_list_remove(OS_SCHED_TASK_RQ(t), t);
     t->t_state = OS_TASK_SLEEP;
     t->t_next_wakeup = os_time_get() + nticks;
     if (nticks == OS_TIMEOUT_NEVER) {
         t->t_flags |= OS_TASK_FLAG_NO_TIMEOUT;
         TAILQ_INSERT_TAIL(&g_os_sleep_list, t, t_os_list); 
     } else {
+#ifdef OS_TIMER_WHEEL
+        TAILQ_INSERT_TAIL(&g_os_sleep_list, t, t_os_list);
+        os_wheel_insert(&g_os_sleep_wheel, &t->t_wheel, t->t_next_wakeup);
+#else
         TAILQ_FOREACH(entry, &g_os_sleep_list, t_os_list) {
             if ((entry->t_flags & OS_TASK_FLAG_NO_TIMEOUT) ||
                     OS_TIME_TICK_GT(entry->t_next_wakeup, t->t_next_wakeup)) {
@@ -181,6 +792,7 @@ os_sched_sleep(struct os_task *t, os_time_t nticks)
         } else {
             TAILQ_INSERT_TAIL(&g_os_sleep_list, t, t_os_list); 
         }
+#endif
     }
 
     return (0);
@@ -219,6 +831,9 @@ os_sched_wakeup(struct os_task *t)
     t->t_next_wakeup = 0;
     t->t_flags &= ~OS_TASK_FLAG_NO_TIMEOUT;
     TAILQ_REMOVE(&g_os_sleep_list, t, t_os_list);
+#ifdef OS_TIMER_WHEEL
+    os_wheel_remove(&g_os_sleep_wheel, &t->t_wheel);
+#endif
     os_sched_insert(t);
 
     return (0);
@@ -237,7 +852,11 @@ void
 os_sched_os_timer_exp(void)
 {
     struct os_task *t;
+#ifdef OS_TIMER_WHEEL
+    struct os_wheel_entry *we;
+#else
     struct os_task *next;
+#endif
     os_time_t now; 
     os_sr_t sr;
 
@@ -245,6 +864,12 @@ os_sched_os_timer_exp(void)
 
     OS_ENTER_CRITICAL(sr);
 
+#ifdef OS_TIMER_WHEEL
+    while ((we = os_wheel_expire(&g_os_sleep_wheel, now)) != NULL) {
+        t = OS_WHEEL_CONTAINER(we, struct os_task, t_wheel);
+        os_sched_wakeup(t);
+    }
+#else
     /*
      * Wakeup any tasks that have their sleep timer expired
      */
@@ -262,6 +887,7 @@ os_sched_os_timer_exp(void)
         }
         t = next;
     }
+#endif
 
     OS_EXIT_CRITICAL(sr); 
 }
@@ -274,10 +900,15 @@ os_time_t
 os_sched_wakeup_ticks(os_time_t now)
 {
     os_time_t rt;
+#ifndef OS_TIMER_WHEEL
     struct os_task *t;
+#endif
 
     OS_ASSERT_CRITICAL();
 
+#ifdef OS_TIMER_WHEEL
+    rt = os_wheel_next_ticks(&g_os_sleep_wheel, now);
+#else
     t = TAILQ_FIRST(&g_os_sleep_list);
     if (t == NULL || (t->t_flags & OS_TASK_FLAG_NO_TIMEOUT)) {
         rt = OS_TIMEOUT_NEVER;
@@ -286,6 +917,7 @@ os_sched_wakeup_ticks(os_time_t now)
     } else {
         rt = 0;     /* wakeup time was in the past */
     }
+#endif
     return (rt);
 }
 
@@ -295,6 +927,10 @@ os_sched_wakeup_ticks(os_time_t now)
  * Returns the task that we should be running. This is the task at the head 
  * of the run list. 
  *  
+ * On an SMP build this is the head of the run list of the calling core,
+ * unless another core has a more important task queued that could run
+ * here; that task is moved to this core's run list and returned.
+ *  
  * NOTE: if you want to guarantee that the os run list does not change after 
  * calling this function you have to call it with interrupts disabled. 
  * 
@@ -303,7 +939,11 @@ os_sched_wakeup_ticks(os_time_t now)
 struct os_task *  
 os_sched_next_task(void) 
 {
+#ifdef OS_SMP
+    return (os_sched_smp_next(os_arch_cpu_id()));
+#else
     return (TAILQ_FIRST(&g_os_run_list));
+#endif
 }
 
 /**
@@ -323,8 +963,13 @@ void
 os_sched_resort(struct os_task *t) 
 {
     if (t->t_state == OS_TASK_READY) {
-        TAILQ_REMOVE(&g_os_run_list, t, t_os_list);
-        os_sched_insert(t);
+        os_sched_run_list_remove(OS_SCHED_TASK_RQ(t), t);
+        os_sched_run_list_insert(OS_SCHED_TASK_RQ(t), t);
+#ifdef OS_SMP
+        if (os_sched_smp_running_on(t) < 0) {
+            os_sched_smp_offer(t);
+        }
+#endif
     }
 }
 
@@ -80,6 +80,8 @@ os_sem_release(struct os_sem *sem)
         return OS_INVALID_PARM;
     }
 
+    os_trace(OS_TRACE_SEM_RELEASE, sem);
+
     /* Get current task */
     resched = 0;
     current = os_sched_get_current_task();
@@ -148,6 +150,8 @@ os_sem_pend(struct os_sem *sem, uint32_t timeout)
         return OS_INVALID_PARM;
     }
 
+    os_trace(OS_TRACE_SEM_PEND, sem);
+
     /* Assume we dont have to put task to sleep; get current task */
     sched = 0;
     current = os_sched_get_current_task();
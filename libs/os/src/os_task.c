@@ -76,6 +76,9 @@ os_task_init(struct os_task *t, char *name, os_task_func_t func, void *arg,
     t->t_state = OS_TASK_READY;
     t->t_name = name;
     t->t_next_wakeup = 0; 
+#ifdef OS_SMP
+    t->t_affinity = OS_CPU_MASK_ALL;
+#endif
 
     rc = os_sanity_check_init(&t->t_sanity_check); 
     if (rc != OS_OK) {
@@ -113,6 +116,41 @@ err:
     return (rc);
 }
 
+#ifdef OS_SMP
+/**
+ * Restrict the cores a task may run on.
+ *
+ * A task that is ready moves right away, including the calling task. A
+ * task that is running on another core keeps running there until it is next
+ * switched out.
+ *
+ * @param t The task
+ * @param mask Bitmask of cores the task may run on, bit N for core N.
+ *
+ * @return 0 on success, OS_EINVAL if no core in 'mask' is up.
+ */
+int
+os_task_set_affinity(struct os_task *t, os_cpumask_t mask)
+{
+    os_sr_t sr;
+
+    if ((mask & ((1U << os_smp_ncpus()) - 1)) == 0) {
+        return (OS_EINVAL);
+    }
+
+    OS_ENTER_CRITICAL(sr);
+    t->t_affinity = mask;
+    os_sched_requeue(t);
+    OS_EXIT_CRITICAL(sr);
+
+    if (g_os_started) {
+        os_sched(NULL);
+    }
+
+    return (0);
+}
+#endif
+
 struct os_task *
 os_task_info_get_next(const struct os_task *prev, struct os_task_info *oti)
 {
@@ -153,6 +191,9 @@ os_task_info_get_next(const struct os_task *prev, struct os_task_info *oti)
     oti->oti_last_checkin = next->t_sanity_check.sc_checkin_last;
     oti->oti_next_checkin = next->t_sanity_check.sc_checkin_last + 
         next->t_sanity_check.sc_checkin_itvl;
+#ifdef OS_TASK_CPUTIME
+    oti->oti_cputime = os_cputime_to_usecs(next->t_cputime);
+#endif
     strncpy(oti->oti_name, next->t_name, sizeof(oti->oti_name));
 
     return (next);
@@ -22,6 +22,11 @@
 
 #include "os/os.h"
 #include "os/queue.h"
+#include "os_priv.h"
+
+#ifdef OS_TIME_CPUTIME
+#include "hal/hal_cputime.h"
+#endif
 
 CTASSERT(sizeof(os_time_t) == 4);
 
@@ -30,26 +35,143 @@ CTASSERT(sizeof(os_time_t) == 4);
 os_time_t g_os_time;
 
 /*
- * Time-of-day collateral.
+ * The monotonic clock.  os_time_tick() keeps it up to date and readers
+ * add the time since on top without taking a lock; they retry if a tick
+ * came in meanwhile.  'os_mono_seq' is odd while an update is in progress
+ * and changes with every update.
+ */
+static volatile uint32_t os_mono_seq;
+static uint32_t os_time_wraps;      /* times g_os_time wrapped around */
+#ifdef OS_TIME_CPUTIME
+/*
+ * The clock is 'os_mono_base' plus 'os_mono_ticks' cputime ticks, at
+ * cputime 'os_mono_last'.  Whole seconds of ticks are moved into the base,
+ * so that any rate converts exactly, sub-MHz and fractional MHz included.
+ */
+static uint64_t os_mono_base;       /* usecs */
+static uint32_t os_mono_ticks;      /* cputime ticks on top, under a second */
+static uint32_t os_mono_last;
+static uint32_t os_mono_hz;         /* cputime ticks per second, 0 until known */
+#endif
+
+#ifdef OS_ARCH_HAS_CAS
+#define OS_MONO_FENCE()     __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#define OS_MONO_FENCE()     __asm__ volatile("" ::: "memory")
+#endif
+
+/*
+ * Time of day.  'mono' is the monotonic clock at the time the time of day
+ * was set.
  */
 static struct {
-    os_time_t ostime;
-    struct os_timeval uptime;
+    uint64_t mono;
     struct os_timeval utctime;
     struct os_timezone timezone;
 } basetod;
 
+/* Microseconds counted by the os tick alone */
+static uint64_t
+os_mono_tick_usecs(void)
+{
+    return ((((uint64_t)os_time_wraps << 32) | g_os_time) * OS_USEC_PER_TICK);
+}
+
+#ifdef OS_TIME_CPUTIME
+/* Microseconds in 'ticks' cputime ticks, rounded down */
+static uint64_t
+os_mono_ticks_to_usecs(uint64_t ticks)
+{
+    return ((ticks / os_mono_hz) * 1000000 +
+            (ticks % os_mono_hz) * 1000000 / os_mono_hz);
+}
+
+/*
+ * cputime ticks since the last fold. A cputime_init() restarts cputime
+ * from 0, which shows up as cputime going backwards; count from there.
+ */
+static uint32_t
+os_mono_elapsed(uint32_t now)
+{
+    uint32_t elapsed;
+
+    elapsed = now - os_mono_last;
+    if ((int32_t)elapsed < 0) {
+        elapsed = now;
+    }
+    return (elapsed);
+}
+#endif
+
+static uint64_t
+os_mono_read(void)
+{
+#ifdef OS_TIME_CPUTIME
+    if (os_mono_hz) {
+        return (os_mono_base +
+                os_mono_ticks_to_usecs((uint64_t)os_mono_ticks +
+                                       os_mono_elapsed(cputime_get32())));
+    }
+#endif
+    return (os_mono_tick_usecs());
+}
+
+#ifdef OS_TIME_CPUTIME
+/*
+ * Fold the cputime elapsed since the last tick into the base, so that the
+ * 32-bit cputime never gets the chance to wrap between two of them.
+ */
 static void
-os_deltatime(os_time_t delta, const struct os_timeval *base,
-    struct os_timeval *result)
+os_mono_fold(void)
 {
-    struct os_timeval tvdelta;
+    uint64_t ticks;
+    uint32_t secs;
+    uint32_t now;
+    uint32_t hz;
 
-    tvdelta.tv_sec = delta / OS_TICKS_PER_SEC;
-    tvdelta.tv_usec = (delta % OS_TICKS_PER_SEC) * OS_USEC_PER_TICK;
-    os_timeradd(base, &tvdelta, result);
+    now = cputime_get32();
+    hz = cputime_usecs_to_ticks(1000000);
+    if (hz != os_mono_hz) {
+        if (!os_mono_hz) {
+            /* cputime_init() sets the rate; count ticks until then. */
+            os_mono_base = os_mono_tick_usecs();
+            os_mono_last = now;
+        } else {
+            /* A new rate comes with a restart of cputime, from 0. */
+            os_mono_base += os_mono_ticks_to_usecs(os_mono_ticks);
+            os_mono_last = 0;
+        }
+        os_mono_hz = hz;
+        os_mono_ticks = 0;
+    }
+    if (!os_mono_hz) {
+        return;
+    }
+
+    ticks = (uint64_t)os_mono_ticks + os_mono_elapsed(now);
+    os_mono_last = now;
+    secs = ticks / os_mono_hz;
+    os_mono_base += (uint64_t)secs * 1000000;
+    os_mono_ticks = ticks - (uint64_t)secs * os_mono_hz;
 }
 
+/**
+ * The longest the tick may stop for, so that the cputime does not get
+ * ahead of the last fold by more than half its range.
+ */
+os_time_t
+os_time_mono_max_idle(void)
+{
+    uint64_t ticks;
+
+    if (!os_mono_hz) {
+        return (OS_TIMEOUT_NEVER);
+    }
+    ticks = (uint64_t)0x7fffffffU * OS_TICKS_PER_SEC / os_mono_hz / 2;
+    return (min(ticks, OS_TIMEOUT_NEVER));
+}
+#endif
+
 os_time_t
 os_time_get(void)
 {
@@ -60,24 +182,25 @@ static void
 os_time_tick(int ticks)
 {
     os_sr_t sr;
-    os_time_t delta, prev_os_time;
+    os_time_t prev_os_time;
 
     assert(ticks >= 0);
 
     OS_ENTER_CRITICAL(sr);
+    os_mono_seq++;
+    OS_MONO_FENCE();
+
     prev_os_time = g_os_time;
     g_os_time += ticks;
-
-    /*
-     * Update 'basetod' when 'g_os_time' crosses the 0x00000000 and
-     * 0x80000000 thresholds.
-     */
-    if ((prev_os_time ^ g_os_time) >> 31) {
-        delta = g_os_time - basetod.ostime;
-        os_deltatime(delta, &basetod.uptime, &basetod.uptime);
-        os_deltatime(delta, &basetod.utctime, &basetod.utctime);
-        basetod.ostime = g_os_time;
+    if (g_os_time < prev_os_time) {
+        os_time_wraps++;
     }
+#ifdef OS_TIME_CPUTIME
+    os_mono_fold();
+#endif
+
+    OS_MONO_FENCE();
+    os_mono_seq++;
     OS_EXIT_CRITICAL(sr);
 }
 
@@ -94,6 +217,56 @@ os_time_advance(int ticks)
     }
 }
 
+/**
+ * Returns the monotonic clock: microseconds since boot, as a 64-bit count
+ * that does not wrap. With OS_TIME_CPUTIME it runs off cputime once
+ * cputime_init() has been called, and has cputime's resolution; otherwise
+ * it counts os ticks. Does not take a lock, so it can be used anywhere,
+ * interrupt handlers included.
+ */
+uint64_t
+os_time_mono_usecs(void)
+{
+    uint64_t usecs;
+    uint32_t seq;
+
+    do {
+        seq = os_mono_seq;
+        OS_MONO_FENCE();
+        usecs = os_mono_read();
+        OS_MONO_FENCE();
+    } while ((seq & 1) || seq != os_mono_seq);
+
+    return (usecs);
+}
+
+/**
+ * Returns the monotonic clock in nanoseconds; see os_time_mono_usecs().
+ */
+uint64_t
+os_time_mono_nsecs(void)
+{
+    return (os_time_mono_usecs() * 1000);
+}
+
+/**
+ * Converts microseconds to os ticks, rounding down.
+ */
+os_time_t
+os_time_usecs_to_ticks(uint64_t usecs)
+{
+    return ((os_time_t)(usecs / OS_USEC_PER_TICK));
+}
+
+/**
+ * Converts os ticks to microseconds.
+ */
+uint64_t
+os_time_ticks_to_usecs(os_time_t ticks)
+{
+    return ((uint64_t)ticks * OS_USEC_PER_TICK);
+}
+
 /**
  * Puts the current task to sleep for the specified number of os ticks. There
  * is no delay if ticks is <= 0.
@@ -117,17 +290,14 @@ int
 os_settimeofday(struct os_timeval *utctime, struct os_timezone *tz)
 {
     os_sr_t sr;
-    os_time_t delta;
+    uint64_t now;
+
+    now = os_time_mono_usecs();
 
     OS_ENTER_CRITICAL(sr);
     if (utctime != NULL) {
-        /*
-         * Update all time-of-day base values.
-         */
-        delta = os_time_get() - basetod.ostime;
-        os_deltatime(delta, &basetod.uptime, &basetod.uptime);
+        basetod.mono = now;
         basetod.utctime = *utctime;
-        basetod.ostime += delta;
     }
 
     if (tz != NULL) {
@@ -141,13 +311,19 @@ os_settimeofday(struct os_timeval *utctime, struct os_timezone *tz)
 int
 os_gettimeofday(struct os_timeval *tv, struct os_timezone *tz)
 {
+    struct os_timeval tvdelta;
+    uint64_t delta;
     os_sr_t sr;
-    os_time_t delta;
+
+    delta = os_time_mono_usecs();
 
     OS_ENTER_CRITICAL(sr);
     if (tv != NULL) {
-        delta = os_time_get() - basetod.ostime;
-        os_deltatime(delta, &basetod.utctime, tv);
+        /* The time of day moves with the monotonic clock. */
+        delta -= basetod.mono;
+        tvdelta.tv_sec = delta / 1000000;
+        tvdelta.tv_usec = delta % 1000000;
+        os_timeradd(&basetod.utctime, &tvdelta, tv);
     }
 
     if (tz != NULL) {
@@ -161,19 +337,5 @@ os_gettimeofday(struct os_timeval *tv, struct os_timezone *tz)
 int64_t
 os_get_uptime_usec(void) 
 {
-  struct os_timeval tv;
-  os_time_t delta;
-  os_sr_t sr;
-  os_time_t ostime;
-
-
-  OS_ENTER_CRITICAL(sr);
-  tv = basetod.uptime;
-  ostime = basetod.ostime;
-  delta = os_time_get() - ostime;
-  OS_EXIT_CRITICAL(sr);
-
-  os_deltatime(delta, &tv, &tv);
-
-  return(tv.tv_sec * 1000000 + tv.tv_usec);
+    return (os_time_mono_usecs());
 }
@@ -0,0 +1,414 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "os/os.h"
+#include "os/queue.h"
+#include "os_priv.h"
+
+#ifdef OS_TRACE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#if (OS_TRACE_RING_SIZE & (OS_TRACE_RING_SIZE - 1)) != 0
+#error "OS_TRACE_RING_SIZE must be a power of two"
+#endif
+
+#define OS_TRACE_RING_MASK  (OS_TRACE_RING_SIZE - 1)
+
+/* Chrome trace thread id of the interrupt handlers of a core */
+#define OS_TRACE_CHROME_ISR_TID     (256)
+
+struct os_trace_ring {
+    /* Sequence number the next record gets */
+    volatile uint32_t otr_head;
+    struct os_trace_rec otr_recs[OS_TRACE_RING_SIZE];
+};
+
+static struct os_trace_ring os_trace_rings[OS_CPUS];
+
+volatile uint8_t g_os_trace_enabled;
+
+static const char *os_trace_names[] = {
+    [OS_TRACE_CTX_SW] = "ctx_sw",
+    [OS_TRACE_ISR_ENTER] = "isr_enter",
+    [OS_TRACE_ISR_EXIT] = "isr_exit",
+    [OS_TRACE_EVQ_PUT] = "evq_put",
+    [OS_TRACE_EVQ_GET] = "evq_get",
+    [OS_TRACE_MUTEX_PEND] = "mutex_pend",
+    [OS_TRACE_MUTEX_RELEASE] = "mutex_release",
+    [OS_TRACE_SEM_PEND] = "sem_pend",
+    [OS_TRACE_SEM_RELEASE] = "sem_release",
+    [OS_TRACE_CALLOUT] = "callout",
+};
+
+/**
+ * Empties the trace rings and turns tracing on. Called from os_init().
+ */
+void
+os_trace_init(void)
+{
+    memset(os_trace_rings, 0, sizeof(os_trace_rings));
+    g_os_trace_enabled = 1;
+}
+
+/**
+ * Turns recording on or off. The records taken so far are kept.
+ */
+void
+os_trace_enable(int on)
+{
+    g_os_trace_enabled = (on != 0);
+}
+
+/**
+ * Adds a record to the ring of the calling core. Use the os_trace() macro
+ * instead of calling this directly; it skips the call when tracing is off.
+ *
+ * @param type  Record type, OS_TRACE_xxx
+ * @param arg   Argument of the record
+ */
+void
+os_trace_event(uint8_t type, uint32_t arg)
+{
+    struct os_trace_ring *ring;
+    struct os_trace_rec *rec;
+    struct os_task *t;
+    uint32_t seq;
+#ifdef OS_SMP
+    int cpu;
+#endif
+#ifndef OS_ARCH_HAS_CAS
+    os_sr_t sr;
+#endif
+
+#ifdef OS_SMP
+    cpu = os_arch_cpu_id();
+    ring = &os_trace_rings[cpu];
+    t = g_os_cpus[cpu].oc_current;
+#else
+    ring = &os_trace_rings[0];
+    t = g_current_task;
+#endif
+
+    /*
+     * The record is marked as being written until all of it is filled in,
+     * so that a reader can tell a half written record from a complete one.
+     */
+#ifdef OS_ARCH_HAS_CAS
+    seq = __atomic_fetch_add(&ring->otr_head, 1, __ATOMIC_RELAXED);
+    rec = &ring->otr_recs[seq & OS_TRACE_RING_MASK];
+    __atomic_store_n(&rec->otr_seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+#else
+    OS_ENTER_CRITICAL(sr);
+    seq = ring->otr_head++;
+    rec = &ring->otr_recs[seq & OS_TRACE_RING_MASK];
+#endif
+
+    rec->otr_time = (uint32_t)os_time_mono_usecs();
+    rec->otr_arg = arg;
+    rec->otr_type = type;
+    rec->otr_taskid = t != NULL ? t->t_taskid : OS_TRACE_NO_TASK;
+
+#ifdef OS_ARCH_HAS_CAS
+    __atomic_store_n(&rec->otr_seq, seq + 1, __ATOMIC_RELEASE);
+#else
+    rec->otr_seq = seq + 1;
+    OS_EXIT_CRITICAL(sr);
+#endif
+}
+
+/**
+ * Reads the record with sequence number '*seq' from the ring of core 'cpu'.
+ * If that record has been overwritten already, the oldest one left is read
+ * instead. On success '*seq' is set to the sequence number of the record
+ * after the one returned; start with 0 to read a ring from the beginning.
+ *
+ * @param cpu   Core whose ring to read
+ * @param seq   Sequence number of the record to read
+ * @param rec   Filled in with the record
+ *
+ * @return 0 on success; OS_ENOENT if there are no more records;
+ *         OS_EINVAL if 'cpu' is not a valid core.
+ */
+int
+os_trace_read(int cpu, uint32_t *seq, struct os_trace_rec *rec)
+{
+    struct os_trace_ring *ring;
+    struct os_trace_rec *slot;
+    uint32_t head;
+    uint32_t want;
+#ifndef OS_ARCH_HAS_CAS
+    os_sr_t sr;
+#endif
+
+    if (cpu < 0 || cpu >= OS_CPUS) {
+        return (OS_EINVAL);
+    }
+    ring = &os_trace_rings[cpu];
+
+    while (1) {
+        head = ring->otr_head;
+        if ((int32_t)(head - *seq) <= 0) {
+            return (OS_ENOENT);
+        }
+        if (head - *seq > OS_TRACE_RING_SIZE) {
+            *seq = head - OS_TRACE_RING_SIZE;
+        }
+
+        want = *seq + 1;
+        slot = &ring->otr_recs[*seq & OS_TRACE_RING_MASK];
+#ifdef OS_ARCH_HAS_CAS
+        if (__atomic_load_n(&slot->otr_seq, __ATOMIC_ACQUIRE) == want) {
+            *rec = *slot;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->otr_seq, __ATOMIC_RELAXED) == want) {
+                *seq = want;
+                return (0);
+            }
+        }
+#else
+        OS_ENTER_CRITICAL(sr);
+        *rec = *slot;
+        OS_EXIT_CRITICAL(sr);
+        if (rec->otr_seq == want) {
+            *seq = want;
+            return (0);
+        }
+#endif
+
+        /*
+         * Either a writer got to the slot first and we try again further
+         * ahead, or the record is still being written.
+         */
+        if ((int32_t)(slot->otr_seq - want) <= 0) {
+            return (OS_ENOENT);
+        }
+    }
+}
+
+static int
+os_trace_out(os_trace_write_func_t func, void *arg, const char *fmt, ...)
+{
+    char buf[160];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    if (len >= (int)sizeof(buf)) {
+        len = sizeof(buf) - 1;
+    }
+
+    return (func(arg, buf, len));
+}
+
+static int
+os_trace_out_rec(os_trace_write_func_t func, void *arg, int cpu,
+                 uint32_t base, struct os_trace_rec *rec, int *running)
+{
+    unsigned long ts;
+    int rc;
+
+    ts = rec->otr_time - base;
+
+    switch (rec->otr_type) {
+    case OS_TRACE_CTX_SW:
+        rc = 0;
+        if (*running >= 0) {
+            rc = os_trace_out(func, arg,
+                ",\n{\"name\":\"run\",\"ph\":\"E\",\"pid\":%d,\"tid\":%d,"
+                "\"ts\":%lu}", cpu, *running, ts);
+        }
+        if (rc == 0) {
+            *running = rec->otr_arg;
+            rc = os_trace_out(func, arg,
+                ",\n{\"name\":\"run\",\"ph\":\"B\",\"pid\":%d,\"tid\":%d,"
+                "\"ts\":%lu}", cpu, *running, ts);
+        }
+        break;
+
+    case OS_TRACE_ISR_ENTER:
+    case OS_TRACE_ISR_EXIT:
+        rc = os_trace_out(func, arg,
+            ",\n{\"name\":\"isr\",\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,"
+            "\"ts\":%lu}", rec->otr_type == OS_TRACE_ISR_ENTER ? 'B' : 'E',
+            cpu, OS_TRACE_CHROME_ISR_TID, ts);
+        break;
+
+    default:
+        if (rec->otr_type < sizeof(os_trace_names) / sizeof(char *) &&
+            os_trace_names[rec->otr_type] != NULL) {
+            rc = os_trace_out(func, arg,
+                ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,"
+                "\"tid\":%d,\"ts\":%lu,\"args\":{\"obj\":\"0x%08lx\"}}",
+                os_trace_names[rec->otr_type], cpu, rec->otr_taskid, ts,
+                (unsigned long)rec->otr_arg);
+        } else {
+            rc = os_trace_out(func, arg,
+                ",\n{\"name\":\"user%d\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,"
+                "\"tid\":%d,\"ts\":%lu,\"args\":{\"arg\":%lu}}",
+                rec->otr_type, cpu, rec->otr_taskid, ts,
+                (unsigned long)rec->otr_arg);
+        }
+        break;
+    }
+
+    return (rc);
+}
+
+/**
+ * Writes the contents of the trace rings in the Chrome trace event format,
+ * which chrome://tracing and the Perfetto UI load. Every core is a process
+ * and every task a thread; a task is shown as running from the context
+ * switch to it until the next one on that core. Recording is turned off
+ * while the trace is written.
+ *
+ * @param func  Called with each piece of output, in order
+ * @param arg   Passed to 'func'
+ *
+ * @return 0 on success; the first non-zero value 'func' returned otherwise.
+ */
+int
+os_trace_export_chrome(os_trace_write_func_t func, void *arg)
+{
+    struct os_task_info oti;
+    struct os_trace_rec rec;
+    struct os_task *prev;
+    uint32_t seq;
+    uint32_t now;
+    uint32_t base;
+    uint32_t age;
+    uint32_t oldest;
+    uint8_t enabled;
+    int running;
+    int cpu;
+    int rc;
+
+    enabled = g_os_trace_enabled;
+    g_os_trace_enabled = 0;
+
+    /* Timestamps are relative to the oldest record on any core. */
+    now = (uint32_t)os_time_mono_usecs();
+    oldest = 0;
+    for (cpu = 0; cpu < OS_CPUS; cpu++) {
+        seq = 0;
+        if (os_trace_read(cpu, &seq, &rec) == 0) {
+            age = now - rec.otr_time;
+            if (age > oldest) {
+                oldest = age;
+            }
+        }
+    }
+    base = now - oldest;
+
+    rc = os_trace_out(func, arg, "{\"traceEvents\":[\n"
+                      "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+                      "\"args\":{\"name\":\"cpu 0\"}}");
+    if (rc != 0) {
+        goto done;
+    }
+
+    for (cpu = 0; cpu < OS_CPUS; cpu++) {
+        if (cpu != 0) {
+            rc = os_trace_out(func, arg,
+                ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"args\":{\"name\":\"cpu %d\"}}", cpu, cpu);
+            if (rc != 0) {
+                goto done;
+            }
+        }
+        rc = os_trace_out(func, arg,
+            ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"tid\":%d,\"args\":{\"name\":\"interrupts\"}}",
+            cpu, OS_TRACE_CHROME_ISR_TID);
+        if (rc != 0) {
+            goto done;
+        }
+
+        prev = NULL;
+        while ((prev = os_task_info_get_next(prev, &oti)) != NULL) {
+            rc = os_trace_out(func, arg,
+                ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                cpu, oti.oti_taskid, oti.oti_name);
+            if (rc != 0) {
+                goto done;
+            }
+        }
+    }
+
+    for (cpu = 0; cpu < OS_CPUS; cpu++) {
+        running = -1;
+        seq = 0;
+        while (os_trace_read(cpu, &seq, &rec) == 0) {
+            rc = os_trace_out_rec(func, arg, cpu, base, &rec, &running);
+            if (rc != 0) {
+                goto done;
+            }
+        }
+    }
+
+    rc = os_trace_out(func, arg, "\n]}\n");
+
+done:
+    g_os_trace_enabled = enabled;
+    return (rc);
+}
+
+#ifdef ARCH_sim
+static int
+os_trace_file_write(void *arg, const char *buf, int len)
+{
+    if (fwrite(buf, 1, len, arg) != len) {
+        return (OS_EINVAL);
+    }
+    return (0);
+}
+
+/**
+ * Writes the trace to the file 'path' in the Chrome trace event format.
+ *
+ * @return 0 on success; OS_EINVAL if the file could not be written.
+ */
+int
+os_trace_dump_file(const char *path)
+{
+    FILE *fp;
+    int rc;
+
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        return (OS_EINVAL);
+    }
+
+    rc = os_trace_export_chrome(os_trace_file_write, fp);
+    if (fclose(fp) != 0 && rc == 0) {
+        rc = OS_EINVAL;
+    }
+
+    return (rc);
+}
+#endif
+
+#endif /* OS_TRACE */
@@ -0,0 +1,320 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <string.h>
+#include <util/util.h>
+
+#include "os/os.h"
+#include "os/os_wheel.h"
+
+/*
+ * One bitmap word per level, and the top level must not wrap os_time_t.
+ * Entries beyond the range of the wheel are parked in the top level, so
+ * there has to be at least one level above level 0 to cascade them from.
+ */
+CTASSERT(OS_WHEEL_SLOT_BITS <= 5);
+CTASSERT(OS_WHEEL_LEVELS >= 2);
+CTASSERT(OS_WHEEL_SLOT_BITS * OS_WHEEL_LEVELS < 32);
+
+#define OS_WHEEL_SLOT_MASK  (OS_WHEEL_SLOTS - 1)
+#define OS_WHEEL_MAP_MASK   ((uint32_t)(((uint64_t)1 << OS_WHEEL_SLOTS) - 1))
+#define OS_WHEEL_SHIFT(l)   ((l) * OS_WHEEL_SLOT_BITS)
+
+/* Number of ticks covered by all levels together */
+#define OS_WHEEL_RANGE      ((os_time_t)1 << OS_WHEEL_SHIFT(OS_WHEEL_LEVELS))
+
+/**
+ * Initialize a timing wheel.
+ *
+ * @param w The wheel to initialize
+ * @param now The current OS time; the first tick the wheel will process.
+ */
+void
+os_wheel_init(struct os_wheel *w, os_time_t now)
+{
+    memset(w, 0, sizeof(*w));
+    w->w_next = now;
+}
+
+/*
+ * Put an entry in the slot matching its expiry time, relative to the next
+ * tick the wheel processes. Entries that are already due go in the current
+ * level 0 slot; entries beyond the range of the wheel go in the last slot
+ * of the top level and are re-filed when that slot is cascaded.
+ */
+static void
+os_wheel_place(struct os_wheel *w, struct os_wheel_entry *we)
+{
+    os_time_t expiry;
+    os_time_t delta;
+    int level;
+    int slot;
+
+    expiry = we->we_expiry;
+    delta = expiry - w->w_next;
+    if ((int32_t)delta < 0) {
+        expiry = w->w_next;
+        delta = 0;
+    } else if (delta >= OS_WHEEL_RANGE) {
+        expiry = w->w_next + OS_WHEEL_RANGE - 1;
+        delta = OS_WHEEL_RANGE - 1;
+    }
+
+    for (level = 0; level < OS_WHEEL_LEVELS - 1; level++) {
+        if (delta < ((os_time_t)1 << OS_WHEEL_SHIFT(level + 1))) {
+            break;
+        }
+    }
+
+    slot = (expiry >> OS_WHEEL_SHIFT(level)) & OS_WHEEL_SLOT_MASK;
+    LIST_INSERT_HEAD(&w->w_slots[level][slot], we, we_next);
+    w->w_map[level] |= 1UL << slot;
+}
+
+/**
+ * Arm a timer entry. The entry must not be queued on any wheel.
+ *
+ * NOTE: must be called with interrupts disabled.
+ *
+ * @param w The wheel to arm the entry on
+ * @param we The entry
+ * @param expiry The OS time at which the entry expires
+ */
+void
+os_wheel_insert(struct os_wheel *w, struct os_wheel_entry *we,
+        os_time_t expiry)
+{
+    we->we_expiry = expiry;
+    os_wheel_place(w, we);
+}
+
+/**
+ * Disarm a timer entry. Does nothing if the entry is not queued.
+ *
+ * NOTE: must be called with interrupts disabled.
+ *
+ * @param w The wheel the entry is queued on
+ * @param we The entry
+ */
+void
+os_wheel_remove(struct os_wheel *w, struct os_wheel_entry *we)
+{
+    struct os_wheel_slot *slot;
+    int idx;
+
+    if (!os_wheel_entry_queued(we)) {
+        return;
+    }
+
+    /*
+     * The first entry of a slot points back at the slot head; use that to
+     * find the slot and clear its bit if the entry was the only one in it.
+     */
+    slot = (struct os_wheel_slot *)we->we_next.le_prev;
+
+    LIST_REMOVE(we, we_next);
+    we->we_next.le_prev = NULL;
+
+    if (slot >= &w->w_slots[0][0] &&
+        slot < &w->w_slots[0][0] + OS_WHEEL_LEVELS * OS_WHEEL_SLOTS &&
+        LIST_EMPTY(slot)) {
+
+        idx = slot - &w->w_slots[0][0];
+        w->w_map[idx / OS_WHEEL_SLOTS] &= ~(1UL << (idx % OS_WHEEL_SLOTS));
+    }
+}
+
+/*
+ * Returns the number of ticks from 'w_next' to the first tick at which the
+ * wheel has work to do: either a level 0 slot with entries in it, or the
+ * start of a higher level slot with entries that need cascading. The caller
+ * must make sure the wheel is not empty.
+ */
+static os_time_t
+os_wheel_next_delta(struct os_wheel *w)
+{
+    os_time_t best;
+    os_time_t cur;
+    os_time_t tick;
+    uint32_t map;
+    int shift;
+    int level;
+    int idx;
+
+    best = OS_TIMEOUT_NEVER;
+    for (level = 0; level < OS_WHEEL_LEVELS; level++) {
+        map = w->w_map[level];
+        if (map == 0) {
+            continue;
+        }
+
+        /* First slot boundary of this level at or after 'w_next' */
+        shift = OS_WHEEL_SHIFT(level);
+        cur = w->w_next >> shift;
+        if (w->w_next & (((os_time_t)1 << shift) - 1)) {
+            cur++;
+        }
+
+        /* Rotate the bitmap so bit 0 is the slot 'cur' falls in */
+        idx = cur & OS_WHEEL_SLOT_MASK;
+        if (idx != 0) {
+            map = ((map >> idx) | (map << (OS_WHEEL_SLOTS - idx))) &
+                  OS_WHEEL_MAP_MASK;
+        }
+
+        tick = (cur + __builtin_ctz(map)) << shift;
+        if (tick - w->w_next < best) {
+            best = tick - w->w_next;
+        }
+    }
+
+    return (best);
+}
+
+static int
+os_wheel_empty(struct os_wheel *w)
+{
+    int level;
+
+    for (level = 0; level < OS_WHEEL_LEVELS; level++) {
+        if (w->w_map[level] != 0) {
+            return (0);
+        }
+    }
+
+    return (1);
+}
+
+/*
+ * Process tick 'w_next': cascade the higher level slots that start at this
+ * tick and move the entries of the current level 0 slot to the expired
+ * list.
+ */
+static void
+os_wheel_process(struct os_wheel *w)
+{
+    struct os_wheel_slot tmp;
+    struct os_wheel_entry *we;
+    int level;
+    int slot;
+
+    slot = w->w_next & OS_WHEEL_SLOT_MASK;
+    for (level = 1; slot == 0 && level < OS_WHEEL_LEVELS; level++) {
+        slot = (w->w_next >> OS_WHEEL_SHIFT(level)) & OS_WHEEL_SLOT_MASK;
+        if (w->w_map[level] & (1UL << slot)) {
+            tmp = w->w_slots[level][slot];
+            if (tmp.lh_first != NULL) {
+                tmp.lh_first->we_next.le_prev = &tmp.lh_first;
+            }
+            LIST_INIT(&w->w_slots[level][slot]);
+            w->w_map[level] &= ~(1UL << slot);
+
+            while ((we = LIST_FIRST(&tmp)) != NULL) {
+                LIST_REMOVE(we, we_next);
+                os_wheel_place(w, we);
+            }
+        }
+    }
+
+    slot = w->w_next & OS_WHEEL_SLOT_MASK;
+    while ((we = LIST_FIRST(&w->w_slots[0][slot])) != NULL) {
+        LIST_REMOVE(we, we_next);
+        LIST_INSERT_HEAD(&w->w_expired, we, we_next);
+    }
+    w->w_map[0] &= ~(1UL << slot);
+
+    w->w_next++;
+}
+
+/**
+ * Advance the wheel up to and including 'now', and return the next entry
+ * that has expired. The entry is removed from the wheel. Call repeatedly
+ * until it returns NULL to collect all expired entries.
+ *
+ * NOTE: must be called with interrupts disabled.
+ *
+ * @param w The wheel
+ * @param now The current OS time
+ *
+ * @return An expired entry, or NULL if there are none.
+ */
+struct os_wheel_entry *
+os_wheel_expire(struct os_wheel *w, os_time_t now)
+{
+    struct os_wheel_entry *we;
+    os_time_t delta;
+
+    while (1) {
+        we = LIST_FIRST(&w->w_expired);
+        if (we != NULL) {
+            LIST_REMOVE(we, we_next);
+            we->we_next.le_prev = NULL;
+            return (we);
+        }
+
+        if (OS_TIME_TICK_GT(w->w_next, now)) {
+            return (NULL);
+        }
+
+        /* Skip ticks at which there is nothing to do. */
+        if (os_wheel_empty(w)) {
+            w->w_next = now + 1;
+            return (NULL);
+        }
+        delta = os_wheel_next_delta(w);
+        if (delta > now - w->w_next) {
+            w->w_next = now + 1;
+            return (NULL);
+        }
+        w->w_next += delta;
+
+        os_wheel_process(w);
+    }
+}
+
+/**
+ * Returns the number of ticks until the wheel next needs to be advanced,
+ * or OS_TIMEOUT_NEVER if the wheel is empty. This is never later than the
+ * first expiry, but can be earlier: if the next thing to happen is a
+ * cascade, the caller finds nothing expired and asks again.
+ *
+ * NOTE: must be called with interrupts disabled.
+ *
+ * @param w The wheel
+ * @param now The current OS time
+ */
+os_time_t
+os_wheel_next_ticks(struct os_wheel *w, os_time_t now)
+{
+    os_time_t tick;
+
+    if (!LIST_EMPTY(&w->w_expired)) {
+        return (0);
+    }
+    if (os_wheel_empty(w)) {
+        return (OS_TIMEOUT_NEVER);
+    }
+
+    tick = w->w_next + os_wheel_next_delta(w);
+    if (OS_TIME_TICK_GEQ(tick, now)) {
+        return (tick - now);
+    } else {
+        return (0);
+    }
+}
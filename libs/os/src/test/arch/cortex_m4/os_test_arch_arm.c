@@ -20,6 +20,11 @@
 #include "testutil/testutil.h"
 #include "os_test_priv.h"
 
+void
+os_test_stop(void)
+{
+}
+
 void
 os_test_restart(void)
 {
@@ -26,13 +26,18 @@
 #include "os/os.h"
 #include "os_test_priv.h"
 
+/**
+ * Stops the OS, and the other cores on an SMP build, without leaving the
+ * current test case. A task can then report its results with TEST_PASS().
+ */
 void
-os_test_restart(void)
+os_test_stop(void)
 {
     struct sigaction sa;
     struct itimerval it;
     int rc;
 
+    os_arch_os_stop();
     g_os_started = 0;
 
     memset(&sa, 0, sizeof sa);
@@ -47,6 +52,11 @@ os_test_restart(void)
         perror("Cannot set itimer");
         abort();
     }
+}
 
+void
+os_test_restart(void)
+{
+    os_test_stop();
     tu_restart();
 }
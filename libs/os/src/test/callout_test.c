@@ -0,0 +1,127 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "testutil/testutil.h"
+#include "os/os.h"
+#include "os_test_priv.h"
+
+#ifdef ARCH_sim
+#define CALLOUT_TEST_STACK_SIZE     1024
+#else
+#define CALLOUT_TEST_STACK_SIZE     256
+#endif
+
+#define CALLOUT_TEST_PRIO           (10)
+#define CALLOUT_TEST_NUM            (5)
+
+struct os_task callout_test_task;
+os_stack_t callout_test_stack[OS_STACK_ALIGN(CALLOUT_TEST_STACK_SIZE)];
+
+static struct os_eventq callout_test_evq;
+static struct os_callout_func callout_test_c[CALLOUT_TEST_NUM];
+
+/* Expected firing order of the callouts armed below */
+static const int callout_test_order[] = { 1, 2, 0, 3 };
+
+static void
+callout_test_handler(void *arg)
+{
+    struct os_callout_func *cf;
+    struct os_event *ev;
+    os_time_t start;
+    os_time_t ticks;
+    os_sr_t sr;
+    int i;
+
+    os_eventq_init(&callout_test_evq);
+    for (i = 0; i < CALLOUT_TEST_NUM; i++) {
+        os_callout_func_init(&callout_test_c[i], &callout_test_evq, NULL,
+                             (void *)(intptr_t)i);
+    }
+
+    start = os_time_get();
+
+    /*
+     * Armed out of order; #3 is re-armed and #4 is stopped before firing.
+     * #4 is far enough out to sit in an upper level of a timing wheel.
+     */
+    os_callout_reset(&callout_test_c[0].cf_c, 30);
+    os_callout_reset(&callout_test_c[1].cf_c, 10);
+    os_callout_reset(&callout_test_c[2].cf_c, 20);
+    os_callout_reset(&callout_test_c[3].cf_c, 5);
+    os_callout_reset(&callout_test_c[4].cf_c, 5000);
+    os_callout_reset(&callout_test_c[3].cf_c, 40);
+
+    for (i = 0; i < CALLOUT_TEST_NUM; i++) {
+        TEST_ASSERT(os_callout_queued(&callout_test_c[i].cf_c));
+    }
+
+    OS_ENTER_CRITICAL(sr);
+    ticks = os_callout_wakeup_ticks(os_time_get());
+    OS_EXIT_CRITICAL(sr);
+    TEST_ASSERT(ticks > 0 && ticks <= 10, "ticks=%u", (unsigned)ticks);
+
+    /* Fire in expiry order, and not early. */
+    for (i = 0; i < 4; i++) {
+        ev = os_eventq_get(&callout_test_evq);
+        TEST_ASSERT_FATAL(ev->ev_type == OS_EVENT_T_TIMER);
+
+        cf = (struct os_callout_func *)ev;
+        TEST_ASSERT(cf == &callout_test_c[callout_test_order[i]],
+                    "callout %d fired as #%d", (int)(cf - callout_test_c), i);
+        TEST_ASSERT(!os_callout_queued(&cf->cf_c));
+        TEST_ASSERT(OS_TIME_TICK_GEQ(os_time_get(), start + 10 * (i + 1)));
+    }
+
+    TEST_ASSERT(os_callout_queued(&callout_test_c[4].cf_c));
+    os_callout_stop(&callout_test_c[4].cf_c);
+    TEST_ASSERT(!os_callout_queued(&callout_test_c[4].cf_c));
+
+    OS_ENTER_CRITICAL(sr);
+    ticks = os_callout_wakeup_ticks(os_time_get());
+    OS_EXIT_CRITICAL(sr);
+    TEST_ASSERT(ticks == OS_TIMEOUT_NEVER);
+
+    /* Stopping a callout whose event is pending also removes the event. */
+    os_callout_reset(&callout_test_c[0].cf_c, 1);
+    os_time_delay(5);
+    TEST_ASSERT(OS_EVENT_QUEUED(&callout_test_c[0].cf_c.c_ev));
+    os_callout_stop(&callout_test_c[0].cf_c);
+    TEST_ASSERT(!OS_EVENT_QUEUED(&callout_test_c[0].cf_c.c_ev));
+    TEST_ASSERT(STAILQ_EMPTY(&callout_test_evq.evq_list));
+
+    os_test_restart();
+}
+
+TEST_CASE(os_callout_test_order)
+{
+    os_init();
+
+    os_task_init(&callout_test_task, "callout", callout_test_handler, NULL,
+                 CALLOUT_TEST_PRIO, OS_WAIT_FOREVER, callout_test_stack,
+                 OS_STACK_ALIGN(CALLOUT_TEST_STACK_SIZE));
+
+    os_start();
+}
+
+TEST_SUITE(os_callout_test_suite)
+{
+    os_callout_test_order();
+}
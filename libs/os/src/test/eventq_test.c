@@ -0,0 +1,128 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include <string.h>
+#include "testutil/testutil.h"
+#include "os/os.h"
+#include "os_test_priv.h"
+
+#define EVQ_TEST_NUM_EVS        (8)
+
+static struct os_eventq evq_test_evq;
+static struct os_event evq_test_evs[EVQ_TEST_NUM_EVS];
+
+static void
+evq_test_setup(void)
+{
+    os_eventq_init(&evq_test_evq);
+    memset(evq_test_evs, 0, sizeof(evq_test_evs));
+}
+
+#ifdef OS_EVENTQ_PRIO
+/**
+ * Gets drain the more urgent levels first, and keep the order of events
+ * within a level.
+ */
+TEST_CASE(os_eventq_test_prio)
+{
+    static const uint8_t prios[EVQ_TEST_NUM_EVS] = {
+        OS_EVENTQ_PRIO_NORMAL, 1, OS_EVENTQ_PRIO_URGENT,
+        OS_EVENTQ_PRIO_NORMAL, OS_EVENTQ_PRIO_URGENT, 1,
+        OS_EVENTQ_PRIO_NORMAL, OS_EVENTQ_PRIO_URGENT,
+    };
+    static const int order[EVQ_TEST_NUM_EVS] = { 2, 4, 7, 1, 5, 0, 3, 6 };
+    int i;
+
+    evq_test_setup();
+
+    for (i = 0; i < EVQ_TEST_NUM_EVS; i++) {
+        os_eventq_put_prio(&evq_test_evq, &evq_test_evs[i], prios[i]);
+    }
+
+    /* Putting a queued event again changes nothing. */
+    os_eventq_put_prio(&evq_test_evq, &evq_test_evs[6],
+                       OS_EVENTQ_PRIO_URGENT);
+    TEST_ASSERT(evq_test_evq.evq_depth[OS_EVENTQ_PRIO_URGENT] == 3);
+    TEST_ASSERT(evq_test_evq.evq_depth[1] == 2);
+    TEST_ASSERT(evq_test_evq.evq_depth[OS_EVENTQ_PRIO_NORMAL] == 3);
+
+    for (i = 0; i < EVQ_TEST_NUM_EVS; i++) {
+        TEST_ASSERT(os_eventq_peek(&evq_test_evq) ==
+                    &evq_test_evs[order[i]]);
+        TEST_ASSERT(os_eventq_get_no_wait(&evq_test_evq) ==
+                    &evq_test_evs[order[i]]);
+        TEST_ASSERT(!OS_EVENT_QUEUED(&evq_test_evs[order[i]]));
+    }
+    TEST_ASSERT(os_eventq_get_no_wait(&evq_test_evq) == NULL);
+    TEST_ASSERT(evq_test_evq.evq_prio_map == 0);
+
+    TEST_ASSERT(evq_test_evq.evq_max_depth[OS_EVENTQ_PRIO_URGENT] == 3);
+    TEST_ASSERT(evq_test_evq.evq_depth[OS_EVENTQ_PRIO_URGENT] == 0);
+    TEST_ASSERT(evq_test_evq.evq_puts[OS_EVENTQ_PRIO_NORMAL] == 3);
+}
+#endif
+
+/**
+ * Removing the last event of a level leaves the other levels alone, and
+ * the normal level keeps working through os_eventq_put() and polling.
+ * Without OS_EVENTQ_PRIO every level is the normal one.
+ */
+TEST_CASE(os_eventq_test_remove)
+{
+    struct os_eventq *evqs[1];
+
+    evq_test_setup();
+
+    os_eventq_put(&evq_test_evq, &evq_test_evs[0]);
+    os_eventq_put_prio(&evq_test_evq, &evq_test_evs[1],
+                       OS_EVENTQ_PRIO_URGENT);
+    TEST_ASSERT(evq_test_evs[0].ev_prio == OS_EVENTQ_PRIO_NORMAL);
+    TEST_ASSERT(STAILQ_FIRST(&evq_test_evq.evq_list) == &evq_test_evs[0]);
+
+#ifdef OS_EVENTQ_PRIO
+    TEST_ASSERT(os_eventq_peek(&evq_test_evq) == &evq_test_evs[1]);
+#endif
+
+    os_eventq_remove(&evq_test_evq, &evq_test_evs[1]);
+    TEST_ASSERT(!OS_EVENT_QUEUED(&evq_test_evs[1]));
+    TEST_ASSERT(os_eventq_peek(&evq_test_evq) == &evq_test_evs[0]);
+#ifdef OS_EVENTQ_PRIO
+    TEST_ASSERT(evq_test_evq.evq_prio_map == 1 << OS_EVENTQ_PRIO_NORMAL);
+    TEST_ASSERT(evq_test_evq.evq_depth[OS_EVENTQ_PRIO_URGENT] == 0);
+#endif
+
+    os_eventq_put_prio(&evq_test_evq, &evq_test_evs[2], 1);
+    evqs[0] = &evq_test_evq;
+#ifdef OS_EVENTQ_PRIO
+    TEST_ASSERT(os_eventq_poll(evqs, 1, 0) == &evq_test_evs[2]);
+    TEST_ASSERT(os_eventq_poll(evqs, 1, 0) == &evq_test_evs[0]);
+#else
+    TEST_ASSERT(os_eventq_poll(evqs, 1, 0) == &evq_test_evs[0]);
+    TEST_ASSERT(os_eventq_poll(evqs, 1, 0) == &evq_test_evs[2]);
+#endif
+    TEST_ASSERT(os_eventq_peek(&evq_test_evq) == NULL);
+    TEST_ASSERT(STAILQ_EMPTY(&evq_test_evq.evq_list));
+}
+
+TEST_SUITE(os_eventq_test_suite)
+{
+#ifdef OS_EVENTQ_PRIO
+    os_eventq_test_prio();
+#endif
+    os_eventq_test_remove();
+}
@@ -0,0 +1,154 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include <string.h>
+#include "testutil/testutil.h"
+#include "os/os.h"
+#include "os_test_priv.h"
+
+#ifdef ARCH_sim
+#define EVG_TEST_STACK_SIZE     1024
+#else
+#define EVG_TEST_STACK_SIZE     256
+#endif
+
+#define EVG_TEST_WAITER_PRIO    (10)
+#define EVG_TEST_SETTER_PRIO    (11)
+
+/* Event queues that signal evg_test_evg */
+#define EVG_TEST_NUM_EVQS       (4)
+
+struct os_task evg_test_waiter_task;
+os_stack_t evg_test_waiter_stack[OS_STACK_ALIGN(EVG_TEST_STACK_SIZE)];
+
+struct os_task evg_test_setter_task;
+os_stack_t evg_test_setter_stack[OS_STACK_ALIGN(EVG_TEST_STACK_SIZE)];
+
+static struct os_evgroup evg_test_evg;
+static struct os_eventq evg_test_evqs[EVG_TEST_NUM_EVQS];
+static struct os_event evg_test_ev;
+static struct os_sem evg_test_sem;
+
+static void
+evg_test_waiter_handler(void *arg)
+{
+    struct os_event *ev;
+    os_error_t err;
+    uint32_t bits;
+    int i;
+
+    /* Bits already set satisfy the wait at once. */
+    os_evgroup_set(&evg_test_evg, 0x1);
+    err = os_evgroup_wait(&evg_test_evg, 0x3, OS_EVGROUP_WAIT_ANY, 0, &bits);
+    TEST_ASSERT(err == OS_OK);
+    TEST_ASSERT(bits == 0x1);
+    err = os_evgroup_wait(&evg_test_evg, 0x3, OS_EVGROUP_WAIT_ALL, 0, &bits);
+    TEST_ASSERT(err == OS_TIMEOUT);
+
+    /* Woken by the setter once both bits are set; they are cleared. */
+    os_sem_release(&evg_test_sem);
+    err = os_evgroup_wait(&evg_test_evg, 0x3,
+                          OS_EVGROUP_WAIT_ALL | OS_EVGROUP_CLEAR,
+                          OS_TIMEOUT_NEVER, &bits);
+    TEST_ASSERT(err == OS_OK);
+    TEST_ASSERT(bits == 0x7);
+    TEST_ASSERT(os_evgroup_get(&evg_test_evg) == 0x4);
+
+    /* Nobody sets 0x8. */
+    err = os_evgroup_wait(&evg_test_evg, 0x8, OS_EVGROUP_WAIT_ANY, 2, &bits);
+    TEST_ASSERT(err == OS_TIMEOUT);
+    TEST_ASSERT(bits == 0x4);
+    TEST_ASSERT(SLIST_EMPTY(&evg_test_evg.evg_head));
+    os_evgroup_clear(&evg_test_evg, 0xffffffff);
+
+    /* One wait covers all the event queues. */
+    for (i = 0; i < EVG_TEST_NUM_EVQS; i++) {
+        os_eventq_set_evgroup(&evg_test_evqs[i], &evg_test_evg, 1 << i);
+    }
+    os_sem_release(&evg_test_sem);
+    err = os_evgroup_wait(&evg_test_evg, (1 << EVG_TEST_NUM_EVQS) - 1,
+                          OS_EVGROUP_WAIT_ANY | OS_EVGROUP_CLEAR,
+                          OS_TIMEOUT_NEVER, &bits);
+    TEST_ASSERT(err == OS_OK);
+    TEST_ASSERT(bits == 1 << 2);
+    TEST_ASSERT(os_evgroup_get(&evg_test_evg) == 0);
+    for (i = 0; i < EVG_TEST_NUM_EVQS; i++) {
+        ev = os_eventq_get_no_wait(&evg_test_evqs[i]);
+        TEST_ASSERT(ev == (i == 2 ? &evg_test_ev : NULL));
+    }
+
+    os_test_restart();
+}
+
+static void
+evg_test_setter_handler(void *arg)
+{
+    os_sem_pend(&evg_test_sem, OS_TIMEOUT_NEVER);
+
+    /* Not enough for the waiter. */
+    os_evgroup_set(&evg_test_evg, 0x4);
+    TEST_ASSERT(!SLIST_EMPTY(&evg_test_evg.evg_head));
+    os_evgroup_set(&evg_test_evg, 0x2);
+
+    os_sem_pend(&evg_test_sem, OS_TIMEOUT_NEVER);
+    os_eventq_put(&evg_test_evqs[2], &evg_test_ev);
+
+    while (1) {
+        os_time_delay(1000);
+    }
+}
+
+/**
+ * Tasks wait for any or all of a mask, with and without a timeout, and
+ * event queues wake a task waiting on their group.
+ */
+TEST_CASE(os_evgroup_test_basic)
+{
+    int i;
+
+    os_init();
+
+    TEST_ASSERT(os_evgroup_init(NULL) == OS_INVALID_PARM);
+    TEST_ASSERT(os_evgroup_init(&evg_test_evg) == OS_OK);
+    TEST_ASSERT(os_evgroup_wait(&evg_test_evg, 0, 0, 0, NULL) ==
+                OS_INVALID_PARM);
+    TEST_ASSERT(os_evgroup_wait(&evg_test_evg, 1, 0, 1, NULL) ==
+                OS_NOT_STARTED);
+
+    os_sem_init(&evg_test_sem, 0);
+    for (i = 0; i < EVG_TEST_NUM_EVQS; i++) {
+        os_eventq_init(&evg_test_evqs[i]);
+    }
+    memset(&evg_test_ev, 0, sizeof(evg_test_ev));
+
+    os_task_init(&evg_test_waiter_task, "evg_waiter",
+                 evg_test_waiter_handler, NULL, EVG_TEST_WAITER_PRIO,
+                 OS_WAIT_FOREVER, evg_test_waiter_stack,
+                 OS_STACK_ALIGN(EVG_TEST_STACK_SIZE));
+    os_task_init(&evg_test_setter_task, "evg_setter",
+                 evg_test_setter_handler, NULL, EVG_TEST_SETTER_PRIO,
+                 OS_WAIT_FOREVER, evg_test_setter_stack,
+                 OS_STACK_ALIGN(EVG_TEST_STACK_SIZE));
+
+    os_start();
+}
+
+TEST_SUITE(os_evgroup_test_suite)
+{
+    os_evgroup_test_basic();
+}
@@ -0,0 +1,221 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include <string.h>
+#include "testutil/testutil.h"
+#include "os/os.h"
+#include "os_test_priv.h"
+
+#ifdef ARCH_sim
+#define EVT_TEST_STACK_SIZE     1024
+#else
+#define EVT_TEST_STACK_SIZE     256
+#endif
+
+#define EVT_TEST_CTRL_PRIO      (10)
+#define EVT_TEST_POOL_PRIO      (11)
+
+#define EVT_TEST_NUM_EVTASKS    (3)
+
+/* How long ctrl waits for the pool before failing */
+#define EVT_TEST_TIMEOUT        (OS_TICKS_PER_SEC)
+
+struct os_task evt_test_ctrl_task;
+os_stack_t evt_test_ctrl_stack[OS_STACK_ALIGN(EVT_TEST_STACK_SIZE)];
+
+static struct os_evpool evt_test_pool;
+static os_stack_t evt_test_pool_stack[OS_STACK_ALIGN(EVT_TEST_STACK_SIZE)];
+
+static struct os_evtask evt_test_evtasks[EVT_TEST_NUM_EVTASKS];
+static struct os_event evt_test_evs[EVT_TEST_NUM_EVTASKS];
+static struct os_event evt_test_chain_ev;
+static struct os_callout_func evt_test_cf;
+
+/* Event tasks in the order their handlers ran */
+static int evt_test_log[16];
+static int evt_test_log_len;
+static int evt_test_cf_fired;
+
+/* Released once for every event handled, callout included */
+static struct os_sem evt_test_sem;
+
+static void
+evt_test_handler(struct os_evtask *et, struct os_event *ev)
+{
+    struct os_callout_func *cf;
+    int idx;
+
+    /* Every event task runs on the pool's worker. */
+    TEST_ASSERT(os_sched_get_current_task() == &evt_test_pool.ep_task);
+
+    if (ev->ev_type == OS_EVENT_T_TIMER) {
+        cf = (struct os_callout_func *)ev;
+        cf->cf_func(CF_ARG(cf));
+        return;
+    }
+
+    idx = et - evt_test_evtasks;
+    if (evt_test_log_len < sizeof(evt_test_log) / sizeof(evt_test_log[0])) {
+        evt_test_log[evt_test_log_len++] = idx;
+    }
+
+    /* Event task 1 hands work to the more urgent event task 0. */
+    if (idx == 1 && ev != &evt_test_chain_ev) {
+        os_eventq_put(os_evtask_eventq(&evt_test_evtasks[0]),
+                      &evt_test_chain_ev);
+    }
+
+    os_sem_release(&evt_test_sem);
+}
+
+static void
+evt_test_cf_func(void *arg)
+{
+    TEST_ASSERT(arg == &evt_test_cf);
+    evt_test_cf_fired++;
+    os_sem_release(&evt_test_sem);
+}
+
+/*
+ * Waits for the pool to handle 'cnt' events.  The pool runs below us, so
+ * it gets the CPU while we wait.
+ */
+static void
+evt_test_wait(int cnt)
+{
+    os_error_t err;
+
+    while (cnt-- > 0) {
+        err = os_sem_pend(&evt_test_sem, EVT_TEST_TIMEOUT);
+        TEST_ASSERT_FATAL(err == OS_OK);
+    }
+}
+
+static void
+evt_test_ctrl_handler(void *arg)
+{
+    struct os_evtask et;
+    os_error_t err;
+    int i;
+
+    /* Let the pool handle the events queued before the OS started. */
+    evt_test_wait(4);
+
+    /* Urgent first. */
+    TEST_ASSERT_FATAL(evt_test_log_len == 4);
+    TEST_ASSERT(evt_test_log[0] == 0);
+    TEST_ASSERT(evt_test_log[1] == 1);
+    /* Work handed to event task 0 runs before event task 2. */
+    TEST_ASSERT(evt_test_log[2] == 0);
+    TEST_ASSERT(evt_test_log[3] == 2);
+    TEST_ASSERT(evt_test_evtasks[0].et_runs == 2);
+    TEST_ASSERT(evt_test_evtasks[1].et_runs == 1);
+    TEST_ASSERT(evt_test_evtasks[2].et_runs == 1);
+
+    /* We outrank the pool, so these all queue up before it runs. */
+    evt_test_log_len = 0;
+    for (i = EVT_TEST_NUM_EVTASKS - 1; i >= 0; i--) {
+        os_eventq_put(os_evtask_eventq(&evt_test_evtasks[i]),
+                      &evt_test_evs[i]);
+    }
+    evt_test_wait(4);
+    TEST_ASSERT(evt_test_log_len == 4);
+    TEST_ASSERT(evt_test_log[0] == 0 && evt_test_log[3] == 2,
+                "log: %d %d %d %d", evt_test_log[0], evt_test_log[1],
+                evt_test_log[2], evt_test_log[3]);
+
+    /* A callout can target an event task. */
+    os_callout_func_init(&evt_test_cf,
+                         os_evtask_eventq(&evt_test_evtasks[2]),
+                         evt_test_cf_func, &evt_test_cf);
+    os_callout_reset(&evt_test_cf.cf_c, 2);
+    evt_test_wait(1);
+    TEST_ASSERT(evt_test_cf_fired == 1);
+
+    /* Error cases */
+    err = os_evtask_init(&et, &evt_test_pool, "et", evt_test_handler, NULL,
+                         1);
+    TEST_ASSERT(err == OS_EINVAL);
+    err = os_evtask_init(&et, &evt_test_pool, "et", evt_test_handler, NULL,
+                         OS_EVPOOL_MAX_EVTASKS);
+    TEST_ASSERT(err == OS_EINVAL);
+    err = os_evtask_init(&et, &evt_test_pool, "et", NULL, NULL, 5);
+    TEST_ASSERT(err == OS_INVALID_PARM);
+
+    /* A removed event task is not run any more.  Event task 0 still is;
+     * once it has run, the pool would go on to event task 2 while we wait
+     * for a release that should not come.
+     */
+    os_evtask_remove(&evt_test_evtasks[2]);
+    evt_test_log_len = 0;
+    os_eventq_put(os_evtask_eventq(&evt_test_evtasks[2]), &evt_test_evs[2]);
+    os_eventq_put(os_evtask_eventq(&evt_test_evtasks[0]), &evt_test_evs[0]);
+    evt_test_wait(1);
+    TEST_ASSERT(os_sem_pend(&evt_test_sem, 2) == OS_TIMEOUT);
+    TEST_ASSERT(evt_test_log_len == 1);
+    TEST_ASSERT(evt_test_log[0] == 0);
+    TEST_ASSERT(evt_test_pool.ep_evtasks[2] == NULL);
+
+    os_test_restart();
+}
+
+/**
+ * Event tasks share their pool's stack, run urgent first and can be fed
+ * by other event tasks and by callouts.
+ */
+TEST_CASE(os_evtask_test_basic)
+{
+    os_error_t err;
+    int i;
+
+    os_init();
+
+    evt_test_log_len = 0;
+    evt_test_cf_fired = 0;
+    memset(evt_test_evs, 0, sizeof(evt_test_evs));
+    memset(&evt_test_chain_ev, 0, sizeof(evt_test_chain_ev));
+    os_sem_init(&evt_test_sem, 0);
+
+    err = os_evpool_init(&evt_test_pool, "evt_pool", EVT_TEST_POOL_PRIO,
+                         evt_test_pool_stack,
+                         OS_STACK_ALIGN(EVT_TEST_STACK_SIZE));
+    TEST_ASSERT_FATAL(err == OS_OK);
+
+    for (i = 0; i < EVT_TEST_NUM_EVTASKS; i++) {
+        err = os_evtask_init(&evt_test_evtasks[i], &evt_test_pool, "evt",
+                             evt_test_handler, NULL, i);
+        TEST_ASSERT_FATAL(err == OS_OK);
+    }
+
+    /* Queue in reverse order of urgency. */
+    for (i = EVT_TEST_NUM_EVTASKS - 1; i >= 0; i--) {
+        os_eventq_put(os_evtask_eventq(&evt_test_evtasks[i]),
+                      &evt_test_evs[i]);
+    }
+
+    os_task_init(&evt_test_ctrl_task, "evt_ctrl", evt_test_ctrl_handler,
+                 NULL, EVT_TEST_CTRL_PRIO, OS_WAIT_FOREVER,
+                 evt_test_ctrl_stack, OS_STACK_ALIGN(EVT_TEST_STACK_SIZE));
+
+    os_start();
+}
+
+TEST_SUITE(os_evtask_test_suite)
+{
+    os_evtask_test_basic();
+}
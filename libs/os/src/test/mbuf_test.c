@@ -22,6 +22,9 @@
 #include "os_test_priv.h"
 
 #include <string.h>
+#ifdef ARCH_sim
+#include <sys/time.h>
+#endif
 
 /* 
  * NOTE: currently, the buffer size cannot be changed as some tests are
@@ -32,6 +35,9 @@
 
 #define MBUF_TEST_DATA_LEN          (1024)
 
+/* Passes over a chain timed by the benchmark */
+#define MBUF_TEST_BENCH_ROUNDS      (2000)
+
 static os_membuf_t os_mbuf_membuf[OS_MEMPOOL_SIZE(MBUF_TEST_POOL_BUF_SIZE,
         MBUF_TEST_POOL_BUF_COUNT)];
 
@@ -64,6 +70,7 @@ os_mbuf_test_misc_assert_sane(struct os_mbuf *om, void *data,
 {
     uint8_t *data_min;
     uint8_t *data_max;
+    struct os_mbuf_ext *ext;
     int totlen;
     int i;
 
@@ -80,8 +87,15 @@ os_mbuf_test_misc_assert_sane(struct os_mbuf *om, void *data,
             TEST_ASSERT(om->om_pkthdr_len == pkthdr_len);
         }
 
-        data_min = om->om_databuf + om->om_pkthdr_len;
-        data_max = om->om_databuf + om->om_omp->omp_databuf_len - om->om_len;
+        if (OS_MBUF_IS_EXT(om)) {
+            ext = OS_MBUF_EXT(om);
+            data_min = ext->ome_buf;
+            data_max = ext->ome_buf + ext->ome_len - om->om_len;
+        } else {
+            data_min = om->om_databuf + om->om_pkthdr_len;
+            data_max = om->om_databuf + om->om_omp->omp_databuf_len -
+                       om->om_len;
+        }
         TEST_ASSERT(om->om_data >= data_min && om->om_data <= data_max);
 
         if (data != NULL) {
@@ -184,6 +198,313 @@ TEST_CASE(os_mbuf_test_dup)
     TEST_ASSERT_FATAL(rc == 0, "Cannot free mbuf chain %d", rc);
 }
 
+static int os_mbuf_test_ext_frees;
+
+static void
+os_mbuf_test_ext_free(struct os_mbuf_ext *ext)
+{
+    TEST_ASSERT(ext->ome_arg == os_mbuf_test_data);
+    os_mbuf_test_ext_frees++;
+}
+
+TEST_CASE(os_mbuf_test_ext)
+{
+    struct os_mbuf_ext ext;
+    struct os_mbuf *om;
+    struct os_mbuf *dup;
+    struct os_mbuf *cur;
+    uint8_t buf[MBUF_TEST_DATA_LEN];
+    int rc;
+
+    os_mbuf_test_setup();
+    os_mbuf_test_ext_frees = 0;
+
+    os_mbuf_ext_init(&ext, os_mbuf_test_data, sizeof os_mbuf_test_data,
+                     os_mbuf_test_ext_free, os_mbuf_test_data);
+
+    /*** Out of range regions are rejected. */
+    om = os_mbuf_get_ext(&os_mbuf_pool, &ext, 1000, 100);
+    TEST_ASSERT(om == NULL);
+
+    om = os_mbuf_get_pkthdr(&os_mbuf_pool, 0);
+    TEST_ASSERT_FATAL(om != NULL);
+    rc = os_mbuf_append_ext(om, &ext, 0, sizeof os_mbuf_test_data + 1);
+    TEST_ASSERT(rc == OS_EINVAL);
+    TEST_ASSERT(ext.ome_refcnt == 0);
+
+    /*** Copied header followed by external data. */
+    rc = os_mbuf_append(om, os_mbuf_test_data, 10);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = os_mbuf_append_ext(om, &ext, 10, 1000);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(ext.ome_refcnt == 1);
+
+    cur = SLIST_NEXT(om, om_next);
+    TEST_ASSERT_FATAL(cur != NULL);
+    TEST_ASSERT(OS_MBUF_IS_EXT(cur));
+    TEST_ASSERT(cur->om_data == os_mbuf_test_data + 10);
+    TEST_ASSERT(OS_MBUF_LEADINGSPACE(cur) == 0);
+    TEST_ASSERT(OS_MBUF_TRAILINGSPACE(cur) == 0);
+    os_mbuf_test_misc_assert_sane(om, os_mbuf_test_data, 10, 1010,
+                                  sizeof (struct os_mbuf_pkthdr));
+
+    /*** Appending after external data goes into a new buffer. */
+    rc = os_mbuf_append(om, os_mbuf_test_data + 1010, 14);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(SLIST_NEXT(cur, om_next) != NULL);
+    TEST_ASSERT(!OS_MBUF_IS_EXT(SLIST_NEXT(cur, om_next)));
+    os_mbuf_test_misc_assert_sane(om, os_mbuf_test_data, 10, 1024,
+                                  sizeof (struct os_mbuf_pkthdr));
+
+    /*** External data is read-only. */
+    rc = os_mbuf_copyinto(om, 5, buf, 10);
+    TEST_ASSERT(rc != 0);
+
+    /*** A duplicate shares the external data. */
+    dup = os_mbuf_dup(om);
+    TEST_ASSERT_FATAL(dup != NULL);
+    TEST_ASSERT(ext.ome_refcnt == 2);
+    TEST_ASSERT(SLIST_NEXT(dup, om_next)->om_data == cur->om_data);
+    os_mbuf_test_misc_assert_sane(dup, os_mbuf_test_data, 10, 1024,
+                                  sizeof (struct os_mbuf_pkthdr));
+
+    /*** Trimming only moves the window into the storage. */
+    os_mbuf_adj(dup, 20);
+    rc = os_mbuf_copydata(dup, 0, 1004, buf);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(memcmp(buf, os_mbuf_test_data + 20, 1004) == 0);
+
+    /*** Pulling up copies out of external storage. */
+    dup = os_mbuf_pullup(dup, 30);
+    TEST_ASSERT_FATAL(dup != NULL);
+    TEST_ASSERT(!OS_MBUF_IS_EXT(dup));
+    TEST_ASSERT(memcmp(dup->om_data, os_mbuf_test_data + 20, 30) == 0);
+    TEST_ASSERT(ext.ome_refcnt == 2);
+
+    /*** The storage is released with the last reference. */
+    rc = os_mbuf_free_chain(om);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(ext.ome_refcnt == 1);
+    TEST_ASSERT(os_mbuf_test_ext_frees == 0);
+
+    rc = os_mbuf_free_chain(dup);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(ext.ome_refcnt == 0);
+    TEST_ASSERT(os_mbuf_test_ext_frees == 1);
+
+    /*** A failed append leaves the chain and the storage untouched. */
+    om = os_mbuf_get(&os_mbuf_pool, 0);
+    TEST_ASSERT_FATAL(om != NULL);
+    while ((cur = os_mbuf_get(&os_mbuf_pool, 0)) != NULL) {
+        os_mbuf_concat(om, cur);
+    }
+    rc = os_mbuf_append_ext(om, &ext, 0, 100);
+    TEST_ASSERT(rc == OS_ENOMEM);
+    TEST_ASSERT(ext.ome_refcnt == 0);
+    TEST_ASSERT(os_mbuf_test_ext_frees == 1);
+
+    os_mbuf_free_chain(om);
+}
+
+/* Builds a packet of the test data, in buffers of 'seg' bytes. */
+static struct os_mbuf *
+os_mbuf_test_chain(int len, int seg)
+{
+    struct os_mbuf *om;
+    struct os_mbuf *om2;
+    int off;
+    int rc;
+
+    om = os_mbuf_get_pkthdr(&os_mbuf_pool, 0);
+    TEST_ASSERT_FATAL(om != NULL);
+
+    for (off = 0; off < len; off += seg) {
+        om2 = os_mbuf_get(&os_mbuf_pool, 0);
+        TEST_ASSERT_FATAL(om2 != NULL);
+        rc = os_mbuf_append(om2, os_mbuf_test_data + off, min(seg, len - off));
+        TEST_ASSERT_FATAL(rc == 0);
+        os_mbuf_concat(om, om2);
+    }
+
+    return (om);
+}
+
+TEST_CASE(os_mbuf_test_iter)
+{
+    struct os_mbuf_iov iov[8];
+    struct os_mbuf_iter it;
+    struct os_mbuf *om;
+    uint8_t buf[8];
+    uint16_t len;
+    uint16_t u16;
+    uint32_t u32;
+    uint8_t *u8p;
+    uint8_t u8;
+    int rc;
+    int i;
+
+    os_mbuf_test_setup();
+
+    /* Header buffer stays empty; data in buffers of 5 bytes. */
+    om = os_mbuf_test_chain(32, 5);
+
+    /*** Byte by byte, across buffer boundaries. */
+    rc = os_mbuf_iter_init(&it, om, 0);
+    TEST_ASSERT_FATAL(rc == 0);
+    for (i = 0; i < 32; i++) {
+        rc = os_mbuf_iter_read_u8(&it, &u8);
+        TEST_ASSERT_FATAL(rc == 0);
+        TEST_ASSERT(u8 == os_mbuf_test_data[i]);
+    }
+    TEST_ASSERT(os_mbuf_iter_read_u8(&it, &u8) == -1);
+    TEST_ASSERT(os_mbuf_iter_peek(&it, &len) == NULL);
+
+    /*** Contiguous values are returned in place. */
+    rc = os_mbuf_iter_init(&it, om, 5);
+    TEST_ASSERT_FATAL(rc == 0);
+    u8p = os_mbuf_iter_peek(&it, &len);
+    TEST_ASSERT(u8p != NULL && len == 5);
+    TEST_ASSERT(os_mbuf_iter_get(&it, 4, buf) == u8p);
+
+    /*** Values that straddle are copied. */
+    u8p = os_mbuf_iter_get(&it, 3, buf);
+    TEST_ASSERT(u8p == buf);
+    TEST_ASSERT(memcmp(buf, os_mbuf_test_data + 9, 3) == 0);
+
+    rc = os_mbuf_iter_init(&it, om, 4);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = os_mbuf_iter_read_le16(&it, &u16);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(u16 == (os_mbuf_test_data[4] | (os_mbuf_test_data[5] << 8)));
+
+    rc = os_mbuf_iter_read_le32(&it, &u32);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(u32 == (os_mbuf_test_data[6] | (os_mbuf_test_data[7] << 8) |
+                        (os_mbuf_test_data[8] << 16) |
+                        ((uint32_t)os_mbuf_test_data[9] << 24)));
+
+    /*** Reading past the end fails and leaves the cursor alone. */
+    rc = os_mbuf_iter_init(&it, om, 30);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(os_mbuf_iter_get(&it, 3, buf) == NULL);
+    TEST_ASSERT(os_mbuf_iter_read_le16(&it, &u16) == 0);
+    TEST_ASSERT(os_mbuf_iter_advance(&it, 1) == -1);
+
+    rc = os_mbuf_iter_init(&it, om, 32);
+    TEST_ASSERT(rc == 0);
+    rc = os_mbuf_iter_init(&it, om, 33);
+    TEST_ASSERT(rc == -1);
+
+    rc = os_mbuf_iter_init(&it, om, 2);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(os_mbuf_iter_advance(&it, 20) == 0);
+    rc = os_mbuf_iter_read(&it, buf, 8);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(memcmp(buf, os_mbuf_test_data + 22, 8) == 0);
+
+    /*** Segment list. */
+    rc = os_mbuf_iov_get(om, 3, 20, iov, 8);
+    TEST_ASSERT_FATAL(rc == 5);
+    TEST_ASSERT(iov[0].omv_len == 2);
+    TEST_ASSERT(memcmp(iov[0].omv_base, os_mbuf_test_data + 3, 2) == 0);
+    for (i = 1; i < 4; i++) {
+        TEST_ASSERT(iov[i].omv_len == 5);
+    }
+    TEST_ASSERT(iov[4].omv_len == 3);
+    TEST_ASSERT(memcmp(iov[4].omv_base, os_mbuf_test_data + 20, 3) == 0);
+
+    rc = os_mbuf_iov_get(om, 3, 20, iov, 4);
+    TEST_ASSERT(rc == -1);
+    rc = os_mbuf_iov_get(om, 3, 30, iov, 8);
+    TEST_ASSERT(rc == -1);
+
+    os_mbuf_free_chain(om);
+}
+
+/**
+ * Reads a packet the way parsers did before the iterator existed, with
+ * os_mbuf_copydata() at increasing offsets, and then with a cursor.
+ */
+TEST_CASE(os_mbuf_test_bench)
+{
+#ifdef ARCH_sim
+    struct timeval start;
+    struct timeval end;
+    struct timeval diff;
+#endif
+    struct os_mbuf_iter it;
+    struct os_mbuf *om;
+    unsigned long usecs[4];
+    uint32_t sum[4];
+    uint8_t buf[2];
+    uint16_t u16;
+    uint8_t u8;
+    int round;
+    int i;
+
+    memset(usecs, 0, sizeof usecs);
+    memset(sum, 0, sizeof sum);
+
+    os_mbuf_test_setup();
+    om = os_mbuf_test_chain(MBUF_TEST_DATA_LEN, 200);
+
+#ifdef ARCH_sim
+#define MBUF_TEST_BENCH(__i, __body) do {                               \
+    gettimeofday(&start, NULL);                                         \
+    for (round = 0; round < MBUF_TEST_BENCH_ROUNDS; round++) {          \
+        __body                                                          \
+    }                                                                   \
+    gettimeofday(&end, NULL);                                           \
+    timersub(&end, &start, &diff);                                      \
+    usecs[(__i)] = diff.tv_sec * 1000000 + diff.tv_usec;                \
+} while (0)
+#else
+#define MBUF_TEST_BENCH(__i, __body) do {                               \
+    for (round = 0; round < MBUF_TEST_BENCH_ROUNDS; round++) {          \
+        __body                                                          \
+    }                                                                   \
+} while (0)
+#endif
+
+    /* Bytes. */
+    MBUF_TEST_BENCH(0,
+        for (i = 0; i < MBUF_TEST_DATA_LEN; i++) {
+            os_mbuf_copydata(om, i, 1, &u8);
+            sum[0] += u8;
+        }
+    );
+    MBUF_TEST_BENCH(1,
+        os_mbuf_iter_init(&it, om, 0);
+        while (os_mbuf_iter_read_u8(&it, &u8) == 0) {
+            sum[1] += u8;
+        }
+    );
+
+    /* 16-bit fields; one in every 200 straddles. */
+    MBUF_TEST_BENCH(2,
+        for (i = 1; i < MBUF_TEST_DATA_LEN - 1; i += 2) {
+            os_mbuf_copydata(om, i, 2, buf);
+            sum[2] += buf[0] | (buf[1] << 8);
+        }
+    );
+    MBUF_TEST_BENCH(3,
+        os_mbuf_iter_init(&it, om, 1);
+        while (os_mbuf_iter_read_le16(&it, &u16) == 0) {
+            sum[3] += u16;
+        }
+    );
+
+    TEST_ASSERT(sum[0] == sum[1]);
+    TEST_ASSERT(sum[2] == sum[3]);
+
+    os_mbuf_free_chain(om);
+
+    TEST_PASS("%d passes over %d bytes: bytes copydata %lu usec, iter %lu "
+              "usec; le16 copydata %lu usec, iter %lu usec",
+              MBUF_TEST_BENCH_ROUNDS, MBUF_TEST_DATA_LEN,
+              usecs[0], usecs[1], usecs[2], usecs[3]);
+}
+
 TEST_CASE(os_mbuf_test_append)
 {
     struct os_mbuf *om;
@@ -408,6 +729,311 @@ TEST_CASE(os_mbuf_test_adj)
     os_mbuf_test_misc_assert_sane(om, NULL, 0, 0, 18);
 }
 
+#define MBUF_TEST_SMALL_BUF_SIZE    (64)
+#define MBUF_TEST_SMALL_BUF_COUNT   (32)
+#define MBUF_TEST_LARGE_BUF_SIZE    (512)
+#define MBUF_TEST_LARGE_BUF_COUNT   (4)
+
+static os_membuf_t os_mbuf_small_membuf[
+    OS_MEMPOOL_SIZE(MBUF_TEST_SMALL_BUF_SIZE, MBUF_TEST_SMALL_BUF_COUNT)];
+static os_membuf_t os_mbuf_large_membuf[
+    OS_MEMPOOL_SIZE(MBUF_TEST_LARGE_BUF_SIZE, MBUF_TEST_LARGE_BUF_COUNT)];
+
+static struct os_mbuf_pool os_mbuf_small_pool;
+static struct os_mempool os_mbuf_small_mempool;
+static struct os_mbuf_pool os_mbuf_large_pool;
+static struct os_mempool os_mbuf_large_mempool;
+
+/* Registers three size classes with msys, largest first. */
+static void
+os_mbuf_test_msys_setup(void)
+{
+    int rc;
+
+    os_mbuf_test_setup();
+
+    rc = os_mempool_init(&os_mbuf_small_mempool, MBUF_TEST_SMALL_BUF_COUNT,
+            MBUF_TEST_SMALL_BUF_SIZE, os_mbuf_small_membuf, "mbuf_small");
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = os_mbuf_pool_init(&os_mbuf_small_pool, &os_mbuf_small_mempool,
+            MBUF_TEST_SMALL_BUF_SIZE, MBUF_TEST_SMALL_BUF_COUNT);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = os_mempool_init(&os_mbuf_large_mempool, MBUF_TEST_LARGE_BUF_COUNT,
+            MBUF_TEST_LARGE_BUF_SIZE, os_mbuf_large_membuf, "mbuf_large");
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = os_mbuf_pool_init(&os_mbuf_large_pool, &os_mbuf_large_mempool,
+            MBUF_TEST_LARGE_BUF_SIZE, MBUF_TEST_LARGE_BUF_COUNT);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    os_msys_reset();
+    os_msys_register(&os_mbuf_large_pool);
+    os_msys_register(&os_mbuf_pool);
+    os_msys_register(&os_mbuf_small_pool);
+}
+
+static int
+os_mbuf_test_chain_len(struct os_mbuf *om)
+{
+    int n;
+
+    for (n = 0; om != NULL; n++) {
+        om = SLIST_NEXT(om, om_next);
+    }
+    return (n);
+}
+
+/**
+ * msys picks the smallest class that fits, falls back to larger classes
+ * when one runs out, and counts what it did per class.
+ */
+TEST_CASE(os_mbuf_test_msys)
+{
+    struct os_mbuf *oms[MBUF_TEST_SMALL_BUF_COUNT];
+    struct os_mbuf *om;
+    struct os_mbuf *big;
+    uint16_t small_len;
+    int i;
+
+    os_mbuf_test_msys_setup();
+    small_len = os_mbuf_small_pool.omp_databuf_len;
+
+    /* Pools are sorted by block size, whatever the registration order. */
+    TEST_ASSERT(os_msys_pool_get_next(NULL) == &os_mbuf_small_pool);
+    TEST_ASSERT(os_msys_pool_get_next(&os_mbuf_small_pool) == &os_mbuf_pool);
+    TEST_ASSERT(os_msys_pool_get_next(&os_mbuf_pool) == &os_mbuf_large_pool);
+    TEST_ASSERT(os_msys_pool_get_next(&os_mbuf_large_pool) == NULL);
+
+    /* Best fit. */
+    om = os_msys_get(small_len, 0);
+    TEST_ASSERT_FATAL(om != NULL);
+    TEST_ASSERT(om->om_omp == &os_mbuf_small_pool);
+    os_mbuf_free_chain(om);
+
+    om = os_msys_get(small_len + 1, 0);
+    TEST_ASSERT_FATAL(om != NULL);
+    TEST_ASSERT(om->om_omp == &os_mbuf_pool);
+    os_mbuf_free_chain(om);
+
+    /* The packet header counts towards the size. */
+    om = os_msys_get_pkthdr(small_len, 0);
+    TEST_ASSERT_FATAL(om != NULL);
+    TEST_ASSERT(om->om_omp == &os_mbuf_pool);
+    os_mbuf_free_chain(om);
+
+    /* Larger than any class: the largest one, counted as too big. */
+    big = os_msys_get(MBUF_TEST_LARGE_BUF_SIZE, 0);
+    TEST_ASSERT_FATAL(big != NULL);
+    TEST_ASSERT(big->om_omp == &os_mbuf_large_pool);
+    TEST_ASSERT(os_mbuf_large_pool.omp_msys_nbig == 1);
+
+    /* An exhausted class falls back to the next one up. */
+    for (i = 0; i < MBUF_TEST_SMALL_BUF_COUNT; i++) {
+        oms[i] = os_msys_get(1, 0);
+        TEST_ASSERT_FATAL(oms[i] != NULL);
+        TEST_ASSERT(oms[i]->om_omp == &os_mbuf_small_pool);
+    }
+    om = os_msys_get(1, 0);
+    TEST_ASSERT_FATAL(om != NULL);
+    TEST_ASSERT(om->om_omp == &os_mbuf_pool);
+
+    TEST_ASSERT(os_mbuf_small_pool.omp_msys_nget ==
+                MBUF_TEST_SMALL_BUF_COUNT + 1);
+    TEST_ASSERT(os_mbuf_small_pool.omp_msys_nmiss == 1);
+    TEST_ASSERT(os_mbuf_small_pool.omp_msys_nfallback == 0);
+    TEST_ASSERT(os_mbuf_pool.omp_msys_nget == 3);
+    TEST_ASSERT(os_mbuf_pool.omp_msys_nfallback == 1);
+    TEST_ASSERT(os_mbuf_pool.omp_msys_nmiss == 0);
+    TEST_ASSERT(os_mbuf_large_pool.omp_msys_nget == 1);
+
+    os_mbuf_free_chain(om);
+    os_mbuf_free_chain(big);
+    for (i = 0; i < MBUF_TEST_SMALL_BUF_COUNT; i++) {
+        os_mbuf_free_chain(oms[i]);
+    }
+
+    /* With every class exhausted the allocation fails. */
+    for (i = 0; i < MBUF_TEST_LARGE_BUF_COUNT; i++) {
+        oms[i] = os_msys_get(MBUF_TEST_LARGE_BUF_SIZE, 0);
+        TEST_ASSERT_FATAL(oms[i] != NULL);
+    }
+    om = os_msys_get(MBUF_TEST_LARGE_BUF_SIZE, 0);
+    TEST_ASSERT(om == NULL);
+    TEST_ASSERT(os_mbuf_large_pool.omp_msys_nmiss == 1);
+    for (i = 0; i < MBUF_TEST_LARGE_BUF_COUNT; i++) {
+        os_mbuf_free_chain(oms[i]);
+    }
+
+    os_msys_reset();
+}
+
+/**
+ * A chain of small blocks packs into the fewest blocks msys can hold it in.
+ */
+TEST_CASE(os_mbuf_test_msys_pack)
+{
+    struct os_mbuf *packed;
+    struct os_mbuf *om;
+    uint16_t large_len;
+    int hdr_len;
+    int len;
+    int rc;
+
+    os_mbuf_test_msys_setup();
+    large_len = os_mbuf_large_pool.omp_databuf_len;
+
+    /* Spill just past one large block, with a user header. */
+    hdr_len = sizeof(struct os_mbuf_pkthdr) + 4;
+    len = large_len - hdr_len + 8;
+    TEST_ASSERT_FATAL(len <= MBUF_TEST_DATA_LEN);
+
+    om = os_mbuf_get_pkthdr(&os_mbuf_small_pool, 4);
+    TEST_ASSERT_FATAL(om != NULL);
+    memcpy(OS_MBUF_USRHDR(om), "hdr!", 4);
+    rc = os_mbuf_append(om, os_mbuf_test_data, len);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(os_mbuf_test_chain_len(om) > 2);
+
+    packed = os_msys_pack(om);
+    TEST_ASSERT_FATAL(packed != om);
+    os_mbuf_test_misc_assert_sane(packed, os_mbuf_test_data,
+                                  large_len - hdr_len, len, hdr_len);
+    TEST_ASSERT(memcmp(OS_MBUF_USRHDR(packed), "hdr!", 4) == 0);
+    TEST_ASSERT(os_mbuf_test_chain_len(packed) == 2);
+    TEST_ASSERT(packed->om_omp == &os_mbuf_large_pool);
+    TEST_ASSERT(SLIST_NEXT(packed, om_next)->om_omp == &os_mbuf_small_pool);
+    TEST_ASSERT(os_mbuf_small_mempool.mp_num_free ==
+                MBUF_TEST_SMALL_BUF_COUNT - 1);
+
+    /* Already as short as it gets. */
+    om = os_msys_pack(packed);
+    TEST_ASSERT(om == packed);
+    os_mbuf_free_chain(om);
+
+    /* Out of the classes that could hold it, the chain is left alone. */
+    om = os_mbuf_get(&os_mbuf_small_pool, 0);
+    TEST_ASSERT_FATAL(om != NULL);
+    rc = os_mbuf_append(om, os_mbuf_test_data, 200);
+    TEST_ASSERT_FATAL(rc == 0);
+    while (os_memblock_get(&os_mbuf_mempool) != NULL) {
+    }
+    while (os_memblock_get(&os_mbuf_large_mempool) != NULL) {
+    }
+    TEST_ASSERT(os_msys_pack(om) == om);
+    os_mbuf_test_misc_assert_sane(om, os_mbuf_test_data,
+                                  os_mbuf_small_pool.omp_databuf_len, 200, 0);
+    os_mbuf_free_chain(om);
+
+    os_msys_reset();
+}
+
+static int os_mbuf_test_wm_calls;
+static int os_mbuf_test_wm_throttle;
+
+static void
+os_mbuf_test_wm_cb(struct os_mqueue *mq, int throttle, void *arg)
+{
+    TEST_ASSERT(arg == &os_mbuf_test_wm_calls);
+    os_mbuf_test_wm_calls++;
+    os_mbuf_test_wm_throttle = throttle;
+}
+
+/**
+ * Packets come off a mbuf queue in batches, in order, and the queue calls
+ * its watermark callback and keeps its statistics.
+ */
+TEST_CASE(os_mbuf_test_mqueue)
+{
+    struct os_mqueue_batch batch;
+    struct os_mbuf *oms[6];
+    struct os_mqueue mq;
+    struct os_eventq evq;
+    struct os_mbuf *om;
+    int rc;
+    int i;
+
+    os_mbuf_test_setup();
+    os_eventq_init(&evq);
+    os_mqueue_init(&mq, NULL);
+
+    rc = os_mqueue_set_watermarks(&mq, 2, 2, os_mbuf_test_wm_cb, NULL);
+    TEST_ASSERT(rc == OS_EINVAL);
+    rc = os_mqueue_set_watermarks(&mq, 4, 1, os_mbuf_test_wm_cb,
+                                  &os_mbuf_test_wm_calls);
+    TEST_ASSERT_FATAL(rc == 0);
+    os_mbuf_test_wm_calls = 0;
+
+    /* Empty queue. */
+    TEST_ASSERT(os_mqueue_get_batch(&mq, &batch, 0) == 0);
+    TEST_ASSERT(os_mqueue_batch_next(&batch) == NULL);
+
+    for (i = 0; i < 6; i++) {
+        oms[i] = os_mbuf_get_pkthdr(&os_mbuf_pool, 0);
+        TEST_ASSERT_FATAL(oms[i] != NULL);
+        rc = os_mqueue_put(&mq, &evq, oms[i]);
+        TEST_ASSERT_FATAL(rc == 0);
+        TEST_ASSERT(os_mbuf_test_wm_calls == (i >= 3));
+    }
+    TEST_ASSERT(os_mbuf_test_wm_throttle == 1);
+    TEST_ASSERT(mq.mq_len == 6);
+    TEST_ASSERT(mq.mq_max_len == 6);
+    TEST_ASSERT(mq.mq_num_puts == 6);
+    TEST_ASSERT(STAILQ_FIRST(&evq.evq_list) == &mq.mq_ev);
+
+    /* Pretend the first packet has been waiting for three ticks. */
+#ifdef OS_MQUEUE_PKT_WAIT
+    OS_MBUF_PKTHDR(oms[0])->omp_enq_time = os_time_get() - 3;
+#else
+    mq.mq_busy_since = os_time_get() - 3;
+#endif
+
+    /* A bounded batch takes the oldest packets. */
+    TEST_ASSERT(os_mqueue_get_batch(&mq, &batch, 2) == 2);
+    TEST_ASSERT(os_mqueue_batch_next(&batch) == oms[0]);
+    TEST_ASSERT(os_mqueue_batch_next(&batch) == oms[1]);
+    TEST_ASSERT(os_mqueue_batch_next(&batch) == NULL);
+    TEST_ASSERT(mq.mq_len == 4);
+    TEST_ASSERT(mq.mq_max_wait == 3);
+    TEST_ASSERT(os_mbuf_test_wm_calls == 1);
+
+#ifdef OS_MQUEUE_PKT_WAIT
+    /* Each packet's own wait counts, not how long the queue has been
+     * non-empty.
+     */
+    OS_MBUF_PKTHDR(oms[2])->omp_enq_time = os_time_get() - 1;
+#endif
+    om = os_mqueue_get(&mq);
+    TEST_ASSERT(om == oms[2]);
+    TEST_ASSERT(mq.mq_max_wait == 3);
+
+    /* Down to the low watermark. */
+    TEST_ASSERT(os_mqueue_get_batch(&mq, &batch, 2) == 2);
+    TEST_ASSERT(os_mbuf_test_wm_calls == 2);
+    TEST_ASSERT(os_mbuf_test_wm_throttle == 0);
+    TEST_ASSERT(os_mqueue_batch_next(&batch) == oms[3]);
+    TEST_ASSERT(os_mqueue_batch_next(&batch) == oms[4]);
+
+    /* The queue keeps working after a batch has emptied it. */
+    rc = os_mqueue_put(&mq, NULL, oms[3]);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(os_mqueue_get_batch(&mq, &batch, 0) == 2);
+    TEST_ASSERT(os_mqueue_batch_next(&batch) == oms[5]);
+    TEST_ASSERT(os_mqueue_batch_next(&batch) == oms[3]);
+    TEST_ASSERT(os_mqueue_batch_next(&batch) == NULL);
+    TEST_ASSERT(mq.mq_len == 0);
+    TEST_ASSERT(STAILQ_EMPTY(&mq.mq_head));
+    TEST_ASSERT(mq.mq_num_puts == 7);
+
+    rc = os_mqueue_put(&mq, NULL, oms[0]);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(os_mqueue_get(&mq) == oms[0]);
+    TEST_ASSERT(os_mqueue_get(&mq) == NULL);
+
+    for (i = 0; i < 6; i++) {
+        os_mbuf_free_chain(oms[i]);
+    }
+}
+
 TEST_SUITE(os_mbuf_test_suite)
 {
     os_mbuf_test_alloc();
@@ -417,4 +1043,10 @@ TEST_SUITE(os_mbuf_test_suite)
     os_mbuf_test_extend();
     os_mbuf_test_adj();
     os_mbuf_test_get_pkthdr();
+    os_mbuf_test_ext();
+    os_mbuf_test_iter();
+    os_mbuf_test_bench();
+    os_mbuf_test_msys();
+    os_mbuf_test_msys_pack();
+    os_mbuf_test_mqueue();
 }
@@ -46,6 +46,37 @@ void *block_array[MEMPOOL_TEST_MAX_BLOCKS];
 
 int verbose = 0;
 
+#ifdef ARCH_sim
+#define MEMPOOL_TEST_STACK_SIZE     1024
+#else
+#define MEMPOOL_TEST_STACK_SIZE     256
+#endif
+
+/* Pool the stress test tasks allocate from, and how long they run */
+#define MEMPOOL_STRESS_BLOCKS       (32)
+#define MEMPOOL_STRESS_BLOCK_SIZE   (16)
+#define MEMPOOL_STRESS_TICKS        (200)
+/* Most blocks a stress task holds at once */
+#define MEMPOOL_STRESS_HOLD         (8)
+
+#define MEMPOOL_STRESS_CTRL_PRIO    (1)
+#define MEMPOOL_STRESS_HI_PRIO      (2)
+#define MEMPOOL_STRESS_LO_PRIO      (3)
+
+struct os_mempool mempool_stress_pool;
+os_membuf_t mempool_stress_membuf[OS_MEMPOOL_SIZE(MEMPOOL_STRESS_BLOCKS,
+                                                  MEMPOOL_STRESS_BLOCK_SIZE)];
+
+struct os_task mempool_stress_ctrl_task;
+os_stack_t mempool_stress_ctrl_stack[OS_STACK_ALIGN(MEMPOOL_TEST_STACK_SIZE)];
+
+struct os_task mempool_stress_tasks[2];
+os_stack_t mempool_stress_stacks[2][OS_STACK_ALIGN(MEMPOOL_TEST_STACK_SIZE)];
+
+static volatile int mempool_stress_stop;
+static volatile int mempool_stress_idle[2];
+static volatile uint32_t mempool_stress_allocs[2];
+
 static int
 mempool_test_get_pool_size(int num_blocks, int block_size)
 {
@@ -209,6 +240,339 @@ mempool_test(int num_blocks, int block_size)
     TEST_ASSERT(rc == OS_INVALID_PARM, "No error freeing bad block address");
 }
 
+/**
+ * Batch gets and puts: short batches when the pool runs out, and nothing
+ * freed when one of the blocks does not belong to the pool.
+ */
+TEST_CASE(os_mempool_test_batch)
+{
+    void *blocks[NUM_MEM_BLOCKS + 1];
+    int cnt;
+    int rc;
+    int i;
+    int j;
+
+    rc = os_mempool_init(&g_TstMempool, NUM_MEM_BLOCKS, MEM_BLOCK_SIZE,
+                         &TstMembuf[0], "TestMemPool");
+    TEST_ASSERT_FATAL(rc == 0);
+
+    cnt = os_memblock_get_n(&g_TstMempool, blocks, 4);
+    TEST_ASSERT(cnt == 4);
+    TEST_ASSERT(g_TstMempool.mp_num_free == NUM_MEM_BLOCKS - 4);
+
+    cnt = os_memblock_get_n(&g_TstMempool, blocks + 4, NUM_MEM_BLOCKS);
+    TEST_ASSERT(cnt == NUM_MEM_BLOCKS - 4);
+    TEST_ASSERT(g_TstMempool.mp_num_free == 0);
+
+    TEST_ASSERT(os_memblock_get_n(&g_TstMempool, blocks, 1) == 0);
+    TEST_ASSERT(os_memblock_get_n(NULL, blocks, 1) == 0);
+    TEST_ASSERT(os_memblock_get_n(&g_TstMempool, blocks, 0) == 0);
+
+    /* Every block was handed out exactly once. */
+    for (i = 0; i < NUM_MEM_BLOCKS; i++) {
+        for (j = i + 1; j < NUM_MEM_BLOCKS; j++) {
+            TEST_ASSERT(blocks[i] != blocks[j]);
+        }
+    }
+
+    /* One bad block and none of them goes back. */
+    blocks[NUM_MEM_BLOCKS] = (uint8_t *)blocks[0] + 1;
+    rc = os_memblock_put_n(&g_TstMempool, blocks, NUM_MEM_BLOCKS + 1);
+    TEST_ASSERT(rc == OS_INVALID_PARM);
+    TEST_ASSERT(g_TstMempool.mp_num_free == 0);
+
+    rc = os_memblock_put_n(&g_TstMempool, blocks, 3);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(g_TstMempool.mp_num_free == 3);
+    rc = os_memblock_put_n(&g_TstMempool, blocks + 3, NUM_MEM_BLOCKS - 3);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(g_TstMempool.mp_num_free == NUM_MEM_BLOCKS);
+
+    /* Single gets see the blocks put back in batches. */
+    for (i = 0; i < NUM_MEM_BLOCKS; i++) {
+        TEST_ASSERT(os_memblock_get(&g_TstMempool) != NULL);
+    }
+    TEST_ASSERT(os_memblock_get(&g_TstMempool) == NULL);
+}
+
+/**
+ * Magazines take blocks from the pool half a magazine at a time, and give
+ * them back the same way when full.
+ */
+TEST_CASE(os_mempool_test_mag)
+{
+    struct os_mempool_mag mag;
+    void *slots[4];
+    void *blocks[NUM_MEM_BLOCKS];
+    int rc;
+    int i;
+
+    rc = os_mempool_init(&g_TstMempool, NUM_MEM_BLOCKS, MEM_BLOCK_SIZE,
+                         &TstMembuf[0], "TestMemPool");
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = os_mempool_mag_init(&mag, &g_TstMempool, slots, 0);
+    TEST_ASSERT(rc == OS_INVALID_PARM);
+    rc = os_mempool_mag_init(&mag, &g_TstMempool, slots, 4);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /* The first get moves two blocks out of the pool. */
+    blocks[0] = os_mempool_mag_get(&mag);
+    TEST_ASSERT(blocks[0] != NULL);
+    TEST_ASSERT(g_TstMempool.mp_num_free == NUM_MEM_BLOCKS - 2);
+    TEST_ASSERT(mag.mm_count == 1);
+
+    blocks[1] = os_mempool_mag_get(&mag);
+    TEST_ASSERT(blocks[1] != NULL);
+    TEST_ASSERT(g_TstMempool.mp_num_free == NUM_MEM_BLOCKS - 2);
+
+    for (i = 2; i < NUM_MEM_BLOCKS; i++) {
+        blocks[i] = os_mempool_mag_get(&mag);
+        TEST_ASSERT(blocks[i] != NULL);
+    }
+    TEST_ASSERT(os_mempool_mag_get(&mag) == NULL);
+    TEST_ASSERT(g_TstMempool.mp_num_free == 0);
+
+    rc = os_mempool_mag_put(&mag, (uint8_t *)blocks[0] + 1);
+    TEST_ASSERT(rc == OS_INVALID_PARM);
+
+    /* The magazine never holds more than its size. */
+    for (i = 0; i < NUM_MEM_BLOCKS; i++) {
+        rc = os_mempool_mag_put(&mag, blocks[i]);
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(mag.mm_count <= 4);
+        TEST_ASSERT(g_TstMempool.mp_num_free + mag.mm_count == i + 1);
+    }
+    TEST_ASSERT(mag.mm_count > 0);
+
+    os_mempool_mag_flush(&mag);
+    TEST_ASSERT(mag.mm_count == 0);
+    TEST_ASSERT(g_TstMempool.mp_num_free == NUM_MEM_BLOCKS);
+}
+
+#ifdef OS_MEMPOOL_STATS
+/**
+ * The statistics follow gets, batch gets and failures, and are reported
+ * by os_mempool_info_get_next().
+ */
+TEST_CASE(os_mempool_test_stats)
+{
+    struct os_mempool_info omi;
+    struct os_mempool *mp;
+    void *blocks[NUM_MEM_BLOCKS];
+    int cnt;
+    int rc;
+
+    rc = os_mempool_init(&g_TstMempool, NUM_MEM_BLOCKS, MEM_BLOCK_SIZE,
+                         &TstMembuf[0], "TestMemPool");
+    TEST_ASSERT_FATAL(rc == 0);
+    os_mempool_set_owner(&g_TstMempool, "mempool_test");
+
+    TEST_ASSERT(g_TstMempool.mp_min_free == NUM_MEM_BLOCKS);
+    TEST_ASSERT(g_TstMempool.mp_num_allocs == 0);
+    TEST_ASSERT(g_TstMempool.mp_num_fails == 0);
+
+    blocks[0] = os_memblock_get(&g_TstMempool);
+    TEST_ASSERT_FATAL(blocks[0] != NULL);
+    cnt = os_memblock_get_n(&g_TstMempool, blocks + 1, 3);
+    TEST_ASSERT_FATAL(cnt == 3);
+    TEST_ASSERT(g_TstMempool.mp_min_free == NUM_MEM_BLOCKS - 4);
+    TEST_ASSERT(g_TstMempool.mp_num_allocs == 4);
+
+    /* Putting blocks back does not raise the watermark. */
+    rc = os_memblock_put_n(&g_TstMempool, blocks, 4);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(g_TstMempool.mp_min_free == NUM_MEM_BLOCKS - 4);
+
+    cnt = os_memblock_get_n(&g_TstMempool, blocks, NUM_MEM_BLOCKS);
+    TEST_ASSERT_FATAL(cnt == NUM_MEM_BLOCKS);
+    TEST_ASSERT(g_TstMempool.mp_min_free == 0);
+    TEST_ASSERT(g_TstMempool.mp_num_fails == 0);
+
+    TEST_ASSERT(os_memblock_get(&g_TstMempool) == NULL);
+    TEST_ASSERT(os_memblock_get_n(&g_TstMempool, blocks, 2) == 0);
+    TEST_ASSERT(g_TstMempool.mp_num_fails == 2);
+    TEST_ASSERT(g_TstMempool.mp_fail_caller != NULL);
+    TEST_ASSERT(g_TstMempool.mp_num_allocs == 4 + NUM_MEM_BLOCKS);
+
+    rc = os_memblock_put_n(&g_TstMempool, blocks, NUM_MEM_BLOCKS);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    mp = NULL;
+    while (1) {
+        mp = os_mempool_info_get_next(mp, &omi);
+        TEST_ASSERT_FATAL(mp != NULL);
+        if (mp == &g_TstMempool) {
+            break;
+        }
+    }
+    TEST_ASSERT(omi.omi_num_free == NUM_MEM_BLOCKS);
+    TEST_ASSERT(omi.omi_min_free == 0);
+    TEST_ASSERT(omi.omi_num_allocs == 4 + NUM_MEM_BLOCKS);
+    TEST_ASSERT(omi.omi_num_fails == 2);
+    TEST_ASSERT(strcmp(omi.omi_owner, "mempool_test") == 0);
+}
+#endif
+
+/*
+ * Allocates and frees blocks in single gets, batches and through a
+ * magazine, stamping every block it holds with its own id so a block that
+ * is handed out twice gets noticed.
+ */
+static void
+mempool_stress_task(void *arg)
+{
+    struct os_mempool_mag mag;
+    void *slots[4];
+    void *held[MEMPOOL_STRESS_HOLD];
+    uint32_t stamp;
+    int nheld;
+    int idx;
+    int rc;
+    int n;
+    int i;
+
+    idx = (intptr_t)arg;
+    stamp = 0xa5a50000 | idx;
+    rc = os_mempool_mag_init(&mag, &mempool_stress_pool, slots, 4);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    n = 1;
+    while (!mempool_stress_stop) {
+        switch (n % 3) {
+        case 0:
+            nheld = os_memblock_get_n(&mempool_stress_pool, held,
+                                      1 + n % MEMPOOL_STRESS_HOLD);
+            break;
+        case 1:
+            held[0] = os_memblock_get(&mempool_stress_pool);
+            nheld = held[0] != NULL;
+            break;
+        default:
+            for (nheld = 0; nheld < 3; nheld++) {
+                held[nheld] = os_mempool_mag_get(&mag);
+                if (held[nheld] == NULL) {
+                    break;
+                }
+            }
+            break;
+        }
+
+        for (i = 0; i < nheld; i++) {
+            memset(held[i], 0, MEMPOOL_STRESS_BLOCK_SIZE);
+            *(uint32_t *)held[i] = stamp;
+        }
+        for (i = 0; i < nheld; i++) {
+            TEST_ASSERT_FATAL(*(uint32_t *)held[i] == stamp,
+                              "block %p handed out twice", held[i]);
+        }
+        mempool_stress_allocs[idx] += nheld;
+
+        if (n % 3 == 2) {
+            for (i = 0; i < nheld; i++) {
+                rc = os_mempool_mag_put(&mag, held[i]);
+                TEST_ASSERT_FATAL(rc == 0);
+            }
+        } else if (nheld == 1) {
+            rc = os_memblock_put(&mempool_stress_pool, held[0]);
+            TEST_ASSERT_FATAL(rc == 0);
+        } else {
+            rc = os_memblock_put_n(&mempool_stress_pool, held, nheld);
+            TEST_ASSERT_FATAL(rc == 0);
+        }
+
+        /* The high priority task lets the low priority one run. */
+        if (idx == 0) {
+            os_time_delay(1);
+        }
+        n++;
+    }
+
+    os_mempool_mag_flush(&mag);
+    mempool_stress_idle[idx] = 1;
+    while (1) {
+        os_time_delay(OS_TICKS_PER_SEC);
+    }
+}
+
+static void
+mempool_stress_ctrl(void *arg)
+{
+    void *blocks[MEMPOOL_STRESS_BLOCKS + 1];
+    int cnt;
+    int i;
+    int j;
+
+    os_time_delay(MEMPOOL_STRESS_TICKS);
+    mempool_stress_stop = 1;
+    while (!mempool_stress_idle[0] || !mempool_stress_idle[1]) {
+        os_time_delay(1);
+    }
+
+    TEST_ASSERT(mempool_stress_allocs[0] > 0);
+    TEST_ASSERT(mempool_stress_allocs[1] > 0);
+
+    /* All blocks are back, and the free list holds each one once. */
+    TEST_ASSERT(mempool_stress_pool.mp_num_free == MEMPOOL_STRESS_BLOCKS);
+    cnt = os_memblock_get_n(&mempool_stress_pool, blocks,
+                            MEMPOOL_STRESS_BLOCKS + 1);
+    TEST_ASSERT(cnt == MEMPOOL_STRESS_BLOCKS);
+    for (i = 0; i < cnt; i++) {
+        for (j = i + 1; j < cnt; j++) {
+            TEST_ASSERT(blocks[i] != blocks[j]);
+        }
+    }
+
+    os_test_restart();
+}
+
+/**
+ * A high priority task that wakes up every tick and a low priority task
+ * that never sleeps share a small pool, so gets and puts keep getting
+ * preempted by each other (and run in parallel on SMP builds).
+ */
+TEST_CASE(os_mempool_test_stress)
+{
+    int rc;
+    int i;
+
+#ifdef OS_SMP
+    os_smp_set_ncpus(OS_CPUS);
+#endif
+    os_init();
+
+    rc = os_mempool_init(&mempool_stress_pool, MEMPOOL_STRESS_BLOCKS,
+                         MEMPOOL_STRESS_BLOCK_SIZE, mempool_stress_membuf,
+                         "StressPool");
+    TEST_ASSERT_FATAL(rc == 0);
+
+    mempool_stress_stop = 0;
+    for (i = 0; i < 2; i++) {
+        mempool_stress_idle[i] = 0;
+        mempool_stress_allocs[i] = 0;
+    }
+
+    os_task_init(&mempool_stress_ctrl_task, "mempool_ctrl",
+                 mempool_stress_ctrl, NULL, MEMPOOL_STRESS_CTRL_PRIO,
+                 OS_WAIT_FOREVER, mempool_stress_ctrl_stack,
+                 OS_STACK_ALIGN(MEMPOOL_TEST_STACK_SIZE));
+#ifdef OS_SMP
+    /* os_test_restart() has to run on the thread that started the OS. */
+    os_task_set_affinity(&mempool_stress_ctrl_task, 1 << 0);
+#endif
+
+    os_task_init(&mempool_stress_tasks[0], "mempool_hi", mempool_stress_task,
+                 (void *)0, MEMPOOL_STRESS_HI_PRIO, OS_WAIT_FOREVER,
+                 mempool_stress_stacks[0],
+                 OS_STACK_ALIGN(MEMPOOL_TEST_STACK_SIZE));
+    os_task_init(&mempool_stress_tasks[1], "mempool_lo", mempool_stress_task,
+                 (void *)1, MEMPOOL_STRESS_LO_PRIO, OS_WAIT_FOREVER,
+                 mempool_stress_stacks[1],
+                 OS_STACK_ALIGN(MEMPOOL_TEST_STACK_SIZE));
+
+    os_start();
+}
+
 /**
  * os mempool test 
  *  
@@ -224,4 +588,13 @@ TEST_CASE(os_mempool_test_case)
 TEST_SUITE(os_mempool_test_suite)
 {
     os_mempool_test_case();
+    os_mempool_test_batch();
+    os_mempool_test_mag();
+#ifdef OS_MEMPOOL_STATS
+    os_mempool_test_stats();
+#endif
+    os_mempool_test_stress();
+#ifdef OS_SMP
+    os_smp_set_ncpus(1);
+#endif
 }
@@ -25,6 +25,9 @@
 #include "os/os_test.h"
 #include "os/os_cfg.h"
 #include "os/os_mutex.h"
+#ifdef OS_MUTEX_STATS
+#include "hal/hal_cputime.h"
+#endif
 #include "os_test_priv.h"
 
 #ifdef ARCH_sim
@@ -45,6 +48,9 @@ os_stack_t stack16[OS_STACK_ALIGN(MUTEX_TEST_STACK_SIZE)];
 struct os_task task17;
 os_stack_t stack17[OS_STACK_ALIGN(MUTEX_TEST_STACK_SIZE)];
 
+struct os_task mutex_test_bench_task;
+os_stack_t mutex_test_bench_stack[OS_STACK_ALIGN(MUTEX_TEST_STACK_SIZE)];
+
 #define TASK14_PRIO (4)
 #define TASK15_PRIO (5)
 #define TASK16_PRIO (6)
@@ -59,6 +65,9 @@ struct os_mutex g_mutex2;
 
 static volatile int g_mutex_test;
 
+/* Uncontended pend/release pairs timed by the fast path benchmark */
+#define MUTEX_TEST_BENCH_ITERS  (100000)
+
 /**
  * mutex test basic 
  *  
@@ -138,6 +147,54 @@ mutex_test_basic_handler(void *arg)
     os_test_restart();
 }
 
+/**
+ * Times uncontended pend/release pairs, which take the lock-free path
+ * where the architecture has one.
+ */
+static void
+mutex_test_bench_handler(void *arg)
+{
+    struct os_mutex *mu;
+    unsigned long usecs;
+    int i;
+#ifdef ARCH_sim
+    struct timeval start;
+    struct timeval end;
+    struct timeval diff;
+#endif
+
+    mu = &g_mutex1;
+
+    /* Only the owner may release. */
+    TEST_ASSERT(os_mutex_release(mu) == OS_BAD_MUTEX);
+
+#ifdef ARCH_sim
+    gettimeofday(&start, NULL);
+#endif
+    for (i = 0; i < MUTEX_TEST_BENCH_ITERS; i++) {
+        os_mutex_pend(mu, 0);
+        os_mutex_release(mu);
+    }
+#ifdef ARCH_sim
+    gettimeofday(&end, NULL);
+    timersub(&end, &start, &diff);
+    usecs = diff.tv_sec * 1000000 + diff.tv_usec;
+#else
+    usecs = 0;
+#endif
+    TEST_ASSERT(mu->mu_owner == NULL && mu->mu_level == 0);
+
+#ifdef OS_MUTEX_STATS
+    TEST_ASSERT(mu->mu_num_pends == MUTEX_TEST_BENCH_ITERS);
+    TEST_ASSERT(mu->mu_num_waits == 0);
+#endif
+
+    os_test_stop();
+
+    TEST_PASS("%d uncontended pend/release pairs: %lu usec",
+              MUTEX_TEST_BENCH_ITERS, (unsigned long)usecs);
+}
+
 static void 
 mutex_test1_task14_handler(void *arg)
 {
@@ -330,6 +387,94 @@ task17_handler(void *arg)
     }
 }
 
+/*
+ * Chain test: task17 holds mutex2, task16 holds mutex1 and waits for
+ * mutex2, task15 waits for mutex1. task15's priority has to reach task17
+ * through task16.
+ */
+static void
+mutex_test_chain_task17_handler(void *arg)
+{
+    os_error_t err;
+
+    err = os_mutex_pend(&g_mutex2, 0);
+    TEST_ASSERT(err == OS_OK);
+
+    /* Let task16 and task15 line up behind us. */
+    os_time_delay(30);
+
+    TEST_ASSERT(task16.t_flags & OS_TASK_FLAG_MUTEX_WAIT);
+    TEST_ASSERT(task15.t_flags & OS_TASK_FLAG_MUTEX_WAIT);
+    TEST_ASSERT(task16.t_prio == TASK15_PRIO);
+    TEST_ASSERT(task17.t_prio == TASK15_PRIO,
+                "priority not inherited through the chain (prio=%u)",
+                task17.t_prio);
+
+    err = os_mutex_release(&g_mutex2);
+    TEST_ASSERT(err == OS_OK);
+    TEST_ASSERT(task17.t_prio == TASK17_PRIO);
+
+    /* task16 and then task15 get their mutexes and give them back. */
+    os_time_delay(30);
+
+    TEST_ASSERT(g_task16_val == 1 && g_task15_val == 1);
+    TEST_ASSERT(task16.t_prio == TASK16_PRIO);
+    TEST_ASSERT(g_mutex1.mu_owner == NULL && g_mutex2.mu_owner == NULL);
+    TEST_ASSERT(SLIST_EMPTY(&g_mutex1.mu_head));
+    TEST_ASSERT(SLIST_EMPTY(&g_mutex2.mu_head));
+
+#ifdef OS_MUTEX_STATS
+    TEST_ASSERT(g_mutex1.mu_num_pends == 2 && g_mutex1.mu_num_waits == 1);
+    TEST_ASSERT(g_mutex2.mu_num_pends == 2 && g_mutex2.mu_num_waits == 1);
+    TEST_ASSERT(g_mutex2.mu_max_hold > 0);
+    TEST_ASSERT(g_mutex2.mu_total_hold >= g_mutex2.mu_max_hold);
+#endif
+
+    os_test_restart();
+}
+
+static void
+mutex_test_chain_task16_handler(void *arg)
+{
+    os_error_t err;
+
+    os_time_delay(10);
+
+    err = os_mutex_pend(&g_mutex1, 0);
+    TEST_ASSERT(err == OS_OK);
+    TEST_ASSERT(task17.t_prio == TASK17_PRIO);
+
+    err = os_mutex_pend(&g_mutex2, OS_TIMEOUT_NEVER);
+    TEST_ASSERT(err == OS_OK);
+
+    g_task16_val = 1;
+    os_mutex_release(&g_mutex2);
+    os_mutex_release(&g_mutex1);
+
+    while (1) {
+        os_time_delay(10000);
+    }
+}
+
+static void
+mutex_test_chain_task15_handler(void *arg)
+{
+    os_error_t err;
+
+    os_time_delay(20);
+
+    err = os_mutex_pend(&g_mutex1, OS_TIMEOUT_NEVER);
+    TEST_ASSERT(err == OS_OK);
+    TEST_ASSERT(g_task16_val == 1);
+
+    g_task15_val = 1;
+    os_mutex_release(&g_mutex1);
+
+    while (1) {
+        os_time_delay(10000);
+    }
+}
+
 TEST_CASE(os_mutex_test_basic)
 {
     os_init();
@@ -343,6 +488,20 @@ TEST_CASE(os_mutex_test_basic)
     os_start();
 }
 
+TEST_CASE(os_mutex_test_bench)
+{
+    os_init();
+
+    os_mutex_init(&g_mutex1);
+
+    os_task_init(&mutex_test_bench_task, "mutex_bench",
+                 mutex_test_bench_handler, NULL, TASK14_PRIO,
+                 OS_WAIT_FOREVER, mutex_test_bench_stack,
+                 OS_STACK_ALIGN(MUTEX_TEST_STACK_SIZE));
+
+    os_start();
+}
+
 TEST_CASE(os_mutex_test_case_1)
 {
     int rc;
@@ -399,9 +558,43 @@ TEST_CASE(os_mutex_test_case_2)
     os_start();
 }
 
+TEST_CASE(os_mutex_test_chain)
+{
+#ifdef OS_MUTEX_STATS
+    int rc;
+#endif
+
+    os_init();
+#ifdef OS_MUTEX_STATS
+    rc = cputime_init(1000000);
+    TEST_ASSERT_FATAL(rc == 0);
+#endif
+
+    g_task15_val = 0;
+    g_task16_val = 0;
+    os_mutex_init(&g_mutex1);
+    os_mutex_init(&g_mutex2);
+
+    os_task_init(&task15, "task15", mutex_test_chain_task15_handler, NULL,
+                 TASK15_PRIO, OS_WAIT_FOREVER, stack15,
+                 OS_STACK_ALIGN(MUTEX_TEST_STACK_SIZE));
+
+    os_task_init(&task16, "task16", mutex_test_chain_task16_handler, NULL,
+                 TASK16_PRIO, OS_WAIT_FOREVER, stack16,
+                 OS_STACK_ALIGN(MUTEX_TEST_STACK_SIZE));
+
+    os_task_init(&task17, "task17", mutex_test_chain_task17_handler, NULL,
+                 TASK17_PRIO, OS_WAIT_FOREVER, stack17,
+                 OS_STACK_ALIGN(MUTEX_TEST_STACK_SIZE));
+
+    os_start();
+}
+
 TEST_SUITE(os_mutex_test_suite)
 {
     os_mutex_test_basic();
     os_mutex_test_case_1();
     os_mutex_test_case_2();
+    os_mutex_test_chain();
+    os_mutex_test_bench();
 }
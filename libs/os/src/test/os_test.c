@@ -20,16 +20,34 @@
 #include <assert.h>
 #include <stddef.h>
 #include "testutil/testutil.h"
+#include "os/os.h"
 #include "os/os_test.h"
 #include "os_test_priv.h"
 
 int
 os_test_all(void)
 {
+#ifdef OS_SMP
+    /* The single core suites rely on single core scheduling. */
+    os_smp_set_ncpus(1);
+#endif
+
     os_mempool_test_suite();
     os_mutex_test_suite();
     os_sem_test_suite();
+    os_evgroup_test_suite();
+    os_eventq_test_suite();
+    os_evtask_test_suite();
     os_mbuf_test_suite();
+    os_sched_test_suite();
+    os_callout_test_suite();
+    os_time_test_suite();
+#ifdef OS_TRACE
+    os_trace_test_suite();
+#endif
+#ifdef OS_SMP
+    os_smp_test_suite();
+#endif
 
     return tu_case_failed;
 }
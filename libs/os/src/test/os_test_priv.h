@@ -20,11 +20,24 @@
 #ifndef H_OS_TEST_PRIV_
 #define H_OS_TEST_PRIV_
 
+void os_test_stop(void);
 void os_test_restart(void);
 
 int os_mempool_test_suite(void);
 int os_mbuf_test_suite(void);
 int os_mutex_test_suite(void);
 int os_sem_test_suite(void);
+int os_evgroup_test_suite(void);
+int os_eventq_test_suite(void);
+int os_evtask_test_suite(void);
+int os_sched_test_suite(void);
+int os_callout_test_suite(void);
+int os_time_test_suite(void);
+#ifdef OS_SMP
+int os_smp_test_suite(void);
+#endif
+#ifdef OS_TRACE
+int os_trace_test_suite(void);
+#endif
 
 #endif
@@ -0,0 +1,449 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include <stdio.h>
+#include <string.h>
+#ifdef ARCH_sim
+#include <sys/time.h>
+#endif
+#include "testutil/testutil.h"
+#include "os/os.h"
+#ifdef OS_TASK_CPUTIME
+#include "hal/hal_cputime.h"
+#endif
+#include "os_test_priv.h"
+
+/*
+ * These tests never start the OS; they create tasks and move them between
+ * the run and sleep lists directly to check the ordering the scheduler
+ * maintains, and to time the list operations.
+ */
+#define SCHED_TEST_STACK_SIZE   128
+#define SCHED_TEST_MAX_TASKS    48
+
+/* Number of sleep/wakeup/resort rounds timed by the benchmark */
+#define SCHED_TEST_BENCH_ITERS  20000
+
+/* Context switch benchmark; runs the OS for this many ticks */
+#define SCHED_TEST_CTXSW_TICKS  (OS_TICKS_PER_SEC)
+#define SCHED_TEST_CTXSW_PRIO   (10)
+
+/* CPU time accounting test; the busy task spins this long every tick */
+#define SCHED_TEST_CPUTIME_TICKS    (OS_TICKS_PER_SEC / 2)
+#define SCHED_TEST_CPUTIME_SPIN     (300)
+
+#ifdef ARCH_sim
+#define SCHED_TEST_CTXSW_STACK_SIZE 1024
+#if defined(OS_SMP)
+#define SCHED_TEST_CTXSW_BACKEND    "SMP backend"
+#elif defined(OS_SIM_UCONTEXT)
+#define SCHED_TEST_CTXSW_BACKEND    "ucontext backend"
+#else
+#define SCHED_TEST_CTXSW_BACKEND    "signal backend"
+#endif
+#else
+#define SCHED_TEST_CTXSW_STACK_SIZE 256
+#define SCHED_TEST_CTXSW_BACKEND    "native"
+#endif
+
+struct os_task sched_test_tasks[SCHED_TEST_MAX_TASKS];
+os_stack_t sched_test_stacks[SCHED_TEST_MAX_TASKS]
+                            [OS_STACK_ALIGN(SCHED_TEST_STACK_SIZE)];
+
+struct os_task sched_test_ping_task;
+struct os_task sched_test_pong_task;
+os_stack_t sched_test_ping_stack[OS_STACK_ALIGN(SCHED_TEST_CTXSW_STACK_SIZE)];
+os_stack_t sched_test_pong_stack[OS_STACK_ALIGN(SCHED_TEST_CTXSW_STACK_SIZE)];
+
+static struct os_sem sched_test_ping_sem;
+static struct os_sem sched_test_pong_sem;
+static uint32_t sched_test_ctxsw_rounds;
+static volatile uint32_t sched_test_cputime_rounds;
+
+static void
+sched_test_task_handler(void *arg)
+{
+    /* Never runs */
+}
+
+static struct os_task *
+sched_test_task_init(int idx, uint8_t prio)
+{
+    struct os_task *t;
+    int rc;
+
+    t = &sched_test_tasks[idx];
+    rc = os_task_init(t, "sched_test", sched_test_task_handler, NULL, prio,
+                      OS_WAIT_FOREVER, sched_test_stacks[idx],
+                      OS_STACK_ALIGN(SCHED_TEST_STACK_SIZE));
+    TEST_ASSERT_FATAL(rc == 0);
+
+    return t;
+}
+
+/**
+ * Returns the head of the run list, past the default event task pool's
+ * worker, which os_init() creates at OS_EVPOOL_PRIO.
+ */
+static struct os_task *
+sched_test_first(void)
+{
+    struct os_task *t;
+
+    t = os_sched_next_task();
+#ifdef OS_EVPOOL
+    if (t == &g_os_evpool.ep_task) {
+        t = TAILQ_NEXT(t, t_os_list);
+    }
+#endif
+    return t;
+}
+
+/**
+ * Verifies that the run list holds exactly the tasks in 'expected', in
+ * order, followed by the sanity and idle tasks.
+ */
+static void
+sched_test_verify(struct os_task **expected, int num_expected)
+{
+    struct os_task *t;
+    int i;
+
+    t = sched_test_first();
+    for (i = 0; i < num_expected; i++) {
+        TEST_ASSERT_FATAL(t == expected[i],
+                          "run list entry %d: task=%p expected=%p",
+                          i, t, expected[i]);
+        t = TAILQ_NEXT(t, t_os_list);
+    }
+
+    TEST_ASSERT_FATAL(t != NULL && t->t_prio == OS_SANITY_PRIO);
+    t = TAILQ_NEXT(t, t_os_list);
+    TEST_ASSERT_FATAL(t != NULL && t->t_prio == OS_IDLE_PRIO);
+    TEST_ASSERT_FATAL(TAILQ_NEXT(t, t_os_list) == NULL);
+}
+
+static void
+sched_test_requeue(struct os_task *t)
+{
+    os_sr_t sr;
+
+    OS_ENTER_CRITICAL(sr);
+    os_sched_sleep(t, OS_TIMEOUT_NEVER);
+    os_sched_wakeup(t);
+    OS_EXIT_CRITICAL(sr);
+}
+
+static void
+sched_test_set_prio(struct os_task *t, uint8_t prio)
+{
+    os_sr_t sr;
+
+    OS_ENTER_CRITICAL(sr);
+    t->t_prio = prio;
+    os_sched_resort(t);
+    OS_EXIT_CRITICAL(sr);
+}
+
+TEST_CASE(os_sched_test_order)
+{
+    struct os_task *t[6];
+
+    os_init();
+
+    /* Tasks of equal priority are queued in creation order. */
+    t[0] = sched_test_task_init(0, 5);
+    t[1] = sched_test_task_init(1, 3);
+    t[2] = sched_test_task_init(2, 5);
+    t[3] = sched_test_task_init(3, 70);
+    t[4] = sched_test_task_init(4, 3);
+    t[5] = sched_test_task_init(5, 5);
+    sched_test_verify((struct os_task *[]) {
+        t[1], t[4], t[0], t[2], t[5], t[3] }, 6);
+
+    /* A task that wakes up goes behind its peers. */
+    sched_test_requeue(t[0]);
+    sched_test_verify((struct os_task *[]) {
+        t[1], t[4], t[2], t[5], t[0], t[3] }, 6);
+
+    sched_test_requeue(t[1]);
+    sched_test_verify((struct os_task *[]) {
+        t[4], t[1], t[2], t[5], t[0], t[3] }, 6);
+
+    /* A boosted task goes behind the tasks at its new priority. */
+    sched_test_set_prio(t[3], 3);
+    sched_test_verify((struct os_task *[]) {
+        t[4], t[1], t[3], t[2], t[5], t[0] }, 6);
+
+    /* Boost above everybody else. */
+    sched_test_set_prio(t[0], 0);
+    sched_test_verify((struct os_task *[]) {
+        t[0], t[4], t[1], t[3], t[2], t[5] }, 6);
+
+    /* Restore priorities; a lone task at a priority must still be found. */
+    sched_test_set_prio(t[3], 70);
+    sched_test_set_prio(t[0], 5);
+    sched_test_verify((struct os_task *[]) {
+        t[4], t[1], t[2], t[5], t[0], t[3] }, 6);
+
+    /* Emptying a priority level must not disturb its neighbours. */
+    sched_test_set_prio(t[4], 33);
+    sched_test_set_prio(t[1], 33);
+    sched_test_verify((struct os_task *[]) {
+        t[2], t[5], t[0], t[4], t[1], t[3] }, 6);
+}
+
+/**
+ * Moves a set of tasks spread over many priorities between the run and
+ * sleep lists, and through priority changes, as a mutex-heavy workload
+ * would. Build with and without OS_SCHED_BITMAP to compare.
+ */
+TEST_CASE(os_sched_test_bench)
+{
+    struct os_task *t;
+#ifdef ARCH_sim
+    struct timeval start;
+    struct timeval end;
+    struct timeval diff;
+#endif
+    uint32_t usecs;
+    uint8_t prio;
+    os_sr_t sr;
+    int i;
+
+    os_init();
+
+    for (i = 0; i < SCHED_TEST_MAX_TASKS; i++) {
+        sched_test_task_init(i, 10 + (i * 7) % 200);
+    }
+
+#ifdef ARCH_sim
+    gettimeofday(&start, NULL);
+#endif
+    for (i = 0; i < SCHED_TEST_BENCH_ITERS; i++) {
+        t = &sched_test_tasks[(i * 13) % SCHED_TEST_MAX_TASKS];
+        prio = t->t_prio;
+
+        OS_ENTER_CRITICAL(sr);
+        os_sched_sleep(t, OS_TIMEOUT_NEVER);
+        os_sched_wakeup(t);
+
+        t->t_prio = 1;
+        os_sched_resort(t);
+        t->t_prio = prio;
+        os_sched_resort(t);
+        OS_EXIT_CRITICAL(sr);
+    }
+#ifdef ARCH_sim
+    gettimeofday(&end, NULL);
+    timersub(&end, &start, &diff);
+    usecs = diff.tv_sec * 1000000 + diff.tv_usec;
+#else
+    usecs = 0;
+#endif
+
+    /* The bookkeeping must have survived all of that. */
+    t = sched_test_first();
+    TEST_ASSERT(t->t_prio == 10);
+    while (TAILQ_NEXT(t, t_os_list) != NULL) {
+        TEST_ASSERT_FATAL(t->t_prio <= TAILQ_NEXT(t, t_os_list)->t_prio);
+        t = TAILQ_NEXT(t, t_os_list);
+    }
+
+    TEST_PASS("%d tasks, %d sleep/wakeup/resort rounds: %lu usec "
+#ifdef OS_SCHED_BITMAP
+              "(bitmap run queue)",
+#else
+              "(sorted run list)",
+#endif
+              SCHED_TEST_MAX_TASKS, SCHED_TEST_BENCH_ITERS,
+              (unsigned long)usecs);
+}
+
+static void
+sched_test_ping_handler(void *arg)
+{
+    os_time_t start;
+    uint32_t rounds;
+
+    /* Let the tick interrupt settle before timing anything. */
+    os_time_delay(1);
+    start = os_time_get();
+    while (os_time_get() - start < SCHED_TEST_CTXSW_TICKS) {
+        os_sem_release(&sched_test_pong_sem);
+        os_sem_pend(&sched_test_ping_sem, OS_TIMEOUT_NEVER);
+    }
+    rounds = sched_test_ctxsw_rounds;
+
+    os_test_stop();
+
+    TEST_ASSERT(rounds > 0);
+    TEST_PASS("%lu context switches/sec (" SCHED_TEST_CTXSW_BACKEND ")",
+              (unsigned long)rounds * 2 * OS_TICKS_PER_SEC /
+              SCHED_TEST_CTXSW_TICKS);
+}
+
+static void
+sched_test_pong_handler(void *arg)
+{
+    while (1) {
+        os_sem_pend(&sched_test_pong_sem, OS_TIMEOUT_NEVER);
+        sched_test_ctxsw_rounds++;
+        os_sem_release(&sched_test_ping_sem);
+    }
+}
+
+/**
+ * Two tasks hand a pair of semaphores back and forth, so that every
+ * release/pend pair is a context switch. Build the sim with and without
+ * OS_SIM_UCONTEXT to compare the arch backends.
+ */
+TEST_CASE(os_sched_test_ctxsw_bench)
+{
+    os_init();
+
+    sched_test_ctxsw_rounds = 0;
+    os_sem_init(&sched_test_ping_sem, 0);
+    os_sem_init(&sched_test_pong_sem, 0);
+
+    os_task_init(&sched_test_ping_task, "ping", sched_test_ping_handler, NULL,
+                 SCHED_TEST_CTXSW_PRIO, OS_WAIT_FOREVER, sched_test_ping_stack,
+                 OS_STACK_ALIGN(SCHED_TEST_CTXSW_STACK_SIZE));
+    os_task_init(&sched_test_pong_task, "pong", sched_test_pong_handler, NULL,
+                 SCHED_TEST_CTXSW_PRIO + 1, OS_WAIT_FOREVER,
+                 sched_test_pong_stack,
+                 OS_STACK_ALIGN(SCHED_TEST_CTXSW_STACK_SIZE));
+
+    os_start();
+}
+
+#ifdef OS_TASK_CPUTIME
+static void
+sched_test_cputime_ctrl(void *arg)
+{
+    struct os_task_info oti;
+    struct os_task *prev;
+    uint64_t elapsed;
+    uint64_t total;
+    uint64_t busy;
+    uint64_t isr;
+    uint32_t rounds;
+
+    os_time_delay(SCHED_TEST_CPUTIME_TICKS);
+
+    rounds = sched_test_cputime_rounds;
+    busy = 0;
+    total = 0;
+    prev = NULL;
+    while ((prev = os_task_info_get_next(prev, &oti)) != NULL) {
+        if (prev == &sched_test_pong_task) {
+            busy = oti.oti_cputime;
+        }
+        total += oti.oti_cputime;
+    }
+    isr = os_cputime_isr_usecs();
+    total += isr;
+    elapsed = cputime_ticks_to_usecs(cputime_get32());
+
+    os_test_stop();
+
+    TEST_ASSERT(rounds > 0);
+    /* Interrupts taken while spinning are not charged to the busy task. */
+    TEST_ASSERT(busy >= (uint64_t)rounds * SCHED_TEST_CPUTIME_SPIN / 2,
+                "busy task: %lluus for %lu rounds", (unsigned long long)busy,
+                (unsigned long)rounds);
+    /*
+     * Everything since the OS started is charged to someone, except what
+     * the running task used since it was last switched in.
+     */
+    TEST_ASSERT(total <= elapsed + 1000 && total >= elapsed / 2,
+                "charged %lluus of %lluus", (unsigned long long)total,
+                (unsigned long long)elapsed);
+    TEST_PASS("busy task %lluus, interrupts %lluus of %lluus",
+              (unsigned long long)busy, (unsigned long long)isr,
+              (unsigned long long)elapsed);
+}
+
+static void
+sched_test_cputime_busy(void *arg)
+{
+    while (1) {
+        cputime_delay_usecs(SCHED_TEST_CPUTIME_SPIN);
+        sched_test_cputime_rounds++;
+        os_time_delay(1);
+    }
+}
+
+/**
+ * A task that spins for a fixed time every tick is charged at least that
+ * much CPU time, and the time charged to all tasks and to interrupts adds
+ * up to the time the OS has been running.
+ */
+TEST_CASE(os_sched_test_cputime)
+{
+    int rc;
+
+    os_init();
+    rc = cputime_init(1000000);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    sched_test_cputime_rounds = 0;
+    os_task_init(&sched_test_ping_task, "cputime_ctrl",
+                 sched_test_cputime_ctrl, NULL, SCHED_TEST_CTXSW_PRIO,
+                 OS_WAIT_FOREVER, sched_test_ping_stack,
+                 OS_STACK_ALIGN(SCHED_TEST_CTXSW_STACK_SIZE));
+    os_task_init(&sched_test_pong_task, "cputime_busy",
+                 sched_test_cputime_busy, NULL, SCHED_TEST_CTXSW_PRIO + 1,
+                 OS_WAIT_FOREVER, sched_test_pong_stack,
+                 OS_STACK_ALIGN(SCHED_TEST_CTXSW_STACK_SIZE));
+
+    os_start();
+}
+
+/**
+ * CPU time converts exactly at rates that are not whole ticks per
+ * microsecond, and amounts beyond 32 bits of ticks do not overflow.
+ */
+TEST_CASE(os_sched_test_cputime_convert)
+{
+    int rc;
+
+    os_init();
+    rc = cputime_init(32768);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(os_cputime_to_usecs(32768) == 1000000);
+    TEST_ASSERT(os_cputime_to_usecs(1) == 30);
+    TEST_ASSERT(os_cputime_to_usecs(0x180000000ULL) == 196608000000ULL);
+
+    rc = cputime_init(1500000);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(os_cputime_to_usecs(3) == 2);
+    TEST_ASSERT(os_cputime_to_usecs(1500000ULL * 86400) == 86400000000ULL);
+}
+#endif
+
+TEST_SUITE(os_sched_test_suite)
+{
+    os_sched_test_order();
+    os_sched_test_bench();
+    os_sched_test_ctxsw_bench();
+#ifdef OS_TASK_CPUTIME
+    os_sched_test_cputime();
+    os_sched_test_cputime_convert();
+#endif
+}
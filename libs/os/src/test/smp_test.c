@@ -0,0 +1,237 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "testutil/testutil.h"
+#include "os/os.h"
+#include "os_test_priv.h"
+
+#ifdef OS_SMP
+
+#ifdef ARCH_sim
+#define SMP_TEST_STACK_SIZE     1024
+#else
+#define SMP_TEST_STACK_SIZE     256
+#endif
+
+#define SMP_TEST_CTRL_PRIO      (5)
+#define SMP_TEST_WORKER_PRIO    (10)
+
+/* How long the affinity test lets the workers run between checks */
+#define SMP_TEST_TICKS          (20)
+
+/* Scaling benchmark; measures for this many ticks */
+#define SMP_TEST_BENCH_TICKS    (OS_TICKS_PER_SEC / 2)
+/* Iterations of busy work per work unit */
+#define SMP_TEST_BENCH_SPINS    (1000)
+
+struct os_task smp_test_ctrl_task;
+os_stack_t smp_test_ctrl_stack[OS_STACK_ALIGN(SMP_TEST_STACK_SIZE)];
+
+struct os_task smp_test_workers[OS_CPUS];
+os_stack_t smp_test_worker_stacks[OS_CPUS]
+                                 [OS_STACK_ALIGN(SMP_TEST_STACK_SIZE)];
+
+static volatile uint32_t smp_test_counts[OS_CPUS];
+static volatile int smp_test_last_cpu[OS_CPUS];
+
+/* Number of cores the next run of the benchmark uses */
+static int smp_test_bench_ncpus;
+/* Work units per second, indexed by number of cores */
+static uint32_t smp_test_bench_rate[OS_CPUS + 1];
+
+static void
+smp_test_init_tasks(os_task_func_t ctrl, os_task_func_t worker, int pin)
+{
+    int rc;
+    int i;
+
+    os_task_init(&smp_test_ctrl_task, "smp_ctrl", ctrl, NULL,
+                 SMP_TEST_CTRL_PRIO, OS_WAIT_FOREVER, smp_test_ctrl_stack,
+                 OS_STACK_ALIGN(SMP_TEST_STACK_SIZE));
+
+    /* os_test_restart() has to run on the thread that started the OS. */
+    rc = os_task_set_affinity(&smp_test_ctrl_task, 1 << 0);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    for (i = 0; i < OS_CPUS; i++) {
+        smp_test_counts[i] = 0;
+        smp_test_last_cpu[i] = -1;
+        os_task_init(&smp_test_workers[i], "smp_worker", worker,
+                     (void *)(intptr_t)i, SMP_TEST_WORKER_PRIO,
+                     OS_WAIT_FOREVER, smp_test_worker_stacks[i],
+                     OS_STACK_ALIGN(SMP_TEST_STACK_SIZE));
+        if (pin) {
+            rc = os_task_set_affinity(&smp_test_workers[i], 1 << i);
+            TEST_ASSERT_FATAL(rc == 0);
+        }
+    }
+}
+
+static void
+smp_test_affinity_worker(void *arg)
+{
+    int idx;
+
+    idx = (intptr_t)arg;
+    while (1) {
+        smp_test_last_cpu[idx] = os_smp_cpu_id();
+        smp_test_counts[idx]++;
+        os_time_delay(1);
+    }
+}
+
+static void
+smp_test_affinity_ctrl(void *arg)
+{
+    uint32_t count;
+    int rc;
+    int i;
+
+    TEST_ASSERT(os_smp_cpu_id() == 0);
+
+    /* There has to be at least one core that is up in the mask. */
+    rc = os_task_set_affinity(&smp_test_workers[0], 0);
+    TEST_ASSERT(rc == OS_EINVAL);
+    rc = os_task_set_affinity(&smp_test_workers[0],
+                              (os_cpumask_t)~OS_CPU_MASK_ALL);
+    TEST_ASSERT(rc == OS_EINVAL);
+
+    /* Every core makes progress, each worker on the core it is pinned to. */
+    os_time_delay(SMP_TEST_TICKS);
+    for (i = 0; i < OS_CPUS; i++) {
+        TEST_ASSERT(smp_test_counts[i] > 0, "worker %d did not run", i);
+        TEST_ASSERT(smp_test_last_cpu[i] == i, "worker %d ran on core %d",
+                    i, smp_test_last_cpu[i]);
+    }
+
+    /* Move the last worker over to core 0. */
+    rc = os_task_set_affinity(&smp_test_workers[OS_CPUS - 1], 1 << 0);
+    TEST_ASSERT(rc == 0);
+    os_time_delay(SMP_TEST_TICKS);
+    count = smp_test_counts[OS_CPUS - 1];
+    os_time_delay(SMP_TEST_TICKS);
+    TEST_ASSERT(smp_test_counts[OS_CPUS - 1] != count);
+    TEST_ASSERT(smp_test_last_cpu[OS_CPUS - 1] == 0);
+
+    os_test_restart();
+}
+
+TEST_CASE(os_smp_test_affinity)
+{
+    os_smp_set_ncpus(OS_CPUS);
+    os_init();
+
+    smp_test_init_tasks(smp_test_affinity_ctrl, smp_test_affinity_worker, 1);
+
+    os_start();
+}
+
+static void
+smp_test_bench_worker(void *arg)
+{
+    volatile uint32_t x;
+    int idx;
+    int i;
+
+    idx = (intptr_t)arg;
+    x = idx;
+    while (1) {
+        for (i = 0; i < SMP_TEST_BENCH_SPINS; i++) {
+            x = x * 1103515245 + 12345;
+        }
+        smp_test_counts[idx]++;
+    }
+}
+
+static uint32_t
+smp_test_bench_total(void)
+{
+    uint32_t total;
+    int i;
+
+    total = 0;
+    for (i = 0; i < OS_CPUS; i++) {
+        total += smp_test_counts[i];
+    }
+    return (total);
+}
+
+static void
+smp_test_bench_ctrl(void *arg)
+{
+    uint32_t steals;
+    uint32_t start;
+    uint32_t rate;
+    uint32_t base;
+    int ncpus;
+    int i;
+
+    ncpus = os_smp_ncpus();
+
+    /* Let the workers spread out before measuring. */
+    os_time_delay(SMP_TEST_TICKS);
+    start = smp_test_bench_total();
+    os_time_delay(SMP_TEST_BENCH_TICKS);
+    rate = (smp_test_bench_total() - start) * OS_TICKS_PER_SEC /
+           SMP_TEST_BENCH_TICKS;
+
+    /* The workers were all queued on core 0 before the OS started. */
+    steals = 0;
+    for (i = 0; i < ncpus; i++) {
+        steals += os_smp_steals(i);
+    }
+    os_test_stop();
+
+    TEST_ASSERT(ncpus == 1 || steals > 0);
+    TEST_ASSERT(rate > 0);
+
+    smp_test_bench_rate[ncpus] = rate;
+    base = smp_test_bench_rate[1] != 0 ? smp_test_bench_rate[1] : 1;
+    TEST_PASS("%d core(s): %lu work units/sec, %lu.%02lux of 1 core",
+              ncpus, (unsigned long)rate, (unsigned long)(rate / base),
+              (unsigned long)((uint64_t)rate * 100 / base % 100));
+}
+
+/**
+ * OS_CPUS tasks that never block do a fixed amount of work per unit, on
+ * 'smp_test_bench_ncpus' cores. Run for 1 to OS_CPUS cores to see how the
+ * throughput scales; on the sim that depends on the number of host CPUs.
+ */
+TEST_CASE(os_smp_test_bench)
+{
+    os_smp_set_ncpus(smp_test_bench_ncpus);
+    os_init();
+
+    smp_test_init_tasks(smp_test_bench_ctrl, smp_test_bench_worker, 0);
+
+    os_start();
+}
+
+TEST_SUITE(os_smp_test_suite)
+{
+    os_smp_test_affinity();
+
+    for (smp_test_bench_ncpus = 1; smp_test_bench_ncpus <= OS_CPUS;
+         smp_test_bench_ncpus++) {
+        os_smp_test_bench();
+    }
+}
+
+#endif /* OS_SMP */
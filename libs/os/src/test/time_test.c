@@ -0,0 +1,192 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include <string.h>
+#include "testutil/testutil.h"
+#include "os/os.h"
+#include "os_test_priv.h"
+
+#ifdef OS_TIME_CPUTIME
+#include "hal/hal_cputime.h"
+#endif
+
+#ifdef ARCH_sim
+#define TIME_TEST_STACK_SIZE    1024
+#else
+#define TIME_TEST_STACK_SIZE    256
+#endif
+
+#define TIME_TEST_PRIO          (10)
+
+/* Reads of the monotonic clock checked for going backwards */
+#define TIME_TEST_READS         (10000)
+
+/* A 32.768 kHz cputime, and a busy wait shorter than an os tick with it */
+#define TIME_TEST_SLOW_FREQ     (32768)
+#define TIME_TEST_SLOW_WAIT     (200)
+
+struct os_task time_test_task;
+os_stack_t time_test_stack[OS_STACK_ALIGN(TIME_TEST_STACK_SIZE)];
+
+/**
+ * Tick and microsecond conversions are each other's inverse.
+ */
+TEST_CASE(os_time_test_convert)
+{
+    TEST_ASSERT(os_time_ticks_to_usecs(0) == 0);
+    TEST_ASSERT(os_time_ticks_to_usecs(OS_TICKS_PER_SEC) == 1000000);
+    TEST_ASSERT(os_time_usecs_to_ticks(1000000) == OS_TICKS_PER_SEC);
+    TEST_ASSERT(os_time_usecs_to_ticks(os_time_ticks_to_usecs(12345)) ==
+                12345);
+
+    /* Partial ticks round down. */
+    TEST_ASSERT(os_time_usecs_to_ticks(os_time_ticks_to_usecs(7) - 1) == 6);
+
+    /* Tick counts beyond 32 bits of microseconds. */
+    TEST_ASSERT(os_time_ticks_to_usecs(0xffffffff) ==
+                (uint64_t)0xffffffff * (1000000 / OS_TICKS_PER_SEC));
+}
+
+static void
+time_test_mono_handler(void *arg)
+{
+    struct os_timeval tv1;
+    struct os_timeval tv2;
+    uint64_t start;
+    uint64_t prev;
+    uint64_t now;
+    int i;
+
+    /* The clock never goes backwards. */
+    prev = os_time_mono_usecs();
+    for (i = 0; i < TIME_TEST_READS; i++) {
+        now = os_time_mono_usecs();
+        TEST_ASSERT_FATAL(now >= prev);
+        prev = now;
+    }
+    TEST_ASSERT(os_time_mono_nsecs() >= prev * 1000);
+
+    /* It keeps up with the os tick. */
+    start = os_time_mono_usecs();
+    os_time_delay(2);
+    now = os_time_mono_usecs();
+    TEST_ASSERT(now - start >= os_time_ticks_to_usecs(1));
+
+    /* The time of day moves with it. */
+    tv1.tv_sec = 1000;
+    tv1.tv_usec = 999999;
+    os_settimeofday(&tv1, NULL);
+    os_time_delay(2);
+    os_gettimeofday(&tv2, NULL);
+    os_timersub(&tv2, &tv1, &tv2);
+    TEST_ASSERT(tv2.tv_sec == 0);
+    TEST_ASSERT(tv2.tv_usec >= os_time_ticks_to_usecs(1));
+    TEST_ASSERT(os_get_uptime_usec() >= now);
+
+    os_test_restart();
+}
+
+/**
+ * The monotonic clock only moves forward, also across os ticks, and the
+ * time of day follows it.
+ */
+TEST_CASE(os_time_test_mono)
+{
+#ifdef OS_TIME_CPUTIME
+    int rc;
+#endif
+
+    os_init();
+#ifdef OS_TIME_CPUTIME
+    rc = cputime_init(1000000);
+    TEST_ASSERT_FATAL(rc == 0);
+#endif
+
+    os_task_init(&time_test_task, "time_test", time_test_mono_handler, NULL,
+                 TIME_TEST_PRIO, OS_WAIT_FOREVER, time_test_stack,
+                 OS_STACK_ALIGN(TIME_TEST_STACK_SIZE));
+
+    os_start();
+}
+
+#ifdef OS_TIME_CPUTIME
+static void
+time_test_mono_slow_handler(void *arg)
+{
+    uint64_t start;
+    uint64_t usecs;
+    uint32_t cstart;
+    uint32_t ticks;
+    int found;
+    int i;
+
+    /*
+     * A 32.768 kHz cputime still gives the clock sub-tick resolution: a
+     * short busy wait shows up as less than an os tick.
+     */
+    found = 0;
+    for (i = 0; i < 10 && !found; i++) {
+        start = os_time_mono_usecs();
+        cputime_delay_usecs(TIME_TEST_SLOW_WAIT);
+        usecs = os_time_mono_usecs() - start;
+        found = usecs >= TIME_TEST_SLOW_WAIT - cputime_ticks_to_usecs(1) &&
+                usecs < os_time_ticks_to_usecs(1) / 2;
+    }
+    TEST_ASSERT(found);
+
+    /* And it runs at the cputime's rate, which is not whole ticks per usec. */
+    start = os_time_mono_usecs();
+    cstart = cputime_get32();
+    os_time_delay(OS_TICKS_PER_SEC / 10);
+    usecs = os_time_mono_usecs() - start;
+    ticks = cputime_get32() - cstart;
+    TEST_ASSERT(usecs + os_time_ticks_to_usecs(1) >=
+                cputime_ticks_to_usecs(ticks));
+    TEST_ASSERT(usecs <= cputime_ticks_to_usecs(ticks) +
+                         os_time_ticks_to_usecs(1));
+
+    os_test_restart();
+}
+
+/**
+ * The monotonic clock follows a cputime slower than 1 MHz.
+ */
+TEST_CASE(os_time_test_mono_slow)
+{
+    int rc;
+
+    os_init();
+    rc = cputime_init(TIME_TEST_SLOW_FREQ);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    os_task_init(&time_test_task, "time_test", time_test_mono_slow_handler,
+                 NULL, TIME_TEST_PRIO, OS_WAIT_FOREVER, time_test_stack,
+                 OS_STACK_ALIGN(TIME_TEST_STACK_SIZE));
+
+    os_start();
+}
+#endif
+
+TEST_SUITE(os_time_test_suite)
+{
+    os_time_test_convert();
+    os_time_test_mono();
+#ifdef OS_TIME_CPUTIME
+    os_time_test_mono_slow();
+#endif
+}
@@ -0,0 +1,208 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "testutil/testutil.h"
+#include "os/os.h"
+#include "hal/hal_cputime.h"
+#include "os_test_priv.h"
+
+#ifdef OS_TRACE
+
+#ifdef ARCH_sim
+#define TRACE_TEST_STACK_SIZE   1024
+#else
+#define TRACE_TEST_STACK_SIZE   256
+#endif
+
+#define TRACE_TEST_PRIO         (10)
+
+/* Records timed by the overhead benchmark */
+#define TRACE_TEST_BENCH_RECS   (100000)
+
+struct os_task trace_test_task;
+os_stack_t trace_test_stack[OS_STACK_ALIGN(TRACE_TEST_STACK_SIZE)];
+
+static struct os_sem trace_test_sem;
+static struct os_eventq trace_test_evq;
+static struct os_event trace_test_ev;
+
+/* Collects the output of the Chrome trace export */
+static char trace_test_buf[32768];
+static int trace_test_len;
+
+static int
+trace_test_write(void *arg, const char *buf, int len)
+{
+    if (trace_test_len + len >= sizeof(trace_test_buf)) {
+        return (OS_ENOMEM);
+    }
+    memcpy(trace_test_buf + trace_test_len, buf, len);
+    trace_test_len += len;
+    trace_test_buf[trace_test_len] = '\0';
+
+    return (0);
+}
+
+/* Returns 1 if core 0 has a record of 'type' with argument 'arg'. */
+static int
+trace_test_find(uint8_t type, void *arg)
+{
+    struct os_trace_rec rec;
+    uint32_t seq;
+
+    seq = 0;
+    while (os_trace_read(0, &seq, &rec) == 0) {
+        if (rec.otr_type == type &&
+            (arg == NULL || rec.otr_arg == (uint32_t)(uintptr_t)arg)) {
+            return (1);
+        }
+    }
+    return (0);
+}
+
+/**
+ * Records appear in sequence, and once the ring has wrapped only the
+ * newest OS_TRACE_RING_SIZE of them are left.
+ */
+TEST_CASE(os_trace_test_ring)
+{
+    struct os_trace_rec rec;
+    uint32_t start;
+    uint32_t seq;
+    uint32_t i;
+    int rc;
+
+    os_init();
+
+    rc = os_trace_read(OS_CPUS, &seq, &rec);
+    TEST_ASSERT(rc == OS_EINVAL);
+
+    seq = 0;
+    rc = os_trace_read(0, &seq, &rec);
+    TEST_ASSERT(rc == OS_ENOENT);
+
+    for (i = 0; i < 3 * OS_TRACE_RING_SIZE; i++) {
+        os_trace_event(OS_TRACE_USER, i);
+    }
+
+    seq = 0;
+    for (i = 2 * OS_TRACE_RING_SIZE; i < 3 * OS_TRACE_RING_SIZE; i++) {
+        rc = os_trace_read(0, &seq, &rec);
+        TEST_ASSERT_FATAL(rc == 0);
+        TEST_ASSERT(seq == i + 1);
+        TEST_ASSERT(rec.otr_type == OS_TRACE_USER);
+        TEST_ASSERT(rec.otr_arg == i);
+        TEST_ASSERT(rec.otr_taskid == OS_TRACE_NO_TASK);
+    }
+    rc = os_trace_read(0, &seq, &rec);
+    TEST_ASSERT(rc == OS_ENOENT);
+
+    /* Nothing is recorded while tracing is off. */
+    os_trace_enable(0);
+    os_trace(OS_TRACE_USER, 0);
+    os_trace_enable(1);
+    rc = os_trace_read(0, &seq, &rec);
+    TEST_ASSERT(rc == OS_ENOENT);
+
+    /* Time the recording path. */
+    rc = cputime_init(1000000);
+    TEST_ASSERT_FATAL(rc == 0);
+    start = cputime_get32();
+    for (i = 0; i < TRACE_TEST_BENCH_RECS; i++) {
+        os_trace(OS_TRACE_USER, i);
+    }
+    i = cputime_ticks_to_usecs(cputime_get32() - start);
+
+    TEST_PASS("%d records: %lu usec, %lu ns per record",
+              TRACE_TEST_BENCH_RECS, (unsigned long)i,
+              (unsigned long)((uint64_t)i * 1000 / TRACE_TEST_BENCH_RECS));
+}
+
+static void
+trace_test_kernel_handler(void *arg)
+{
+    struct os_event *ev;
+    int rc;
+
+    os_sem_release(&trace_test_sem);
+    os_sem_pend(&trace_test_sem, OS_TIMEOUT_NEVER);
+    os_eventq_put(&trace_test_evq, &trace_test_ev);
+    ev = os_eventq_get(&trace_test_evq);
+    os_time_delay(2);
+
+    os_test_stop();
+
+    TEST_ASSERT(ev == &trace_test_ev);
+    TEST_ASSERT(trace_test_find(OS_TRACE_SEM_RELEASE, &trace_test_sem));
+    TEST_ASSERT(trace_test_find(OS_TRACE_SEM_PEND, &trace_test_sem));
+    TEST_ASSERT(trace_test_find(OS_TRACE_EVQ_PUT, &trace_test_evq));
+    TEST_ASSERT(trace_test_find(OS_TRACE_EVQ_GET, &trace_test_evq));
+    TEST_ASSERT(trace_test_find(OS_TRACE_CTX_SW, NULL));
+    TEST_ASSERT(trace_test_find(OS_TRACE_ISR_ENTER, NULL));
+    TEST_ASSERT(trace_test_find(OS_TRACE_ISR_EXIT, NULL));
+
+    trace_test_len = 0;
+    rc = os_trace_export_chrome(trace_test_write, NULL);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(strncmp(trace_test_buf, "{\"traceEvents\":[", 16) == 0);
+    TEST_ASSERT(strcmp(trace_test_buf + trace_test_len - 4, "\n]}\n") == 0);
+    TEST_ASSERT(strstr(trace_test_buf, "\"name\":\"trace_test\"") != NULL);
+    TEST_ASSERT(strstr(trace_test_buf, "\"sem_release\"") != NULL);
+    TEST_ASSERT(strstr(trace_test_buf, "\"ph\":\"B\"") != NULL);
+
+    /* A writer error stops the export. */
+    trace_test_len = sizeof(trace_test_buf);
+    rc = os_trace_export_chrome(trace_test_write, NULL);
+    TEST_ASSERT(rc == OS_ENOMEM);
+    TEST_ASSERT(g_os_trace_enabled);
+
+    TEST_PASS("%d bytes of Chrome trace", (int)strlen(trace_test_buf));
+}
+
+/**
+ * Kernel operations show up in the trace, and the trace exports as a
+ * Chrome trace.
+ */
+TEST_CASE(os_trace_test_kernel)
+{
+    int rc;
+
+    os_init();
+    rc = cputime_init(1000000);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    os_sem_init(&trace_test_sem, 0);
+    os_eventq_init(&trace_test_evq);
+    memset(&trace_test_ev, 0, sizeof(trace_test_ev));
+
+    os_task_init(&trace_test_task, "trace_test", trace_test_kernel_handler,
+                 NULL, TRACE_TEST_PRIO, OS_WAIT_FOREVER, trace_test_stack,
+                 OS_STACK_ALIGN(TRACE_TEST_STACK_SIZE));
+
+    os_start();
+}
+
+TEST_SUITE(os_trace_test_suite)
+{
+    os_trace_test_ring();
+    os_trace_test_kernel();
+}
+
+#endif /* OS_TRACE */
@@ -61,6 +61,16 @@ static struct shell_cmd g_shell_os_mpool_display_cmd = {
     .sc_cmd = "mempools",
     .sc_cmd_func = shell_os_mpool_display_cmd
 };
+static struct shell_cmd g_shell_os_msys_display_cmd = {
+    .sc_cmd = "msys",
+    .sc_cmd_func = shell_os_msys_display_cmd
+};
+#ifdef BASELIBC_PRESENT
+static struct shell_cmd g_shell_os_heap_display_cmd = {
+    .sc_cmd = "heap",
+    .sc_cmd_func = shell_os_heap_display_cmd
+};
+#endif
 static struct shell_cmd g_shell_os_date_cmd = {
     .sc_cmd = "date",
     .sc_cmd_func = shell_os_date_cmd
@@ -369,13 +379,15 @@ err:
 static void
 shell_nlip_mqueue_process(void)
 {
+    struct os_mqueue_batch batch;
     struct os_mbuf *m;
 
     /* Copy data out of the mbuf 12 bytes at a time and write it to
      * the console.
      */
+    os_mqueue_get_batch(&g_shell_nlip_mq, &batch, 0);
     while (1) {
-        m = os_mqueue_get(&g_shell_nlip_mq);
+        m = os_mqueue_batch_next(&batch);
         if (!m) {
             break;
         }
@@ -582,6 +594,18 @@ shell_task_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size,
         goto err;
     }
 
+    rc = shell_cmd_register(&g_shell_os_msys_display_cmd);
+    if (rc != 0) {
+        goto err;
+    }
+
+#ifdef BASELIBC_PRESENT
+    rc = shell_cmd_register(&g_shell_os_heap_display_cmd);
+    if (rc != 0) {
+        goto err;
+    }
+#endif
+
     rc = shell_cmd_register(&g_shell_os_date_cmd);
     if (rc != 0) {
         goto err;
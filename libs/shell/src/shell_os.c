@@ -27,6 +27,7 @@
 #include "shell_priv.h"
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include <util/datetime.h>
 
@@ -69,12 +70,22 @@ shell_os_tasks_display_cmd(int argc, char **argv)
                 (unsigned long)oti.oti_next_checkin, oti.oti_flags,
                 oti.oti_stksize, oti.oti_stkusage, (unsigned long)oti.oti_cswcnt,
                 (unsigned long)oti.oti_runtime);
+#ifdef OS_TASK_CPUTIME
+        console_printf("    cputime: %lluus\n",
+                (unsigned long long)oti.oti_cputime);
+#endif
 
     }
 
     if (name && !found) {
         console_printf("Couldn't find task with name %s\n", name);
     }
+#ifdef OS_TASK_CPUTIME
+    if (!name) {
+        console_printf("  interrupts (cputime: %lluus)\n",
+                (unsigned long long)os_cputime_isr_usecs());
+    }
+#endif
 
     return (0);
 }
@@ -113,6 +124,17 @@ shell_os_mpool_display_cmd(int argc, char **argv)
         console_printf("  %s (blksize: %d, nblocks: %d, nfree: %d)\n",
                 omi.omi_name, omi.omi_block_size, omi.omi_num_blocks,
                 omi.omi_num_free);
+#ifdef OS_MEMPOOL_STATS
+        console_printf("    owner: %s, minfree: %d, nalloc: %lu, "
+                "nfail: %lu", omi.omi_owner[0] ? omi.omi_owner : "-",
+                omi.omi_min_free, (unsigned long)omi.omi_num_allocs,
+                (unsigned long)omi.omi_num_fails);
+        if (omi.omi_num_fails != 0) {
+            console_printf(" (first at %lu, last by %p)",
+                    (unsigned long)omi.omi_first_fail, omi.omi_fail_caller);
+        }
+        console_printf("\n");
+#endif
     }
 
     if (name && !found) {
@@ -123,6 +145,49 @@ shell_os_mpool_display_cmd(int argc, char **argv)
     return (0);
 }
 
+int
+shell_os_msys_display_cmd(int argc, char **argv)
+{
+    struct os_mbuf_pool *omp;
+
+    console_printf("Msys pools: \n");
+    omp = NULL;
+    while (1) {
+        omp = os_msys_pool_get_next(omp);
+        if (omp == NULL) {
+            break;
+        }
+
+        console_printf("  %s (bufsize: %d, nbufs: %d, nfree: %d)\n",
+                omp->omp_pool->name, omp->omp_databuf_len,
+                omp->omp_mbuf_count, omp->omp_pool->mp_num_free);
+        console_printf("    nget: %lu, nfallback: %lu, nmiss: %lu, "
+                "nbig: %lu\n", (unsigned long)omp->omp_msys_nget,
+                (unsigned long)omp->omp_msys_nfallback,
+                (unsigned long)omp->omp_msys_nmiss,
+                (unsigned long)omp->omp_msys_nbig);
+    }
+
+    return (0);
+}
+
+#ifdef BASELIBC_PRESENT
+int
+shell_os_heap_display_cmd(int argc, char **argv)
+{
+    size_t free_bytes;
+    size_t largest_block;
+
+    get_malloc_memory_status(&free_bytes, &largest_block);
+    console_printf("Heap: \n");
+    console_printf("  free: %lu, largest: %lu, fragmentation: %u%%\n",
+            (unsigned long)free_bytes, (unsigned long)largest_block,
+            get_malloc_fragmentation());
+
+    return (0);
+}
+#endif
+
 int
 shell_os_date_cmd(int argc, char **argv)
 {
@@ -22,6 +22,10 @@
 
 int shell_os_tasks_display_cmd(int argc, char **argv);
 int shell_os_mpool_display_cmd(int argc, char **argv);
+int shell_os_msys_display_cmd(int argc, char **argv);
+#ifdef BASELIBC_PRESENT
+int shell_os_heap_display_cmd(int argc, char **argv);
+#endif
 int shell_os_date_cmd(int argc, char **argv);
 
 #endif /* __SHELL_PRIV_H_ */
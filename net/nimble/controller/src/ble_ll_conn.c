@@ -1270,7 +1270,10 @@ ble_ll_conn_spvn_timer_cb(void *arg)
     struct ble_ll_conn_sm *connsm;
 
     connsm = (struct ble_ll_conn_sm *)arg;
-    ble_ll_event_send(&connsm->conn_spvn_ev);
+
+    /* Don't let the timeout wait behind queued data and HCI commands. */
+    os_eventq_put_prio(&g_ble_ll_data.ll_evq, &connsm->conn_spvn_ev,
+                       OS_EVENTQ_PRIO_URGENT);
 }
 
 /**
@@ -192,25 +192,31 @@ ble_att_svr_find_by_uuid(struct ble_att_svr_entry *prev, uint8_t *uuid)
     return NULL;
 }
 
+/**
+ * Locates the fixed-size base of a request without rearranging the mbuf
+ * chain.  The base is returned in place if it is contiguous; otherwise it is
+ * copied into the caller's buffer, which must hold base_len bytes.
+ *
+ * @return                      0 on success;
+ *                              BLE_HS_EBADDATA if the request is too short.
+ */
 static int
-ble_att_svr_pullup_req_base(struct os_mbuf **om, int base_len,
-                            uint8_t *out_att_err)
+ble_att_svr_req_base(struct os_mbuf *om, int base_len, void *buf,
+                     void **out_base)
 {
-    uint8_t att_err;
-    int rc;
+    struct os_mbuf_iter it;
 
-    rc = ble_hs_misc_pullup_base(om, base_len);
-    if (rc == BLE_HS_ENOMEM) {
-        att_err = BLE_ATT_ERR_INSUFFICIENT_RES;
-    } else {
-        att_err = 0;
+    if (OS_MBUF_PKTLEN(om) < base_len) {
+        return BLE_HS_EBADDATA;
     }
 
-    if (out_att_err != NULL) {
-        *out_att_err = att_err;
+    os_mbuf_iter_init(&it, om, 0);
+    *out_base = os_mbuf_iter_get(&it, base_len, buf);
+    if (*out_base == NULL) {
+        return BLE_HS_EBADDATA;
     }
 
-    return rc;
+    return 0;
 }
 
 static int
@@ -582,21 +588,24 @@ done:
 int
 ble_att_svr_rx_mtu(uint16_t conn_handle, struct os_mbuf **om)
 {
+    uint8_t buf[BLE_ATT_MTU_CMD_SZ];
     struct ble_att_mtu_cmd cmd;
     struct ble_l2cap_chan *chan;
     struct ble_hs_conn *conn;
     struct os_mbuf *txom;
     uint8_t att_err;
+    void *base;
     int rc;
 
     txom = NULL;
+    att_err = 0;
 
-    rc = ble_att_svr_pullup_req_base(om, BLE_ATT_MTU_CMD_SZ, &att_err);
+    rc = ble_att_svr_req_base(*om, BLE_ATT_MTU_CMD_SZ, buf, &base);
     if (rc != 0) {
         goto done;
     }
 
-    ble_att_mtu_cmd_parse((*om)->om_data, (*om)->om_len, &cmd);
+    ble_att_mtu_cmd_parse(base, BLE_ATT_MTU_CMD_SZ, &cmd);
 
     rc = ble_att_svr_build_mtu_rsp(conn_handle, &txom, &att_err);
     if (rc != 0) {
@@ -780,10 +789,12 @@ ble_att_svr_rx_find_info(uint16_t conn_handle, struct os_mbuf **rxom)
     return BLE_HS_ENOTSUP;
 #endif
 
+    uint8_t buf[BLE_ATT_FIND_INFO_REQ_SZ];
     struct ble_att_find_info_req req;
     struct os_mbuf *txom;
     uint16_t err_handle;
     uint8_t att_err;
+    void *base;
     int rc;
 
     /* Initialize some values in case of early error. */
@@ -791,13 +802,13 @@ ble_att_svr_rx_find_info(uint16_t conn_handle, struct os_mbuf **rxom)
     att_err = 0;
     err_handle = 0;
 
-    rc = ble_att_svr_pullup_req_base(rxom, BLE_ATT_FIND_INFO_REQ_SZ, &att_err);
+    rc = ble_att_svr_req_base(*rxom, BLE_ATT_FIND_INFO_REQ_SZ, buf, &base);
     if (rc != 0) {
         err_handle = 0;
         goto done;
     }
 
-    ble_att_find_info_req_parse((*rxom)->om_data, (*rxom)->om_len, &req);
+    ble_att_find_info_req_parse(base, BLE_ATT_FIND_INFO_REQ_SZ, &req);
 
     /* Tx error response if start handle is greater than end handle or is equal
      * to 0 (Vol. 3, Part F, 3.4.3.1).
@@ -1092,10 +1103,12 @@ ble_att_svr_rx_find_type_value(uint16_t conn_handle, struct os_mbuf **rxom)
     return BLE_HS_ENOTSUP;
 #endif
 
+    uint8_t buf[BLE_ATT_FIND_TYPE_VALUE_REQ_BASE_SZ];
     struct ble_att_find_type_value_req req;
     struct os_mbuf *txom;
     uint16_t err_handle;
     uint8_t att_err;
+    void *base;
     int rc;
 
     /* Initialize some values in case of early error. */
@@ -1103,14 +1116,16 @@ ble_att_svr_rx_find_type_value(uint16_t conn_handle, struct os_mbuf **rxom)
     att_err = 0;
     err_handle = 0;
 
-    rc = ble_att_svr_pullup_req_base(rxom, BLE_ATT_FIND_TYPE_VALUE_REQ_BASE_SZ,
-                                     &att_err);
+    rc = ble_att_svr_req_base(*rxom, BLE_ATT_FIND_TYPE_VALUE_REQ_BASE_SZ, buf,
+                              &base);
     if (rc != 0) {
         err_handle = 0;
         goto done;
     }
 
-    ble_att_find_type_value_req_parse((*rxom)->om_data, (*rxom)->om_len, &req);
+    ble_att_find_type_value_req_parse(base,
+                                      BLE_ATT_FIND_TYPE_VALUE_REQ_BASE_SZ,
+                                      &req);
 
     /* Tx error response if start handle is greater than end handle or is equal
      * to 0 (Vol. 3, Part F, 3.4.3.3).
@@ -1273,6 +1288,7 @@ ble_att_svr_rx_read_type(uint16_t conn_handle, struct os_mbuf **rxom)
     return BLE_HS_ENOTSUP;
 #endif
 
+    uint8_t buf[BLE_ATT_READ_TYPE_REQ_SZ_128];
     struct ble_att_read_type_req req;
     struct os_mbuf *txom;
     uint16_t err_handle;
@@ -1280,10 +1296,12 @@ ble_att_svr_rx_read_type(uint16_t conn_handle, struct os_mbuf **rxom)
     uint16_t pktlen;
     uint8_t uuid128[16];
     uint8_t att_err;
+    uint8_t *base;
     int rc;
 
     /* Initialize some values in case of early error. */
     txom = NULL;
+    att_err = 0;
 
     pktlen = OS_MBUF_PKTLEN(*rxom);
     if (pktlen != BLE_ATT_READ_TYPE_REQ_SZ_16 &&
@@ -1293,13 +1311,13 @@ ble_att_svr_rx_read_type(uint16_t conn_handle, struct os_mbuf **rxom)
         return BLE_HS_EBADDATA;
     }
 
-    rc = ble_att_svr_pullup_req_base(rxom, pktlen, &att_err);
+    rc = ble_att_svr_req_base(*rxom, pktlen, buf, (void **)&base);
     if (rc != 0) {
         err_handle = 0;
         goto done;
     }
 
-    ble_att_read_type_req_parse((*rxom)->om_data, (*rxom)->om_len, &req);
+    ble_att_read_type_req_parse(base, pktlen, &req);
 
     if (req.batq_start_handle > req.batq_end_handle ||
         req.batq_start_handle == 0) {
@@ -1310,9 +1328,9 @@ ble_att_svr_rx_read_type(uint16_t conn_handle, struct os_mbuf **rxom)
         goto done;
     }
 
-    switch ((*rxom)->om_len) {
+    switch (pktlen) {
     case BLE_ATT_READ_TYPE_REQ_SZ_16:
-        uuid16 = le16toh((*rxom)->om_data + 5);
+        uuid16 = le16toh(base + 5);
         rc = ble_uuid_16_to_128(uuid16, uuid128);
         if (rc != 0) {
             att_err = BLE_ATT_ERR_ATTR_NOT_FOUND;
@@ -1323,7 +1341,7 @@ ble_att_svr_rx_read_type(uint16_t conn_handle, struct os_mbuf **rxom)
         break;
 
     case BLE_ATT_READ_TYPE_REQ_SZ_128:
-        memcpy(uuid128, (*rxom)->om_data + 5, 16);
+        memcpy(uuid128, base + 5, 16);
         break;
 
     default:
@@ -1412,10 +1430,12 @@ ble_att_svr_rx_read(uint16_t conn_handle, struct os_mbuf **rxom)
 #endif
 
     struct ble_att_svr_access_ctxt ctxt;
+    uint8_t buf[BLE_ATT_READ_REQ_SZ];
     struct ble_att_read_req req;
     struct os_mbuf *txom;
     uint16_t err_handle;
     uint8_t att_err;
+    void *base;
     int rc;
 
     /* Initialize some values in case of early error. */
@@ -1423,13 +1443,13 @@ ble_att_svr_rx_read(uint16_t conn_handle, struct os_mbuf **rxom)
     att_err = 0;
     err_handle = 0;
 
-    rc = ble_att_svr_pullup_req_base(rxom, BLE_ATT_READ_REQ_SZ, &att_err);
+    rc = ble_att_svr_req_base(*rxom, BLE_ATT_READ_REQ_SZ, buf, &base);
     if (rc != 0) {
         err_handle = 0;
         goto done;
     }
 
-    ble_att_read_req_parse((*rxom)->om_data, (*rxom)->om_len, &req);
+    ble_att_read_req_parse(base, BLE_ATT_READ_REQ_SZ, &req);
 
     ctxt.offset = 0;
     rc = ble_att_svr_read_handle(conn_handle, req.barq_handle, &ctxt,
@@ -1510,11 +1530,13 @@ ble_att_svr_rx_read_blob(uint16_t conn_handle, struct os_mbuf **rxom)
 #endif
 
     struct ble_att_svr_access_ctxt ctxt;
+    uint8_t buf[BLE_ATT_READ_BLOB_REQ_SZ];
     struct ble_att_read_blob_req req;
     struct os_mbuf *txom;
     uint16_t err_handle;
     uint16_t mtu;
     uint8_t att_err;
+    void *base;
     int rc;
 
     /* Initialize some values in case of early error. */
@@ -1528,13 +1550,13 @@ ble_att_svr_rx_read_blob(uint16_t conn_handle, struct os_mbuf **rxom)
         goto done;
     }
 
-    rc = ble_att_svr_pullup_req_base(rxom, BLE_ATT_READ_BLOB_REQ_SZ, &att_err);
+    rc = ble_att_svr_req_base(*rxom, BLE_ATT_READ_BLOB_REQ_SZ, buf, &base);
     if (rc != 0) {
         err_handle = 0;
         goto done;
     }
 
-    ble_att_read_blob_req_parse((*rxom)->om_data, (*rxom)->om_len, &req);
+    ble_att_read_blob_req_parse(base, BLE_ATT_READ_BLOB_REQ_SZ, &req);
 
     ctxt.offset = req.babq_offset;
     rc = ble_att_svr_read_handle(conn_handle, req.babq_handle, &ctxt,
@@ -1568,12 +1590,13 @@ done:
 
 static int
 ble_att_svr_build_read_mult_rsp(uint16_t conn_handle,
-                                struct os_mbuf **rxom,
+                                struct os_mbuf *rxom,
                                 struct os_mbuf **out_txom,
                                 uint8_t *att_err,
                                 uint16_t *err_handle)
 {
     struct ble_att_svr_access_ctxt ctxt;
+    struct os_mbuf_iter it;
     struct os_mbuf *txom;
     uint16_t chunk_sz;
     uint16_t tx_space;
@@ -1613,22 +1636,8 @@ ble_att_svr_build_read_mult_rsp(uint16_t conn_handle,
      * for each.  Stop when there are no more handles to process, or the
      * response is full.
      */
-    while (OS_MBUF_PKTLEN(*rxom) >= 2 && tx_space > 0) {
-        /* Ensure the full 16-bit handle is contiguous at the start of the
-         * mbuf.
-         */
-        rc = ble_att_svr_pullup_req_base(rxom, 2, att_err);
-        if (rc != 0) {
-            *err_handle = 0;
-            goto done;
-        }
-
-        /* Extract the 16-bit handle and strip it from the front of the
-         * mbuf.
-         */
-        handle = le16toh((*rxom)->om_data);
-        os_mbuf_adj(*rxom, 2);
-
+    os_mbuf_iter_init(&it, rxom, BLE_ATT_READ_MULT_REQ_BASE_SZ);
+    while (tx_space > 0 && os_mbuf_iter_read_le16(&it, &handle) == 0) {
         ctxt.offset = 0;
         rc = ble_att_svr_read_handle(conn_handle, handle, &ctxt, att_err);
         if (rc != 0) {
@@ -1667,9 +1676,11 @@ ble_att_svr_rx_read_mult(uint16_t conn_handle, struct os_mbuf **rxom)
     return BLE_HS_ENOTSUP;
 #endif
 
+    uint8_t buf[BLE_ATT_READ_MULT_REQ_BASE_SZ];
     struct os_mbuf *txom;
     uint16_t err_handle;
     uint8_t att_err;
+    void *base;
     int rc;
 
     /* Initialize some values in case of early error. */
@@ -1677,19 +1688,16 @@ ble_att_svr_rx_read_mult(uint16_t conn_handle, struct os_mbuf **rxom)
     err_handle = 0;
     att_err = 0;
 
-    rc = ble_att_svr_pullup_req_base(rxom, BLE_ATT_READ_MULT_REQ_BASE_SZ,
-                                     &att_err);
+    rc = ble_att_svr_req_base(*rxom, BLE_ATT_READ_MULT_REQ_BASE_SZ, buf,
+                              &base);
     if (rc != 0) {
         err_handle = 0;
         goto done;
     }
 
-    ble_att_read_mult_req_parse((*rxom)->om_data, (*rxom)->om_len);
+    ble_att_read_mult_req_parse(base, BLE_ATT_READ_MULT_REQ_BASE_SZ);
 
-    /* Strip opcode from request. */
-    os_mbuf_adj(*rxom, BLE_ATT_READ_MULT_REQ_BASE_SZ);
-
-    rc = ble_att_svr_build_read_mult_rsp(conn_handle, rxom, &txom, &att_err,
+    rc = ble_att_svr_build_read_mult_rsp(conn_handle, *rxom, &txom, &att_err,
                                          &err_handle);
     if (rc != 0) {
         goto done;
@@ -1970,16 +1978,19 @@ ble_att_svr_rx_read_group_type(uint16_t conn_handle, struct os_mbuf **rxom)
     return BLE_HS_ENOTSUP;
 #endif
 
+    uint8_t buf[BLE_ATT_READ_GROUP_TYPE_REQ_SZ_128];
     struct ble_att_read_group_type_req req;
     struct os_mbuf *txom;
     uint8_t uuid128[16];
     uint16_t err_handle;
     uint16_t pktlen;
     uint8_t att_err;
+    void *base;
     int rc;
 
     /* Initialize some values in case of early error. */
     txom = NULL;
+    att_err = 0;
 
     pktlen = OS_MBUF_PKTLEN(*rxom);
     if (pktlen != BLE_ATT_READ_GROUP_TYPE_REQ_SZ_16 &&
@@ -1989,13 +2000,13 @@ ble_att_svr_rx_read_group_type(uint16_t conn_handle, struct os_mbuf **rxom)
         return BLE_HS_EBADDATA;
     }
 
-    rc = ble_att_svr_pullup_req_base(rxom, pktlen, &att_err);
+    rc = ble_att_svr_req_base(*rxom, pktlen, buf, &base);
     if (rc != 0) {
         err_handle = 0;
         goto done;
     }
 
-    ble_att_read_group_type_req_parse((*rxom)->om_data, (*rxom)->om_len, &req);
+    ble_att_read_group_type_req_parse(base, pktlen, &req);
 
     if (req.bagq_start_handle > req.bagq_end_handle ||
         req.bagq_start_handle == 0) {
@@ -2075,10 +2086,12 @@ ble_att_svr_rx_write(uint16_t conn_handle, struct os_mbuf **rxom)
 #endif
 
     struct ble_att_svr_access_ctxt ctxt;
+    uint8_t buf[BLE_ATT_WRITE_REQ_BASE_SZ];
     struct ble_att_write_req req;
     struct os_mbuf *txom;
     uint16_t err_handle;
     uint8_t att_err;
+    void *base;
     int rc;
 
     /* Initialize some values in case of early error. */
@@ -2086,14 +2099,13 @@ ble_att_svr_rx_write(uint16_t conn_handle, struct os_mbuf **rxom)
     att_err = 0;
     err_handle = 0;
 
-    rc = ble_att_svr_pullup_req_base(rxom, BLE_ATT_WRITE_REQ_BASE_SZ,
-                                     &att_err);
+    rc = ble_att_svr_req_base(*rxom, BLE_ATT_WRITE_REQ_BASE_SZ, buf, &base);
     if (rc != 0) {
         err_handle = 0;
         goto done;
     }
 
-    ble_att_write_req_parse((*rxom)->om_data, (*rxom)->om_len, &req);
+    ble_att_write_req_parse(base, BLE_ATT_WRITE_REQ_BASE_SZ, &req);
 
     /* Strip the request base from the front of the mbuf. */
     os_mbuf_adj(*rxom, BLE_ATT_WRITE_REQ_BASE_SZ);
@@ -2130,17 +2142,18 @@ ble_att_svr_rx_write_no_rsp(uint16_t conn_handle, struct os_mbuf **rxom)
 #endif
 
     struct ble_att_svr_access_ctxt ctxt;
+    uint8_t buf[BLE_ATT_WRITE_REQ_BASE_SZ];
     struct ble_att_write_req req;
     uint8_t att_err;
+    void *base;
     int rc;
 
-    rc = ble_att_svr_pullup_req_base(rxom, BLE_ATT_WRITE_REQ_BASE_SZ,
-                                     &att_err);
+    rc = ble_att_svr_req_base(*rxom, BLE_ATT_WRITE_REQ_BASE_SZ, buf, &base);
     if (rc != 0) {
         return rc;
     }
 
-    ble_att_write_cmd_parse((*rxom)->om_data, (*rxom)->om_len, &req);
+    ble_att_write_cmd_parse(base, BLE_ATT_WRITE_REQ_BASE_SZ, &req);
 
     /* Strip the request base from the front of the mbuf. */
     os_mbuf_adj(*rxom, BLE_ATT_WRITE_REQ_BASE_SZ);
@@ -2346,6 +2359,7 @@ ble_att_svr_rx_prep_write(uint16_t conn_handle, struct os_mbuf **rxom)
     return BLE_HS_ENOTSUP;
 #endif
 
+    uint8_t buf[BLE_ATT_PREP_WRITE_CMD_BASE_SZ];
     struct ble_att_prep_write_cmd req;
     struct ble_att_prep_entry *prep_entry;
     struct ble_att_prep_entry *prep_prev;
@@ -2355,6 +2369,7 @@ ble_att_svr_rx_prep_write(uint16_t conn_handle, struct os_mbuf **rxom)
     struct os_mbuf *txom;
     uint16_t err_handle;
     uint8_t att_err;
+    void *base;
     int rc;
 
     /* Initialize some values in case of early error. */
@@ -2363,14 +2378,14 @@ ble_att_svr_rx_prep_write(uint16_t conn_handle, struct os_mbuf **rxom)
     att_err = 0;
     err_handle = 0;
 
-    rc = ble_att_svr_pullup_req_base(rxom, BLE_ATT_PREP_WRITE_CMD_BASE_SZ,
-                                     &att_err);
+    rc = ble_att_svr_req_base(*rxom, BLE_ATT_PREP_WRITE_CMD_BASE_SZ, buf,
+                              &base);
     if (rc != 0) {
         err_handle = 0;
         goto done;
     }
 
-    ble_att_prep_write_req_parse((*rxom)->om_data, (*rxom)->om_len, &req);
+    ble_att_prep_write_req_parse(base, BLE_ATT_PREP_WRITE_CMD_BASE_SZ, &req);
 
     /* Strip the request base from the front of the mbuf. */
     os_mbuf_adj(*rxom, BLE_ATT_PREP_WRITE_CMD_BASE_SZ);
@@ -2442,8 +2457,12 @@ ble_att_svr_rx_prep_write(uint16_t conn_handle, struct os_mbuf **rxom)
     }
     txom = *rxom;
 
-    ble_att_prep_write_rsp_write(txom->om_data, BLE_ATT_PREP_WRITE_CMD_BASE_SZ,
-                                 &req);
+    /* The request base was not pulled up, so the space it left may be split
+     * over two buffers; build the header flat and copy it in.
+     */
+    ble_att_prep_write_rsp_write(buf, BLE_ATT_PREP_WRITE_CMD_BASE_SZ, &req);
+    rc = os_mbuf_copyinto(txom, 0, buf, BLE_ATT_PREP_WRITE_CMD_BASE_SZ);
+    BLE_HS_DBG_ASSERT_EVAL(rc == 0);
 
     rc = 0;
 
@@ -2522,24 +2541,26 @@ ble_att_svr_rx_exec_write(uint16_t conn_handle, struct os_mbuf **rxom)
 #endif
 
     struct ble_att_prep_entry_list prep_list;
+    uint8_t buf[BLE_ATT_EXEC_WRITE_REQ_SZ];
     struct ble_att_exec_write_req req;
     struct ble_hs_conn *conn;
     struct os_mbuf *txom;
     uint16_t err_handle;
     uint8_t att_err;
+    void *base;
     int rc;
 
     /* Initialize some values in case of early error. */
     txom = NULL;
+    att_err = 0;
 
-    rc = ble_att_svr_pullup_req_base(rxom, BLE_ATT_EXEC_WRITE_REQ_SZ,
-                                     &att_err);
+    rc = ble_att_svr_req_base(*rxom, BLE_ATT_EXEC_WRITE_REQ_SZ, buf, &base);
     if (rc != 0) {
         err_handle = 0;
         goto done;
     }
 
-    ble_att_exec_write_req_parse((*rxom)->om_data, (*rxom)->om_len, &req);
+    ble_att_exec_write_req_parse(base, BLE_ATT_EXEC_WRITE_REQ_SZ, &req);
 
     rc = ble_att_svr_build_exec_write_rsp(&txom, &att_err);
     if (rc != 0) {
@@ -2593,21 +2614,19 @@ ble_att_svr_rx_notify(uint16_t conn_handle, struct os_mbuf **rxom)
     return BLE_HS_ENOTSUP;
 #endif
 
+    uint8_t buf[BLE_ATT_NOTIFY_REQ_BASE_SZ];
     struct ble_att_notify_req req;
     uint16_t attr_len;
     void *attr_data;
+    void *base;
     int rc;
 
-    if (OS_MBUF_PKTLEN(*rxom) < BLE_ATT_NOTIFY_REQ_BASE_SZ) {
-        return BLE_HS_EBADDATA;
-    }
-
-    rc = ble_att_svr_pullup_req_base(rxom, BLE_ATT_NOTIFY_REQ_BASE_SZ, NULL);
+    rc = ble_att_svr_req_base(*rxom, BLE_ATT_NOTIFY_REQ_BASE_SZ, buf, &base);
     if (rc != 0) {
-        return BLE_HS_ENOMEM;
+        return rc;
     }
 
-    ble_att_notify_req_parse((*rxom)->om_data, (*rxom)->om_len, &req);
+    ble_att_notify_req_parse(base, BLE_ATT_NOTIFY_REQ_BASE_SZ, &req);
 
     if (req.banq_handle == 0) {
         return BLE_HS_EBADDATA;
@@ -2670,26 +2689,24 @@ ble_att_svr_rx_indicate(uint16_t conn_handle, struct os_mbuf **rxom)
     return BLE_HS_ENOTSUP;
 #endif
 
+    uint8_t buf[BLE_ATT_INDICATE_REQ_BASE_SZ];
     struct ble_att_indicate_req req;
     struct os_mbuf *txom;
     uint16_t attr_len;
     void *attr_data;
+    void *base;
     int rc;
 
     /* Initialize some values in case of early error. */
     txom = NULL;
 
-    if (OS_MBUF_PKTLEN(*rxom) < BLE_ATT_INDICATE_REQ_BASE_SZ) {
-        rc = BLE_HS_EBADDATA;
-        goto done;
-    }
-
-    rc = ble_att_svr_pullup_req_base(rxom, BLE_ATT_INDICATE_REQ_BASE_SZ, NULL);
+    rc = ble_att_svr_req_base(*rxom, BLE_ATT_INDICATE_REQ_BASE_SZ, buf,
+                              &base);
     if (rc != 0) {
         goto done;
     }
 
-    ble_att_indicate_req_parse((*rxom)->om_data, (*rxom)->om_len, &req);
+    ble_att_indicate_req_parse(base, BLE_ATT_INDICATE_REQ_BASE_SZ, &req);
 
     if (req.baiq_handle == 0) {
         rc = BLE_HS_EBADDATA;
@@ -71,6 +71,9 @@ static struct os_eventq ble_hs_evq;
 static struct os_eventq *ble_hs_parent_evq;
 static struct os_task *ble_hs_parent_task;
 
+/* Most received packets processed before other host events get a turn */
+#define BLE_HS_RX_BATCH_MAX     (8)
+
 static struct os_mqueue ble_hs_rx_q;
 static struct os_mqueue ble_hs_tx_q;
 
@@ -158,9 +161,11 @@ ble_hs_unlock(void)
 void
 ble_hs_process_tx_data_queue(void)
 {
+    struct os_mqueue_batch batch;
     struct os_mbuf *om;
 
-    while ((om = os_mqueue_get(&ble_hs_tx_q)) != NULL) {
+    os_mqueue_get_batch(&ble_hs_tx_q, &batch, 0);
+    while ((om = os_mqueue_batch_next(&batch)) != NULL) {
 #ifdef PHONY_TRANSPORT
         ble_hs_test_pkt_txed(om);
 #else
@@ -172,11 +177,18 @@ ble_hs_process_tx_data_queue(void)
 static void
 ble_hs_process_rx_data_queue(void)
 {
+    struct os_mqueue_batch batch;
     struct os_mbuf *om;
 
-    while ((om = os_mqueue_get(&ble_hs_rx_q)) != NULL) {
+    os_mqueue_get_batch(&ble_hs_rx_q, &batch, BLE_HS_RX_BATCH_MAX);
+    while ((om = os_mqueue_batch_next(&batch)) != NULL) {
         host_hci_data_rx(om);
     }
+
+    /* Let the events queued behind this one run before the rest. */
+    if (ble_hs_rx_q.mq_len != 0) {
+        os_eventq_put(&ble_hs_evq, &ble_hs_rx_q.mq_ev);
+    }
 }
 
 static void
@@ -209,13 +221,9 @@ ble_hs_event_handle(void *unused)
 {
     struct os_callout_func *cf;
     struct os_event *ev;
-    os_sr_t sr;
 
     while (1) {
-        OS_ENTER_CRITICAL(sr);
-        ev = STAILQ_FIRST(&ble_hs_evq.evq_list);
-        OS_EXIT_CRITICAL(sr);
-
+        ev = os_eventq_peek(&ble_hs_evq);
         if (ev == NULL) {
             break;
         }
@@ -110,7 +110,7 @@ log_append(struct log *log, uint16_t module, uint16_t level, void *data,
     /* Try to get UTC Time */
     rc = os_gettimeofday(&tv, NULL);
     if (rc || tv.tv_sec < UTC01_01_2016) {
-        ue->ue_ts = os_get_uptime_usec();
+        ue->ue_ts = os_time_mono_usecs();
     } else {
         ue->ue_ts = tv.tv_sec * 1000000 + tv.tv_usec;
     }